@@ -0,0 +1,182 @@
+/**
+ * Benchmark and check of the CPU frustum culling of SceneBvh, on synthetic
+ * scenes of boxes scattered with a constant density (mostly small objects,
+ * a few large ones), seen from cameras inside the scene.
+ *
+ *  - building on one thread and on all cores must give the same tree;
+ *  - every query kernel must find exactly the boxes that testing each one
+ *    alone finds (isBoxVisible), after the build and after every object
+ *    moved and the tree was refit;
+ *  - times are reported for the build, the refit, and the queries of each
+ *    kernel against that brute force loop.
+ *
+ * Usage: bench_culling [number of objects...] (default 10000 100000 1000000)
+ * Returns a non-zero exit code when a check fails.
+ */
+
+#include "SceneBvh.h"
+#include "Parallel.h"
+
+#include <glm/ext.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double millisecondsSince(Clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+struct Scene {
+	std::vector<Aabb> boxes;
+	std::vector<glm::vec3> velocities;
+	float halfSize;
+};
+
+Scene makeScene(size_t objectCount, std::mt19937_64& rng) {
+	Scene scene;
+	// About one object per 1000 cubic units, whatever their number
+	scene.halfSize = 5.0f * std::cbrt(static_cast<float>(objectCount));
+	std::uniform_real_distribution<float> position(-scene.halfSize, scene.halfSize);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::uniform_real_distribution<float> velocity(-1.0f, 1.0f);
+	scene.boxes.resize(objectCount);
+	scene.velocities.resize(objectCount);
+	for (size_t i = 0; i < objectCount; ++i) {
+		const glm::vec3 center(position(rng), position(rng), position(rng));
+		const float size = unit(rng) < 0.01f ? 5.0f + 20.0f * unit(rng) : 0.5f + 2.5f * unit(rng);
+		const glm::vec3 halfExtent = 0.5f * size * glm::vec3(0.5f + unit(rng), 0.5f + unit(rng), 0.5f + unit(rng));
+		scene.boxes[i] = { center - halfExtent, center + halfExtent };
+		scene.velocities[i] = glm::vec3(velocity(rng), velocity(rng), velocity(rng));
+	}
+	return scene;
+}
+
+std::vector<Frustum> makeCameras(const Scene& scene, size_t count, std::mt19937_64& rng) {
+	std::uniform_real_distribution<float> position(-0.8f * scene.halfSize, 0.8f * scene.halfSize);
+	std::vector<Frustum> cameras;
+	for (size_t i = 0; i < count; ++i) {
+		const glm::vec3 eye(position(rng), position(rng), position(rng));
+		const glm::vec3 target(position(rng), position(rng), position(rng));
+		const glm::mat4 view = glm::lookAt(eye, target, glm::vec3(0, 0, 1));
+		const glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, scene.halfSize);
+		cameras.push_back(extractFrustum(projection * view));
+	}
+	return cameras;
+}
+
+void bruteForce(const std::vector<Aabb>& boxes, const Frustum& frustum, std::vector<uint32_t>& visible) {
+	visible.clear();
+	for (uint32_t i = 0; i < boxes.size(); ++i) {
+		if (isBoxVisible(frustum, boxes[i])) visible.push_back(i);
+	}
+}
+
+/**
+ * Times the queries of `kernel` (or brute force) from every camera, and
+ * checks them against `expected`. Returns milliseconds per query.
+ */
+template <typename Query>
+double timeQueries(const std::vector<Frustum>& cameras, const std::vector<std::vector<uint32_t>>& expected, Query&& query, bool& same) {
+	constexpr int kRuns = 3;
+	std::vector<uint32_t> visible;
+	double best = 1e30;
+	for (int run = 0; run < kRuns; ++run) {
+		const Clock::time_point start = Clock::now();
+		for (size_t camera = 0; camera < cameras.size(); ++camera) {
+			query(cameras[camera], visible);
+			if (run == 0) {
+				std::sort(visible.begin(), visible.end());
+				same = same && visible == expected[camera];
+			}
+		}
+		if (run > 0) best = std::min(best, millisecondsSince(start) / cameras.size());
+	}
+	return best;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	std::vector<size_t> objectCounts;
+	for (int i = 1; i < argc; ++i) {
+		objectCounts.push_back(std::strtoul(argv[i], nullptr, 10));
+	}
+	if (objectCounts.empty()) {
+		objectCounts = { 10000, 100000, 1000000 };
+	}
+	const unsigned threads = defaultThreadCount();
+	std::mt19937_64 rng(0xb7b);
+	bool ok = true;
+
+	for (size_t objectCount : objectCounts) {
+		Scene scene = makeScene(objectCount, rng);
+		const std::vector<Frustum> cameras = makeCameras(scene, 8, rng);
+
+		// Same tree on 1 thread and on all cores
+		SceneBvh serialBvh;
+		Clock::time_point start = Clock::now();
+		serialBvh.build(scene.boxes, 1);
+		const double serialBuild = millisecondsSince(start);
+		SceneBvh bvh;
+		start = Clock::now();
+		bvh.build(scene.boxes, threads);
+		const double parallelBuild = millisecondsSince(start);
+		const bool sameTree = bvh.nodeCount() == serialBvh.nodeCount() && bvh.objectOrder() == serialBvh.objectOrder();
+
+		std::printf("%zu objects: %zu nodes of %u\n", objectCount, bvh.nodeCount(), SceneBvh::kWidth);
+		std::printf("  build:  %8.2f ms on 1 thread, %8.2f ms on %u (same tree: %s)\n",
+			serialBuild, parallelBuild, threads, sameTree ? "yes" : "NO");
+		ok = ok && sameTree;
+
+		auto runQueries = [&](const char* label) {
+			std::vector<std::vector<uint32_t>> expected(cameras.size());
+			size_t visibleSum = 0;
+			for (size_t camera = 0; camera < cameras.size(); ++camera) {
+				bruteForce(scene.boxes, cameras[camera], expected[camera]);
+				visibleSum += expected[camera].size();
+			}
+			bool same = true;
+			const double bruteForceTime = timeQueries(cameras, expected, [&](const Frustum& frustum, std::vector<uint32_t>& visible) {
+				bruteForce(scene.boxes, frustum, visible);
+			}, same);
+			std::printf("  %s %zu visible on average, brute force %8.3f ms", label, visibleSum / cameras.size(), bruteForceTime);
+			for (CullingKernel kernel : { CullingKernel::Scalar, CullingKernel::SSE, CullingKernel::AVX2 }) {
+				if (!isSupported(kernel)) continue;
+				bool kernelSame = true;
+				const double time = timeQueries(cameras, expected, [&](const Frustum& frustum, std::vector<uint32_t>& visible) {
+					bvh.query(frustum, visible, kernel);
+				}, kernelSame);
+				std::printf(", %s %8.3f ms%s", cullingKernelName(kernel), time, kernelSame ? "" : " (WRONG)");
+				ok = ok && kernelSame;
+			}
+			std::printf("\n");
+		};
+		runQueries("query:");
+
+		// Every object moves, then the same tree is refit
+		for (size_t i = 0; i < objectCount; ++i) {
+			scene.boxes[i].min += scene.velocities[i];
+			scene.boxes[i].max += scene.velocities[i];
+		}
+		start = Clock::now();
+		bvh.refit(scene.boxes, 1);
+		const double serialRefit = millisecondsSince(start);
+		start = Clock::now();
+		bvh.refit(scene.boxes, threads);
+		const double parallelRefit = millisecondsSince(start);
+		std::printf("  refit:  %8.2f ms on 1 thread, %8.2f ms on %u\n", serialRefit, parallelRefit, threads);
+		runQueries("moved:");
+	}
+
+	std::printf("%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,450 @@
+/**
+ * Benchmark of the OBJ loading pipeline, stage by stage, on synthetic
+ * OBJ/MTL files of several sizes. No GPU is needed.
+ *
+ * The stages are:
+ *  - tinyobj::LoadObj and tinyobj::ObjReader::ParseFromString, from memory;
+ *  - the expansion of every face corner into a VertexAttributes (the loop
+ *    the app used before ObjStreamLoader), then the same with each SIMD
+ *    kernel of VertexConversion.h and with the best one on all cores, then
+ *    weldVertices();
+ *  - ObjStreamLoader: parse (from the file), optimize, writeVertices and
+ *    takeIndices (meshlets and levels of detail);
+ *  - TextGeometryLoader, on the welded mesh written in the [points] and
+ *    [indices] text format.
+ *
+ * Each stage reports MB/s of its input text (the OBJ file, or the text
+ * geometry file for the last stage), vertices/s (face corners, the same
+ * count for every stage so that rates compare) and the peak resident set
+ * size while it ran (on Linux; elsewhere the peak of the whole process so
+ * far). The report is JSON, on stdout.
+ *
+ * Both tinyobj entry points must find the same corners, every kernel the
+ * same vertices as the loop, the welded and streamed meshes the same
+ * number of vertices, and the text geometry the welded mesh's counts.
+ *
+ * Usage: bench_loader [triangle count...] (default: 10000 100000 1000000)
+ * Returns a non-zero exit code when a check fails.
+ */
+
+#include "MeshWelder.h"
+#include "ObjStreamLoader.h"
+#include "Parallel.h"
+#include "TextGeometryLoader.h"
+#include "VertexConversion.h"
+
+#include "tiny_obj_loader.h"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kMaterialCount = 8;
+constexpr size_t kQuadsPerGroup = 20000;
+
+struct SyntheticScene {
+	std::string obj;
+	std::string mtl;
+	size_t triangleCount = 0;
+	size_t cornerCount = 0; // after triangulation
+};
+
+/**
+ * A bumpy height field with normals and uvs, as quads, split into groups
+ * that each use one of the materials. A few quads lack their uvs or their
+ * normals.
+ */
+SyntheticScene makeScene(size_t triangleCount) {
+	SyntheticScene scene;
+	const size_t side = std::max<size_t>(1, static_cast<size_t>(std::sqrt(triangleCount / 2.0)));
+	const size_t quads = side * side;
+	scene.triangleCount = 2 * quads;
+	scene.cornerCount = 3 * scene.triangleCount;
+
+	char buf[160];
+	for (int m = 0; m < kMaterialCount; ++m) {
+		std::snprintf(buf, sizeof(buf), "newmtl material%d\nKd %.3f %.3f %.3f\n\n", m, 0.2 + 0.1 * m, 0.8 - 0.05 * m, 0.5);
+		scene.mtl += buf;
+	}
+
+	std::mt19937 rng(0x10ad);
+	std::uniform_real_distribution<float> noise(-0.002f, 0.002f);
+	scene.obj.reserve(quads * 110);
+	scene.obj += "mtllib bench_loader.mtl\n";
+	const size_t n = side + 1;
+	for (size_t j = 0; j < n; ++j) {
+		for (size_t i = 0; i < n; ++i) {
+			const float x = float(i) / side, z = float(j) / side;
+			const float y = 0.05f * std::sin(12.0f * x) * std::cos(9.0f * z) + noise(rng);
+			std::snprintf(buf, sizeof(buf), "v %.6f %.6f %.6f\n", x, y, z);
+			scene.obj += buf;
+		}
+	}
+	for (size_t j = 0; j < n; ++j) {
+		for (size_t i = 0; i < n; ++i) {
+			std::snprintf(buf, sizeof(buf), "vt %.6f %.6f\n", float(i) / side, float(j) / side);
+			scene.obj += buf;
+		}
+	}
+	for (size_t j = 0; j < n; ++j) {
+		for (size_t i = 0; i < n; ++i) {
+			const float x = float(i) / side, z = float(j) / side;
+			float nx = -0.6f * std::cos(12.0f * x) * std::cos(9.0f * z), nz = 0.45f * std::sin(12.0f * x) * std::sin(9.0f * z);
+			const float length = std::sqrt(nx * nx + 1.0f + nz * nz);
+			std::snprintf(buf, sizeof(buf), "vn %.5f %.5f %.5f\n", nx / length, 1.0f / length, nz / length);
+			scene.obj += buf;
+		}
+	}
+	for (size_t q = 0; q < quads; ++q) {
+		if (q % kQuadsPerGroup == 0) {
+			std::snprintf(buf, sizeof(buf), "g part%zu\nusemtl material%zu\n", q / kQuadsPerGroup, (q / kQuadsPerGroup) % kMaterialCount);
+			scene.obj += buf;
+		}
+		const size_t i = q % side, j = q / side;
+		const size_t a = j * n + i + 1, b = a + 1, c = a + n + 1, d = a + n;
+		if (q % 16 == 5) {
+			std::snprintf(buf, sizeof(buf), "f %zu//%zu %zu//%zu %zu//%zu %zu//%zu\n", a, a, b, b, c, c, d, d);
+		} else if (q % 16 == 13) {
+			std::snprintf(buf, sizeof(buf), "f %zu/%zu %zu/%zu %zu/%zu %zu/%zu\n", a, a, b, b, c, c, d, d);
+		} else {
+			std::snprintf(buf, sizeof(buf), "f %zu/%zu/%zu %zu/%zu/%zu %zu/%zu/%zu %zu/%zu/%zu\n", a, a, a, b, b, b, c, c, c, d, d, d);
+		}
+		scene.obj += buf;
+	}
+	return scene;
+}
+
+/**
+ * Expands every face corner into a vertex, with the axis swap and uv flip
+ * of the renderer.
+ */
+std::vector<VertexAttributes> expandVertices(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes) {
+	std::vector<VertexAttributes> vertexData;
+	const bool hasColors = attrib.colors.size() == attrib.vertices.size();
+	for (const tinyobj::shape_t& shape : shapes) {
+		size_t offset = vertexData.size();
+		vertexData.resize(offset + shape.mesh.indices.size());
+
+		for (size_t i = 0; i < shape.mesh.indices.size(); ++i) {
+			const tinyobj::index_t& idx = shape.mesh.indices[i];
+			VertexAttributes& vertex = vertexData[offset + i];
+
+			vertex.position = {
+				attrib.vertices[3 * idx.vertex_index + 0],
+				-attrib.vertices[3 * idx.vertex_index + 2],
+				attrib.vertices[3 * idx.vertex_index + 1]
+			};
+
+			if (idx.normal_index >= 0) {
+				vertex.normal = {
+					attrib.normals[3 * idx.normal_index + 0],
+					-attrib.normals[3 * idx.normal_index + 2],
+					attrib.normals[3 * idx.normal_index + 1]
+				};
+			} else {
+				vertex.normal = { 0.0f, 0.0f, 0.0f };
+			}
+
+			if (hasColors) {
+				vertex.color = {
+					attrib.colors[3 * idx.vertex_index + 0],
+					attrib.colors[3 * idx.vertex_index + 1],
+					attrib.colors[3 * idx.vertex_index + 2]
+				};
+			} else {
+				vertex.color = { 1.0f, 1.0f, 1.0f };
+			}
+
+			if (idx.texcoord_index >= 0) {
+				vertex.uv = {
+					attrib.texcoords[2 * idx.texcoord_index + 0],
+					1 - attrib.texcoords[2 * idx.texcoord_index + 1]
+				};
+			} else {
+				vertex.uv = { 0.0f, 1.0f };
+			}
+		}
+	}
+	return vertexData;
+}
+
+/**
+ * The face corners, as input of the conversion kernels.
+ */
+std::vector<ObjCorner> gatherCorners(const std::vector<tinyobj::shape_t>& shapes) {
+	std::vector<ObjCorner> corners;
+	for (const tinyobj::shape_t& shape : shapes) {
+		for (const tinyobj::index_t& idx : shape.mesh.indices) {
+			corners.push_back({ idx.vertex_index, idx.texcoord_index, idx.normal_index });
+		}
+	}
+	return corners;
+}
+
+size_t cornerCount(const std::vector<tinyobj::shape_t>& shapes) {
+	size_t count = 0;
+	for (const tinyobj::shape_t& shape : shapes) {
+		count += shape.mesh.indices.size();
+	}
+	return count;
+}
+
+/**
+ * Restarts the peak resident set size, so that the next reading only
+ * covers what runs in between. Only Linux can do that.
+ */
+void resetPeakRss() {
+#ifdef __linux__
+	std::ofstream("/proc/self/clear_refs") << "5";
+#endif
+}
+
+/**
+ * Peak resident set size in MB, or a negative value if unknown.
+ */
+double peakRssMB() {
+#if defined(__linux__)
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line)) {
+		if (line.compare(0, 6, "VmHWM:") == 0) {
+			return std::strtod(line.c_str() + 6, nullptr) / 1024.0; // kB
+		}
+	}
+	return -1.0;
+#elif defined(_WIN32)
+	return -1.0;
+#else
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return usage.ru_maxrss / (1024.0 * 1024.0); // bytes
+#else
+	return usage.ru_maxrss / 1024.0; // kB
+#endif
+#endif
+}
+
+struct StageResult {
+	std::string name;
+	double seconds = 0.0;
+	double peakRss = 0.0;
+	size_t bytes = 0; // of input text, if not the OBJ
+};
+
+/**
+ * Runs `stage` `repeats` times and keeps the fastest run. `setup` runs
+ * before each one, untimed.
+ */
+StageResult measure(const std::string& name, int repeats, const std::function<void()>& setup, const std::function<void()>& stage) {
+	StageResult result{ name };
+	result.seconds = std::numeric_limits<double>::infinity();
+	for (int r = 0; r < repeats; ++r) {
+		setup();
+		resetPeakRss();
+		const auto start = Clock::now();
+		stage();
+		result.seconds = std::min(result.seconds, std::chrono::duration<double>(Clock::now() - start).count());
+		result.peakRss = std::max(result.peakRss, peakRssMB());
+	}
+	return result;
+}
+
+void printJsonNumber(double value) {
+	if (value < 0.0 || !std::isfinite(value)) {
+		std::printf("null");
+	} else {
+		std::printf("%.3f", value);
+	}
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	std::vector<size_t> sizes;
+	for (int i = 1; i < argc; ++i) {
+		sizes.push_back(std::strtoull(argv[i], nullptr, 10));
+	}
+	if (sizes.empty()) {
+		sizes = { 10000, 100000, 1000000 };
+	}
+	const fs::path directory = fs::temp_directory_path();
+	const fs::path objPath = directory / "bench_loader.obj";
+	const fs::path mtlPath = directory / "bench_loader.mtl";
+	const fs::path textPath = directory / "bench_loader.txt";
+
+	bool ok = true;
+	double peakRss = -1.0;
+	std::printf("{\n  \"threads\": %u,\n  \"conversion_kernel\": \"%s\",\n  \"runs\": [", std::thread::hardware_concurrency(), conversionKernelName(bestConversionKernel()));
+	for (size_t s = 0; s < sizes.size(); ++s) {
+		const SyntheticScene scene = makeScene(sizes[s]);
+		{
+			std::ofstream(objPath, std::ios::binary) << scene.obj;
+			std::ofstream(mtlPath, std::ios::binary) << scene.mtl;
+		}
+		// Small inputs are noisy, keep the fastest of several runs
+		const int repeats = scene.triangleCount <= 100000 ? 5 : 1;
+		auto nothing = []() {};
+		std::vector<StageResult> stages;
+
+		tinyobj::attrib_t attrib;
+		std::vector<tinyobj::shape_t> shapes;
+		stages.push_back(measure("tinyobj::LoadObj", repeats, [&]() { attrib = {}; shapes.clear(); }, [&]() {
+			std::vector<tinyobj::material_t> materials;
+			std::string warn, err;
+			std::istringstream objStream(scene.obj);
+			std::istringstream mtlStream(scene.mtl);
+			tinyobj::MaterialStreamReader materialReader(mtlStream);
+			ok = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, &objStream, &materialReader) && ok;
+		}));
+
+		size_t readerCorners = 0;
+		stages.push_back(measure("tinyobj::ObjReader::ParseFromString", repeats, nothing, [&]() {
+			tinyobj::ObjReader reader;
+			ok = reader.ParseFromString(scene.obj, scene.mtl) && ok;
+			readerCorners = cornerCount(reader.GetShapes());
+		}));
+
+		std::vector<VertexAttributes> expanded;
+		stages.push_back(measure("expand vertices", repeats, [&]() { expanded.clear(); expanded.shrink_to_fit(); }, [&]() {
+			expanded = expandVertices(attrib, shapes);
+		}));
+
+		// Same conversion, batched
+		const std::vector<ObjCorner> objCorners = gatherCorners(shapes);
+		ObjVertexSources sources;
+		sources.positions = attrib.vertices.data();
+		sources.colors = attrib.colors.size() == attrib.vertices.size() ? attrib.colors.data() : nullptr;
+		sources.normals = attrib.normals.empty() ? nullptr : attrib.normals.data();
+		sources.texcoords = attrib.texcoords.empty() ? nullptr : attrib.texcoords.data();
+		std::vector<VertexAttributes> converted(objCorners.size());
+		bool sameConversion = converted.size() == expanded.size();
+		auto clear = [&]() { std::memset(converted.data(), 0, converted.size() * sizeof(VertexAttributes)); };
+		auto matches = [&]() {
+			return sameConversion && std::memcmp(converted.data(), expanded.data(), expanded.size() * sizeof(VertexAttributes)) == 0;
+		};
+		for (ConversionKernel kernel : { ConversionKernel::Scalar, ConversionKernel::SSE2, ConversionKernel::AVX2, ConversionKernel::NEON }) {
+			if (!isSupported(kernel)) continue;
+			stages.push_back(measure(std::string("expand vertices (") + conversionKernelName(kernel) + ")", repeats, clear, [&]() {
+				convertObjVertices(objCorners.data(), objCorners.size(), sources, converted.data(), kernel);
+			}));
+			sameConversion = matches();
+		}
+		stages.push_back(measure(std::string("expand vertices (") + conversionKernelName(bestConversionKernel()) + ", all threads)", repeats, clear, [&]() {
+			parallelForRanges(objCorners.size(), 1 << 14, [&](size_t, size_t begin, size_t end) {
+				convertObjVertices(objCorners.data() + begin, end - begin, sources, converted.data() + begin);
+			});
+		}));
+		sameConversion = matches();
+		converted = {};
+
+		IndexedMesh welded;
+		stages.push_back(measure("weldVertices", repeats, [&]() { welded = {}; }, [&]() {
+			welded = weldVertices(expanded);
+		}));
+		const size_t corners = expanded.size();
+		attrib = {};
+		shapes = {};
+		expanded = {};
+
+		// The welded mesh in the text geometry format, with as many digits
+		// as the OBJ
+		{
+			std::ofstream text(textPath, std::ios::binary);
+			text << "[points]\n";
+			char line[256];
+			for (const VertexAttributes& v : welded.vertices) {
+				const int length = std::snprintf(line, sizeof(line), "%.6f %.6f %.6f %.6f %.6f %.6f %.6f %.6f %.6f\n",
+					v.position.x, v.position.y, v.position.z, v.normal.x, v.normal.y, v.normal.z, v.color.r, v.color.g, v.color.b);
+				text.write(line, length);
+			}
+			text << "[indices]\n";
+			for (size_t i = 0; i + 2 < welded.indexCount(); i += 3) {
+				auto index = [&](size_t k) { return welded.use16BitIndices ? uint32_t(welded.indices16[k]) : welded.indices32[k]; };
+				const int length = std::snprintf(line, sizeof(line), "%u %u %u\n", index(i), index(i + 1), index(i + 2));
+				text.write(line, length);
+			}
+		}
+		std::vector<VertexAttributes> textVertices(welded.vertices.size());
+		std::vector<uint32_t> textIndices(welded.indexCount());
+		bool sameText = false;
+		stages.push_back(measure("TextGeometryLoader", repeats, nothing, [&]() {
+			TextGeometryLoader textLoader;
+			sameText = textLoader.open(textPath)
+				&& textLoader.vertexCount() == textVertices.size() && textLoader.indexCount() == textIndices.size()
+				&& textLoader.writeVertices(textVertices.data()) && textLoader.writeIndices(textIndices.data());
+		}));
+		stages.back().bytes = static_cast<size_t>(fs::file_size(textPath));
+		textVertices = {};
+		textIndices = {};
+
+		ObjStreamLoader loader;
+		stages.push_back(measure("ObjStreamLoader::parse", repeats, nothing, [&]() {
+			ok = loader.parse(objPath) && ok;
+		}));
+		// The next stages consume the parsed data, so each run parses again
+		auto parse = [&]() { loader.parse(objPath); };
+		stages.push_back(measure("ObjStreamLoader::optimize", repeats, parse, [&]() {
+			loader.optimize();
+		}));
+		std::vector<VertexAttributes> vertices(loader.vertexCount());
+		stages.push_back(measure("ObjStreamLoader::writeVertices", repeats, nothing, [&]() {
+			loader.writeVertices(vertices.data());
+		}));
+		stages.push_back(measure("ObjStreamLoader::takeIndices", repeats, [&]() { parse(); loader.optimize(); }, [&]() {
+			loader.takeIndices();
+		}));
+
+		const bool sameCorners = corners == scene.cornerCount && readerCorners == scene.cornerCount;
+		const bool sameVertices = welded.vertices.size() == vertices.size();
+		ok = ok && sameCorners && sameConversion && sameVertices && sameText;
+
+		std::printf("%s\n    {\n", s > 0 ? "," : "");
+		std::printf("      \"triangles\": %zu,\n      \"obj_bytes\": %zu,\n      \"corners\": %zu,\n      \"unique_vertices\": %zu,\n",
+			scene.triangleCount, scene.obj.size(), corners, vertices.size());
+		std::printf("      \"same_corners\": %s,\n      \"same_conversion\": %s,\n      \"same_vertices\": %s,\n      \"same_text_geometry\": %s,\n      \"stages\": [\n",
+			sameCorners ? "true" : "false", sameConversion ? "true" : "false", sameVertices ? "true" : "false", sameText ? "true" : "false");
+		for (size_t i = 0; i < stages.size(); ++i) {
+			const StageResult& stage = stages[i];
+			std::printf("        { \"name\": \"%s\", \"seconds\": %.6f, \"mb_per_s\": ", stage.name.c_str(), stage.seconds);
+			printJsonNumber((stage.bytes ? stage.bytes : scene.obj.size()) / (1024.0 * 1024.0) / stage.seconds);
+			std::printf(", \"vertices_per_s\": %.0f, \"peak_rss_mb\": ", scene.cornerCount / stage.seconds);
+			printJsonNumber(stage.peakRss);
+			peakRss = std::max(peakRss, stage.peakRss);
+			std::printf(" }%s\n", i + 1 < stages.size() ? "," : "");
+		}
+		std::printf("      ]\n    }");
+		std::fflush(stdout);
+	}
+	std::printf("\n  ],\n  \"peak_rss_mb\": ");
+	printJsonNumber(peakRss);
+	std::printf(",\n  \"pass\": %s\n}\n", ok ? "true" : "false");
+
+	std::error_code error;
+	fs::remove(objPath, error);
+	fs::remove(mtlPath, error);
+	fs::remove(textPath, error);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,513 @@
+/**
+ * Benchmark and corpus check of the tiny_obj_loader number tokenizers.
+ *
+ * Compares the current float parser(Eisel-Lemire) and index triple parser
+ * (SWAR) against verbatim copies of the previous implementations:
+ *  - OBJ-style numbers(printf %f, %g, integers) and index triples must parse
+ *    to the same real_t and vertex_index_t as before;
+ *  - every number must parse to the same double as strtod(). The previous
+ *    parser is not correctly rounded, so on the corner-case corpus(long
+ *    significands, large exponents) its real_t may differ; such tokens are
+ *    only counted, and accepted when the new result is the rounded strtod();
+ *  - throughput is reported in MB/s for both versions.
+ *
+ * Usage: bench_obj_numbers [number of tokens]
+ * Returns a non-zero exit code when the corpus check fails.
+ */
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace tinyobj {
+
+// Previous implementation of tryParseDouble(), kept as a reference.
+static bool legacyTryParseDouble(const char *s, const char *s_end,
+                                 double *result) {
+  if (s >= s_end) {
+    return false;
+  }
+
+  double mantissa = 0.0;
+  // This exponent is base 2 rather than 10.
+  // However the exponent we parse is supposed to be one of ten,
+  // thus we must take care to convert the exponent/and or the
+  // mantissa to a * 2^E, where a is the mantissa and E is the
+  // exponent.
+  // To get the final double we will use ldexp, it requires the
+  // exponent to be in base 2.
+  int exponent = 0;
+
+  // NOTE: THESE MUST BE DECLARED HERE SINCE WE ARE NOT ALLOWED
+  // TO JUMP OVER DEFINITIONS.
+  char sign = '+';
+  char exp_sign = '+';
+  char const *curr = s;
+
+  // How many characters were read in a loop.
+  int read = 0;
+  // Tells whether a loop terminated due to reaching s_end.
+  bool end_not_reached = false;
+  bool leading_decimal_dots = false;
+
+  /*
+          BEGIN PARSING.
+  */
+
+  // Find out what sign we've got.
+  if (*curr == '+' || *curr == '-') {
+    sign = *curr;
+    curr++;
+    if ((curr != s_end) && (*curr == '.')) {
+      // accept. Somethig like `.7e+2`, `-.5234`
+      leading_decimal_dots = true;
+    }
+  } else if (IS_DIGIT(*curr)) { /* Pass through. */
+  } else if (*curr == '.') {
+    // accept. Somethig like `.7e+2`, `-.5234`
+    leading_decimal_dots = true;
+  } else {
+    goto fail;
+  }
+
+  // Read the integer part.
+  end_not_reached = (curr != s_end);
+  if (!leading_decimal_dots) {
+    while (end_not_reached && IS_DIGIT(*curr)) {
+      mantissa *= 10;
+      mantissa += static_cast<int>(*curr - 0x30);
+      curr++;
+      read++;
+      end_not_reached = (curr != s_end);
+    }
+
+    // We must make sure we actually got something.
+    if (read == 0) goto fail;
+  }
+
+  // We allow numbers of form "#", "###" etc.
+  if (!end_not_reached) goto assemble;
+
+  // Read the decimal part.
+  if (*curr == '.') {
+    curr++;
+    read = 1;
+    end_not_reached = (curr != s_end);
+    while (end_not_reached && IS_DIGIT(*curr)) {
+      static const double pow_lut[] = {
+          1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001,
+      };
+      const int lut_entries = sizeof pow_lut / sizeof pow_lut[0];
+
+      // NOTE: Don't use powf here, it will absolutely murder precision.
+      mantissa += static_cast<int>(*curr - 0x30) *
+                  (read < lut_entries ? pow_lut[read] : std::pow(10.0, -read));
+      read++;
+      curr++;
+      end_not_reached = (curr != s_end);
+    }
+  } else if (*curr == 'e' || *curr == 'E') {
+  } else {
+    goto assemble;
+  }
+
+  if (!end_not_reached) goto assemble;
+
+  // Read the exponent part.
+  if (*curr == 'e' || *curr == 'E') {
+    curr++;
+    // Figure out if a sign is present and if it is.
+    end_not_reached = (curr != s_end);
+    if (end_not_reached && (*curr == '+' || *curr == '-')) {
+      exp_sign = *curr;
+      curr++;
+    } else if (IS_DIGIT(*curr)) { /* Pass through. */
+    } else {
+      // Empty E is not allowed.
+      goto fail;
+    }
+
+    read = 0;
+    end_not_reached = (curr != s_end);
+    while (end_not_reached && IS_DIGIT(*curr)) {
+      // To avoid annoying MSVC's min/max macro definiton,
+      // Use hardcoded int max value
+      if (exponent > (2147483647/10)) { // 2147483647 = std::numeric_limits<int>::max()
+        // Integer overflow
+        goto fail;
+      }
+      exponent *= 10;
+      exponent += static_cast<int>(*curr - 0x30);
+      curr++;
+      read++;
+      end_not_reached = (curr != s_end);
+    }
+    exponent *= (exp_sign == '+' ? 1 : -1);
+    if (read == 0) goto fail;
+  }
+
+assemble:
+  *result = (sign == '+' ? 1 : -1) *
+            (exponent ? std::ldexp(mantissa * std::pow(5.0, exponent), exponent)
+                      : mantissa);
+  return true;
+fail:
+  return false;
+}
+
+static inline real_t legacyParseReal(const char **token) {
+	(*token) += strspn((*token), " \t");
+	const char *end = (*token) + strcspn((*token), " \t\r");
+	double val = 0.0;
+	legacyTryParseDouble((*token), end, &val);
+	real_t f = static_cast<real_t>(val);
+	(*token) = end;
+	return f;
+}
+
+// Previous implementation of parseTriple(), kept as a reference.
+static bool legacyParseTriple(const char **token, int vsize, int vnsize,
+                              int vtsize, vertex_index_t *ret,
+                              const warning_context &context) {
+  if (!ret) {
+    return false;
+  }
+
+  vertex_index_t vi(-1);
+
+  if (!fixIndex(atoi((*token)), vsize, &vi.v_idx, false, context)) {
+    return false;
+  }
+
+  (*token) += strcspn((*token), "/ \t\r");
+  if ((*token)[0] != '/') {
+    (*ret) = vi;
+    return true;
+  }
+  (*token)++;
+
+  // i//k
+  if ((*token)[0] == '/') {
+    (*token)++;
+    if (!fixIndex(atoi((*token)), vnsize, &vi.vn_idx, true, context)) {
+      return false;
+    }
+    (*token) += strcspn((*token), "/ \t\r");
+    (*ret) = vi;
+    return true;
+  }
+
+  // i/j/k or i/j
+  if (!fixIndex(atoi((*token)), vtsize, &vi.vt_idx, true, context)) {
+    return false;
+  }
+
+  (*token) += strcspn((*token), "/ \t\r");
+  if ((*token)[0] != '/') {
+    (*ret) = vi;
+    return true;
+  }
+
+  // i/j/k
+  (*token)++;  // skip '/'
+  if (!fixIndex(atoi((*token)), vnsize, &vi.vn_idx, true, context)) {
+    return false;
+  }
+  (*token) += strcspn((*token), "/ \t\r");
+
+  (*ret) = vi;
+
+  return true;
+}
+
+} // namespace tinyobj
+
+using namespace tinyobj;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * Space separated number tokens in the styles written by OBJ exporters.
+ */
+std::string makeNumberCorpus(size_t count, std::mt19937_64& rng) {
+	std::uniform_real_distribution<double> unit(-1.0, 1.0);
+	std::uniform_int_distribution<int> style(0, 5);
+	std::string corpus;
+	char buf[128];
+	for (size_t i = 0; i < count; ++i) {
+		double x = unit(rng);
+		switch (style(rng)) {
+		case 0: case 1: case 2:
+			std::snprintf(buf, sizeof(buf), "%f", x * 100.0); // Blender, 3ds Max
+			break;
+		case 3:
+			std::snprintf(buf, sizeof(buf), "%.4f", x);
+			break;
+		case 4:
+			std::snprintf(buf, sizeof(buf), "%g", x * 1000.0);
+			break;
+		default:
+			std::snprintf(buf, sizeof(buf), "%d", static_cast<int>(x * 100000));
+			break;
+		}
+		corpus += buf;
+		corpus += (i % 3 == 2) ? '\n' : ' ';
+	}
+	return corpus;
+}
+
+/**
+ * Corner cases of the grammar and of rounding: exponents, leading dots,
+ * explicit plus signs and more than 19 significant digits.
+ */
+std::string makeEdgeCaseCorpus(size_t count, std::mt19937_64& rng) {
+	std::uniform_real_distribution<double> unit(-1.0, 1.0);
+	std::uniform_int_distribution<int> style(0, 3);
+	std::uniform_int_distribution<int> exponent(-300, 300);
+	std::string corpus;
+	char buf[128];
+	for (size_t i = 0; i < count; ++i) {
+		double x = unit(rng);
+		switch (style(rng)) {
+		case 0:
+			std::snprintf(buf, sizeof(buf), "%.7e", x * std::pow(10.0, exponent(rng)));
+			break;
+		case 1:
+			std::snprintf(buf, sizeof(buf), "%.17g", x * std::pow(10.0, exponent(rng) / 10));
+			break;
+		case 2:
+			std::snprintf(buf, sizeof(buf), "%s.%06dE%+d", x < 0 ? "-" : "+",
+				static_cast<int>(std::fabs(x) * 999999), exponent(rng) / 30);
+			break;
+		default:
+			std::snprintf(buf, sizeof(buf), "%.24f", x * 10.0);
+			break;
+		}
+		corpus += buf;
+		corpus += (i % 3 == 2) ? '\n' : ' ';
+	}
+	corpus += "0 -0 . -. 1. .5e1 1e 1e+ 4.9e-324 2.2250738585072011e-308 1.7976931348623157e308 1e309 0e400\n";
+	return corpus;
+}
+
+/**
+ * `f` line bodies with v, v/vt, v//vn and v/vt/vn triples, including
+ * relative and zero indices.
+ */
+std::string makeTripleCorpus(size_t count, std::mt19937_64& rng) {
+	std::uniform_int_distribution<int> magnitude(0, 7);
+	std::uniform_int_distribution<int> form(0, 3);
+	std::uniform_int_distribution<int> coin(0, 9);
+	auto index = [&]() {
+		int digits = 1 + magnitude(rng);
+		std::uniform_int_distribution<int> value(0, static_cast<int>(std::pow(10.0, digits)) - 1);
+		int i = value(rng);
+		return coin(rng) == 0 ? -(i + 1) : i + 1;
+	};
+	std::string corpus;
+	for (size_t i = 0; i < count; ++i) {
+		int a = index(), b = index(), c = index();
+		switch (form(rng)) {
+		case 0: corpus += std::to_string(a); break;
+		case 1: corpus += std::to_string(a) + "/" + std::to_string(b); break;
+		case 2: corpus += std::to_string(a) + "//" + std::to_string(c); break;
+		default: corpus += std::to_string(a) + "/" + std::to_string(b) + "/" + std::to_string(c); break;
+		}
+		corpus += (i % 4 == 3) ? '\n' : ' ';
+	}
+	corpus += "1/0/1 +7 2/-0 12345678901 -3//0\n";
+	return corpus;
+}
+
+std::vector<std::string> splitLines(const std::string& text) {
+	std::vector<std::string> lines;
+	size_t begin = 0;
+	while (begin < text.size()) {
+		size_t end = text.find('\n', begin);
+		if (end == std::string::npos) end = text.size();
+		lines.push_back(text.substr(begin, end - begin));
+		begin = end + 1;
+	}
+	return lines;
+}
+
+template <typename Func>
+double megabytesPerSecond(size_t bytes, int repeats, Func&& func) {
+	auto start = Clock::now();
+	for (int r = 0; r < repeats; ++r) {
+		func();
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	return static_cast<double>(bytes) * repeats / (1024.0 * 1024.0) / seconds;
+}
+
+volatile double g_sink;
+
+} // namespace
+
+int main(int argc, char** argv) {
+	size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+	std::mt19937_64 rng(0x0b1ec7);
+
+	const std::string numbers = makeNumberCorpus(count, rng);
+	const std::string edgeCases = makeEdgeCaseCorpus(count / 10, rng);
+	const std::string triples = makeTripleCorpus(count, rng);
+	const std::vector<std::string> numberLines = splitLines(numbers);
+	const std::vector<std::string> edgeLines = splitLines(edgeCases);
+	const std::vector<std::string> tripleLines = splitLines(triples);
+
+	// Corpus check
+	struct NumberCheck {
+		size_t tokens = 0;
+		size_t realMismatches = 0;   // new real_t != previous real_t
+		size_t legacyMisrounded = 0; // ... because the previous parser was off
+		size_t doubleMismatches = 0; // new double != strtod()
+	};
+	auto checkNumbers = [](const std::vector<std::string>& lines) {
+		NumberCheck check;
+		for (const std::string& line : lines) {
+			const char* end = line.c_str() + line.size();
+			const char* token = line.c_str();
+			while (token < end) {
+				token += strspn(token, " \t");
+				const char* tokenEnd = token + strcspn(token, " \t\r");
+				const std::string text(token, tokenEnd);
+				double current = 0.0, legacy = 0.0;
+				bool ok = tryParseDouble(token, tokenEnd, &current);
+				bool legacyOk = legacyTryParseDouble(token, tokenEnd, &legacy);
+				char* referenceEnd = nullptr;
+				double reference = std::strtod(text.c_str(), &referenceEnd);
+				if (ok && referenceEnd != text.c_str() && std::memcmp(&current, &reference, sizeof(double)) != 0) {
+					if (check.doubleMismatches < 10) {
+						std::cerr << "double mismatch with strtod: '" << text << "'" << std::endl;
+					}
+					++check.doubleMismatches;
+				}
+				real_t a = static_cast<real_t>(current), b = static_cast<real_t>(legacy);
+				real_t rounded = static_cast<real_t>(reference);
+				if (ok != legacyOk || std::memcmp(&a, &b, sizeof(real_t)) != 0) {
+					++check.realMismatches;
+					if (ok == legacyOk && std::memcmp(&a, &rounded, sizeof(real_t)) == 0) {
+						++check.legacyMisrounded;
+					} else if (check.realMismatches - check.legacyMisrounded < 10) {
+						std::cerr << "real_t mismatch: '" << text << "'" << std::endl;
+					}
+				}
+				++check.tokens;
+				token = tokenEnd;
+			}
+		}
+		return check;
+	};
+	const NumberCheck objCheck = checkNumbers(numberLines);
+	const NumberCheck edgeCheck = checkNumbers(edgeLines);
+
+	std::string warn;
+	warning_context context;
+	context.warn = &warn;
+	context.line_number = 0;
+	size_t tripleTokens = 0, tripleMismatches = 0;
+	for (const std::string& line : tripleLines) {
+		const char* end = line.c_str() + line.size();
+		const char* current = line.c_str();
+		const char* legacy = line.c_str();
+		while (current < end) {
+			vertex_index_t a, b;
+			bool okA = parseTriple(&current, end, 100000000, 100000000, 100000000, &a, context);
+			bool okB = legacyParseTriple(&legacy, 100000000, 100000000, 100000000, &b, context);
+			// On failure the token position is irrelevant: the loader stops.
+			if (okA != okB || (okA && (current != legacy || a.v_idx != b.v_idx || a.vt_idx != b.vt_idx || a.vn_idx != b.vn_idx))) {
+				if (tripleMismatches < 10) {
+					std::cerr << "triple mismatch in line: '" << line << "'" << std::endl;
+				}
+				++tripleMismatches;
+				break;
+			}
+			++tripleTokens;
+			if (!okA) break;
+			current += strspn(current, " \t\r");
+			legacy = current;
+		}
+	}
+
+	// Throughput
+	const int repeats = 3;
+	double numbersBefore = megabytesPerSecond(numbers.size(), repeats, [&]() {
+		double sum = 0.0;
+		for (const std::string& line : numberLines) {
+			const char* token = line.c_str();
+			while (*token) sum += legacyParseReal(&token);
+		}
+		g_sink = sum;
+	});
+	double numbersAfter = megabytesPerSecond(numbers.size(), repeats, [&]() {
+		double sum = 0.0;
+		for (const std::string& line : numberLines) {
+			const char* token = line.c_str();
+			while (*token) sum += parseReal(&token);
+		}
+		g_sink = sum;
+	});
+	double triplesBefore = megabytesPerSecond(triples.size(), repeats, [&]() {
+		long long sum = 0;
+		for (const std::string& line : tripleLines) {
+			const char* token = line.c_str();
+			while (*token) {
+				vertex_index_t vi;
+				if (legacyParseTriple(&token, 100000000, 100000000, 100000000, &vi, context)) {
+					sum += vi.v_idx + vi.vt_idx + vi.vn_idx;
+				} else {
+					token += strcspn(token, " \t\r"); // skip the invalid token
+				}
+				token += strspn(token, " \t\r");
+			}
+		}
+		g_sink = static_cast<double>(sum);
+	});
+	double triplesAfter = megabytesPerSecond(triples.size(), repeats, [&]() {
+		long long sum = 0;
+		for (const std::string& line : tripleLines) {
+			const char* token = line.c_str();
+			const char* end = token + line.size();
+			while (*token) {
+				vertex_index_t vi;
+				if (parseTriple(&token, end, 100000000, 100000000, 100000000, &vi, context)) {
+					sum += vi.v_idx + vi.vt_idx + vi.vn_idx;
+				} else {
+					token += strcspn(token, " \t\r"); // skip the invalid token
+				}
+				token += strspn(token, " \t\r");
+			}
+		}
+		g_sink = static_cast<double>(sum);
+	});
+
+	const bool ok = objCheck.realMismatches == 0
+		&& objCheck.doubleMismatches == 0 && edgeCheck.doubleMismatches == 0
+		&& edgeCheck.realMismatches == edgeCheck.legacyMisrounded
+		&& tripleMismatches == 0;
+	std::printf("corpus: %zu OBJ numbers, %zu corner-case numbers, %zu triples\n",
+		objCheck.tokens, edgeCheck.tokens, tripleTokens);
+	std::printf("  OBJ numbers, real_t mismatches vs previous parser: %zu\n", objCheck.realMismatches);
+	std::printf("  corner cases, real_t mismatches vs previous parser: %zu (previous parser misrounded: %zu)\n",
+		edgeCheck.realMismatches, edgeCheck.legacyMisrounded);
+	std::printf("  double mismatches vs strtod: %zu\n", objCheck.doubleMismatches + edgeCheck.doubleMismatches);
+	std::printf("  triple mismatches vs previous parser: %zu\n", tripleMismatches);
+	std::printf("numbers: %8.1f MB/s before, %8.1f MB/s after (x%.2f)\n",
+		numbersBefore, numbersAfter, numbersAfter / numbersBefore);
+	std::printf("triples: %8.1f MB/s before, %8.1f MB/s after (x%.2f)\n",
+		triplesBefore, triplesAfter, triplesAfter / triplesBefore);
+
+	std::printf("%s\n", ok ? "PASS" : "FAIL");
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+/**
+ * Benchmark and check of the BC1/BC3/BC7 block compression encoder, on a
+ * synthetic texture (or on an image given on the command line) whose
+ * quadrants are a smooth gradient, smoothed noise, hard edges and a varying
+ * alpha channel.
+ *
+ *  - encoding on one thread and on all cores must give the same blocks;
+ *  - every format must reach a minimum PSNR, and BC7 must beat BC1/BC3 on
+ *    the same image with the Normal and High presets;
+ *  - throughput is reported in megapixels/s for one thread and all cores.
+ *
+ * BC1 has no alpha, so it is measured on an opaque copy of the image.
+ *
+ * Usage: bench_texture_compression [size of the synthetic image | image.png/.tga/.ppm]
+ * Returns a non-zero exit code when a check fails.
+ */
+
+#include "BlockCompression.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+Image makeTexture(uint32_t size) {
+	Image image;
+	image.width = size;
+	image.height = size;
+	image.pixels.resize(size_t(4) * size * size);
+
+	// Noise on a coarse grid, bilinearly interpolated
+	const uint32_t cell = 8;
+	const uint32_t gridSize = size / cell + 2;
+	std::mt19937 rng(0x7e47);
+	std::vector<float> grid(size_t(3) * gridSize * gridSize);
+	for (float& value : grid) value = static_cast<float>(rng() % 256);
+
+	const uint32_t half = size / 2;
+	for (uint32_t y = 0; y < size; ++y) {
+		for (uint32_t x = 0; x < size; ++x) {
+			uint8_t* p = &image.pixels[4 * (size_t(y) * size + x)];
+			p[3] = 255;
+			if (x < half && y < half) {
+				p[0] = static_cast<uint8_t>(255 * x / half);
+				p[1] = static_cast<uint8_t>(255 * y / half);
+				p[2] = static_cast<uint8_t>(128 + 127 * std::sin(0.05 * (x + y)));
+			} else if (y < half) {
+				const float fx = float(x % cell) / cell, fy = float(y % cell) / cell;
+				const size_t gx = x / cell, gy = y / cell;
+				for (int c = 0; c < 3; ++c) {
+					auto at = [&](size_t i, size_t j) { return grid[3 * (j * gridSize + i) + c]; };
+					const float top = at(gx, gy) + fx * (at(gx + 1, gy) - at(gx, gy));
+					const float bottom = at(gx, gy + 1) + fx * (at(gx + 1, gy + 1) - at(gx, gy + 1));
+					p[c] = static_cast<uint8_t>(top + fy * (bottom - top));
+				}
+			} else if (x < half) {
+				const bool on = ((x / 6) + (y / 10)) % 2 == 0;
+				const bool stripe = (x + 2 * y) % 23 < 3;
+				p[0] = stripe ? 250 : on ? 200 : 30;
+				p[1] = stripe ? 250 : on ? 60 : 180;
+				p[2] = stripe ? 20 : on ? 40 : 220;
+			} else {
+				const float dx = float(x) - 1.5f * half, dy = float(y) - 1.5f * half;
+				const float radius = std::sqrt(dx * dx + dy * dy) / (0.5f * half);
+				p[0] = static_cast<uint8_t>(std::clamp(255.0f * radius, 0.0f, 255.0f));
+				p[1] = 90;
+				p[2] = static_cast<uint8_t>(255 * (x - half) / half);
+				p[3] = radius > 1.0f ? 0 : static_cast<uint8_t>(255.0f * (1.0f - radius * radius));
+			}
+		}
+	}
+	return image;
+}
+
+struct Result {
+	double psnr = 0.0;
+	double serialRate = 0.0; // megapixels/s
+	double parallelRate = 0.0;
+	bool deterministic = false;
+};
+
+Result measure(const Image& image, BlockFormat format, CompressionPreset preset, unsigned threads) {
+	Result result;
+	const double megapixels = double(image.width) * image.height / 1e6;
+
+	auto start = Clock::now();
+	const std::vector<uint8_t> serial = compressImage(image, format, preset, 1);
+	result.serialRate = megapixels / std::chrono::duration<double>(Clock::now() - start).count();
+
+	start = Clock::now();
+	const std::vector<uint8_t> parallel = compressImage(image, format, preset, threads);
+	result.parallelRate = megapixels / std::chrono::duration<double>(Clock::now() - start).count();
+
+	result.deterministic = serial == parallel;
+	result.psnr = computePsnr(image, decompressImage(serial.data(), image.width, image.height, format));
+	return result;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	Image image;
+	std::string name = "synthetic";
+	char* end = nullptr;
+	const unsigned long size = argc > 1 ? std::strtoul(argv[1], &end, 10) : 512;
+	const bool synthetic = argc <= 1 || *end == '\0';
+	if (!synthetic) {
+		std::string error;
+		if (!loadImage(argv[1], image, &error)) {
+			std::fprintf(stderr, "Could not load %s: %s\n", argv[1], error.c_str());
+			return 1;
+		}
+		name = argv[1];
+	} else {
+		image = makeTexture(std::max(8u, static_cast<uint32_t>(size) & ~7u));
+	}
+	Image opaque = image;
+	for (size_t i = 3; i < opaque.pixels.size(); i += 4) opaque.pixels[i] = 255;
+	// At least 4 threads, so that the determinism check splits the work
+	const unsigned threads = std::max(4u, std::thread::hardware_concurrency());
+
+	std::printf("image: %s, %ux%u\n", name.c_str(), image.width, image.height);
+	std::printf("format preset   PSNR (dB)  1 thread (MP/s)  %2u threads (MP/s)  same blocks\n", threads);
+	const BlockFormat formats[] = { BlockFormat::BC1, BlockFormat::BC3, BlockFormat::BC7 };
+	const CompressionPreset presets[] = { CompressionPreset::Fast, CompressionPreset::Normal, CompressionPreset::High };
+	const char* presetNames[] = { "fast", "normal", "high" };
+	double psnr[3][3] = {};
+	bool ok = true;
+	for (int f = 0; f < 3; ++f) {
+		for (int p = 0; p < 3; ++p) {
+			const Image& source = formats[f] == BlockFormat::BC1 ? opaque : image;
+			const Result result = measure(source, formats[f], presets[p], threads);
+			psnr[f][p] = result.psnr;
+			ok = ok && result.deterministic;
+			std::printf("%-6s %-7s %9.2f  %15.2f  %17.2f  %s\n", blockFormatName(formats[f]), presetNames[p],
+				result.psnr, result.serialRate, result.parallelRate, result.deterministic ? "yes" : "NO");
+		}
+	}
+
+	// Loose bounds, that a broken encoder (wrong bit layout, endpoint
+	// order...) misses by far
+	if (synthetic) {
+		for (int p = 0; p < 3; ++p) {
+			ok = ok && psnr[0][p] > 25.0 && psnr[1][p] > 25.0 && psnr[2][p] > 25.0;
+		}
+	}
+	for (int p = 1; p < 3; ++p) {
+		ok = ok && psnr[2][p] >= psnr[1][p];
+	}
+
+	std::printf("%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
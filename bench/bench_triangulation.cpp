@@ -0,0 +1,336 @@
+/**
+ * Benchmark and check of the polygon triangulation of tiny_obj_loader
+ * (exportGroupsToShape), on a synthetic polygon-heavy file in the style of
+ * CAD exports: quads, convex n-gons, concave (star shaped) n-gons and a few
+ * large concave polygons.
+ *
+ *  - triangulating on one thread and on all cores must give the same
+ *    triangles in the same order, both for exportGroupsToShape alone and
+ *    for a whole LoadObjParallel;
+ *  - ObjStreamLoader, which the app loads with, must give the same
+ *    triangles too, as vertex positions since it welds vertices;
+ *  - every convex face must take the fan fast path, and every polygon must
+ *    become corners - 2 triangles covering its area;
+ *  - throughput is reported in faces/s for one thread and for all cores,
+ *    and for the stream loader.
+ *
+ * Usage: bench_triangulation [number of faces]
+ * Returns a non-zero exit code when a check fails.
+ */
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+#include "ObjStreamLoader.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace tinyobj;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum class FaceKind { Quad, Convex, Concave, LargeConcave };
+
+struct SyntheticObj {
+	std::vector<real_t> positions; // xyz
+	std::vector<face_t> faces;
+	std::vector<FaceKind> kinds;
+	std::string text; // the same geometry as an OBJ file
+};
+
+/**
+ * Polygons with their own corners, each one in a random plane. Concave
+ * polygons alternate between two radii, which keeps them simple.
+ */
+SyntheticObj makePolygons(size_t faceCount, std::mt19937_64& rng) {
+	std::uniform_real_distribution<double> unit(-1.0, 1.0);
+	std::uniform_int_distribution<int> kind(0, 99);
+	std::uniform_int_distribution<int> convexCorners(5, 16);
+	std::uniform_int_distribution<int> concaveCorners(3, 12); // times 2
+	std::uniform_int_distribution<int> largeCorners(32, 100); // times 2
+	const double pi = 3.14159265358979323846;
+
+	SyntheticObj obj;
+	obj.faces.reserve(faceCount);
+	obj.text.reserve(faceCount * 400);
+	char buf[128];
+	for (size_t i = 0; i < faceCount; ++i) {
+		if (i % 50000 == 0) {
+			std::snprintf(buf, sizeof(buf), "o part%zu\n", i / 50000);
+			obj.text += buf;
+		}
+
+		FaceKind faceKind;
+		int corners;
+		const int k = kind(rng);
+		if (k < 40) {
+			faceKind = FaceKind::Quad;
+			corners = 4;
+		} else if (k < 70) {
+			faceKind = FaceKind::Convex;
+			corners = convexCorners(rng);
+		} else if (k < 99) {
+			faceKind = FaceKind::Concave;
+			corners = 2 * concaveCorners(rng);
+		} else {
+			faceKind = FaceKind::LargeConcave;
+			corners = 2 * largeCorners(rng);
+		}
+
+		// Orthonormal basis of a random plane
+		double n[3] = { unit(rng), unit(rng), unit(rng) };
+		double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (length < 1e-3) {
+			n[0] = 0.0; n[1] = 0.0; n[2] = length = 1.0;
+		}
+		for (double& c : n) c /= length;
+		double u[3] = { 1.0, 0.0, 0.0 };
+		if (std::fabs(n[0]) > 0.9) { u[0] = 0.0; u[1] = 1.0; }
+		double d = u[0] * n[0] + u[1] * n[1] + u[2] * n[2];
+		for (int c = 0; c < 3; ++c) u[c] -= d * n[c];
+		length = std::sqrt(u[0] * u[0] + u[1] * u[1] + u[2] * u[2]);
+		for (double& c : u) c /= length;
+		const double w[3] = { n[1] * u[2] - n[2] * u[1], n[2] * u[0] - n[0] * u[2], n[0] * u[1] - n[1] * u[0] };
+		const double center[3] = { 100.0 * unit(rng), 100.0 * unit(rng), 100.0 * unit(rng) };
+		const double radius = 1.0 + 0.5 * unit(rng);
+		const double phase = pi * unit(rng);
+
+		face_t face;
+		std::string line = "f";
+		for (int c = 0; c < corners; ++c) {
+			double r = radius;
+			if (faceKind == FaceKind::Concave || faceKind == FaceKind::LargeConcave) {
+				r *= (c % 2 == 0) ? 1.0 : 0.5;
+			}
+			const double angle = phase + 2.0 * pi * c / corners;
+			const double x = r * std::cos(angle), y = r * std::sin(angle);
+			const int index = static_cast<int>(obj.positions.size() / 3);
+			for (int a = 0; a < 3; ++a) {
+				obj.positions.push_back(static_cast<real_t>(center[a] + x * u[a] + y * w[a]));
+			}
+			std::snprintf(buf, sizeof(buf), "v %f %f %f\n",
+				obj.positions[3 * index], obj.positions[3 * index + 1], obj.positions[3 * index + 2]);
+			obj.text += buf;
+			face.vertex_indices.push_back(vertex_index_t(index, -1, -1));
+			line += " " + std::to_string(index + 1);
+		}
+		obj.text += line + "\n";
+		obj.faces.push_back(face);
+		obj.kinds.push_back(faceKind);
+	}
+
+	// Positions are compared as parsed back from the text
+	for (size_t i = 0; i < obj.positions.size(); ++i) {
+		std::snprintf(buf, sizeof(buf), "%f", obj.positions[i]);
+		obj.positions[i] = static_cast<real_t>(std::strtod(buf, nullptr));
+	}
+	return obj;
+}
+
+double triangleArea(const std::vector<real_t>& v, const index_t* corners) {
+	const real_t* a = &v[3 * corners[0].vertex_index];
+	const real_t* b = &v[3 * corners[1].vertex_index];
+	const real_t* c = &v[3 * corners[2].vertex_index];
+	const double e0[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+	const double e1[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+	const double x = e0[1] * e1[2] - e0[2] * e1[1];
+	const double y = e0[2] * e1[0] - e0[0] * e1[2];
+	const double z = e0[0] * e1[1] - e0[1] * e1[0];
+	return 0.5 * std::sqrt(x * x + y * y + z * z);
+}
+
+// Area of a planar polygon, from its Newell normal
+double polygonArea(const std::vector<real_t>& v, const face_t& face) {
+	double n[3] = { 0.0, 0.0, 0.0 };
+	const size_t count = face.vertex_indices.size();
+	for (size_t k = 0; k < count; ++k) {
+		const real_t* a = &v[3 * face.vertex_indices[k].v_idx];
+		const real_t* b = &v[3 * face.vertex_indices[(k + 1) % count].v_idx];
+		n[0] += (a[1] - b[1]) * double(a[2] + b[2]);
+		n[1] += (a[2] - b[2]) * double(a[0] + b[0]);
+		n[2] += (a[0] - b[0]) * double(a[1] + b[1]);
+	}
+	return 0.5 * std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+}
+
+bool sameMesh(const mesh_t& a, const mesh_t& b) {
+	if (a.indices.size() != b.indices.size() || a.num_face_vertices != b.num_face_vertices
+		|| a.material_ids != b.material_ids || a.smoothing_group_ids != b.smoothing_group_ids) {
+		return false;
+	}
+	for (size_t i = 0; i < a.indices.size(); ++i) {
+		if (a.indices[i].vertex_index != b.indices[i].vertex_index
+			|| a.indices[i].normal_index != b.indices[i].normal_index
+			|| a.indices[i].texcoord_index != b.indices[i].texcoord_index) {
+			return false;
+		}
+	}
+	return true;
+}
+
+template <typename Func>
+double facesPerSecond(size_t faces, int repeats, Func&& func) {
+	auto start = Clock::now();
+	for (int r = 0; r < repeats; ++r) {
+		func();
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	return static_cast<double>(faces) * repeats / seconds;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+	std::mt19937_64 rng(0x7a1a6);
+	const SyntheticObj obj = makePolygons(count, rng);
+	// At least 4 threads, so that the determinism check splits the work
+	const unsigned threads = std::max(4u, std::thread::hardware_concurrency());
+
+	PrimGroup group;
+	group.faceGroup = obj.faces;
+	const std::vector<tag_t> tags;
+	auto triangulate = [&](unsigned numThreads) {
+		shape_t shape;
+		exportGroupsToShape(&shape, group, tags, 0, "synthetic", true, obj.positions, nullptr, numThreads);
+		return shape;
+	};
+
+	// Same triangles whatever the number of threads
+	const shape_t serial = triangulate(1);
+	const shape_t parallel = triangulate(threads);
+	const bool sameTriangles = sameMesh(serial.mesh, parallel.mesh);
+
+	// Triangle count and area of each polygon
+	size_t kindCounts[4] = {}, fanFaces = 0, missedConvex = 0;
+	size_t countMismatches = 0, areaMismatches = 0;
+	size_t triangle = 0;
+	const size_t triangleCount = serial.mesh.num_face_vertices.size();
+	for (size_t f = 0; f < obj.faces.size(); ++f) {
+		const face_t& face = obj.faces[f];
+		const size_t corners = face.vertex_indices.size();
+		++kindCounts[static_cast<int>(obj.kinds[f])];
+		if (corners > 4) {
+			std::vector<real_t> positions(3 * corners);
+			const bool convex = gatherFacePositions(face, obj.positions, positions.data())
+				&& isConvexPolygon(positions.data(), corners);
+			fanFaces += convex ? 1 : 0;
+			missedConvex += (obj.kinds[f] == FaceKind::Convex && !convex) ? 1 : 0;
+		}
+		if (triangle + corners - 2 > triangleCount) {
+			++countMismatches;
+			break;
+		}
+		double area = 0.0;
+		for (size_t t = 0; t < corners - 2; ++t, ++triangle) {
+			area += triangleArea(obj.positions, &serial.mesh.indices[3 * triangle]);
+		}
+		const double expected = polygonArea(obj.positions, face);
+		if (std::fabs(area - expected) > 1e-3 * expected) {
+			++areaMismatches;
+		}
+	}
+	if (triangle != triangleCount) {
+		++countMismatches;
+	}
+
+	// Whole file, parsed and triangulated
+	const std::filesystem::path path = std::filesystem::temp_directory_path() / "bench_triangulation.obj";
+	{
+		std::ofstream file(path, std::ios::binary);
+		file << obj.text;
+	}
+	auto load = [&](unsigned numThreads, attrib_t* attrib, std::vector<shape_t>* shapes) {
+		std::vector<material_t> materials;
+		std::string warn, err;
+		return LoadObjParallel(attrib, shapes, &materials, &warn, &err, path.string().c_str(), nullptr, true, true, numThreads);
+	};
+	attrib_t serialAttrib, parallelAttrib;
+	std::vector<shape_t> serialShapes, parallelShapes;
+	bool sameLoad = load(1, &serialAttrib, &serialShapes) && load(threads, &parallelAttrib, &parallelShapes)
+		&& serialShapes.size() == parallelShapes.size() && serialAttrib.vertices == parallelAttrib.vertices;
+	for (size_t s = 0; sameLoad && s < serialShapes.size(); ++s) {
+		sameLoad = sameMesh(serialShapes[s].mesh, parallelShapes[s].mesh);
+	}
+
+	// The app's loader, vertex positions of each triangle corner after the
+	// axis swap of convertObjVertex
+	auto streamLoad = [&](std::vector<glm::vec3>* corners) {
+		ObjStreamLoader loader;
+		if (!loader.parse(path)) return false;
+		LodSettings lodSettings;
+		lodSettings.levelCount = 0;
+		const IndexedMesh mesh = loader.takeIndices(lodSettings, 1);
+		if (!corners) return true;
+		std::vector<VertexAttributes> vertices(loader.vertexCount());
+		loader.writeVertices(vertices.data(), 1);
+		corners->clear();
+		for (const MeshChunk& chunk : mesh.chunks) {
+			for (uint32_t i = chunk.firstIndex; i < chunk.firstIndex + chunk.indexCount; ++i) {
+				const uint32_t index = mesh.use16BitIndices ? mesh.indices16[i] : mesh.indices32[i];
+				corners->push_back(vertices[chunk.baseVertex + index].position);
+			}
+		}
+		return true;
+	};
+	std::vector<glm::vec3> streamCorners;
+	bool sameStream = streamLoad(&streamCorners);
+	size_t expectedCorners = 0;
+	for (size_t s = 0; sameStream && s < serialShapes.size(); ++s) {
+		for (const index_t& index : serialShapes[s].mesh.indices) {
+			const real_t* p = &serialAttrib.vertices[3 * index.vertex_index];
+			sameStream = expectedCorners < streamCorners.size()
+				&& streamCorners[expectedCorners++] == glm::vec3(p[0], -p[2], p[1]);
+			if (!sameStream) break;
+		}
+	}
+	sameStream = sameStream && expectedCorners == streamCorners.size();
+
+	// Throughput
+	const int repeats = 3;
+	const double serialRate = facesPerSecond(count, repeats, [&]() { triangulate(1); });
+	const double parallelRate = facesPerSecond(count, repeats, [&]() { triangulate(threads); });
+	const double serialLoad = facesPerSecond(count, 1, [&]() {
+		attrib_t attrib;
+		std::vector<shape_t> shapes;
+		load(1, &attrib, &shapes);
+	});
+	const double parallelLoad = facesPerSecond(count, 1, [&]() {
+		attrib_t attrib;
+		std::vector<shape_t> shapes;
+		load(threads, &attrib, &shapes);
+	});
+	const double streamRate = facesPerSecond(count, 1, [&]() { streamLoad(nullptr); });
+	std::error_code error;
+	std::filesystem::remove(path, error);
+
+	const bool ok = sameTriangles && sameLoad && sameStream && missedConvex == 0 && countMismatches == 0 && areaMismatches == 0;
+	std::printf("corpus: %zu faces (%zu quads, %zu convex, %zu concave, %zu large concave), %.1f MB of OBJ\n",
+		count, kindCounts[0], kindCounts[1], kindCounts[2], kindCounts[3], obj.text.size() / (1024.0 * 1024.0));
+	std::printf("  %zu triangles, %zu n-gons took the convex fast path (%zu convex ones missed)\n",
+		triangleCount, fanFaces, missedConvex);
+	std::printf("  faces with a wrong triangle count: %zu, with a wrong area: %zu\n", countMismatches, areaMismatches);
+	std::printf("  1 vs %u threads, same triangles: exportGroupsToShape %s, LoadObjParallel %s\n",
+		threads, sameTriangles ? "yes" : "NO", sameLoad ? "yes" : "NO");
+	std::printf("  ObjStreamLoader, same triangles: %s\n", sameStream ? "yes" : "NO");
+	std::printf("triangulation: %10.0f faces/s on 1 thread, %10.0f faces/s on %u (x%.2f)\n",
+		serialRate, parallelRate, threads, parallelRate / serialRate);
+	std::printf("whole load:    %10.0f faces/s on 1 thread, %10.0f faces/s on %u (x%.2f)\n",
+		serialLoad, parallelLoad, threads, parallelLoad / serialLoad);
+	std::printf("stream load:   %10.0f faces/s on 1 thread\n", streamRate);
+
+	std::printf("%s\n", ok ? "PASS" : "FAIL");
+
+	return ok ? 0 : 1;
+}
@@ -1,3 +1,8 @@
+// Depending on the vertex encoding chosen by the application (see
+// VertexEncoding.h), position is either the final one or a unorm16 position
+// within the bounding box of the mesh, and normal is either the final one or
+// an octahedral encoding in normal.xy. Colors and UVs are always converted to
+// floats by the vertex fetch.
 struct VertexInput {
 	@location(0) position: vec3f,
 	@location(1) normal: vec3f,
@@ -5,40 +10,86 @@ struct VertexInput {
 	@location(3) uv: vec2f, // new attribute
 };
 
+// Fetched once per instance, from the second vertex buffer, when copies are
+// instanced
+struct InstanceInput {
+	@location(4) model0: vec4f, // columns of the model matrix
+	@location(5) model1: vec4f,
+	@location(6) model2: vec4f,
+	@location(7) model3: vec4f,
+	@location(8) color: vec4f,
+};
+
 struct VertexOutput {
 	@builtin(position) position: vec4f,
 	@location(0) color: vec3f,
 	@location(1) normal: vec3f,
 	@location(2) uv: vec2f, // <--- Add a texture coordinate output
+	@location(3) tint: vec4f,
 };
 
 
-// A structure holding the value of our uniforms
-struct MyUniforms {
+// A structure holding the value of the uniforms shared by all draws of a frame
+struct FrameUniforms {
     projectionMatrix: mat4x4f,
     viewMatrix: mat4x4f,
-    modelMatrix: mat4x4f,
-    color: vec4f,
     time: f32,
+    octNormals: u32,
+    positionOffset: vec4f,
+    positionScale: vec4f,
 };
 
-@group(0) @binding(0) var<uniform> uMyUniforms: MyUniforms;
+@group(0) @binding(0) var<uniform> uMyUniforms: FrameUniforms;
 
 // The texture binding
 @group(0) @binding(1) var gradientTexture: texture_2d<f32>;
 
 @group(0) @binding(2) var textureSampler: sampler;
 
-@vertex
-fn vs_main(in: VertexInput) -> VertexOutput {
+// The uniforms of the object being drawn, selected by a dynamic offset, when
+// copies are not instanced
+struct ObjectUniforms {
+    modelMatrix: mat4x4f,
+    color: vec4f,
+};
+
+@group(0) @binding(3) var<uniform> uObject: ObjectUniforms;
+
+// Inverse of the octahedral mapping of unit vectors to [-1, 1]^2
+fn octDecode(p: vec2f) -> vec3f {
+	var n = vec3f(p, 1.0 - abs(p.x) - abs(p.y));
+	if (n.z < 0.0) {
+		n = vec3f((1.0 - abs(n.yx)) * select(vec2f(-1.0), vec2f(1.0), n.xy >= vec2f(0.0)), n.z);
+	}
+	return normalize(n);
+}
+
+fn transform(in: VertexInput, modelMatrix: mat4x4f, tint: vec4f) -> VertexOutput {
 	var out: VertexOutput;
-	out.position = uMyUniforms.projectionMatrix * uMyUniforms.viewMatrix * uMyUniforms.modelMatrix * vec4f(in.position, 1.0);
-    out.normal = (uMyUniforms.modelMatrix * vec4f(in.normal, 0.0)).xyz;
+	let position = uMyUniforms.positionOffset.xyz + uMyUniforms.positionScale.xyz * in.position;
+	var normal = in.normal;
+	if (uMyUniforms.octNormals != 0u) {
+		normal = octDecode(in.normal.xy);
+	}
+	out.position = uMyUniforms.projectionMatrix * uMyUniforms.viewMatrix * modelMatrix * vec4f(position, 1.0);
+    out.normal = (modelMatrix * vec4f(normal, 0.0)).xyz;
 	out.color = in.color;
 	out.uv = in.uv * 6.0;
+	out.tint = tint;
 	return out;
 }
 
+@vertex
+fn vs_main(in: VertexInput, instance: InstanceInput) -> VertexOutput {
+	let modelMatrix = mat4x4f(instance.model0, instance.model1, instance.model2, instance.model3);
+	return transform(in, modelMatrix, instance.color);
+}
+
+@vertex
+fn vs_object(in: VertexInput) -> VertexOutput {
+	return transform(in, uObject.modelMatrix, uObject.color);
+}
+
 @fragment
 fn fs_main(in: VertexOutput) -> @location(0) vec4f {
 	// We remap UV coords to actual texel coordinates
@@ -47,9 +98,9 @@ fn fs_main(in: VertexOutput) -> @location(0) vec4f {
 	// And we fetch a texel from the texture
 	// let color = textureLoad(gradientTexture, texelCoords, 0).rgb;
 
-  let color = textureSample(gradientTexture, textureSampler, in.uv).rgb;
+  let color = textureSample(gradientTexture, textureSampler, in.uv).rgb * in.tint.rgb;
 
 	// Gamma-correction
 	let corrected_color = pow(color, vec3f(2.2));
-	return vec4f(corrected_color, uMyUniforms.color.a);
+	return vec4f(corrected_color, in.tint.a);
 }
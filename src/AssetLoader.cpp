@@ -0,0 +1,117 @@
+#include "AssetLoader.h"
+
+#include "Profiler.h"
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace fs = std::filesystem;
+
+void AssetLoader::loadShader(const fs::path& path) {
+	expect(1);
+	m_pool.submit([this, path]() {
+		PROFILE_ZONE("load shader");
+		ShaderAsset shader;
+		shader.path = path;
+		std::ifstream file(path, std::ios::binary);
+		if (file.is_open()) {
+			shader.source.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		}
+		push(std::move(shader));
+	});
+}
+
+void AssetLoader::loadMesh(const fs::path& path, const VertexEncoding& encoding) {
+	expect(1);
+	m_pool.submit([this, path, encoding]() {
+		PROFILE_ZONE("load mesh");
+		MeshAsset mesh;
+		mesh.path = path;
+		mesh.cache = std::make_unique<MeshCache>();
+		if (TextGeometryLoader::handles(path)) {
+			// Parses about as fast as a cache would map, so it has none. The
+			// render thread parses it straight into the buffers.
+			mesh.textLoader = std::make_unique<TextGeometryLoader>();
+			mesh.ok = mesh.textLoader->open(path);
+			if (!mesh.ok) {
+				std::cerr << "Could not load " << path << ": " << mesh.textLoader->error() << std::endl;
+			}
+		} else if (mesh.cache->open(path, encoding)) {
+			mesh.fromCache = true;
+			mesh.ok = true;
+		} else {
+			// Everything but writing the vertices, which the render thread
+			// does straight into the vertex buffer
+			mesh.loader = std::make_unique<ObjStreamLoader>();
+			mesh.ok = mesh.loader->parse(path);
+			if (mesh.ok) {
+				mesh.report = mesh.loader->optimize();
+				mesh.indices = mesh.loader->takeIndices();
+			}
+		}
+		push(std::move(mesh));
+	});
+}
+
+uint32_t AssetLoader::loadMaterialTextures(const fs::path& objPath, const TextureLoadSettings& settings, std::shared_future<bool> blockCompression) {
+	expect(1);
+	const uint32_t request = ++m_materialRequests;
+	MaterialTextureCallbacks callbacks;
+	callbacks.materials = [this, request](MaterialTextures&& materials, size_t textureCount, std::string&& warnings) {
+		expect(textureCount);
+		MaterialsAsset asset;
+		asset.request = request;
+		asset.materials = std::move(materials);
+		asset.textureCount = textureCount;
+		asset.warnings = std::move(warnings);
+		push(std::move(asset));
+	};
+	callbacks.texture = [this, request](size_t index, MaterialTexture&& texture, std::string&& error) {
+		TextureAsset asset;
+		asset.request = request;
+		asset.index = index;
+		asset.texture = std::move(texture);
+		asset.error = std::move(error);
+		push(std::move(asset));
+	};
+	::loadMaterialTextures(objPath, m_pool, settings, std::move(blockCompression), std::move(callbacks));
+	return request;
+}
+
+bool AssetLoader::next(LoadedAsset& asset) {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_ready.wait(lock, [this]() { return !m_finished.empty() || m_pending == 0; });
+	if (m_finished.empty()) {
+		return false;
+	}
+	asset = std::move(m_finished.front().asset);
+	m_lastFinishTime = m_finished.front().time;
+	m_finished.pop_front();
+	return true;
+}
+
+bool AssetLoader::poll(LoadedAsset& asset) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_finished.empty()) {
+		return false;
+	}
+	asset = std::move(m_finished.front().asset);
+	m_lastFinishTime = m_finished.front().time;
+	m_finished.pop_front();
+	return true;
+}
+
+void AssetLoader::expect(size_t count) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_pending += count;
+}
+
+void AssetLoader::push(LoadedAsset&& asset) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_finished.push_back(Finished{ std::move(asset), Clock::now() });
+		--m_pending;
+	}
+	m_ready.notify_one();
+}
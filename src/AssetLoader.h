@@ -0,0 +1,131 @@
+/**
+ * Loads the CPU side of the scene's assets on a thread pool, so that file
+ * I/O and parsing overlap the acquisition of the adapter and device
+ * instead of delaying the first frame.
+ *
+ * Each finished asset is pushed to a queue that the render thread drains
+ * with `next` (or `poll` between frames, for assets reloaded while the app
+ * runs), in completion order, to create the matching GPU objects:
+ *  - the WGSL source of a shader;
+ *  - a mesh, either mapped from its cache or parsed and optimized into an
+ *    ObjStreamLoader whose vertices are still to be written (straight into
+ *    a mapped vertex buffer, see ObjStreamLoader.h), or for the text format
+ *    of TextGeometryLoader.h, converted in memory;
+ *  - the material table of an OBJ, then each of its textures.
+ */
+
+#pragma once
+
+#include "MaterialTextures.h"
+#include "MeshCache.h"
+#include "ObjStreamLoader.h"
+#include "Parallel.h"
+#include "TextGeometryLoader.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <variant>
+
+struct ShaderAsset {
+	std::filesystem::path path;
+	std::string source; // empty if it could not be read
+};
+
+struct MeshAsset {
+	std::filesystem::path path;
+	bool ok = false; // whether the source could be read
+	// Holds the mesh on a cache hit, otherwise `save` (or `keep` for text
+	// geometry) it once the buffers are written
+	std::unique_ptr<MeshCache> cache;
+	bool fromCache = false; // whether `cache` holds the mesh
+	// Only for text geometry: the opened file, that writes the buffers
+	std::unique_ptr<TextGeometryLoader> textLoader;
+	// Only on a cache miss: the parsed OBJ, and its triangles
+	std::unique_ptr<ObjStreamLoader> loader;
+	IndexedMesh indices;
+	MeshOptimizationReport report;
+};
+
+struct MaterialsAsset {
+	uint32_t request = 0; // as returned by loadMaterialTextures
+	MaterialTextures materials;
+	size_t textureCount = 0; // TextureAssets that follow
+	std::string warnings;
+};
+
+struct TextureAsset {
+	uint32_t request = 0; // as returned by loadMaterialTextures
+	size_t index = 0; // in the material table
+	MaterialTexture texture; // without levels if it could not be loaded
+	std::string error;
+};
+
+using LoadedAsset = std::variant<ShaderAsset, MeshAsset, MaterialsAsset, TextureAsset>;
+
+class AssetLoader {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	/**
+	 * @param threadCount Number of worker threads, 0 to use all cores.
+	 */
+	explicit AssetLoader(unsigned threadCount = 0) : m_pool(threadCount) {}
+
+	void loadShader(const std::filesystem::path& path);
+
+	/**
+	 * Loads a mesh, from its cache if it holds vertices in `encoding`.
+	 */
+	void loadMesh(const std::filesystem::path& path, const VertexEncoding& encoding);
+
+	/**
+	 * Loads the material table of `objPath`, then its textures. See
+	 * loadMaterialTextures for `blockCompression`. Returns an identifier of
+	 * the request, that its assets carry.
+	 */
+	uint32_t loadMaterialTextures(const std::filesystem::path& objPath, const TextureLoadSettings& settings, std::shared_future<bool> blockCompression);
+
+	/**
+	 * Waits for the next finished asset. Returns false once every requested
+	 * asset has been returned.
+	 */
+	bool next(LoadedAsset& asset);
+
+	/**
+	 * Same as `next`, but returns false right away if no asset is finished.
+	 */
+	bool poll(LoadedAsset& asset);
+
+	/**
+	 * Time at which the last asset returned by `next` was finished.
+	 */
+	Clock::time_point lastFinishTime() const { return m_lastFinishTime; }
+
+private:
+	// Counts assets before the job that pushes them is submitted, so that
+	// `next` cannot return false while some are on their way.
+	void expect(size_t count);
+	void push(LoadedAsset&& asset);
+
+private:
+	struct Finished {
+		LoadedAsset asset;
+		Clock::time_point time;
+	};
+
+	std::mutex m_mutex;
+	std::condition_variable m_ready;
+	std::deque<Finished> m_finished;
+	size_t m_pending = 0; // expected but not pushed yet
+	uint32_t m_materialRequests = 0;
+	Clock::time_point m_lastFinishTime;
+	// Last, so that its destructor finishes the jobs while the queue exists
+	ThreadPool m_pool;
+};
@@ -0,0 +1,1009 @@
+#include "BlockCompression.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+constexpr int kBlockPixels = 16;
+
+// Block rows per range of work, blocks of a row are cheap to encode alone
+constexpr size_t kMinBlockRowsPerRange = 4;
+
+struct Block {
+	uint8_t pixels[kBlockPixels][4]; // RGBA, row by row
+};
+
+Block loadBlock(const Image& image, uint32_t blockX, uint32_t blockY) {
+	Block block;
+	for (uint32_t y = 0; y < 4; ++y) {
+		const uint32_t sourceY = std::min(4 * blockY + y, image.height - 1);
+		for (uint32_t x = 0; x < 4; ++x) {
+			const uint32_t sourceX = std::min(4 * blockX + x, image.width - 1);
+			std::memcpy(block.pixels[4 * y + x], &image.pixels[4 * (size_t(sourceY) * image.width + sourceX)], 4);
+		}
+	}
+	return block;
+}
+
+void storeBlock(const Block& block, uint32_t blockX, uint32_t blockY, Image& image) {
+	for (uint32_t y = 0; y < 4 && 4 * blockY + y < image.height; ++y) {
+		for (uint32_t x = 0; x < 4 && 4 * blockX + x < image.width; ++x) {
+			std::memcpy(&image.pixels[4 * (size_t(4 * blockY + y) * image.width + 4 * blockX + x)], block.pixels[4 * y + x], 4);
+		}
+	}
+}
+
+int squaredError(const uint8_t* a, const uint8_t* b, int channels) {
+	int error = 0;
+	for (int c = 0; c < channels; ++c) {
+		const int d = int(a[c]) - int(b[c]);
+		error += d * d;
+	}
+	return error;
+}
+
+// ----------------------------------------------------------------------------
+// Endpoint fitting, shared by all formats
+
+/**
+ * Sets `mean` and the unit principal axis of `count` points (a null axis if
+ * they are all equal).
+ */
+void principalAxis(const uint8_t (*points)[4], int count, int channels, float mean[4], float axis[4]) {
+	for (int c = 0; c < 4; ++c) mean[c] = axis[c] = 0.0f;
+	if (count == 0) return;
+	for (int i = 0; i < count; ++i) {
+		for (int c = 0; c < channels; ++c) mean[c] += points[i][c];
+	}
+	for (int c = 0; c < channels; ++c) mean[c] /= float(count);
+
+	float covariance[4][4] = {};
+	for (int i = 0; i < count; ++i) {
+		float d[4];
+		for (int c = 0; c < channels; ++c) d[c] = points[i][c] - mean[c];
+		for (int a = 0; a < channels; ++a) {
+			for (int b = a; b < channels; ++b) covariance[a][b] += d[a] * d[b];
+		}
+	}
+	float trace = 0.0f;
+	int largest = 0;
+	for (int a = 0; a < channels; ++a) {
+		for (int b = 0; b < a; ++b) covariance[a][b] = covariance[b][a];
+		trace += covariance[a][a];
+		if (covariance[a][a] > covariance[largest][largest]) largest = a;
+	}
+	if (trace <= 0.0f) return;
+
+	// Power iteration, from the row of the channel that varies the most
+	float v[4] = {};
+	for (int c = 0; c < channels; ++c) v[c] = covariance[largest][c];
+	for (int iteration = 0; iteration < 4; ++iteration) {
+		float next[4] = {};
+		float scale = 0.0f;
+		for (int a = 0; a < channels; ++a) {
+			for (int b = 0; b < channels; ++b) next[a] += covariance[a][b] * v[b];
+			scale = std::max(scale, std::abs(next[a]));
+		}
+		if (scale == 0.0f) break;
+		for (int c = 0; c < channels; ++c) v[c] = next[c] / scale;
+	}
+	float length = 0.0f;
+	for (int c = 0; c < channels; ++c) length += v[c] * v[c];
+	length = std::sqrt(length);
+	if (length == 0.0f) return;
+	for (int c = 0; c < channels; ++c) axis[c] = v[c] / length;
+}
+
+/**
+ * Endpoints at the extremes of the projections of the points on their
+ * principal axis.
+ */
+void fitEndpoints(const uint8_t (*points)[4], int count, int channels, float e0[4], float e1[4]) {
+	float mean[4], axis[4];
+	principalAxis(points, count, channels, mean, axis);
+	float lo = 0.0f, hi = 0.0f;
+	for (int i = 0; i < count; ++i) {
+		float t = 0.0f;
+		for (int c = 0; c < channels; ++c) t += (points[i][c] - mean[c]) * axis[c];
+		lo = std::min(lo, t);
+		hi = std::max(hi, t);
+	}
+	for (int c = 0; c < 4; ++c) {
+		e0[c] = std::clamp(mean[c] + lo * axis[c], 0.0f, 255.0f);
+		e1[c] = std::clamp(mean[c] + hi * axis[c], 0.0f, 255.0f);
+	}
+}
+
+/**
+ * Least squares endpoints for the given interpolation weights (0 at e0, 1
+ * at e1) of the points. Returns false if the weights are all equal.
+ */
+bool refineEndpoints(const uint8_t (*points)[4], int count, int channels, const float* weights, float e0[4], float e1[4]) {
+	float a = 0.0f, b = 0.0f, c = 0.0f;
+	float x0[4] = {}, x1[4] = {};
+	for (int i = 0; i < count; ++i) {
+		const float t = weights[i], s = 1.0f - t;
+		a += s * s;
+		b += s * t;
+		c += t * t;
+		for (int k = 0; k < channels; ++k) {
+			x0[k] += s * points[i][k];
+			x1[k] += t * points[i][k];
+		}
+	}
+	const float determinant = a * c - b * b;
+	if (std::abs(determinant) < 1e-6f) return false;
+	for (int k = 0; k < channels; ++k) {
+		e0[k] = std::clamp((c * x0[k] - b * x1[k]) / determinant, 0.0f, 255.0f);
+		e1[k] = std::clamp((a * x1[k] - b * x0[k]) / determinant, 0.0f, 255.0f);
+	}
+	return true;
+}
+
+int refineIterations(CompressionPreset preset) {
+	switch (preset) {
+	case CompressionPreset::Fast: return 0;
+	case CompressionPreset::Normal: return 1;
+	default: return 3;
+	}
+}
+
+// ----------------------------------------------------------------------------
+// BC1 color blocks
+
+uint16_t packRgb565(const float color[3]) {
+	const int r = static_cast<int>(std::lround(color[0] * 31.0f / 255.0f));
+	const int g = static_cast<int>(std::lround(color[1] * 63.0f / 255.0f));
+	const int b = static_cast<int>(std::lround(color[2] * 31.0f / 255.0f));
+	return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+void unpackRgb565(uint16_t packed, uint8_t color[4]) {
+	const int r = packed >> 11, g = (packed >> 5) & 63, b = packed & 31;
+	color[0] = static_cast<uint8_t>((r << 3) | (r >> 2));
+	color[1] = static_cast<uint8_t>((g << 2) | (g >> 4));
+	color[2] = static_cast<uint8_t>((b << 3) | (b >> 2));
+	color[3] = 255;
+}
+
+/**
+ * Four colors when c0 > c1 (always in BC3), otherwise three colors and
+ * transparent black.
+ */
+void colorPalette(uint16_t c0, uint16_t c1, bool forceFourColors, uint8_t palette[4][4]) {
+	unpackRgb565(c0, palette[0]);
+	unpackRgb565(c1, palette[1]);
+	if (c0 > c1 || forceFourColors) {
+		for (int c = 0; c < 3; ++c) {
+			palette[2][c] = static_cast<uint8_t>((2 * palette[0][c] + palette[1][c] + 1) / 3);
+			palette[3][c] = static_cast<uint8_t>((palette[0][c] + 2 * palette[1][c] + 1) / 3);
+		}
+		palette[2][3] = palette[3][3] = 255;
+	} else {
+		for (int c = 0; c < 3; ++c) {
+			palette[2][c] = static_cast<uint8_t>((palette[0][c] + palette[1][c] + 1) / 2);
+			palette[3][c] = 0;
+		}
+		palette[2][3] = 255;
+		palette[3][3] = 0;
+	}
+}
+
+struct ColorFit {
+	uint16_t c0, c1;
+	uint32_t indices; // 2 bits per pixel, pixel 0 in the lowest bits
+	int error;
+};
+
+/**
+ * Indices and error of a pair of 565 endpoints. In four color mode the
+ * endpoints are put in the order that selects it.
+ */
+ColorFit evaluateColors(const Block& block, uint16_t c0, uint16_t c1, bool fourColors, bool forceFourColors) {
+	if (fourColors ? c0 < c1 : c0 > c1) std::swap(c0, c1);
+	uint8_t palette[4][4];
+	colorPalette(c0, c1, forceFourColors, palette);
+	// In three color mode the last entry is transparent, never used for
+	// opaque blocks. Equal endpoints select three color mode unless forced.
+	const int entries = (c0 > c1 || forceFourColors) ? 4 : 3;
+	ColorFit fit = { c0, c1, 0, 0 };
+	for (int i = 0; i < kBlockPixels; ++i) {
+		int best = 0, bestError = std::numeric_limits<int>::max();
+		for (int k = 0; k < entries; ++k) {
+			const int error = squaredError(block.pixels[i], palette[k], 3);
+			if (error < bestError) {
+				best = k;
+				bestError = error;
+			}
+		}
+		fit.indices |= uint32_t(best) << (2 * i);
+		fit.error += bestError;
+	}
+	return fit;
+}
+
+/**
+ * @param forceFourColors The block is decoded in four color mode whatever
+ *        the endpoint order, as in BC3.
+ */
+ColorFit encodeColorBlock(const Block& block, CompressionPreset preset, bool forceFourColors) {
+	float e0[4], e1[4];
+	fitEndpoints(block.pixels, kBlockPixels, 3, e0, e1);
+	ColorFit best = evaluateColors(block, packRgb565(e1), packRgb565(e0), true, forceFourColors);
+
+	// Interpolation weight of each index, in four and three color modes
+	static const float kWeights4[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+	static const float kWeights3[4] = { 0.0f, 1.0f, 0.5f, 0.0f };
+	const int iterations = refineIterations(preset);
+	for (int iteration = 0; iteration < iterations; ++iteration) {
+		float weights[kBlockPixels];
+		for (int i = 0; i < kBlockPixels; ++i) weights[i] = kWeights4[(best.indices >> (2 * i)) & 3];
+		if (!refineEndpoints(block.pixels, kBlockPixels, 3, weights, e0, e1)) break;
+		const ColorFit fit = evaluateColors(block, packRgb565(e0), packRgb565(e1), true, forceFourColors);
+		if (fit.error >= best.error) break;
+		best = fit;
+	}
+
+	if (preset == CompressionPreset::High && !forceFourColors && best.error > 0) {
+		// Three color mode has a midpoint, which is sometimes closer
+		fitEndpoints(block.pixels, kBlockPixels, 3, e0, e1);
+		ColorFit three = evaluateColors(block, packRgb565(e0), packRgb565(e1), false, false);
+		for (int iteration = 0; iteration < iterations; ++iteration) {
+			float weights[kBlockPixels];
+			for (int i = 0; i < kBlockPixels; ++i) weights[i] = kWeights3[(three.indices >> (2 * i)) & 3];
+			if (!refineEndpoints(block.pixels, kBlockPixels, 3, weights, e0, e1)) break;
+			const ColorFit fit = evaluateColors(block, packRgb565(e0), packRgb565(e1), false, false);
+			if (fit.error >= three.error) break;
+			three = fit;
+		}
+		if (three.error < best.error) best = three;
+	}
+	return best;
+}
+
+void writeColorBlock(const ColorFit& fit, uint8_t* out) {
+	out[0] = static_cast<uint8_t>(fit.c0);
+	out[1] = static_cast<uint8_t>(fit.c0 >> 8);
+	out[2] = static_cast<uint8_t>(fit.c1);
+	out[3] = static_cast<uint8_t>(fit.c1 >> 8);
+	for (int k = 0; k < 4; ++k) out[4 + k] = static_cast<uint8_t>(fit.indices >> (8 * k));
+}
+
+void decodeColorBlock(const uint8_t* in, bool forceFourColors, Block& block) {
+	const uint16_t c0 = static_cast<uint16_t>(in[0] | (in[1] << 8));
+	const uint16_t c1 = static_cast<uint16_t>(in[2] | (in[3] << 8));
+	const uint32_t indices = uint32_t(in[4]) | (uint32_t(in[5]) << 8) | (uint32_t(in[6]) << 16) | (uint32_t(in[7]) << 24);
+	uint8_t palette[4][4];
+	colorPalette(c0, c1, forceFourColors, palette);
+	for (int i = 0; i < kBlockPixels; ++i) {
+		std::memcpy(block.pixels[i], palette[(indices >> (2 * i)) & 3], 4);
+	}
+}
+
+// ----------------------------------------------------------------------------
+// BC3 alpha blocks (the BC4 format)
+
+/**
+ * Eight values when a0 > a1, otherwise six values, 0 and 255.
+ */
+void alphaPalette(int a0, int a1, uint8_t palette[8]) {
+	palette[0] = static_cast<uint8_t>(a0);
+	palette[1] = static_cast<uint8_t>(a1);
+	if (a0 > a1) {
+		for (int k = 2; k < 8; ++k) palette[k] = static_cast<uint8_t>(((8 - k) * a0 + (k - 1) * a1 + 3) / 7);
+	} else {
+		for (int k = 2; k < 6; ++k) palette[k] = static_cast<uint8_t>(((6 - k) * a0 + (k - 1) * a1 + 2) / 5);
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+struct AlphaFit {
+	int a0, a1;
+	uint64_t indices; // 3 bits per pixel
+	int error;
+};
+
+AlphaFit evaluateAlpha(const Block& block, int a0, int a1) {
+	uint8_t palette[8];
+	alphaPalette(a0, a1, palette);
+	AlphaFit fit = { a0, a1, 0, 0 };
+	for (int i = 0; i < kBlockPixels; ++i) {
+		int best = 0, bestError = std::numeric_limits<int>::max();
+		for (int k = 0; k < 8; ++k) {
+			const int d = int(block.pixels[i][3]) - palette[k];
+			if (d * d < bestError) {
+				best = k;
+				bestError = d * d;
+			}
+		}
+		fit.indices |= uint64_t(best) << (3 * i);
+		fit.error += bestError;
+	}
+	return fit;
+}
+
+AlphaFit encodeAlphaBlock(const Block& block, CompressionPreset preset) {
+	int lo = 255, hi = 0; // all values
+	int innerLo = 255, innerHi = 0; // values other than 0 and 255
+	for (int i = 0; i < kBlockPixels; ++i) {
+		const int a = block.pixels[i][3];
+		lo = std::min(lo, a);
+		hi = std::max(hi, a);
+		if (a != 0 && a != 255) {
+			innerLo = std::min(innerLo, a);
+			innerHi = std::max(innerHi, a);
+		}
+	}
+	if (lo == hi) {
+		return evaluateAlpha(block, lo, hi);
+	}
+
+	auto consider = [&](AlphaFit& best, int a0, int a1) {
+		const AlphaFit fit = evaluateAlpha(block, a0, a1);
+		if (fit.error < best.error) best = fit;
+	};
+	AlphaFit best = evaluateAlpha(block, hi, lo);
+	if (preset != CompressionPreset::Fast && innerLo <= innerHi) {
+		// Six value mode, where 0 and 255 are exact
+		consider(best, innerLo, innerHi);
+	}
+	if (preset == CompressionPreset::High) {
+		// Pulling the endpoints in trades the extremes for the middle
+		for (int d0 = -3; d0 <= 0; ++d0) {
+			for (int d1 = 0; d1 <= 3; ++d1) {
+				if (hi + d0 > lo + d1) consider(best, hi + d0, lo + d1);
+			}
+		}
+	}
+	return best;
+}
+
+void writeAlphaBlock(const AlphaFit& fit, uint8_t* out) {
+	out[0] = static_cast<uint8_t>(fit.a0);
+	out[1] = static_cast<uint8_t>(fit.a1);
+	for (int k = 0; k < 6; ++k) out[2 + k] = static_cast<uint8_t>(fit.indices >> (8 * k));
+}
+
+void decodeAlphaBlock(const uint8_t* in, Block& block) {
+	uint8_t palette[8];
+	alphaPalette(in[0], in[1], palette);
+	uint64_t indices = 0;
+	for (int k = 0; k < 6; ++k) indices |= uint64_t(in[2 + k]) << (8 * k);
+	for (int i = 0; i < kBlockPixels; ++i) {
+		block.pixels[i][3] = palette[(indices >> (3 * i)) & 7];
+	}
+}
+
+// ----------------------------------------------------------------------------
+// BC7
+
+struct Bc7ModeInfo {
+	int subsetCount;
+	int partitionBits;
+	int rotationBits;
+	int indexSelectionBits;
+	int colorBits;
+	int alphaBits;
+	int endpointPBits; // one per endpoint
+	int sharedPBits; // one per subset
+	int indexBits;
+	int secondaryIndexBits;
+};
+
+const Bc7ModeInfo kBc7Modes[8] = {
+	{ 3, 4, 0, 0, 4, 0, 1, 0, 3, 0 },
+	{ 2, 6, 0, 0, 6, 0, 0, 1, 3, 0 },
+	{ 3, 6, 0, 0, 5, 0, 0, 0, 2, 0 },
+	{ 2, 6, 0, 0, 7, 0, 1, 0, 2, 0 },
+	{ 1, 0, 2, 1, 5, 6, 0, 0, 2, 3 },
+	{ 1, 0, 2, 0, 7, 8, 0, 0, 2, 2 },
+	{ 1, 0, 0, 0, 7, 7, 1, 0, 4, 0 },
+	{ 2, 6, 0, 0, 5, 5, 1, 0, 2, 0 },
+};
+
+// Two subset partitions: bit i set if pixel i is in the second subset
+const uint16_t kBc7Partitions2[64] = {
+	0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80,
+	0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+	0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE,
+	0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+	0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696, 0xA55A,
+	0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660,
+	0x0272, 0x04E4, 0x4E40, 0x2720, 0xC936, 0x936C, 0x39C6, 0x639C,
+	0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22,
+};
+
+// Anchor pixel of the second subset of each two subset partition
+const uint8_t kBc7Anchors2[64] = {
+	15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+	15, 2, 8, 2, 2, 8, 8, 15, 2, 8, 2, 2, 8, 8, 2, 2,
+	15, 15, 6, 8, 2, 8, 15, 15, 2, 8, 2, 2, 2, 15, 15, 6,
+	6, 2, 6, 8, 15, 15, 2, 2, 15, 15, 15, 15, 15, 2, 2, 15,
+};
+
+const uint8_t kBc7Weights2[4] = { 0, 21, 43, 64 };
+const uint8_t kBc7Weights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+const uint8_t kBc7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+const uint8_t* bc7Weights(int indexBits) {
+	return indexBits == 2 ? kBc7Weights2 : indexBits == 3 ? kBc7Weights3 : kBc7Weights4;
+}
+
+uint8_t bc7Interpolate(int e0, int e1, int weight) {
+	return static_cast<uint8_t>(((64 - weight) * e0 + weight * e1 + 32) >> 6);
+}
+
+// Endpoint of `bits` bits, plus a p-bit if any, expanded to 8 bits
+int bc7Expand(int value, int bits, int pBit, bool hasPBit) {
+	if (hasPBit) {
+		value = (value << 1) | pBit;
+		++bits;
+	}
+	return (value << (8 - bits)) | (value >> (2 * bits - 8));
+}
+
+// 128 bit block, written and read from the least significant bit
+class BitStream {
+public:
+	explicit BitStream(uint8_t* data) : m_data(data) {}
+
+	void write(uint32_t value, int bits) {
+		for (int i = 0; i < bits; ++i, ++m_position) {
+			m_data[m_position >> 3] |= static_cast<uint8_t>(((value >> i) & 1) << (m_position & 7));
+		}
+	}
+
+	uint32_t read(int bits) {
+		uint32_t value = 0;
+		for (int i = 0; i < bits; ++i, ++m_position) {
+			value |= uint32_t((m_data[m_position >> 3] >> (m_position & 7)) & 1) << i;
+		}
+		return value;
+	}
+
+private:
+	uint8_t* m_data;
+	int m_position = 0;
+};
+
+/**
+ * Encoding of one subset in mode 1 (6 bit RGB, shared p-bit, 3 bit indices,
+ * opaque) or mode 6 (7 bit RGBA, one p-bit per endpoint, 4 bit indices).
+ */
+struct Bc7SubsetFit {
+	uint8_t endpoints[2][4]; // without p-bits
+	uint8_t pBits[2];
+	uint8_t indices[kBlockPixels]; // of the subset's pixels, in order
+	int error;
+};
+
+struct Bc7SubsetSearch {
+	int mode; // 1 or 6
+	int iterations; // least squares refinements
+	bool searchPBits; // try every p-bit combination
+};
+
+/**
+ * Quantizes float endpoints with the given p-bits, then picks the closest
+ * palette entry for each pixel.
+ */
+Bc7SubsetFit evaluateBc7Subset(const uint8_t (*pixels)[4], int count, const Bc7ModeInfo& mode,
+	const float e0[4], const float e1[4], int p0, int p1) {
+	const bool hasPBit = mode.endpointPBits > 0 || mode.sharedPBits > 0;
+	const int channels = mode.alphaBits > 0 ? 4 : 3;
+	const int maxValue = (1 << mode.colorBits) - 1;
+	Bc7SubsetFit fit;
+	fit.pBits[0] = static_cast<uint8_t>(p0);
+	fit.pBits[1] = static_cast<uint8_t>(p1);
+	uint8_t expanded[2][4];
+	const float* targets[2] = { e0, e1 };
+	for (int e = 0; e < 2; ++e) {
+		for (int c = 0; c < 4; ++c) {
+			if (c >= channels) {
+				fit.endpoints[e][c] = 0;
+				expanded[e][c] = 255;
+				continue;
+			}
+			// Nearest of the values around the rounded one
+			const float target = targets[e][c];
+			const int precision = mode.colorBits + (hasPBit ? 1 : 0);
+			int guess = static_cast<int>(std::lround(target * ((1 << precision) - 1) / 255.0f));
+			if (hasPBit) guess >>= 1;
+			int best = 0;
+			float bestError = std::numeric_limits<float>::max();
+			for (int q = std::max(0, guess - 1); q <= std::min(maxValue, guess + 1); ++q) {
+				const float error = std::abs(bc7Expand(q, mode.colorBits, fit.pBits[e], hasPBit) - target);
+				if (error < bestError) {
+					best = q;
+					bestError = error;
+				}
+			}
+			fit.endpoints[e][c] = static_cast<uint8_t>(best);
+			expanded[e][c] = static_cast<uint8_t>(bc7Expand(best, mode.colorBits, fit.pBits[e], hasPBit));
+		}
+	}
+
+	const int entries = 1 << mode.indexBits;
+	const uint8_t* weights = bc7Weights(mode.indexBits);
+	uint8_t palette[16][4];
+	for (int k = 0; k < entries; ++k) {
+		for (int c = 0; c < 4; ++c) palette[k][c] = bc7Interpolate(expanded[0][c], expanded[1][c], weights[k]);
+	}
+	// Project each pixel on the segment between the endpoints, then only
+	// compare it to the palette entries around the projection
+	float axis[4], axisLength = 0.0f;
+	for (int c = 0; c < 4; ++c) {
+		axis[c] = float(expanded[1][c]) - float(expanded[0][c]);
+		axisLength += axis[c] * axis[c];
+	}
+	const float scale = axisLength > 0.0f ? 64.0f / axisLength : 0.0f;
+	fit.error = 0;
+	for (int i = 0; i < count; ++i) {
+		float t = 0.0f;
+		for (int c = 0; c < 4; ++c) t += (float(pixels[i][c]) - expanded[0][c]) * axis[c];
+		const float weight = t * scale;
+		int guess = 0;
+		while (guess + 1 < entries && weights[guess + 1] <= weight) ++guess;
+		int best = guess, bestError = std::numeric_limits<int>::max();
+		for (int k = std::max(0, guess - 1); k <= std::min(entries - 1, guess + 2); ++k) {
+			const int error = squaredError(pixels[i], palette[k], 4);
+			if (error < bestError) {
+				best = k;
+				bestError = error;
+			}
+		}
+		fit.indices[i] = static_cast<uint8_t>(best);
+		fit.error += bestError;
+	}
+	return fit;
+}
+
+Bc7SubsetFit encodeBc7Subset(const uint8_t (*pixels)[4], int count, int anchor, const Bc7SubsetSearch& search) {
+	const Bc7ModeInfo& mode = kBc7Modes[search.mode];
+	const int channels = mode.alphaBits > 0 ? 4 : 3;
+	const bool shared = mode.sharedPBits > 0;
+	float e0[4], e1[4];
+	fitEndpoints(pixels, count, channels, e0, e1);
+
+	auto bestForEndpoints = [&](const float* a, const float* b) {
+		if (search.searchPBits) {
+			Bc7SubsetFit best = evaluateBc7Subset(pixels, count, mode, a, b, 0, 0);
+			for (int p = 1; p < (shared ? 2 : 4); ++p) {
+				const int p0 = p & 1, p1 = shared ? p0 : p >> 1;
+				const Bc7SubsetFit fit = evaluateBc7Subset(pixels, count, mode, a, b, p0, p1);
+				if (fit.error < best.error) best = fit;
+			}
+			return best;
+		}
+		// The p-bit that best matches the average of each endpoint
+		auto parity = [&](const float* e) {
+			float sum = 0.0f;
+			for (int c = 0; c < channels; ++c) sum += e[c];
+			return static_cast<int>(std::lround(sum / channels)) & 1;
+		};
+		const int p0 = parity(a), p1 = shared ? p0 : parity(b);
+		return evaluateBc7Subset(pixels, count, mode, a, b, p0, p1);
+	};
+
+	Bc7SubsetFit best = bestForEndpoints(e0, e1);
+	const uint8_t* weights = bc7Weights(mode.indexBits);
+	for (int iteration = 0; iteration < search.iterations && best.error > 0; ++iteration) {
+		float t[kBlockPixels];
+		for (int i = 0; i < count; ++i) t[i] = weights[best.indices[i]] / 64.0f;
+		if (!refineEndpoints(pixels, count, channels, t, e0, e1)) break;
+		const Bc7SubsetFit fit = bestForEndpoints(e0, e1);
+		if (fit.error >= best.error) break;
+		best = fit;
+	}
+
+	// The most significant bit of the anchor index is implicitly 0, swap the
+	// endpoints otherwise (weights are symmetric, so the palette is the same)
+	const int highestIndex = (1 << mode.indexBits) - 1;
+	if (best.indices[anchor] > highestIndex / 2) {
+		for (int c = 0; c < 4; ++c) std::swap(best.endpoints[0][c], best.endpoints[1][c]);
+		std::swap(best.pBits[0], best.pBits[1]);
+		for (int i = 0; i < count; ++i) best.indices[i] = static_cast<uint8_t>(highestIndex - best.indices[i]);
+	}
+	return best;
+}
+
+// Sums of R, G, B and of their pairwise products, from which the residual
+// of a line fit is computed without going through the pixels again
+constexpr int kMomentCount = 9;
+
+void pixelMoments(const uint8_t* pixel, float moments[kMomentCount]) {
+	const float r = pixel[0], g = pixel[1], b = pixel[2];
+	moments[0] = r;
+	moments[1] = g;
+	moments[2] = b;
+	moments[3] = r * r;
+	moments[4] = r * g;
+	moments[5] = r * b;
+	moments[6] = g * g;
+	moments[7] = g * b;
+	moments[8] = b * b;
+}
+
+/**
+ * Sum of the squared distances of `count` pixels to their principal axis,
+ * that is the trace of their covariance minus its largest eigenvalue.
+ */
+float lineResidual(const float moments[kMomentCount], int count) {
+	if (count < 2) return 0.0f;
+	const float n = float(count);
+	const float m[3] = { moments[0] / n, moments[1] / n, moments[2] / n };
+	const float c00 = moments[3] - m[0] * moments[0], c01 = moments[4] - m[0] * moments[1];
+	const float c02 = moments[5] - m[0] * moments[2], c11 = moments[6] - m[1] * moments[1];
+	const float c12 = moments[7] - m[1] * moments[2], c22 = moments[8] - m[2] * moments[2];
+	const float trace = c00 + c11 + c22;
+	if (trace <= 0.0f) return 0.0f;
+	float v[3] = { 1.0f, 1.0f, 1.0f };
+	if (c00 >= c11 && c00 >= c22) { v[0] = c00; v[1] = c01; v[2] = c02; }
+	else if (c11 >= c22) { v[0] = c01; v[1] = c11; v[2] = c12; }
+	else { v[0] = c02; v[1] = c12; v[2] = c22; }
+	for (int iteration = 0; iteration < 4; ++iteration) {
+		const float x = c00 * v[0] + c01 * v[1] + c02 * v[2];
+		const float y = c01 * v[0] + c11 * v[1] + c12 * v[2];
+		const float z = c02 * v[0] + c12 * v[1] + c22 * v[2];
+		const float scale = std::max(std::abs(x), std::max(std::abs(y), std::abs(z)));
+		if (scale == 0.0f) return trace;
+		v[0] = x / scale;
+		v[1] = y / scale;
+		v[2] = z / scale;
+	}
+	const float lengthSquared = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+	const float variance = (c00 * v[0] * v[0] + c11 * v[1] * v[1] + c22 * v[2] * v[2]
+		+ 2.0f * (c01 * v[0] * v[1] + c02 * v[0] * v[2] + c12 * v[1] * v[2])) / lengthSquared;
+	return std::max(0.0f, trace - variance);
+}
+
+void writeBc7Mode6(const Bc7SubsetFit& fit, uint8_t* out) {
+	std::memset(out, 0, 16);
+	BitStream bits(out);
+	bits.write(1 << 6, 7);
+	for (int c = 0; c < 4; ++c) {
+		bits.write(fit.endpoints[0][c], 7);
+		bits.write(fit.endpoints[1][c], 7);
+	}
+	bits.write(fit.pBits[0], 1);
+	bits.write(fit.pBits[1], 1);
+	for (int i = 0; i < kBlockPixels; ++i) {
+		bits.write(fit.indices[i], i == 0 ? 3 : 4);
+	}
+}
+
+void writeBc7Mode1(int partition, const Bc7SubsetFit fits[2], const uint8_t subsetOf[kBlockPixels], uint8_t* out) {
+	std::memset(out, 0, 16);
+	BitStream bits(out);
+	bits.write(1 << 1, 2);
+	bits.write(partition, 6);
+	for (int c = 0; c < 3; ++c) {
+		for (int s = 0; s < 2; ++s) {
+			bits.write(fits[s].endpoints[0][c], 6);
+			bits.write(fits[s].endpoints[1][c], 6);
+		}
+	}
+	bits.write(fits[0].pBits[0], 1);
+	bits.write(fits[1].pBits[0], 1);
+	int next[2] = { 0, 0 };
+	for (int i = 0; i < kBlockPixels; ++i) {
+		const int s = subsetOf[i];
+		const bool anchor = i == 0 || i == kBc7Anchors2[partition];
+		bits.write(fits[s].indices[next[s]++], anchor ? 2 : 3);
+	}
+}
+
+void encodeBc7Block(const Block& block, CompressionPreset preset, uint8_t* out) {
+	const int iterations = refineIterations(preset) == 0 ? 1 : refineIterations(preset);
+	const bool searchPBits = preset != CompressionPreset::Fast;
+	const Bc7SubsetFit single = encodeBc7Subset(block.pixels, kBlockPixels, 0, { 6, iterations, searchPBits });
+	if (preset == CompressionPreset::Fast || single.error == 0) {
+		writeBc7Mode6(single, out);
+		return;
+	}
+	bool opaque = true;
+	for (int i = 0; i < kBlockPixels; ++i) opaque = opaque && block.pixels[i][3] == 255;
+	if (!opaque) {
+		writeBc7Mode6(single, out);
+		return;
+	}
+
+	// Mode 1: rank the partitions by how well each subset fits a line, then
+	// encode the most promising ones
+	float moments[kBlockPixels][kMomentCount];
+	float total[kMomentCount] = {};
+	for (int i = 0; i < kBlockPixels; ++i) {
+		pixelMoments(block.pixels[i], moments[i]);
+		for (int k = 0; k < kMomentCount; ++k) total[k] += moments[i][k];
+	}
+	float estimates[64];
+	int order[64];
+	for (int p = 0; p < 64; ++p) {
+		float second[kMomentCount] = {}, first[kMomentCount];
+		int secondCount = 0;
+		for (int i = 0; i < kBlockPixels; ++i) {
+			if ((kBc7Partitions2[p] >> i) & 1) {
+				for (int k = 0; k < kMomentCount; ++k) second[k] += moments[i][k];
+				++secondCount;
+			}
+		}
+		for (int k = 0; k < kMomentCount; ++k) first[k] = total[k] - second[k];
+		estimates[p] = lineResidual(first, kBlockPixels - secondCount) + lineResidual(second, secondCount);
+		order[p] = p;
+	}
+	const int candidates = preset == CompressionPreset::High ? 16 : 4;
+	std::partial_sort(order, order + candidates, order + 64, [&](int a, int b) {
+		return estimates[a] < estimates[b] || (estimates[a] == estimates[b] && a < b);
+	});
+
+	int bestPartition = -1;
+	Bc7SubsetFit bestFits[2];
+	uint8_t bestSubsetOf[kBlockPixels];
+	int bestError = single.error;
+	for (int k = 0; k < candidates; ++k) {
+		const int p = order[k];
+		uint8_t subsets[2][kBlockPixels][4];
+		uint8_t subsetOf[kBlockPixels];
+		int counts[2] = { 0, 0 };
+		int anchors[2] = { 0, 0 };
+		for (int i = 0; i < kBlockPixels; ++i) {
+			const int s = (kBc7Partitions2[p] >> i) & 1;
+			if (i == kBc7Anchors2[p]) anchors[1] = counts[1];
+			subsetOf[i] = static_cast<uint8_t>(s);
+			std::memcpy(subsets[s][counts[s]++], block.pixels[i], 4);
+		}
+		Bc7SubsetFit fits[2];
+		int error = 0;
+		for (int s = 0; s < 2 && error < bestError; ++s) {
+			fits[s] = encodeBc7Subset(subsets[s], counts[s], anchors[s], { 1, iterations, searchPBits });
+			error += fits[s].error;
+		}
+		if (error < bestError) {
+			bestError = error;
+			bestPartition = p;
+			bestFits[0] = fits[0];
+			bestFits[1] = fits[1];
+			std::memcpy(bestSubsetOf, subsetOf, sizeof(subsetOf));
+		}
+	}
+	if (bestPartition < 0) {
+		writeBc7Mode6(single, out);
+	} else {
+		writeBc7Mode1(bestPartition, bestFits, bestSubsetOf, out);
+	}
+}
+
+void decodeBc7Block(const uint8_t* in, Block& block) {
+	uint8_t data[16];
+	std::memcpy(data, in, 16);
+	BitStream bits(data);
+	int modeIndex = 0;
+	while (modeIndex < 8 && bits.read(1) == 0) ++modeIndex;
+	if (modeIndex == 8 || kBc7Modes[modeIndex].subsetCount == 3) {
+		// Reserved mode, or a three subset mode which is not supported here
+		for (int i = 0; i < kBlockPixels; ++i) {
+			block.pixels[i][0] = 255;
+			block.pixels[i][1] = 0;
+			block.pixels[i][2] = 255;
+			block.pixels[i][3] = 255;
+		}
+		return;
+	}
+	const Bc7ModeInfo& mode = kBc7Modes[modeIndex];
+	const int partition = static_cast<int>(bits.read(mode.partitionBits));
+	const int rotation = static_cast<int>(bits.read(mode.rotationBits));
+	const int indexSelection = static_cast<int>(bits.read(mode.indexSelectionBits));
+
+	int endpoints[2][2][4]; // subset, endpoint, channel
+	for (int c = 0; c < 3; ++c) {
+		for (int s = 0; s < mode.subsetCount; ++s) {
+			for (int e = 0; e < 2; ++e) endpoints[s][e][c] = static_cast<int>(bits.read(mode.colorBits));
+		}
+	}
+	for (int s = 0; s < mode.subsetCount; ++s) {
+		for (int e = 0; e < 2; ++e) endpoints[s][e][3] = static_cast<int>(bits.read(mode.alphaBits));
+	}
+	int pBits[2][2] = {};
+	const bool hasPBit = mode.endpointPBits > 0 || mode.sharedPBits > 0;
+	for (int s = 0; s < mode.subsetCount; ++s) {
+		if (mode.endpointPBits) {
+			pBits[s][0] = static_cast<int>(bits.read(1));
+			pBits[s][1] = static_cast<int>(bits.read(1));
+		} else if (mode.sharedPBits) {
+			pBits[s][0] = pBits[s][1] = static_cast<int>(bits.read(1));
+		}
+	}
+	for (int s = 0; s < mode.subsetCount; ++s) {
+		for (int e = 0; e < 2; ++e) {
+			for (int c = 0; c < 3; ++c) {
+				endpoints[s][e][c] = bc7Expand(endpoints[s][e][c], mode.colorBits, pBits[s][e], hasPBit);
+			}
+			endpoints[s][e][3] = mode.alphaBits == 0 ? 255
+				: bc7Expand(endpoints[s][e][3], mode.alphaBits, pBits[s][e], hasPBit);
+		}
+	}
+
+	const uint16_t subsets = mode.subsetCount == 2 ? kBc7Partitions2[partition] : 0;
+	auto isAnchor = [&](int i) { return i == 0 || (mode.subsetCount == 2 && i == kBc7Anchors2[partition]); };
+	int indices[kBlockPixels];
+	int secondary[kBlockPixels] = {};
+	for (int i = 0; i < kBlockPixels; ++i) {
+		indices[i] = static_cast<int>(bits.read(mode.indexBits - (isAnchor(i) ? 1 : 0)));
+	}
+	if (mode.secondaryIndexBits) {
+		for (int i = 0; i < kBlockPixels; ++i) {
+			secondary[i] = static_cast<int>(bits.read(mode.secondaryIndexBits - (i == 0 ? 1 : 0)));
+		}
+	}
+
+	for (int i = 0; i < kBlockPixels; ++i) {
+		const int s = (subsets >> i) & 1;
+		int colorIndex = indices[i], colorBits = mode.indexBits;
+		int alphaIndex = indices[i], alphaBits = mode.indexBits;
+		if (mode.secondaryIndexBits) {
+			alphaIndex = secondary[i];
+			alphaBits = mode.secondaryIndexBits;
+			if (indexSelection) {
+				std::swap(colorIndex, alphaIndex);
+				std::swap(colorBits, alphaBits);
+			}
+		}
+		uint8_t* pixel = block.pixels[i];
+		for (int c = 0; c < 3; ++c) {
+			pixel[c] = bc7Interpolate(endpoints[s][0][c], endpoints[s][1][c], bc7Weights(colorBits)[colorIndex]);
+		}
+		pixel[3] = bc7Interpolate(endpoints[s][0][3], endpoints[s][1][3], bc7Weights(alphaBits)[alphaIndex]);
+		if (rotation > 0) std::swap(pixel[3], pixel[rotation - 1]);
+	}
+}
+
+void encodeBlock(const Block& block, BlockFormat format, CompressionPreset preset, uint8_t* out) {
+	switch (format) {
+	case BlockFormat::BC1:
+		writeColorBlock(encodeColorBlock(block, preset, false), out);
+		break;
+	case BlockFormat::BC3:
+		writeAlphaBlock(encodeAlphaBlock(block, preset), out);
+		writeColorBlock(encodeColorBlock(block, preset, true), out + 8);
+		break;
+	case BlockFormat::BC7:
+		encodeBc7Block(block, preset, out);
+		break;
+	case BlockFormat::RGBA8:
+		break;
+	}
+}
+
+void decodeBlock(const uint8_t* in, BlockFormat format, Block& block) {
+	switch (format) {
+	case BlockFormat::BC1:
+		decodeColorBlock(in, false, block);
+		break;
+	case BlockFormat::BC3:
+		decodeColorBlock(in + 8, true, block);
+		decodeAlphaBlock(in, block);
+		break;
+	case BlockFormat::BC7:
+		decodeBc7Block(in, block);
+		break;
+	case BlockFormat::RGBA8:
+		break;
+	}
+}
+
+} // namespace
+
+const char* blockFormatName(BlockFormat format) {
+	switch (format) {
+	case BlockFormat::BC1: return "BC1";
+	case BlockFormat::BC3: return "BC3";
+	case BlockFormat::BC7: return "BC7";
+	default: return "RGBA8";
+	}
+}
+
+size_t blockFormatSize(BlockFormat format) {
+	switch (format) {
+	case BlockFormat::BC1: return 8;
+	case BlockFormat::BC3: return 16;
+	case BlockFormat::BC7: return 16;
+	default: return 4;
+	}
+}
+
+uint32_t EncodedTexture::bytesPerRow(size_t level) const {
+	const uint32_t width = levelWidth(level);
+	if (format == BlockFormat::RGBA8) return 4 * width;
+	return static_cast<uint32_t>((width + 3) / 4 * blockFormatSize(format));
+}
+
+uint32_t EncodedTexture::rowCount(size_t level) const {
+	const uint32_t height = levelHeight(level);
+	return format == BlockFormat::RGBA8 ? height : (height + 3) / 4;
+}
+
+BlockFormat chooseBlockFormat(const Image& image, CompressionPreset preset) {
+	if (image.width % 4 != 0 || image.height % 4 != 0) {
+		return BlockFormat::RGBA8;
+	}
+	if (preset != CompressionPreset::Fast) {
+		return BlockFormat::BC7;
+	}
+	for (size_t i = 3; i < image.pixels.size(); i += 4) {
+		if (image.pixels[i] != 255) return BlockFormat::BC3;
+	}
+	return BlockFormat::BC1;
+}
+
+std::vector<uint8_t> compressImage(const Image& image, BlockFormat format, CompressionPreset preset, unsigned threadCount) {
+	const uint32_t blocksX = (image.width + 3) / 4;
+	const uint32_t blocksY = (image.height + 3) / 4;
+	const size_t blockSize = blockFormatSize(format);
+	std::vector<uint8_t> blocks(size_t(blocksX) * blocksY * blockSize);
+	if (format == BlockFormat::RGBA8 || blocks.empty()) {
+		return blocks;
+	}
+	parallelForRanges(blocksY, kMinBlockRowsPerRange, [&](size_t, size_t begin, size_t end) {
+		for (size_t y = begin; y < end; ++y) {
+			for (uint32_t x = 0; x < blocksX; ++x) {
+				const Block block = loadBlock(image, x, static_cast<uint32_t>(y));
+				encodeBlock(block, format, preset, &blocks[(y * blocksX + x) * blockSize]);
+			}
+		}
+	}, threadCount);
+	return blocks;
+}
+
+Image decompressImage(const uint8_t* blocks, uint32_t width, uint32_t height, BlockFormat format) {
+	Image image;
+	image.width = width;
+	image.height = height;
+	image.pixels.resize(size_t(4) * width * height);
+	const uint32_t blocksX = (width + 3) / 4;
+	const uint32_t blocksY = (height + 3) / 4;
+	const size_t blockSize = blockFormatSize(format);
+	for (uint32_t y = 0; y < blocksY; ++y) {
+		for (uint32_t x = 0; x < blocksX; ++x) {
+			Block block;
+			decodeBlock(blocks + (size_t(y) * blocksX + x) * blockSize, format, block);
+			storeBlock(block, x, y, image);
+		}
+	}
+	return image;
+}
+
+EncodedTexture encodeTexture(std::vector<Image>&& levels, BlockFormat format, CompressionPreset preset, unsigned threadCount) {
+	EncodedTexture texture;
+	texture.format = format;
+	if (levels.empty()) {
+		return texture;
+	}
+	texture.width = levels[0].width;
+	texture.height = levels[0].height;
+	for (Image& level : levels) {
+		if (format == BlockFormat::RGBA8) {
+			texture.levels.push_back(std::move(level.pixels));
+		} else {
+			texture.levels.push_back(compressImage(level, format, preset, threadCount));
+		}
+	}
+	levels.clear();
+	return texture;
+}
+
+double computePsnr(const Image& reference, const Image& image) {
+	const size_t size = std::min(reference.pixels.size(), image.pixels.size());
+	if (size == 0) return 0.0;
+	double sum = 0.0;
+	for (size_t i = 0; i < size; ++i) {
+		const double d = double(reference.pixels[i]) - double(image.pixels[i]);
+		sum += d * d;
+	}
+	if (sum == 0.0) return std::numeric_limits<double>::infinity();
+	return 10.0 * std::log10(255.0 * 255.0 * double(size) / sum);
+}
@@ -0,0 +1,93 @@
+/**
+ * CPU encoder and decoder for the BC texture formats that WebGPU exposes
+ * with the "texture-compression-bc" feature:
+ *  - BC1: opaque RGB, 8 bytes per 4x4 block (4 bits per pixel);
+ *  - BC3: BC1 color plus a separate alpha block, 16 bytes per block;
+ *  - BC7: RGBA, 16 bytes per block, with much better quality than BC1/BC3.
+ *    Only modes 1 (two subsets, opaque) and 6 (one subset, RGBA) are
+ *    encoded; every mode but the three subset ones (0 and 2) is decoded.
+ *
+ * Blocks are stored row by row, and images that are not a multiple of 4
+ * pixels are padded by repeating their last row and column. Input and
+ * decoded images are RGBA8 (see ImageDecoders.h). Nothing in here depends
+ * on WebGPU.
+ */
+
+#pragma once
+
+#include "ImageDecoders.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum class BlockFormat : uint32_t {
+	RGBA8, // uncompressed
+	BC1,
+	BC3,
+	BC7,
+};
+
+/**
+ * Encoder effort. Fast picks BC1/BC3 and fits each block once, Normal and
+ * High pick BC7 and search more endpoints, p-bits and partitions.
+ */
+enum class CompressionPreset : uint32_t {
+	Fast,
+	Normal,
+	High,
+};
+
+const char* blockFormatName(BlockFormat format);
+
+/**
+ * Bytes per 4x4 block, or per pixel for RGBA8.
+ */
+size_t blockFormatSize(BlockFormat format);
+
+/**
+ * Mip chain of a texture in its GPU format, level 0 first.
+ */
+struct EncodedTexture {
+	BlockFormat format = BlockFormat::RGBA8;
+	uint32_t width = 0; // of level 0, in pixels
+	uint32_t height = 0;
+	std::vector<std::vector<uint8_t>> levels;
+
+	uint32_t levelWidth(size_t level) const { return width >> level > 0 ? width >> level : 1; }
+	uint32_t levelHeight(size_t level) const { return height >> level > 0 ? height >> level : 1; }
+	// Layout of a level for queue.writeTexture: bytes per row of pixels (or
+	// of blocks) and number of such rows
+	uint32_t bytesPerRow(size_t level) const;
+	uint32_t rowCount(size_t level) const;
+};
+
+/**
+ * Format a texture is compressed to with `preset`. Level 0 of BC textures
+ * must be a multiple of 4 pixels in WebGPU, other images stay RGBA8.
+ */
+BlockFormat chooseBlockFormat(const Image& image, CompressionPreset preset);
+
+/**
+ * Compresses `image` to `format` (not RGBA8), on worker threads. The
+ * result does not depend on the number of threads.
+ * @param threadCount Number of worker threads, 0 to use all cores.
+ */
+std::vector<uint8_t> compressImage(const Image& image, BlockFormat format, CompressionPreset preset, unsigned threadCount = 0);
+
+/**
+ * Decodes `width` x `height` pixels of blocks in `format` (not RGBA8).
+ * Blocks of BC7 modes 0 and 2 decode as opaque magenta.
+ */
+Image decompressImage(const uint8_t* blocks, uint32_t width, uint32_t height, BlockFormat format);
+
+/**
+ * Compresses every level of a mip chain (or moves it as is for RGBA8).
+ */
+EncodedTexture encodeTexture(std::vector<Image>&& levels, BlockFormat format, CompressionPreset preset, unsigned threadCount = 0);
+
+/**
+ * Peak signal to noise ratio of `image` against `reference`, in dB, over
+ * the RGBA channels. Infinite when they are identical.
+ */
+double computePsnr(const Image& reference, const Image& image);
@@ -0,0 +1,86 @@
+#include "FileWatcher.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+namespace fs = std::filesystem;
+
+#ifdef __linux__
+
+FileWatcher::FileWatcher() {
+	m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+}
+
+FileWatcher::~FileWatcher() {
+	if (m_fd >= 0) {
+		::close(m_fd);
+	}
+}
+
+bool FileWatcher::watch(const fs::path& path) {
+	if (m_fd < 0) {
+		return false;
+	}
+	std::error_code error;
+	const fs::path absolute = fs::absolute(path, error).lexically_normal();
+	if (error) {
+		return false;
+	}
+	const fs::path directory = absolute.parent_path();
+	auto watched = std::find_if(m_directories.begin(), m_directories.end(), [&](const auto& entry) { return entry.second == directory; });
+	if (watched == m_directories.end()) {
+		// Written in place, or replaced by a rename
+		const int descriptor = inotify_add_watch(m_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (descriptor < 0) {
+			return false;
+		}
+		m_directories[descriptor] = directory;
+	}
+	m_files[absolute] = path;
+	return true;
+}
+
+std::vector<fs::path> FileWatcher::changes() {
+	std::vector<fs::path> changed;
+	if (m_fd < 0) {
+		return changed;
+	}
+	alignas(inotify_event) char buffer[4096];
+	for (;;) {
+		const ssize_t size = ::read(m_fd, buffer, sizeof(buffer));
+		if (size <= 0) {
+			break; // EAGAIN once the queue is empty
+		}
+		for (ssize_t offset = 0; offset < size;) {
+			const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+			offset += sizeof(inotify_event) + event->len;
+			auto directory = m_directories.find(event->wd);
+			if (directory == m_directories.end() || event->len == 0) continue;
+			auto file = m_files.find(directory->second / event->name);
+			if (file != m_files.end() && std::find(changed.begin(), changed.end(), file->second) == changed.end()) {
+				changed.push_back(file->second);
+			}
+		}
+	}
+	return changed;
+}
+
+#else
+
+FileWatcher::FileWatcher() = default;
+
+FileWatcher::~FileWatcher() = default;
+
+bool FileWatcher::watch(const fs::path&) {
+	return false;
+}
+
+std::vector<fs::path> FileWatcher::changes() {
+	return {};
+}
+
+#endif
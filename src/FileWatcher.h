@@ -0,0 +1,42 @@
+/**
+ * Reports changes to a set of files, for hot reloading resources while the
+ * app runs.
+ *
+ * On Linux this uses inotify. The parent directory of each file is watched
+ * rather than the file itself, because most editors save by writing a new
+ * file and renaming it over the old one, which a watch on the old inode
+ * would miss. Elsewhere, `watch` fails and nothing is ever reported.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <vector>
+
+class FileWatcher {
+public:
+	FileWatcher();
+	~FileWatcher();
+	FileWatcher(const FileWatcher&) = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+
+	/**
+	 * Starts watching `path`. Returns false if it cannot be watched.
+	 */
+	bool watch(const std::filesystem::path& path);
+
+	/**
+	 * Watched files written or replaced since the last call, as given to
+	 * `watch`, each listed once however many times it was saved. Does not
+	 * block.
+	 */
+	std::vector<std::filesystem::path> changes();
+
+private:
+	int m_fd = -1;
+	// Watch descriptor of each watched directory
+	std::map<int, std::filesystem::path> m_directories;
+	// Path given to `watch` of each absolute, normalized path
+	std::map<std::filesystem::path, std::filesystem::path> m_files;
+};
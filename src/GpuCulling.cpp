@@ -0,0 +1,381 @@
+#include "GpuCulling.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <string>
+
+using namespace wgpu;
+
+namespace {
+
+/**
+ * The same structure as in the shader, replicated in C++
+ */
+struct CullUniforms {
+	glm::vec4 planes[6];
+	glm::vec4 eye;
+	uint32_t instanceCount;
+	uint32_t drawCount;
+	uint32_t _pad[2];
+};
+
+static_assert(sizeof(CullUniforms) % 16 == 0);
+static_assert(sizeof(GpuCulling::DrawIndexedArgs) == 5 * sizeof(uint32_t));
+
+// The visible instances of each bucket, then how many of them are copied,
+// zeroed before every cull. The bucket of each instance follows.
+constexpr uint64_t kBucketCountersSize = 2 * GpuCulling::kDistanceBuckets * sizeof(uint32_t);
+
+// Preceded by the declarations of kInstanceVec4Count, the size of an
+// instance in vec4s, and kDistanceBuckets
+const char* kCullShader = R"(
+struct CullUniforms {
+	planes: array<vec4f, 6>,
+	eye: vec4f,
+	instanceCount: u32,
+	drawCount: u32,
+};
+
+struct Instance {
+	data: array<vec4f, kInstanceVec4Count>,
+};
+
+struct DrawIndexedArgs {
+	indexCount: u32,
+	instanceCount: u32,
+	firstIndex: u32,
+	baseVertex: i32,
+	firstInstance: u32,
+};
+
+struct Buckets {
+	counts: array<atomic<u32>, kDistanceBuckets>,
+	copied: array<atomic<u32>, kDistanceBuckets>,
+	ofInstance: array<u32>, // kCulled for culled instances
+};
+
+const kCulled = 0xffffffffu;
+
+@group(0) @binding(0) var<uniform> uCull: CullUniforms;
+@group(0) @binding(1) var<storage, read> spheres: array<vec4f>;
+@group(0) @binding(2) var<storage, read> instances: array<Instance>;
+@group(0) @binding(3) var<storage, read_write> visibleInstances: array<Instance>;
+@group(0) @binding(4) var<storage, read_write> draws: array<DrawIndexedArgs>;
+@group(0) @binding(5) var<storage, read_write> buckets: Buckets;
+
+// Same as GpuCulling::distanceBucket
+fn distanceBucket(sphere: vec4f) -> u32 {
+	let gap = length(sphere.xyz - uCull.eye.xyz) - sphere.w;
+	if (gap <= sphere.w) {
+		return 0u;
+	}
+	return u32(min(floor(log2(gap / sphere.w)) + 1.0, f32(kDistanceBuckets - 1u)));
+}
+
+// Index of the first visible instance of a bucket, once they are counted
+fn firstInstance(bucket: u32) -> u32 {
+	var first = 0u;
+	for (var b = 0u; b < bucket; b++) {
+		first += atomicLoad(&buckets.counts[b]);
+	}
+	return first;
+}
+
+// Same test as isSphereVisible in Meshlets.cpp. The bucket is stored for
+// the copy, so that both passes agree on it.
+@compute @workgroup_size(64)
+fn cull(@builtin(global_invocation_id) id: vec3u) {
+	let i = id.x;
+	if (i >= uCull.instanceCount) {
+		return;
+	}
+	let sphere = spheres[i];
+	for (var p = 0u; p < 6u; p++) {
+		let plane = uCull.planes[p];
+		if (dot(plane.xyz, sphere.xyz) + plane.w < -sphere.w) {
+			buckets.ofInstance[i] = kCulled;
+			return;
+		}
+	}
+	let bucket = distanceBucket(sphere);
+	buckets.ofInstance[i] = bucket;
+	atomicAdd(&buckets.counts[bucket], 1u);
+}
+
+// Once every instance is counted, the visible ones are copied after those
+// of the previous buckets
+@compute @workgroup_size(64)
+fn compact(@builtin(global_invocation_id) id: vec3u) {
+	let i = id.x;
+	if (i >= uCull.instanceCount) {
+		return;
+	}
+	let bucket = buckets.ofInstance[i];
+	if (bucket == kCulled) {
+		return;
+	}
+	let slot = firstInstance(bucket) + atomicAdd(&buckets.copied[bucket], 1u);
+	visibleInstances[slot] = instances[i];
+}
+
+// Each draw gets the instances of the bucket in its firstInstance
+@compute @workgroup_size(64)
+fn writeDrawArgs(@builtin(global_invocation_id) id: vec3u) {
+	let i = id.x;
+	if (i >= uCull.drawCount) {
+		return;
+	}
+	let bucket = min(draws[i].firstInstance, kDistanceBuckets - 1u);
+	draws[i].instanceCount = atomicLoad(&buckets.counts[bucket]);
+	draws[i].firstInstance = firstInstance(bucket);
+}
+)";
+
+uint32_t workgroupCount(uint32_t invocations) {
+	return (invocations + GpuCulling::kWorkgroupSize - 1) / GpuCulling::kWorkgroupSize;
+}
+
+void releaseBuffer(Buffer& buffer) {
+	if (!buffer) return;
+	buffer.destroy();
+	buffer.release();
+	buffer = nullptr;
+}
+
+} // namespace
+
+uint32_t GpuCulling::distanceBucket(const glm::vec4& sphere, const glm::vec3& eye) {
+	const float gap = glm::length(glm::vec3(sphere) - eye) - sphere.w;
+	if (gap <= sphere.w) return 0;
+	return static_cast<uint32_t>(std::min(std::floor(std::log2(gap / sphere.w)) + 1.0f, float(kDistanceBuckets - 1)));
+}
+
+float GpuCulling::bucketDistance(uint32_t bucket) {
+	return bucket == 0 ? 0.0f : std::exp2(float(bucket - 1));
+}
+
+bool GpuCulling::init(Device device, uint32_t instanceSize, uint32_t maxInstances) {
+	release();
+	if (instanceSize == 0 || instanceSize % 16 != 0 || maxInstances == 0 || maxInstances > kMaxInstances) {
+		return false;
+	}
+	// The instance buffers are bound whole as storage, so they must fit in
+	// maxStorageBufferBindingSize (by default 128 MiB, about 1.6M instances
+	// of 80 bytes, well below kMaxInstances)
+	SupportedLimits supportedLimits;
+	if (!device.getLimits(&supportedLimits)) {
+		return false;
+	}
+	const uint64_t instanceBufferSize = uint64_t(maxInstances) * instanceSize;
+	if (instanceBufferSize > supportedLimits.limits.maxStorageBufferBindingSize || instanceBufferSize > supportedLimits.limits.maxBufferSize) {
+		return false;
+	}
+	m_device = device;
+	m_instanceSize = instanceSize;
+	m_maxInstances = maxInstances;
+
+	const std::string source =
+		"const kInstanceVec4Count = " + std::to_string(instanceSize / 16) + "u;\n"
+		"const kDistanceBuckets = " + std::to_string(kDistanceBuckets) + "u;\n"
+		+ kCullShader;
+	ShaderModuleWGSLDescriptor shaderCodeDesc;
+	shaderCodeDesc.chain.next = nullptr;
+	shaderCodeDesc.chain.sType = SType::ShaderModuleWGSLDescriptor;
+	shaderCodeDesc.code = source.c_str();
+	ShaderModuleDescriptor shaderDesc;
+	shaderDesc.nextInChain = &shaderCodeDesc.chain;
+#ifdef WEBGPU_BACKEND_WGPU
+	shaderDesc.hintCount = 0;
+	shaderDesc.hints = nullptr;
+#endif
+	ShaderModule shaderModule = device.createShaderModule(shaderDesc);
+
+	std::vector<BindGroupLayoutEntry> entries(6, Default);
+	for (uint32_t binding = 0; binding < entries.size(); ++binding) {
+		entries[binding].binding = binding;
+		entries[binding].visibility = ShaderStage::Compute;
+	}
+	entries[0].buffer.type = BufferBindingType::Uniform;
+	entries[0].buffer.minBindingSize = sizeof(CullUniforms);
+	entries[1].buffer.type = BufferBindingType::ReadOnlyStorage;
+	entries[2].buffer.type = BufferBindingType::ReadOnlyStorage;
+	entries[3].buffer.type = BufferBindingType::Storage;
+	entries[4].buffer.type = BufferBindingType::Storage;
+	entries[5].buffer.type = BufferBindingType::Storage;
+	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = (uint32_t)entries.size();
+	bindGroupLayoutDesc.entries = entries.data();
+	m_bindGroupLayout = device.createBindGroupLayout(bindGroupLayoutDesc);
+
+	PipelineLayoutDescriptor layoutDesc{};
+	layoutDesc.bindGroupLayoutCount = 1;
+	layoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&m_bindGroupLayout;
+	PipelineLayout layout = device.createPipelineLayout(layoutDesc);
+
+	ComputePipelineDescriptor pipelineDesc;
+	pipelineDesc.label = "Cull instances";
+	pipelineDesc.layout = layout;
+	pipelineDesc.compute.module = shaderModule;
+	pipelineDesc.compute.entryPoint = "cull";
+	pipelineDesc.compute.constantCount = 0;
+	pipelineDesc.compute.constants = nullptr;
+	m_cullPipeline = device.createComputePipeline(pipelineDesc);
+	pipelineDesc.label = "Compact instances";
+	pipelineDesc.compute.entryPoint = "compact";
+	m_compactPipeline = device.createComputePipeline(pipelineDesc);
+	pipelineDesc.label = "Write draw arguments";
+	pipelineDesc.compute.entryPoint = "writeDrawArgs";
+	m_drawArgsPipeline = device.createComputePipeline(pipelineDesc);
+	layout.release();
+	shaderModule.release();
+	if (!m_cullPipeline || !m_compactPipeline || !m_drawArgsPipeline) {
+		release();
+		return false;
+	}
+
+	BufferDescriptor bufferDesc;
+	bufferDesc.mappedAtCreation = false;
+	bufferDesc.label = "Cull uniforms";
+	bufferDesc.size = sizeof(CullUniforms);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	m_uniforms = device.createBuffer(bufferDesc);
+	bufferDesc.label = "Instance bounding spheres";
+	bufferDesc.size = uint64_t(maxInstances) * sizeof(glm::vec4);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Storage;
+	m_spheres = device.createBuffer(bufferDesc);
+	bufferDesc.label = "Instances to cull";
+	bufferDesc.size = uint64_t(maxInstances) * instanceSize;
+	m_instances = device.createBuffer(bufferDesc);
+	bufferDesc.label = "Visible instances";
+	bufferDesc.usage = BufferUsage::CopySrc | BufferUsage::Storage | BufferUsage::Vertex;
+	m_visibleInstances = device.createBuffer(bufferDesc);
+	bufferDesc.label = "Distance buckets";
+	bufferDesc.size = kBucketCountersSize + uint64_t(maxInstances) * sizeof(uint32_t);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Storage;
+	m_buckets = device.createBuffer(bufferDesc);
+
+	createDrawArgs(16);
+	return true;
+}
+
+void GpuCulling::createDrawArgs(uint32_t maxDraws) {
+	// Work already submitted keeps using the previous buffers until it is
+	// done, destroying them only takes effect then
+	releaseBuffer(m_drawArgs);
+	if (m_bindGroup) {
+		m_bindGroup.release();
+		m_bindGroup = nullptr;
+	}
+	m_maxDraws = maxDraws;
+
+	BufferDescriptor bufferDesc;
+	bufferDesc.label = "Indirect draws";
+	bufferDesc.size = uint64_t(maxDraws) * sizeof(DrawIndexedArgs);
+	bufferDesc.usage = BufferUsage::CopySrc | BufferUsage::CopyDst | BufferUsage::Storage | BufferUsage::Indirect;
+	bufferDesc.mappedAtCreation = false;
+	m_drawArgs = m_device.createBuffer(bufferDesc);
+
+	std::vector<BindGroupEntry> bindings(6);
+	const Buffer buffers[] = { m_uniforms, m_spheres, m_instances, m_visibleInstances, m_drawArgs, m_buckets };
+	const uint64_t sizes[] = {
+		sizeof(CullUniforms),
+		uint64_t(m_maxInstances) * sizeof(glm::vec4),
+		uint64_t(m_maxInstances) * m_instanceSize,
+		uint64_t(m_maxInstances) * m_instanceSize,
+		bufferDesc.size,
+		kBucketCountersSize + uint64_t(m_maxInstances) * sizeof(uint32_t),
+	};
+	for (uint32_t binding = 0; binding < bindings.size(); ++binding) {
+		bindings[binding].binding = binding;
+		bindings[binding].buffer = buffers[binding];
+		bindings[binding].offset = 0;
+		bindings[binding].size = sizes[binding];
+	}
+	BindGroupDescriptor bindGroupDesc;
+	bindGroupDesc.layout = m_bindGroupLayout;
+	bindGroupDesc.entryCount = (uint32_t)bindings.size();
+	bindGroupDesc.entries = bindings.data();
+	m_bindGroup = m_device.createBindGroup(bindGroupDesc);
+}
+
+void GpuCulling::release() {
+	if (m_bindGroup) {
+		m_bindGroup.release();
+		m_bindGroup = nullptr;
+	}
+	releaseBuffer(m_uniforms);
+	releaseBuffer(m_spheres);
+	releaseBuffer(m_instances);
+	releaseBuffer(m_visibleInstances);
+	releaseBuffer(m_drawArgs);
+	releaseBuffer(m_buckets);
+	if (m_cullPipeline) {
+		m_cullPipeline.release();
+		m_cullPipeline = nullptr;
+	}
+	if (m_compactPipeline) {
+		m_compactPipeline.release();
+		m_compactPipeline = nullptr;
+	}
+	if (m_drawArgsPipeline) {
+		m_drawArgsPipeline.release();
+		m_drawArgsPipeline = nullptr;
+	}
+	if (m_bindGroupLayout) {
+		m_bindGroupLayout.release();
+		m_bindGroupLayout = nullptr;
+	}
+	m_maxInstances = 0;
+	m_maxDraws = 0;
+	m_instanceCount = 0;
+}
+
+void GpuCulling::setInstances(Queue queue, const void* instances, const glm::vec4* spheres, uint32_t count) {
+	assert(count <= m_maxInstances);
+	m_instanceCount = std::min(count, m_maxInstances);
+	if (m_instanceCount == 0) return;
+	queue.writeBuffer(m_instances, 0, instances, uint64_t(m_instanceCount) * m_instanceSize);
+	queue.writeBuffer(m_spheres, 0, spheres, uint64_t(m_instanceCount) * sizeof(glm::vec4));
+}
+
+void GpuCulling::cull(Queue queue, CommandEncoder encoder, const Frustum& frustum, const glm::vec3& eye, const std::vector<DrawIndexedArgs>& draws) {
+	if (!enabled() || draws.empty()) return;
+	if (draws.size() > m_maxDraws) {
+		createDrawArgs(std::max<uint32_t>(static_cast<uint32_t>(draws.size()), 2 * m_maxDraws));
+	}
+
+	// The bucket counters are zeroed before the compute pass accumulates
+	// into them, and the draws keep their bucket until it replaces it
+	CullUniforms uniforms;
+	std::copy(std::begin(frustum.planes), std::end(frustum.planes), uniforms.planes);
+	uniforms.eye = glm::vec4(eye, 1.0f);
+	uniforms.instanceCount = m_instanceCount;
+	uniforms.drawCount = static_cast<uint32_t>(draws.size());
+	uniforms._pad[0] = uniforms._pad[1] = 0;
+	queue.writeBuffer(m_uniforms, 0, &uniforms, sizeof(CullUniforms));
+	const uint32_t zeros[2 * kDistanceBuckets] = {};
+	queue.writeBuffer(m_buckets, 0, zeros, kBucketCountersSize);
+	std::vector<DrawIndexedArgs> args = draws;
+	for (DrawIndexedArgs& draw : args) {
+		draw.instanceCount = 0;
+	}
+	queue.writeBuffer(m_drawArgs, 0, args.data(), args.size() * sizeof(DrawIndexedArgs));
+
+	ComputePassDescriptor computePassDesc;
+	computePassDesc.label = "Cull instances";
+	computePassDesc.timestampWriteCount = 0;
+	computePassDesc.timestampWrites = nullptr;
+	ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+	computePass.setBindGroup(0, m_bindGroup, 0, nullptr);
+	if (m_instanceCount > 0) {
+		computePass.setPipeline(m_cullPipeline);
+		computePass.dispatchWorkgroups(workgroupCount(m_instanceCount), 1, 1);
+		computePass.setPipeline(m_compactPipeline);
+		computePass.dispatchWorkgroups(workgroupCount(m_instanceCount), 1, 1);
+	}
+	computePass.setPipeline(m_drawArgsPipeline);
+	computePass.dispatchWorkgroups(workgroupCount(static_cast<uint32_t>(draws.size())), 1, 1);
+	computePass.end();
+	computePass.release();
+}
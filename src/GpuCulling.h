@@ -0,0 +1,127 @@
+/**
+ * Frustum culling of instances on the GPU, feeding indirect draws.
+ *
+ * A compute pass tests the bounding sphere of every instance against the
+ * frustum planes, and sorts the visible ones by their distance to the
+ * camera into a few buckets, counted with atomics. A second dispatch copies
+ * them into a compact buffer, bucket after bucket, that the render pass
+ * binds as its per-instance vertex buffer, and a third one gives every
+ * indirect draw the count and first instance of its bucket: the CPU never
+ * reads them back, it only issues one drawIndexedIndirect per index range
+ * and bucket, and selects the level of detail of each bucket.
+ *
+ * Instances are opaque blocks of a multiple of 16 bytes (e.g. a model
+ * matrix and a color), copied as they are. Within a bucket, visible
+ * instances are in no particular order.
+ */
+
+#pragma once
+
+#include "Meshlets.h"
+
+#include <webgpu/webgpu.hpp>
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+class GpuCulling {
+public:
+	/**
+	 * Arguments of drawIndexedIndirect, in the layout the GPU reads.
+	 */
+	struct DrawIndexedArgs {
+		uint32_t indexCount;
+		uint32_t instanceCount;
+		uint32_t firstIndex;
+		int32_t baseVertex;
+		uint32_t firstInstance;
+	};
+
+	/**
+	 * Workgroups are 1D, which limits the number of instances to
+	 * 64 * 65535.
+	 */
+	static constexpr uint32_t kWorkgroupSize = 64;
+	static constexpr uint32_t kMaxInstances = kWorkgroupSize * 65535;
+
+	/**
+	 * An instance whose bounding sphere is at a gap g from the camera is in
+	 * bucket 0 when g <= radius, otherwise in bucket 1 + floor(log2(g /
+	 * radius)), up to kDistanceBuckets - 1. The shader computes the same.
+	 */
+	static constexpr uint32_t kDistanceBuckets = 8;
+	static uint32_t distanceBucket(const glm::vec4& sphere, const glm::vec3& eye);
+
+	/**
+	 * Smallest gap between the camera and the bounding sphere of an instance
+	 * of `bucket`, in radii of that sphere.
+	 */
+	static float bucketDistance(uint32_t bucket);
+
+	/**
+	 * @param device Must allow 5 storage buffers per stage and workgroups of
+	 * kWorkgroupSize invocations.
+	 * @param instanceSize Bytes per instance, a multiple of 16.
+	 * @param maxInstances At most kMaxInstances.
+	 * Returns false if the device cannot cull that many instances, e.g.
+	 * when their buffer exceeds maxStorageBufferBindingSize.
+	 */
+	bool init(wgpu::Device device, uint32_t instanceSize, uint32_t maxInstances);
+	void release();
+
+	bool enabled() const { return m_cullPipeline != nullptr; }
+
+	/**
+	 * Uploads `count` instances of `instanceSize` bytes and their bounding
+	 * spheres, as (center, radius) in world space.
+	 */
+	void setInstances(wgpu::Queue queue, const void* instances, const glm::vec4* spheres, uint32_t count);
+
+	/**
+	 * Encodes the culling of the instances against `frustum` (in world
+	 * space, see extractFrustum), and the arguments of `draws`. The
+	 * firstInstance of each draw is the distance bucket that it draws, seen
+	 * from `eye`: the GPU replaces it with the first visible instance of
+	 * that bucket, and instanceCount with their number. The uniforms and
+	 * arguments are written on the queue, so cull at most once per submitted
+	 * command buffer.
+	 */
+	void cull(wgpu::Queue queue, wgpu::CommandEncoder encoder, const Frustum& frustum, const glm::vec3& eye, const std::vector<DrawIndexedArgs>& draws);
+
+	/**
+	 * The visible instances after `cull`, to bind as the per-instance vertex
+	 * buffer (or to copy out, as storage).
+	 */
+	wgpu::Buffer visibleInstances() const { return m_visibleInstances; }
+	uint64_t visibleInstancesSize() const { return uint64_t(m_maxInstances) * m_instanceSize; }
+
+	/**
+	 * The arguments of draw `draw` of the last `cull` are at
+	 * drawArgsOffset(draw) in drawArgs().
+	 */
+	wgpu::Buffer drawArgs() const { return m_drawArgs; }
+	static uint64_t drawArgsOffset(size_t draw) { return draw * sizeof(DrawIndexedArgs); }
+
+private:
+	void createDrawArgs(uint32_t maxDraws);
+
+private:
+	wgpu::Device m_device = nullptr;
+	wgpu::BindGroupLayout m_bindGroupLayout = nullptr;
+	wgpu::ComputePipeline m_cullPipeline = nullptr;
+	wgpu::ComputePipeline m_compactPipeline = nullptr;
+	wgpu::ComputePipeline m_drawArgsPipeline = nullptr;
+	wgpu::Buffer m_uniforms = nullptr;
+	wgpu::Buffer m_spheres = nullptr;
+	wgpu::Buffer m_instances = nullptr;
+	wgpu::Buffer m_visibleInstances = nullptr;
+	wgpu::Buffer m_buckets = nullptr;
+	wgpu::Buffer m_drawArgs = nullptr;
+	wgpu::BindGroup m_bindGroup = nullptr;
+	uint32_t m_instanceSize = 0;
+	uint32_t m_maxInstances = 0;
+	uint32_t m_maxDraws = 0;
+	uint32_t m_instanceCount = 0;
+};
@@ -0,0 +1,149 @@
+#include "GpuTimer.h"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace wgpu;
+
+bool GpuTimer::init(Device device, std::vector<std::string> passNames, uint32_t ringSize) {
+	release();
+	if (passNames.empty() || ringSize == 0) {
+		return false;
+	}
+	m_device = device;
+	const uint32_t queryCount = 2 * static_cast<uint32_t>(passNames.size());
+
+	QuerySetDescriptor querySetDesc;
+	querySetDesc.label = "Pass timestamps";
+	querySetDesc.type = QueryType::Timestamp;
+	querySetDesc.count = queryCount;
+	m_querySet = device.createQuerySet(querySetDesc);
+	if (!m_querySet) {
+		return false;
+	}
+
+	m_bufferSize = queryCount * sizeof(uint64_t);
+	BufferDescriptor bufferDesc;
+	bufferDesc.label = "Timestamp resolve buffer";
+	bufferDesc.size = m_bufferSize;
+	bufferDesc.usage = BufferUsage::QueryResolve | BufferUsage::CopySrc;
+	bufferDesc.mappedAtCreation = false;
+	m_resolveBuffer = device.createBuffer(bufferDesc);
+
+	bufferDesc.label = "Timestamp readback buffer";
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::MapRead;
+	m_ring.resize(ringSize);
+	for (Readback& readback : m_ring) {
+		readback.buffer = device.createBuffer(bufferDesc);
+	}
+
+	m_passes.resize(passNames.size());
+	for (uint32_t pass = 0; pass < m_passes.size(); ++pass) {
+		PassTiming& timing = m_passes[pass];
+		timing.name = std::move(passNames[pass]);
+		timing.writes[0].querySet = m_querySet;
+		timing.writes[0].queryIndex = 2 * pass;
+		timing.writes[0].location = RenderPassTimestampLocation::Beginning;
+		timing.writes[1].querySet = m_querySet;
+		timing.writes[1].queryIndex = 2 * pass + 1;
+		timing.writes[1].location = RenderPassTimestampLocation::End;
+	}
+	return true;
+}
+
+void GpuTimer::release() {
+	// Destroying a buffer that is being mapped cancels the mapping, but its
+	// callback, which points into the ring, is still called
+	for (Readback& readback : m_ring) {
+		readback.buffer.destroy();
+	}
+	while (std::any_of(m_ring.begin(), m_ring.end(), [](const Readback& readback) { return readback.inFlight; })) {
+#ifdef WEBGPU_BACKEND_WGPU
+		wgpuDevicePoll(m_device, true, nullptr);
+#else
+		m_device.tick();
+#endif
+	}
+	for (Readback& readback : m_ring) {
+		readback.buffer.release();
+	}
+	m_ring.clear();
+	if (m_resolveBuffer) {
+		m_resolveBuffer.destroy();
+		m_resolveBuffer.release();
+		m_resolveBuffer = nullptr;
+	}
+	if (m_querySet) {
+		m_querySet.destroy();
+		m_querySet.release();
+		m_querySet = nullptr;
+	}
+	m_passes.clear();
+	m_timingFrame = nullptr;
+}
+
+void GpuTimer::beginFrame() {
+	m_timingFrame = nullptr;
+	m_resolved = false;
+	for (Readback& readback : m_ring) {
+		if (!readback.inFlight) {
+			m_timingFrame = &readback;
+			break;
+		}
+	}
+}
+
+const RenderPassTimestampWrite* GpuTimer::renderPassTimestampWrites(uint32_t pass) const {
+	return m_timingFrame ? m_passes[pass].writes.data() : nullptr;
+}
+
+void GpuTimer::resolve(CommandEncoder encoder) {
+	if (!m_timingFrame) return;
+	encoder.resolveQuerySet(m_querySet, 0, 2 * static_cast<uint32_t>(m_passes.size()), m_resolveBuffer, 0);
+	encoder.copyBufferToBuffer(m_resolveBuffer, 0, m_timingFrame->buffer, 0, m_bufferSize);
+	m_resolved = true;
+}
+
+void GpuTimer::afterSubmit() {
+	if (!m_timingFrame || !m_resolved) return;
+	Readback& readback = *m_timingFrame;
+	readback.inFlight = true;
+	readback.callback = readback.buffer.mapAsync(MapMode::Read, 0, m_bufferSize, [this, &readback](BufferMapAsyncStatus status) {
+		if (status == BufferMapAsyncStatus::Success) {
+			read(readback);
+			readback.buffer.unmap();
+		}
+		readback.inFlight = false;
+	});
+	m_timingFrame = nullptr;
+}
+
+void GpuTimer::read(Readback& readback) {
+	// Timestamps are in nanoseconds. Some GPUs may reorder or reset them
+	// within a pass, which gives no meaningful duration.
+	const uint64_t* timestamps = static_cast<const uint64_t*>(readback.buffer.getConstMappedRange(0, m_bufferSize));
+	for (size_t pass = 0; pass < m_passes.size(); ++pass) {
+		const uint64_t begin = timestamps[2 * pass];
+		const uint64_t end = timestamps[2 * pass + 1];
+		PassTiming& timing = m_passes[pass];
+		timing.last = end > begin ? (end - begin) * 1e-6 : 0.0;
+		timing.sum += timing.last;
+	}
+	++m_framesSinceReport;
+}
+
+std::string GpuTimer::report() {
+	if (m_framesSinceReport == 0) {
+		return {};
+	}
+	std::string text;
+	char line[128];
+	for (PassTiming& timing : m_passes) {
+		std::snprintf(line, sizeof(line), "%s%s %.3f ms", text.empty() ? "" : ", ", timing.name.c_str(), timing.sum / m_framesSinceReport);
+		text += line;
+		timing.sum = 0.0;
+	}
+	std::snprintf(line, sizeof(line), " over %u frames", m_framesSinceReport);
+	m_framesSinceReport = 0;
+	return text + line;
+}
@@ -0,0 +1,103 @@
+/**
+ * GPU durations of render passes, measured with timestamp queries.
+ *
+ * Every timed pass writes a timestamp when it begins and one when it ends.
+ * At the end of the frame, the timestamps are resolved into a buffer and
+ * copied into one of a ring of mappable buffers, which is read back
+ * asynchronously a few frames later: the CPU never waits for the GPU. When
+ * every buffer of the ring is still in flight, the frame is simply not
+ * timed.
+ *
+ * Timestamps require the TimestampQuery feature. Without it, `init` returns
+ * false and the timer does nothing, so callers do not need to check.
+ */
+
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class GpuTimer {
+public:
+	/**
+	 * @param device Must have been created with FeatureName::TimestampQuery.
+	 * @param passNames One per timed pass of a frame, for `report`.
+	 * @param ringSize Number of frames that can be in flight at once.
+	 */
+	bool init(wgpu::Device device, std::vector<std::string> passNames, uint32_t ringSize = 4);
+
+	/**
+	 * Waits for the frames still being read back, then releases the GPU
+	 * objects.
+	 */
+	void release();
+
+	bool enabled() const { return m_querySet != nullptr; }
+
+	/**
+	 * Starts a frame, which is timed if a readback buffer is free.
+	 */
+	void beginFrame();
+
+	/**
+	 * Timestamp writes of pass `pass` (an index into the names given to
+	 * `init`) for the current frame, `timestampWriteCount()` of them.
+	 */
+	const wgpu::RenderPassTimestampWrite* renderPassTimestampWrites(uint32_t pass) const;
+	size_t timestampWriteCount() const { return m_timingFrame ? 2 : 0; }
+
+	/**
+	 * Resolves the timestamps of the frame, after its last timed pass.
+	 */
+	void resolve(wgpu::CommandEncoder encoder);
+
+	/**
+	 * Starts reading back the frame, once its commands are submitted.
+	 */
+	void afterSubmit();
+
+	/**
+	 * GPU duration of pass `pass` in the latest frame read back, in
+	 * milliseconds (0 before the first one).
+	 */
+	double lastMilliseconds(uint32_t pass) const { return m_passes[pass].last; }
+
+	/**
+	 * The average duration of each pass over the frames read back since the
+	 * last report, e.g. "render 1.234 ms over 58 frames", then starts a new
+	 * average. Empty if no frame was read back meanwhile.
+	 */
+	std::string report();
+
+private:
+	struct PassTiming {
+		std::string name;
+		std::array<wgpu::RenderPassTimestampWrite, 2> writes;
+		double last = 0.0;
+		double sum = 0.0;
+	};
+
+	struct Readback {
+		wgpu::Buffer buffer = nullptr;
+		bool inFlight = false;
+		std::unique_ptr<wgpu::BufferMapCallback> callback;
+	};
+
+	void read(Readback& readback);
+
+private:
+	wgpu::Device m_device = nullptr;
+	wgpu::QuerySet m_querySet = nullptr;
+	wgpu::Buffer m_resolveBuffer = nullptr;
+	uint64_t m_bufferSize = 0;
+	std::vector<PassTiming> m_passes;
+	std::vector<Readback> m_ring;
+	Readback* m_timingFrame = nullptr; // where the current frame is read back
+	bool m_resolved = false;
+	uint32_t m_framesSinceReport = 0;
+};
@@ -0,0 +1,160 @@
+/**
+ * Fast non-cryptographic 64 bit hash of a byte range, used to key and
+ * validate on-disk caches. This is XXH64 (https://github.com/Cyan4973/xxHash),
+ * so digests are stable across platforms and runs.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace hash_detail {
+
+constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t kPrime3 = 0x165667B19E3779F9ull;
+constexpr uint64_t kPrime4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t kPrime5 = 0x27D4EB2F165667C5ull;
+
+inline uint64_t rotl(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+// Reads little-endian words whatever the host byte order is
+inline uint64_t read64(const unsigned char* p) {
+	uint64_t v = 0;
+	for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+	return v;
+}
+
+inline uint32_t read32(const unsigned char* p) {
+	return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input) {
+	acc += input * kPrime2;
+	acc = rotl(acc, 31);
+	return acc * kPrime1;
+}
+
+inline uint64_t mergeRound(uint64_t acc, uint64_t val) {
+	acc ^= round(0, val);
+	return acc * kPrime1 + kPrime4;
+}
+
+inline uint64_t finalize(uint64_t h, const unsigned char* p, const unsigned char* end) {
+	while (end - p >= 8) {
+		h ^= round(0, read64(p));
+		h = rotl(h, 27) * kPrime1 + kPrime4;
+		p += 8;
+	}
+	if (end - p >= 4) {
+		h ^= uint64_t(read32(p)) * kPrime1;
+		h = rotl(h, 23) * kPrime2 + kPrime3;
+		p += 4;
+	}
+	while (p < end) {
+		h ^= (*p) * kPrime5;
+		h = rotl(h, 11) * kPrime1;
+		++p;
+	}
+
+	h ^= h >> 33;
+	h *= kPrime2;
+	h ^= h >> 29;
+	h *= kPrime3;
+	h ^= h >> 32;
+	return h;
+}
+
+inline uint64_t mergeLanes(const uint64_t v[4]) {
+	uint64_t h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+	for (int i = 0; i < 4; ++i) {
+		h = mergeRound(h, v[i]);
+	}
+	return h;
+}
+
+} // namespace hash_detail
+
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0) {
+	using namespace hash_detail;
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	const unsigned char* end = p + size;
+	uint64_t h;
+
+	if (size >= 32) {
+		uint64_t v[4] = { seed + kPrime1 + kPrime2, seed + kPrime2, seed, seed - kPrime1 };
+		do {
+			for (int i = 0; i < 4; ++i) {
+				v[i] = round(v[i], read64(p + 8 * i));
+			}
+			p += 32;
+		} while (end - p >= 32);
+		h = mergeLanes(v);
+	} else {
+		h = seed + kPrime5;
+	}
+
+	h += static_cast<uint64_t>(size);
+	return finalize(h, p, end);
+}
+
+/**
+ * Same digest as hashBytes, for bytes that come in pieces (e.g. a file
+ * written section by section): `update` with each piece in order, then
+ * `digest`.
+ */
+class IncrementalHash {
+public:
+	explicit IncrementalHash(uint64_t seed = 0)
+		: m_lanes{ seed + hash_detail::kPrime1 + hash_detail::kPrime2, seed + hash_detail::kPrime2, seed, seed - hash_detail::kPrime1 }
+		, m_seed(seed)
+	{}
+
+	void update(const void* data, size_t size) {
+		using namespace hash_detail;
+		const unsigned char* p = static_cast<const unsigned char*>(data);
+		if (size == 0) return;
+		const unsigned char* end = p + size;
+		m_size += size;
+		if (m_buffered > 0) {
+			const size_t n = std::min(size, sizeof(m_buffer) - m_buffered);
+			std::memcpy(m_buffer + m_buffered, p, n);
+			m_buffered += n;
+			p += n;
+			if (m_buffered < sizeof(m_buffer)) return;
+			consume(m_buffer);
+			m_buffered = 0;
+		}
+		for (; end - p >= 32; p += 32) {
+			consume(p);
+		}
+		std::memcpy(m_buffer, p, static_cast<size_t>(end - p));
+		m_buffered = static_cast<size_t>(end - p);
+	}
+
+	uint64_t digest() const {
+		using namespace hash_detail;
+		uint64_t h = m_size >= 32 ? mergeLanes(m_lanes) : m_seed + kPrime5;
+		h += m_size;
+		return finalize(h, m_buffer, m_buffer + m_buffered);
+	}
+
+private:
+	void consume(const unsigned char* p) {
+		for (int i = 0; i < 4; ++i) {
+			m_lanes[i] = hash_detail::round(m_lanes[i], hash_detail::read64(p + 8 * i));
+		}
+	}
+
+private:
+	uint64_t m_lanes[4];
+	uint64_t m_seed;
+	uint64_t m_size = 0;
+	unsigned char m_buffer[32];
+	size_t m_buffered = 0;
+};
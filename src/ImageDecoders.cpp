@@ -0,0 +1,774 @@
+#include "ImageDecoders.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+// Images larger than this are rejected before allocating their pixels
+constexpr uint64_t kMaxPixelCount = uint64_t(1) << 28;
+
+bool fail(std::string* error, const char* message) {
+	if (error) *error = message;
+	return false;
+}
+
+bool allocate(Image& image, uint32_t width, uint32_t height) {
+	if (width == 0 || height == 0 || uint64_t(width) * height > kMaxPixelCount) {
+		return false;
+	}
+	image.width = width;
+	image.height = height;
+	image.pixels.assign(size_t(4) * width * height, 0);
+	return true;
+}
+
+uint32_t readBigEndian32(const uint8_t* p) {
+	return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+uint16_t readLittleEndian16(const uint8_t* p) {
+	return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+// ----------------------------------------------------------------------------
+// Inflate (RFC 1951)
+
+/**
+ * Canonical Huffman code, decoded with a kFastBits lookup table for short
+ * codes and a walk over the code lengths for the longer ones.
+ */
+class Huffman {
+public:
+	static constexpr int kMaxBits = 15;
+	static constexpr int kFastBits = 10;
+
+	// Returns false if the lengths do not form a valid prefix code
+	bool build(const uint8_t* lengths, int count) {
+		std::fill(std::begin(m_counts), std::end(m_counts), uint16_t(0));
+		for (int i = 0; i < count; ++i) ++m_counts[lengths[i]];
+		m_counts[0] = 0;
+		int left = 1;
+		for (int len = 1; len <= kMaxBits; ++len) {
+			left = 2 * left - m_counts[len];
+			if (left < 0) return false; // over-subscribed
+		}
+
+		uint16_t offsets[kMaxBits + 1];
+		offsets[1] = 0;
+		for (int len = 1; len < kMaxBits; ++len) offsets[len + 1] = offsets[len] + m_counts[len];
+		for (int i = 0; i < count; ++i) {
+			if (lengths[i] != 0) m_symbols[offsets[lengths[i]]++] = static_cast<uint16_t>(i);
+		}
+
+		// Fast table, indexed by the next kFastBits bits of the stream. Codes
+		// are stored most significant bit first but read least significant
+		// bit first, so they are reversed.
+		std::fill(std::begin(m_fast), std::end(m_fast), uint16_t(0));
+		int code = 0, index = 0;
+		for (int len = 1; len <= kFastBits; ++len) {
+			for (int k = 0; k < m_counts[len]; ++k, ++code, ++index) {
+				int reversed = 0;
+				for (int b = 0; b < len; ++b) reversed |= ((code >> b) & 1) << (len - 1 - b);
+				const uint16_t entry = static_cast<uint16_t>((m_symbols[index] << 4) | len);
+				for (int fill = reversed; fill < (1 << kFastBits); fill += 1 << len) m_fast[fill] = entry;
+			}
+			code <<= 1;
+		}
+		return true;
+	}
+
+	uint16_t fastEntry(uint32_t bits) const { return m_fast[bits & ((1 << kFastBits) - 1)]; }
+
+	/**
+	 * Decodes a code longer than kFastBits, given at least kMaxBits bits of
+	 * the stream in `bits`. Returns the symbol and sets `length`, or -1.
+	 */
+	int decodeSlow(uint32_t bits, int& length) const {
+		int code = 0, first = 0, index = 0;
+		for (int len = 1; len <= kMaxBits; ++len) {
+			code |= (bits >> (len - 1)) & 1;
+			const int count = m_counts[len];
+			if (code - first < count) {
+				length = len;
+				return m_symbols[index + (code - first)];
+			}
+			index += count;
+			first = (first + count) << 1;
+			code <<= 1;
+		}
+		return -1;
+	}
+
+private:
+	uint16_t m_counts[kMaxBits + 1];
+	uint16_t m_symbols[288];
+	uint16_t m_fast[1 << kFastBits]; // symbol << 4 | length, 0 if longer
+};
+
+class Inflater {
+public:
+	Inflater(const uint8_t* data, size_t size, std::vector<uint8_t>& out)
+		: m_data(data), m_end(data + size), m_out(out) {}
+
+	bool inflate() {
+		bool last = false;
+		while (!last) {
+			last = bits(1) != 0;
+			const uint32_t type = bits(2);
+			bool ok;
+			if (type == 0) {
+				ok = stored();
+			} else if (type == 1) {
+				ok = fixedBlock();
+			} else if (type == 2) {
+				ok = dynamicBlock();
+			} else {
+				ok = false;
+			}
+			if (!ok || m_overrun) return false;
+		}
+		return true;
+	}
+
+private:
+	void refill() {
+		while (m_bitCount <= 24) {
+			if (m_data < m_end) {
+				m_bitBuffer |= uint32_t(*m_data++) << m_bitCount;
+			} else if (m_bitCount + 8 * m_paddingBytes > 64) {
+				m_overrun = true; // reading well past the end of the stream
+				return;
+			} else {
+				++m_paddingBytes;
+			}
+			m_bitCount += 8;
+		}
+	}
+
+	uint32_t bits(int count) {
+		if (m_bitCount < count) refill();
+		const uint32_t value = m_bitBuffer & ((uint32_t(1) << count) - 1);
+		m_bitBuffer >>= count;
+		m_bitCount -= count;
+		return value;
+	}
+
+	int decode(const Huffman& huffman) {
+		if (m_bitCount < Huffman::kMaxBits) refill();
+		const uint16_t entry = huffman.fastEntry(m_bitBuffer);
+		int length;
+		int symbol;
+		if (entry != 0) {
+			length = entry & 15;
+			symbol = entry >> 4;
+		} else {
+			symbol = huffman.decodeSlow(m_bitBuffer, length);
+			if (symbol < 0) return -1;
+		}
+		m_bitBuffer >>= length;
+		m_bitCount -= length;
+		return symbol;
+	}
+
+	bool stored() {
+		// Skip to a byte boundary, then give back the buffered whole bytes
+		bits(m_bitCount % 8);
+		const size_t buffered = m_bitCount / 8 - std::min<size_t>(m_paddingBytes, m_bitCount / 8);
+		m_data -= buffered;
+		m_bitBuffer = 0;
+		m_bitCount = 0;
+		m_paddingBytes = 0;
+		if (m_end - m_data < 4) return false;
+		const uint16_t length = readLittleEndian16(m_data);
+		const uint16_t complement = readLittleEndian16(m_data + 2);
+		m_data += 4;
+		if (length != static_cast<uint16_t>(~complement) || size_t(m_end - m_data) < length) return false;
+		m_out.insert(m_out.end(), m_data, m_data + length);
+		m_data += length;
+		return true;
+	}
+
+	bool fixedBlock() {
+		static const struct Fixed {
+			Huffman lengths, distances;
+			Fixed() {
+				uint8_t l[288];
+				std::fill(l, l + 144, uint8_t(8));
+				std::fill(l + 144, l + 256, uint8_t(9));
+				std::fill(l + 256, l + 280, uint8_t(7));
+				std::fill(l + 280, l + 288, uint8_t(8));
+				lengths.build(l, 288);
+				uint8_t d[30];
+				std::fill(d, d + 30, uint8_t(5));
+				distances.build(d, 30);
+			}
+		} fixed;
+		return codes(fixed.lengths, fixed.distances);
+	}
+
+	bool dynamicBlock() {
+		const int literalCount = static_cast<int>(bits(5)) + 257;
+		const int distanceCount = static_cast<int>(bits(5)) + 1;
+		const int codeLengthCount = static_cast<int>(bits(4)) + 4;
+		if (literalCount > 286 || distanceCount > 30) return false;
+
+		static const uint8_t kOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+		uint8_t lengths[286 + 30] = {};
+		for (int i = 0; i < codeLengthCount; ++i) lengths[kOrder[i]] = static_cast<uint8_t>(bits(3));
+		Huffman codeLengths;
+		if (!codeLengths.build(lengths, 19)) return false;
+
+		const int total = literalCount + distanceCount;
+		int i = 0;
+		while (i < total) {
+			const int symbol = decode(codeLengths);
+			if (symbol < 0) return false;
+			if (symbol < 16) {
+				lengths[i++] = static_cast<uint8_t>(symbol);
+				continue;
+			}
+			uint8_t value = 0;
+			int repeat;
+			if (symbol == 16) {
+				if (i == 0) return false;
+				value = lengths[i - 1];
+				repeat = 3 + static_cast<int>(bits(2));
+			} else if (symbol == 17) {
+				repeat = 3 + static_cast<int>(bits(3));
+			} else {
+				repeat = 11 + static_cast<int>(bits(7));
+			}
+			if (i + repeat > total) return false;
+			std::fill(lengths + i, lengths + i + repeat, value);
+			i += repeat;
+		}
+		if (lengths[256] == 0) return false; // no end of block code
+
+		Huffman literals, distances;
+		if (!literals.build(lengths, literalCount) || !distances.build(lengths + literalCount, distanceCount)) {
+			return false;
+		}
+		return codes(literals, distances);
+	}
+
+	bool codes(const Huffman& literals, const Huffman& distances) {
+		static const uint16_t kLengthBase[29] = {
+			3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+			35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		static const uint8_t kLengthExtra[29] = {
+			0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+			3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		static const uint16_t kDistanceBase[30] = {
+			1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+			257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+		static const uint8_t kDistanceExtra[30] = {
+			0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+			7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+		for (;;) {
+			int symbol = decode(literals);
+			if (symbol < 0 || m_overrun) return false;
+			if (symbol < 256) {
+				m_out.push_back(static_cast<uint8_t>(symbol));
+				continue;
+			}
+			if (symbol == 256) return true;
+			symbol -= 257;
+			if (symbol >= 29) return false;
+			const size_t length = kLengthBase[symbol] + bits(kLengthExtra[symbol]);
+			const int distanceSymbol = decode(distances);
+			if (distanceSymbol < 0 || distanceSymbol >= 30) return false;
+			const size_t distance = kDistanceBase[distanceSymbol] + bits(kDistanceExtra[distanceSymbol]);
+			if (distance > m_out.size()) return false;
+
+			// The match may overlap the bytes it produces
+			const size_t from = m_out.size() - distance;
+			m_out.resize(m_out.size() + length);
+			uint8_t* out = m_out.data() + m_out.size() - length;
+			const uint8_t* in = m_out.data() + from;
+			if (distance >= length) {
+				std::memcpy(out, in, length);
+			} else {
+				for (size_t k = 0; k < length; ++k) out[k] = in[k];
+			}
+		}
+	}
+
+private:
+	const uint8_t* m_data;
+	const uint8_t* m_end;
+	std::vector<uint8_t>& m_out;
+	uint32_t m_bitBuffer = 0;
+	int m_bitCount = 0;
+	size_t m_paddingBytes = 0; // zero bytes read past the end
+	bool m_overrun = false;
+};
+
+// zlib stream (RFC 1950) around a deflate stream
+bool zlibDecompress(const uint8_t* data, size_t size, std::vector<uint8_t>& out) {
+	if (size < 2) return false;
+	const uint8_t cmf = data[0], flg = data[1];
+	if ((cmf & 15) != 8 || (cmf >> 4) > 7 || ((cmf << 8) | flg) % 31 != 0 || (flg & 0x20) != 0) {
+		return false; // not deflate, or a preset dictionary
+	}
+	return Inflater(data + 2, size - 2, out).inflate();
+}
+
+// ----------------------------------------------------------------------------
+// PNG
+
+uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+	const int p = int(a) + b - c;
+	const int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+	if (pa <= pb && pa <= pc) return a;
+	return pb <= pc ? b : c;
+}
+
+/**
+ * Undoes the filter of each row of a (sub)image in place, and moves the
+ * rows together over their filter type bytes.
+ */
+bool unfilter(uint8_t* data, uint32_t rowBytes, uint32_t rows, uint32_t pixelBytes) {
+	uint8_t* previous = nullptr;
+	for (uint32_t y = 0; y < rows; ++y) {
+		const uint8_t filter = data[size_t(y) * (rowBytes + 1)];
+		uint8_t* row = data + size_t(y) * rowBytes;
+		std::memmove(row, row + y + 1, rowBytes);
+		switch (filter) {
+		case 0:
+			break;
+		case 1:
+			for (uint32_t x = pixelBytes; x < rowBytes; ++x) row[x] += row[x - pixelBytes];
+			break;
+		case 2:
+			if (previous) for (uint32_t x = 0; x < rowBytes; ++x) row[x] += previous[x];
+			break;
+		case 3:
+			for (uint32_t x = 0; x < rowBytes; ++x) {
+				const int left = x >= pixelBytes ? row[x - pixelBytes] : 0;
+				const int up = previous ? previous[x] : 0;
+				row[x] += static_cast<uint8_t>((left + up) / 2);
+			}
+			break;
+		case 4:
+			for (uint32_t x = 0; x < rowBytes; ++x) {
+				const uint8_t left = x >= pixelBytes ? row[x - pixelBytes] : 0;
+				const uint8_t up = previous ? previous[x] : 0;
+				const uint8_t upLeft = previous && x >= pixelBytes ? previous[x - pixelBytes] : 0;
+				row[x] += paeth(left, up, upLeft);
+			}
+			break;
+		default:
+			return false;
+		}
+		previous = row;
+	}
+	return true;
+}
+
+struct PngHeader {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint8_t bitDepth = 0;
+	uint8_t colorType = 0;
+	uint8_t interlace = 0;
+	uint8_t palette[256][4];
+	uint32_t paletteSize = 0;
+	bool hasColorKey = false;
+	uint16_t colorKey[3] = {}; // tRNS for gray and RGB images
+
+	int channels() const {
+		switch (colorType) {
+		case 0: return 1;
+		case 2: return 3;
+		case 3: return 1;
+		case 4: return 2;
+		default: return 4;
+		}
+	}
+};
+
+/**
+ * Converts the unfiltered rows of a (sub)image to RGBA8 and writes its
+ * pixel (x, y) to image pixel (x0 + x * dx, y0 + y * dy).
+ */
+void expandPixels(const PngHeader& png, const uint8_t* data, uint32_t width, uint32_t height,
+	uint32_t x0, uint32_t y0, uint32_t dx, uint32_t dy, Image& image) {
+	const int channels = png.channels();
+	const uint32_t rowBytes = (width * channels * png.bitDepth + 7) / 8;
+	const int depth = png.bitDepth;
+	for (uint32_t y = 0; y < height; ++y) {
+		const uint8_t* row = data + size_t(y) * rowBytes;
+		uint8_t* out = &image.pixels[4 * (size_t(y0 + y * dy) * image.width + x0)];
+		for (uint32_t x = 0; x < width; ++x, out += 4 * dx) {
+			// Samples at their full depth, and scaled to 8 bits
+			uint16_t raw[4];
+			uint8_t v[4];
+			for (int c = 0; c < channels; ++c) {
+				if (depth == 16) {
+					const uint8_t* p = row + 2 * (size_t(x) * channels + c);
+					raw[c] = static_cast<uint16_t>((p[0] << 8) | p[1]);
+					v[c] = p[0];
+				} else if (depth == 8) {
+					raw[c] = row[size_t(x) * channels + c];
+					v[c] = static_cast<uint8_t>(raw[c]);
+				} else {
+					// 1, 2 or 4 bits, gray or palette only (one channel)
+					const uint32_t bit = x * depth;
+					raw[c] = static_cast<uint16_t>((row[bit / 8] >> (8 - depth - bit % 8)) & ((1 << depth) - 1));
+					v[c] = static_cast<uint8_t>(raw[c] * 255 / ((1 << depth) - 1));
+				}
+			}
+			switch (png.colorType) {
+			case 0:
+				out[0] = out[1] = out[2] = v[0];
+				out[3] = png.hasColorKey && raw[0] == png.colorKey[0] ? 0 : 255;
+				break;
+			case 2:
+				out[0] = v[0];
+				out[1] = v[1];
+				out[2] = v[2];
+				out[3] = png.hasColorKey && raw[0] == png.colorKey[0] && raw[1] == png.colorKey[1]
+					&& raw[2] == png.colorKey[2] ? 0 : 255;
+				break;
+			case 3:
+				std::memcpy(out, png.palette[raw[0] < png.paletteSize ? raw[0] : 0], 4);
+				break;
+			case 4:
+				out[0] = out[1] = out[2] = v[0];
+				out[3] = v[1];
+				break;
+			default:
+				std::memcpy(out, v, 4);
+				break;
+			}
+		}
+	}
+}
+
+bool validPngFormat(uint8_t colorType, uint8_t bitDepth) {
+	switch (colorType) {
+	case 0: return bitDepth == 1 || bitDepth == 2 || bitDepth == 4 || bitDepth == 8 || bitDepth == 16;
+	case 3: return bitDepth == 1 || bitDepth == 2 || bitDepth == 4 || bitDepth == 8;
+	case 2: case 4: case 6: return bitDepth == 8 || bitDepth == 16;
+	default: return false;
+	}
+}
+
+// ----------------------------------------------------------------------------
+// PNM
+
+// Next whitespace separated token of a PNM header, skipping comments
+bool pnmNumber(const uint8_t*& p, const uint8_t* end, uint32_t& value) {
+	for (;;) {
+		while (p < end && std::isspace(*p)) ++p;
+		if (p < end && *p == '#') {
+			while (p < end && *p != '\n') ++p;
+			continue;
+		}
+		break;
+	}
+	if (p == end || !std::isdigit(*p)) return false;
+	uint64_t v = 0;
+	while (p < end && std::isdigit(*p)) {
+		v = v * 10 + (*p++ - '0');
+		if (v > std::numeric_limits<uint32_t>::max()) return false;
+	}
+	value = static_cast<uint32_t>(v);
+	return true;
+}
+
+} // namespace
+
+bool decodePng(const uint8_t* data, size_t size, Image& image, std::string* error) {
+	static const uint8_t kSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	if (size < 8 || std::memcmp(data, kSignature, 8) != 0) {
+		return fail(error, "not a PNG file");
+	}
+
+	PngHeader png;
+	std::vector<uint8_t> compressed;
+	bool hasHeader = false, ended = false;
+	const uint8_t* p = data + 8;
+	const uint8_t* end = data + size;
+	while (!ended) {
+		if (end - p < 12) return fail(error, "truncated PNG file");
+		const uint32_t length = readBigEndian32(p);
+		const uint8_t* type = p + 4;
+		const uint8_t* chunk = p + 8;
+		if (length > size_t(end - chunk) - 4) return fail(error, "truncated PNG file");
+		p = chunk + length + 4; // skip the CRC
+
+		if (std::memcmp(type, "IHDR", 4) == 0) {
+			if (length != 13) return fail(error, "invalid PNG header");
+			png.width = readBigEndian32(chunk);
+			png.height = readBigEndian32(chunk + 4);
+			png.bitDepth = chunk[8];
+			png.colorType = chunk[9];
+			png.interlace = chunk[12];
+			if (!validPngFormat(png.colorType, png.bitDepth) || chunk[10] != 0 || chunk[11] != 0 || png.interlace > 1) {
+				return fail(error, "unsupported PNG format");
+			}
+			hasHeader = true;
+		} else if (!hasHeader) {
+			return fail(error, "PNG header missing");
+		} else if (std::memcmp(type, "PLTE", 4) == 0) {
+			png.paletteSize = std::min<uint32_t>(length / 3, 256);
+			for (uint32_t i = 0; i < png.paletteSize; ++i) {
+				png.palette[i][0] = chunk[3 * i];
+				png.palette[i][1] = chunk[3 * i + 1];
+				png.palette[i][2] = chunk[3 * i + 2];
+				png.palette[i][3] = 255;
+			}
+		} else if (std::memcmp(type, "tRNS", 4) == 0) {
+			if (png.colorType == 3) {
+				for (uint32_t i = 0; i < std::min(length, png.paletteSize); ++i) png.palette[i][3] = chunk[i];
+			} else if (png.colorType == 0 && length >= 2) {
+				png.hasColorKey = true;
+				png.colorKey[0] = static_cast<uint16_t>((chunk[0] << 8) | chunk[1]);
+			} else if (png.colorType == 2 && length >= 6) {
+				png.hasColorKey = true;
+				for (int c = 0; c < 3; ++c) png.colorKey[c] = static_cast<uint16_t>((chunk[2 * c] << 8) | chunk[2 * c + 1]);
+			}
+		} else if (std::memcmp(type, "IDAT", 4) == 0) {
+			compressed.insert(compressed.end(), chunk, chunk + length);
+		} else if (std::memcmp(type, "IEND", 4) == 0) {
+			ended = true;
+		} else if ((type[0] & 0x20) == 0) {
+			return fail(error, "unsupported critical PNG chunk");
+		}
+	}
+	if (png.colorType == 3 && png.paletteSize == 0) return fail(error, "PNG palette missing");
+	if (!allocate(image, png.width, png.height)) return fail(error, "invalid PNG size");
+
+	// Sub-images: the whole image, or the 7 Adam7 passes
+	struct Pass { uint32_t x0, y0, dx, dy; };
+	static const Pass kWhole[1] = { { 0, 0, 1, 1 } };
+	static const Pass kAdam7[7] = {
+		{ 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 },
+		{ 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 } };
+	const Pass* passes = png.interlace ? kAdam7 : kWhole;
+	const int passCount = png.interlace ? 7 : 1;
+
+	const uint32_t bitsPerPixel = png.channels() * png.bitDepth;
+	const uint32_t pixelBytes = std::max<uint32_t>(1, bitsPerPixel / 8);
+	size_t expectedSize = 0;
+	for (int i = 0; i < passCount; ++i) {
+		const Pass& pass = passes[i];
+		const uint64_t w = png.width > pass.x0 ? (png.width - pass.x0 + pass.dx - 1) / pass.dx : 0;
+		const uint64_t h = png.height > pass.y0 ? (png.height - pass.y0 + pass.dy - 1) / pass.dy : 0;
+		if (w > 0 && h > 0) expectedSize += static_cast<size_t>(((w * bitsPerPixel + 7) / 8 + 1) * h);
+	}
+
+	std::vector<uint8_t> raw;
+	raw.reserve(expectedSize);
+	if (!zlibDecompress(compressed.data(), compressed.size(), raw)) return fail(error, "corrupt PNG data");
+	if (raw.size() < expectedSize) return fail(error, "truncated PNG data");
+
+	uint8_t* passData = raw.data();
+	for (int i = 0; i < passCount; ++i) {
+		const Pass& pass = passes[i];
+		const uint32_t w = png.width > pass.x0 ? (png.width - pass.x0 + pass.dx - 1) / pass.dx : 0;
+		const uint32_t h = png.height > pass.y0 ? (png.height - pass.y0 + pass.dy - 1) / pass.dy : 0;
+		if (w == 0 || h == 0) continue;
+		const uint32_t rowBytes = static_cast<uint32_t>((uint64_t(w) * bitsPerPixel + 7) / 8);
+		if (!unfilter(passData, rowBytes, h, pixelBytes)) return fail(error, "corrupt PNG data");
+		expandPixels(png, passData, w, h, pass.x0, pass.y0, pass.dx, pass.dy, image);
+		passData += size_t(rowBytes + 1) * h;
+	}
+	return true;
+}
+
+bool decodeTga(const uint8_t* data, size_t size, Image& image, std::string* error) {
+	if (size < 18) return fail(error, "truncated TGA file");
+	const uint8_t idLength = data[0];
+	const uint8_t colorMapType = data[1];
+	const uint8_t imageType = data[2];
+	const uint16_t mapFirst = readLittleEndian16(data + 3);
+	const uint16_t mapLength = readLittleEndian16(data + 5);
+	const uint8_t mapEntryBits = data[7];
+	const uint16_t width = readLittleEndian16(data + 12);
+	const uint16_t height = readLittleEndian16(data + 14);
+	const uint8_t pixelBits = data[16];
+	const uint8_t descriptor = data[17];
+
+	const bool rle = imageType >= 9;
+	const int baseType = rle ? imageType - 8 : imageType;
+	if (baseType < 1 || baseType > 3 || colorMapType > 1 || (baseType == 1 && colorMapType != 1)) {
+		return fail(error, "unsupported TGA format");
+	}
+	auto validDepth = [](uint8_t bits) { return bits == 15 || bits == 16 || bits == 24 || bits == 32; };
+	if ((baseType == 1 && (pixelBits != 8 && pixelBits != 16)) || (baseType == 1 && !validDepth(mapEntryBits))
+		|| (baseType == 2 && !validDepth(pixelBits)) || (baseType == 3 && pixelBits != 8 && pixelBits != 16)) {
+		return fail(error, "unsupported TGA format");
+	}
+	if (!allocate(image, width, height)) return fail(error, "invalid TGA size");
+
+	const uint8_t* p = data + 18 + idLength;
+	const uint8_t* end = data + size;
+	if (p > end) return fail(error, "truncated TGA file");
+
+	// Converts one stored value (pixel or color map entry) to RGBA
+	auto toRgba = [](const uint8_t* in, int bits, bool gray, uint8_t* out) {
+		if (gray) {
+			out[0] = out[1] = out[2] = in[0];
+			out[3] = bits == 16 ? in[1] : 255;
+		} else if (bits == 15 || bits == 16) {
+			const uint16_t v = readLittleEndian16(in);
+			out[0] = static_cast<uint8_t>(((v >> 10) & 31) * 255 / 31);
+			out[1] = static_cast<uint8_t>(((v >> 5) & 31) * 255 / 31);
+			out[2] = static_cast<uint8_t>((v & 31) * 255 / 31);
+			out[3] = 255; // the attribute bit is rarely meaningful
+		} else {
+			out[0] = in[2];
+			out[1] = in[1];
+			out[2] = in[0];
+			out[3] = bits == 32 ? in[3] : 255;
+		}
+	};
+
+	std::vector<uint8_t> colorMap;
+	if (colorMapType == 1) {
+		const size_t entryBytes = (mapEntryBits + 7) / 8;
+		if (size_t(end - p) < entryBytes * mapLength) return fail(error, "truncated TGA file");
+		colorMap.resize(4 * (size_t(mapFirst) + mapLength));
+		for (size_t i = 0; i < mapLength; ++i) {
+			toRgba(p + i * entryBytes, mapEntryBits, false, &colorMap[4 * (mapFirst + i)]);
+		}
+		p += entryBytes * mapLength;
+	}
+
+	const size_t pixelBytes = (pixelBits + 7) / 8;
+	auto readPixel = [&](const uint8_t* in, uint8_t* out) {
+		if (baseType == 1) {
+			const size_t index = pixelBits == 8 ? in[0] : readLittleEndian16(in);
+			if (4 * index + 4 <= colorMap.size()) {
+				std::memcpy(out, &colorMap[4 * index], 4);
+			} else {
+				std::memset(out, 0, 4);
+			}
+		} else {
+			toRgba(in, pixelBits, baseType == 3, out);
+		}
+	};
+
+	// Decoded in file order, then flipped as the origin bits require
+	const size_t pixelCount = size_t(width) * height;
+	uint8_t* out = image.pixels.data();
+	size_t done = 0;
+	while (done < pixelCount) {
+		size_t run = 1;
+		bool repeat = false;
+		if (rle) {
+			if (p >= end) return fail(error, "truncated TGA file");
+			repeat = (*p & 0x80) != 0;
+			run = std::min<size_t>((*p & 0x7F) + 1, pixelCount - done);
+			++p;
+		} else {
+			run = pixelCount;
+		}
+		const size_t needed = repeat ? pixelBytes : pixelBytes * run;
+		if (size_t(end - p) < needed) return fail(error, "truncated TGA file");
+		for (size_t k = 0; k < run; ++k) {
+			readPixel(repeat ? p : p + k * pixelBytes, out + 4 * (done + k));
+		}
+		p += needed;
+		done += run;
+	}
+
+	const bool rightToLeft = (descriptor & 0x10) != 0;
+	const bool topToBottom = (descriptor & 0x20) != 0;
+	const size_t rowBytes = 4 * size_t(width);
+	if (!topToBottom) {
+		std::vector<uint8_t> row(rowBytes);
+		for (uint32_t y = 0; y < height / 2u; ++y) {
+			uint8_t* a = out + y * rowBytes;
+			uint8_t* b = out + (height - 1 - y) * rowBytes;
+			std::memcpy(row.data(), a, rowBytes);
+			std::memcpy(a, b, rowBytes);
+			std::memcpy(b, row.data(), rowBytes);
+		}
+	}
+	if (rightToLeft) {
+		for (uint32_t y = 0; y < height; ++y) {
+			uint32_t* row = reinterpret_cast<uint32_t*>(out + y * rowBytes);
+			std::reverse(row, row + width);
+		}
+	}
+	return true;
+}
+
+bool decodePnm(const uint8_t* data, size_t size, Image& image, std::string* error) {
+	if (size < 2 || data[0] != 'P' || (data[1] != '2' && data[1] != '3' && data[1] != '5' && data[1] != '6')) {
+		return fail(error, "unsupported PNM format");
+	}
+	const bool ascii = data[1] == '2' || data[1] == '3';
+	const int channels = (data[1] == '3' || data[1] == '6') ? 3 : 1;
+	const uint8_t* p = data + 2;
+	const uint8_t* end = data + size;
+	uint32_t width, height, maxValue;
+	if (!pnmNumber(p, end, width) || !pnmNumber(p, end, height) || !pnmNumber(p, end, maxValue)
+		|| maxValue == 0 || maxValue > 65535) {
+		return fail(error, "invalid PNM header");
+	}
+	if (!allocate(image, width, height)) return fail(error, "invalid PNM size");
+
+	const size_t sampleCount = size_t(width) * height * channels;
+	const size_t sampleBytes = maxValue > 255 ? 2 : 1;
+	if (!ascii) {
+		// A single whitespace separates the header from the samples
+		if (p == end || !std::isspace(*p)) return fail(error, "invalid PNM header");
+		++p;
+		if (size_t(end - p) < sampleCount * sampleBytes) return fail(error, "truncated PNM file");
+	}
+
+	uint8_t* out = image.pixels.data();
+	for (size_t i = 0; i < sampleCount; ++i) {
+		uint32_t value;
+		if (ascii) {
+			if (!pnmNumber(p, end, value)) return fail(error, "truncated PNM file");
+			value = std::min(value, maxValue);
+		} else if (sampleBytes == 2) {
+			value = std::min<uint32_t>((p[0] << 8) | p[1], maxValue);
+			p += 2;
+		} else {
+			value = std::min<uint32_t>(*p++, maxValue);
+		}
+		const uint8_t v = static_cast<uint8_t>((value * 255 + maxValue / 2) / maxValue);
+		const size_t pixel = i / channels;
+		if (channels == 1) {
+			out[4 * pixel] = out[4 * pixel + 1] = out[4 * pixel + 2] = v;
+		} else {
+			out[4 * pixel + i % 3] = v;
+		}
+		out[4 * pixel + 3] = 255;
+	}
+	return true;
+}
+
+bool loadImage(const std::filesystem::path& path, Image& image, std::string* error) {
+	MappedFile file;
+	if (!file.open(path)) {
+		return fail(error, "cannot read file");
+	}
+	const uint8_t* data = file.data();
+	const size_t size = file.size();
+	if (size >= 8 && data[0] == 0x89 && std::memcmp(data + 1, "PNG", 3) == 0) {
+		return decodePng(data, size, image, error);
+	}
+	if (size >= 2 && data[0] == 'P' && data[1] >= '1' && data[1] <= '7') {
+		return decodePnm(data, size, image, error);
+	}
+	std::string extension = path.extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(),
+		[](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	if (extension == ".tga") {
+		return decodeTga(data, size, image, error);
+	}
+	return fail(error, "unsupported image format");
+}
@@ -0,0 +1,39 @@
+/**
+ * Decoders for the image formats used by MTL texture maps, so that loading
+ * textures does not need an image library:
+ *  - PNG: every color type and bit depth, palettes, tRNS transparency and
+ *    Adam7 interlacing (inflate is implemented here too);
+ *  - TGA: uncompressed and RLE, true color, grayscale and color mapped;
+ *  - PNM: binary and ASCII PGM/PPM (P2, P3, P5, P6), 8 or 16 bits.
+ *
+ * Every image is converted to 8 bit RGBA, top row first. Decoders are
+ * stateless and may run concurrently on worker threads.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+struct Image {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint8_t> pixels; // RGBA8, rows from top to bottom
+};
+
+/**
+ * Each decoder returns false and sets `error` if the data is not a valid or
+ * supported image of its format.
+ */
+bool decodePng(const uint8_t* data, size_t size, Image& image, std::string* error = nullptr);
+bool decodeTga(const uint8_t* data, size_t size, Image& image, std::string* error = nullptr);
+bool decodePnm(const uint8_t* data, size_t size, Image& image, std::string* error = nullptr);
+
+/**
+ * Reads and decodes an image file. The format is detected from the PNG and
+ * PNM signatures, and TGA (which has none) from the extension.
+ */
+bool loadImage(const std::filesystem::path& path, Image& image, std::string* error = nullptr);
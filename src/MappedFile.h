@@ -0,0 +1,37 @@
+/**
+ * Read-only memory mapping of a whole file.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+class MappedFile {
+public:
+	MappedFile() = default;
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	/**
+	 * Maps the file at `path`, closing any previous mapping.
+	 * Returns false if the file cannot be opened or is empty.
+	 */
+	bool open(const std::filesystem::path& path);
+	void close();
+
+	bool isOpen() const { return m_data != nullptr; }
+	const unsigned char* data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+private:
+	const unsigned char* m_data = nullptr;
+	size_t m_size = 0;
+#ifdef _WIN32
+	void* m_fileHandle = nullptr;
+	void* m_mappingHandle = nullptr;
+#endif
+};
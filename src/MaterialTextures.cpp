@@ -0,0 +1,203 @@
+#include "MaterialTextures.h"
+#include "MappedFile.h"
+#include "Mipmaps.h"
+#include "TextureCache.h"
+
+#include "tiny_obj_loader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <string_view>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct DecodedImage {
+	MaterialTexture texture; // without levels if it could not be loaded
+	std::string error;
+};
+
+/**
+ * Paths of the MTL files referenced by `mtllib` statements, found by
+ * searching the whole file for the keyword rather than parsing it.
+ */
+std::vector<fs::path> findMaterialLibraries(const fs::path& objPath) {
+	std::vector<fs::path> paths;
+	MappedFile file;
+	if (!file.open(objPath)) {
+		return paths;
+	}
+	const std::string_view text(reinterpret_cast<const char*>(file.data()), file.size());
+	const std::string_view keyword = "mtllib";
+	for (size_t at = text.find(keyword); at != std::string_view::npos; at = text.find(keyword, at + keyword.size())) {
+		// Only at the start of a line (after optional blanks), followed by a blank
+		size_t lineStart = at;
+		while (lineStart > 0 && (text[lineStart - 1] == ' ' || text[lineStart - 1] == '\t')) --lineStart;
+		const size_t after = at + keyword.size();
+		if ((lineStart > 0 && text[lineStart - 1] != '\n' && text[lineStart - 1] != '\r')
+			|| after >= text.size() || (text[after] != ' ' && text[after] != '\t')) {
+			continue;
+		}
+		size_t lineEnd = text.find_first_of("\r\n", after);
+		if (lineEnd == std::string_view::npos) lineEnd = text.size();
+		// Several files may be listed, separated by blanks
+		size_t begin = after;
+		while (begin < lineEnd) {
+			begin = text.find_first_not_of(" \t", begin);
+			if (begin == std::string_view::npos || begin >= lineEnd) break;
+			size_t end = std::min(text.find_first_of(" \t", begin), lineEnd);
+			const fs::path path = objPath.parent_path() / fs::path(std::string(text.substr(begin, end - begin)));
+			if (std::find(paths.begin(), paths.end(), path) == paths.end()) {
+				paths.push_back(path);
+			}
+			begin = end;
+		}
+	}
+	return paths;
+}
+
+/**
+ * Texture paths are relative to the MTL file. Exporters often write
+ * absolute paths of the machine the asset was made on, so when such a path
+ * does not exist the file name is looked up next to the MTL file.
+ */
+fs::path resolveTexturePath(const fs::path& mtlPath, const std::string& name) {
+	fs::path path(name);
+	if (path.is_relative()) {
+		return mtlPath.parent_path() / path;
+	}
+	std::error_code error;
+	if (!fs::exists(path, error)) {
+		fs::path local = mtlPath.parent_path() / path.filename();
+		if (fs::exists(local, error)) {
+			return local;
+		}
+	}
+	return path;
+}
+
+/**
+ * A valid cache is read before waiting for `blockCompression`, and the
+ * image is decoded and mipmapped before too when the cache cannot be used.
+ */
+DecodedImage decodeTexture(const fs::path& path, const TextureLoadSettings& settings, const std::shared_future<bool>& blockCompression) {
+	DecodedImage decoded;
+	decoded.texture.source = path;
+	decoded.texture.psnr = std::numeric_limits<double>::infinity();
+	TextureCache cache;
+	const bool cached = settings.useCache && cache.open(path, settings.preset);
+	if (cached && blockCompression.get()) {
+		decoded.texture.encoded = std::move(cache.texture());
+		decoded.texture.psnr = cache.psnr();
+		decoded.texture.fromCache = true;
+		return decoded;
+	}
+
+	Image image;
+	if (!loadImage(path, image, &decoded.error)) {
+		return decoded;
+	}
+	std::vector<Image> levels = generateMipmaps(std::move(image));
+	const BlockFormat format = blockCompression.get() ? chooseBlockFormat(levels[0], settings.preset) : BlockFormat::RGBA8;
+	if (format == BlockFormat::RGBA8) {
+		decoded.texture.encoded = encodeTexture(std::move(levels), format, settings.preset);
+		return decoded;
+	}
+	const Image reference = levels[0];
+	decoded.texture.encoded = encodeTexture(std::move(levels), format, settings.preset);
+	const std::vector<uint8_t>& blocks = decoded.texture.encoded.levels[0];
+	decoded.texture.psnr = computePsnr(reference, decompressImage(blocks.data(), reference.width, reference.height, format));
+	if (settings.useCache) {
+		cache.save(decoded.texture.encoded, decoded.texture.psnr);
+	}
+	return decoded;
+}
+
+/**
+ * 1x1 texture of a diffuse color. The shader raises texels to the power
+ * 2.2, so the color is stored with the inverse gamma.
+ */
+Image solidColor(const tinyobj::real_t diffuse[3]) {
+	Image image;
+	image.width = 1;
+	image.height = 1;
+	image.pixels.resize(4);
+	for (int c = 0; c < 3; ++c) {
+		const float value = std::clamp(static_cast<float>(diffuse[c]), 0.0f, 1.0f);
+		image.pixels[c] = static_cast<uint8_t>(std::lround(std::pow(value, 1.0f / 2.2f) * 255.0f));
+	}
+	image.pixels[3] = 255;
+	return image;
+}
+
+} // namespace
+
+int MaterialTextures::find(const std::string& name) const {
+	auto it = std::find(names.begin(), names.end(), name);
+	return it == names.end() ? -1 : static_cast<int>(it - names.begin());
+}
+
+void loadMaterialTextures(const fs::path& objPath, ThreadPool& pool, const TextureLoadSettings& settings,
+	std::shared_future<bool> blockCompression, MaterialTextureCallbacks callbacks) {
+	pool.submit([objPath, &pool, settings, blockCompression, callbacks]() {
+		MaterialTextures result;
+		std::string warnings;
+		std::vector<fs::path> imagePaths;
+		std::vector<Image> solidColors; // after the images
+		std::vector<uint32_t> solidColorOfMaterial;
+		std::map<fs::path, uint32_t> imageIndices;
+		for (const fs::path& mtlPath : findMaterialLibraries(objPath)) {
+			result.libraries.push_back(mtlPath);
+			std::ifstream file(mtlPath);
+			if (!file.is_open()) {
+				warnings += "Could not read material library " + mtlPath.string() + "\n";
+				continue;
+			}
+			std::map<std::string, int> materialMap;
+			std::vector<tinyobj::material_t> materials;
+			std::string warn, err;
+			tinyobj::LoadMtl(&materialMap, &materials, &file, &warn, &err);
+			warnings += warn + err;
+
+			for (const tinyobj::material_t& material : materials) {
+				uint32_t texture = kNoTexture;
+				if (!material.diffuse_texname.empty()) {
+					const fs::path path = resolveTexturePath(mtlPath, material.diffuse_texname);
+					auto inserted = imageIndices.emplace(path, static_cast<uint32_t>(imagePaths.size()));
+					if (inserted.second) {
+						imagePaths.push_back(path);
+					}
+					texture = inserted.first->second;
+				} else {
+					solidColorOfMaterial.push_back(static_cast<uint32_t>(result.names.size()));
+					solidColors.push_back(solidColor(material.diffuse));
+				}
+				result.names.push_back(material.name);
+				result.textureOfMaterial.push_back(texture);
+			}
+		}
+		// Solid colors come after the images
+		for (size_t i = 0; i < solidColorOfMaterial.size(); ++i) {
+			result.textureOfMaterial[solidColorOfMaterial[i]] = static_cast<uint32_t>(imagePaths.size() + i);
+		}
+
+		const size_t imageCount = imagePaths.size();
+		callbacks.materials(std::move(result), imageCount + solidColors.size(), std::move(warnings));
+		for (size_t i = 0; i < imageCount; ++i) {
+			pool.submit([i, path = imagePaths[i], settings, blockCompression, callbacks]() {
+				DecodedImage decoded = decodeTexture(path, settings, blockCompression);
+				callbacks.texture(i, std::move(decoded.texture), std::move(decoded.error));
+			});
+		}
+		for (size_t i = 0; i < solidColors.size(); ++i) {
+			MaterialTexture solid;
+			solid.encoded = encodeTexture(generateMipmaps(std::move(solidColors[i])), BlockFormat::RGBA8, CompressionPreset::Fast);
+			solid.psnr = std::numeric_limits<double>::infinity();
+			callbacks.texture(imageCount + i, std::move(solid), std::string());
+		}
+	});
+}
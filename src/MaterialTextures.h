@@ -0,0 +1,80 @@
+/**
+ * Diffuse textures of the materials of an OBJ file.
+ *
+ * Loading runs on a thread pool while the caller does something else
+ * (typically creating the WebGPU device and loading the mesh): one task
+ * finds the `mtllib` files of the OBJ and parses them, then each `map_Kd`
+ * image is decoded (see ImageDecoders.h), gets its mip chain (see
+ * Mipmaps.h) and, if the device supports it, is block compressed (see
+ * BlockCompression.h) in a task of its own. Compressed textures are cached
+ * on disk (see TextureCache.h). Results are handed to callbacks as soon as
+ * they are ready, see AssetLoader.h for how they reach the render thread.
+ *
+ * Materials without a map get a 1x1 texture of their diffuse color.
+ * Materials whose map cannot be loaded get no texture, and the renderer
+ * shows its default one instead.
+ */
+
+#pragma once
+
+#include "BlockCompression.h"
+#include "Parallel.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <string>
+#include <vector>
+
+constexpr uint32_t kNoTexture = ~0u;
+
+struct MaterialTexture {
+	// Full mip chain, sRGB encoded
+	EncodedTexture encoded;
+	// Image file, empty for the solid colors of materials without a map
+	std::filesystem::path source;
+	// Of level 0 against the decoded image, infinite if not compressed
+	double psnr = 0.0;
+	bool fromCache = false;
+};
+
+struct TextureLoadSettings {
+	CompressionPreset preset = CompressionPreset::Normal;
+	// Read and write the encoded textures next to their images
+	bool useCache = true;
+};
+
+struct MaterialTextures {
+	// Material names, as in `newmtl` and `usemtl`
+	std::vector<std::string> names;
+	// Texture of each material or kNoTexture, materials may share a texture
+	std::vector<uint32_t> textureOfMaterial;
+	// MTL files referenced by the OBJ, even those that could not be read
+	std::vector<std::filesystem::path> libraries;
+
+	/**
+	 * Index of the material called `name`, or -1.
+	 */
+	int find(const std::string& name) const;
+};
+
+struct MaterialTextureCallbacks {
+	// Called once the MTL files are parsed, with no textures yet, the number
+	// of textures that will follow and what could not be parsed
+	std::function<void(MaterialTextures&& materials, size_t textureCount, std::string&& warnings)> materials;
+	// Called once per texture, in any order. If it could not be loaded, it
+	// has no levels and `error` says why.
+	std::function<void(size_t index, MaterialTexture&& texture, std::string&& error)> texture;
+};
+
+/**
+ * Starts loading the textures of the materials of `objPath` on `pool`.
+ * Callbacks run on the workers of `pool`.
+ * @param blockCompression Whether the device has the
+ *        "texture-compression-bc" feature, otherwise textures stay RGBA8.
+ *        Images are decoded and mipmapped before it is needed, so it may be
+ *        fulfilled later, once the adapter is known.
+ */
+void loadMaterialTextures(const std::filesystem::path& objPath, ThreadPool& pool, const TextureLoadSettings& settings,
+	std::shared_future<bool> blockCompression, MaterialTextureCallbacks callbacks);
@@ -0,0 +1,138 @@
+/**
+ * CPU side mesh data, shared by the loaders and the renderer.
+ * Nothing in here depends on WebGPU.
+ */
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * A structure that describes the data layout in the vertex buffer
+ * We do not instantiate it but use it in `sizeof` and `offsetof`
+ */
+struct VertexAttributes {
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec3 color;
+	glm::vec2 uv; // <--- Add a texture coordinate attribute
+};
+
+// Vertices are hashed and compared as raw bytes, so there must be no padding
+static_assert(sizeof(VertexAttributes) == 11 * sizeof(float));
+
+/**
+ * A range of the index buffer drawn with a single `drawIndexed` call.
+ * Indices are relative to `baseVertex`.
+ */
+struct MeshChunk {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	int32_t baseVertex;
+};
+
+/**
+ * A range of the index buffer, regardless of chunks.
+ */
+struct IndexRange {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+};
+
+/**
+ * A cluster of at most kMaxMeshletVertices vertices and
+ * kMaxMeshletTriangles triangles, stored as a range of the index buffer,
+ * with what is needed to cull it (see Meshlets.h).
+ */
+struct Meshlet {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	// Bounding sphere
+	glm::vec3 center;
+	float radius;
+	// Normal cone: all triangles face away from a viewer at position p if
+	// dot(center - p, coneAxis) >= coneCutoff * length(center - p) + radius
+	glm::vec3 coneAxis;
+	float coneCutoff;
+};
+
+/**
+ * One level of detail of a shape: a range of the index buffer that uses the
+ * same vertices as the full detail one, and how far (in mesh units) its
+ * surface may be from the full detail surface.
+ */
+struct MeshLod {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error;
+};
+
+constexpr uint32_t kNoMaterial = ~0u;
+
+/**
+ * A group or object of the source file (or a part of one that uses a single
+ * material), with its levels of detail lods[firstLod] (full detail) to
+ * lods[firstLod + lodCount - 1].
+ */
+struct MeshShape {
+	glm::vec3 center; // bounding sphere
+	float radius;
+	uint32_t firstLod;
+	uint32_t lodCount;
+	uint32_t material = kNoMaterial; // index in IndexedMesh::materials
+};
+
+/**
+ * Deduplicated vertices and a triangle list indexing them.
+ * Only one of `indices16` and `indices32` is filled, depending on
+ * `use16BitIndices`. With 16 bit indices, large meshes are split into
+ * several chunks that each address at most 65536 vertices. Meshlets
+ * partition the full detail triangles independently of chunks, and the
+ * coarser levels of detail of each shape follow them in the index buffer.
+ */
+struct IndexedMesh {
+	std::vector<VertexAttributes> vertices;
+	std::vector<uint16_t> indices16;
+	std::vector<uint32_t> indices32;
+	bool use16BitIndices = false;
+	std::vector<MeshChunk> chunks;
+	std::vector<Meshlet> meshlets; // may be empty
+	std::vector<MeshShape> shapes; // may be empty
+	std::vector<MeshLod> lods;
+	std::vector<std::string> materials; // names used by `usemtl`
+
+	size_t indexCount() const {
+		return use16BitIndices ? indices16.size() : indices32.size();
+	}
+	size_t indexSize() const {
+		return use16BitIndices ? sizeof(uint16_t) : sizeof(uint32_t);
+	}
+	const void* indexData() const {
+		return use16BitIndices
+			? static_cast<const void*>(indices16.data())
+			: static_cast<const void*>(indices32.data());
+	}
+};
+
+/**
+ * Boundaries of the shapes of a triangle list, given the index offsets at
+ * which shapes start (possibly unsorted, repeated or not multiples of 3):
+ * shape i covers [bounds[i], bounds[i + 1]). Empty shapes are dropped.
+ */
+inline std::vector<size_t> shapeBoundaries(size_t indexCount, const std::vector<size_t>& shapeOffsets) {
+	const size_t end = indexCount / 3 * 3;
+	std::vector<size_t> bounds;
+	bounds.push_back(0);
+	for (size_t offset : shapeOffsets) {
+		offset = std::min(offset / 3 * 3, end);
+		if (offset > bounds.back()) bounds.push_back(offset);
+	}
+	if (end > bounds.back()) bounds.push_back(end);
+	return bounds;
+}
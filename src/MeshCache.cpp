@@ -0,0 +1,377 @@
+#include "MeshCache.h"
+#include "Hash.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <system_error>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char kMagic[8] = { 'W', 'G', 'P', 'U', 'M', 'E', 'S', 'H' };
+
+// Bump when the layout of the file itself changes
+constexpr uint32_t kFormatVersion = 5;
+
+// Written in native byte order, so a file from a host with the other
+// endianness fails this check and gets rebuilt.
+constexpr uint32_t kByteOrderMark = 0x01020304;
+
+constexpr size_t kSectionAlignment = 16;
+
+/**
+ * File layout: this header, then the vertex, index, chunk, meshlet, shape,
+ * level of detail and material sections, each aligned to 16 bytes. Offsets
+ * are from the start of the file. Vertices are stored in the encoding of
+ * `vertexEncoding` (VertexEncoding::key), and the header holds what the
+ * shader needs to decode them. Material names are stored one after the
+ * other, each followed by a null character.
+ */
+struct MeshCacheHeader {
+	char magic[8];
+	uint32_t formatVersion;
+	uint32_t converterVersion;
+	uint32_t byteOrderMark;
+	uint32_t vertexStride;
+	uint64_t sourceHash;
+	uint64_t sourceSize;
+	uint64_t vertexCount;
+	uint64_t vertexOffset;
+	uint64_t indexCount;
+	uint64_t indexOffset;
+	uint32_t indexSize;
+	uint32_t chunkCount;
+	uint64_t chunkOffset;
+	uint64_t meshletCount;
+	uint64_t meshletOffset;
+	uint64_t shapeCount;
+	uint64_t shapeOffset;
+	uint64_t lodCount;
+	uint64_t lodOffset;
+	uint64_t materialCount;
+	uint64_t materialOffset;
+	uint64_t materialSize; // in bytes
+	uint64_t payloadSize; // everything after the header
+	uint64_t payloadHash;
+	uint32_t vertexEncoding;
+	uint32_t octNormals;
+	float positionOffset[3];
+	float positionScale[3];
+	float maxPositionError;
+	float maxNormalError;
+	float maxColorError;
+	float maxUVError;
+	float radius;
+	uint32_t padding[3];
+};
+
+static_assert(sizeof(MeshCacheHeader) % kSectionAlignment == 0);
+
+uint64_t alignUp(uint64_t value) {
+	return (value + kSectionAlignment - 1) & ~uint64_t(kSectionAlignment - 1);
+}
+
+// Whether [offset, offset + count * stride) lies within a file of `fileSize` bytes
+bool sectionFits(uint64_t offset, uint64_t count, uint64_t stride, uint64_t fileSize) {
+	if (offset > fileSize || offset % kSectionAlignment != 0) return false;
+	return count <= (fileSize - offset) / stride;
+}
+
+} // namespace
+
+fs::path MeshCache::cachePath(const fs::path& sourcePath) {
+	fs::path path = sourcePath;
+	path += ".meshcache";
+	return path;
+}
+
+bool MeshCache::load(const fs::path& sourcePath, const VertexEncoding& encoding, const BuildCallback& build) {
+	if (open(sourcePath, encoding)) {
+		return true;
+	}
+	if (m_path.empty()) {
+		return false; // source could not be read
+	}
+
+	IndexedMesh mesh;
+	if (!build(mesh)) {
+		return false;
+	}
+	const size_t vertexCount = mesh.vertices.size();
+	std::vector<unsigned char> vertices(vertexCount * vertexLayout(encoding).stride);
+	const VertexDecoding decoding = encodeVertices(mesh.vertices.data(), vertexCount, encoding, vertices.data());
+	mesh.vertices = {};
+	save(vertices.data(), vertexCount, decoding, std::move(mesh));
+	if (!m_vertexData) {
+		m_vertices = std::move(vertices);
+		m_vertexData = m_vertices.data();
+	}
+	return true;
+}
+
+bool MeshCache::open(const fs::path& sourcePath, const VertexEncoding& encoding) {
+	m_file.close();
+	m_mesh = IndexedMesh{};
+	m_vertices = {};
+	m_cacheHit = false;
+	m_path.clear();
+	m_encoding = encoding;
+	m_vertexStride = vertexLayout(encoding).stride;
+
+	MappedFile source;
+	if (!source.open(sourcePath)) {
+		std::cerr << "Could not read " << sourcePath << std::endl;
+		return false;
+	}
+	m_sourceSize = source.size();
+	m_sourceHash = hashBytes(source.data(), source.size());
+	source.close();
+
+	m_path = cachePath(sourcePath);
+	m_cacheHit = openCache();
+	return m_cacheHit;
+}
+
+void MeshCache::save(const void* vertexData, size_t vertexCount, const VertexDecoding& decoding, IndexedMesh&& indices) {
+	if (writeCache(vertexData, vertexCount, decoding, indices) && openCache()) {
+		return;
+	}
+	std::cerr << "Could not write mesh cache " << m_path << ", keeping the mesh in memory" << std::endl;
+	useMesh(vertexCount, decoding, std::move(indices));
+}
+
+void MeshCache::keep(const VertexEncoding& encoding, const VertexDecoding& decoding, size_t vertexCount, size_t indexCount, bool use16BitIndices) {
+	m_file.close();
+	m_vertices = {};
+	m_cacheHit = false;
+	m_path.clear();
+	m_encoding = encoding;
+	m_vertexStride = vertexLayout(encoding).stride;
+	IndexedMesh mesh;
+	mesh.use16BitIndices = use16BitIndices;
+	mesh.chunks = { { 0, static_cast<uint32_t>(indexCount), 0 } };
+	useMesh(vertexCount, decoding, std::move(mesh));
+	m_indexData = nullptr;
+	m_indexCount = indexCount;
+}
+
+bool MeshCache::openCache() {
+	if (!m_file.open(m_path)) {
+		return false; // no cache yet
+	}
+
+	auto reject = [&](const char* reason) {
+		std::cout << "Rebuilding mesh cache " << m_path << " (" << reason << ")" << std::endl;
+		m_file.close();
+		return false;
+	};
+
+	const unsigned char* data = m_file.data();
+	const uint64_t fileSize = m_file.size();
+	if (fileSize < sizeof(MeshCacheHeader)) {
+		return reject("truncated");
+	}
+	MeshCacheHeader header;
+	std::memcpy(&header, data, sizeof(header));
+	if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+		return reject("not a mesh cache");
+	}
+	if (header.formatVersion != kFormatVersion || header.byteOrderMark != kByteOrderMark) {
+		return reject("unsupported format");
+	}
+	if (header.converterVersion != kMeshConverterVersion) {
+		return reject("older converter");
+	}
+	if (header.vertexEncoding != m_encoding.key() || header.vertexStride != m_vertexStride) {
+		return reject("other vertex encoding");
+	}
+	if (header.sourceHash != m_sourceHash || header.sourceSize != m_sourceSize) {
+		return reject("source changed");
+	}
+	if (header.payloadSize != fileSize - sizeof(MeshCacheHeader)) {
+		return reject("truncated");
+	}
+	if (hashBytes(data + sizeof(MeshCacheHeader), header.payloadSize) != header.payloadHash) {
+		return reject("corrupt");
+	}
+	if ((header.indexSize != sizeof(uint16_t) && header.indexSize != sizeof(uint32_t))
+		|| !sectionFits(header.vertexOffset, header.vertexCount, header.vertexStride, fileSize)
+		|| !sectionFits(header.indexOffset, header.indexCount, header.indexSize, fileSize)
+		|| !sectionFits(header.chunkOffset, header.chunkCount, sizeof(MeshChunk), fileSize)
+		|| !sectionFits(header.meshletOffset, header.meshletCount, sizeof(Meshlet), fileSize)
+		|| !sectionFits(header.shapeOffset, header.shapeCount, sizeof(MeshShape), fileSize)
+		|| !sectionFits(header.lodOffset, header.lodCount, sizeof(MeshLod), fileSize)
+		|| !sectionFits(header.materialOffset, header.materialSize, 1, fileSize)) {
+		return reject("corrupt");
+	}
+
+	m_chunks.resize(header.chunkCount);
+	std::memcpy(m_chunks.data(), data + header.chunkOffset, header.chunkCount * sizeof(MeshChunk));
+	for (const MeshChunk& chunk : m_chunks) {
+		if (chunk.firstIndex > header.indexCount || chunk.indexCount > header.indexCount - chunk.firstIndex) {
+			m_chunks.clear();
+			return reject("corrupt");
+		}
+	}
+	m_meshlets.resize(static_cast<size_t>(header.meshletCount));
+	std::memcpy(m_meshlets.data(), data + header.meshletOffset, m_meshlets.size() * sizeof(Meshlet));
+	for (const Meshlet& meshlet : m_meshlets) {
+		if (meshlet.firstIndex > header.indexCount || meshlet.indexCount > header.indexCount - meshlet.firstIndex) {
+			m_chunks.clear();
+			m_meshlets.clear();
+			return reject("corrupt");
+		}
+	}
+	m_lods.resize(static_cast<size_t>(header.lodCount));
+	std::memcpy(m_lods.data(), data + header.lodOffset, m_lods.size() * sizeof(MeshLod));
+	m_shapes.resize(static_cast<size_t>(header.shapeCount));
+	std::memcpy(m_shapes.data(), data + header.shapeOffset, m_shapes.size() * sizeof(MeshShape));
+	bool lodsValid = true;
+	for (const MeshLod& lod : m_lods) {
+		lodsValid = lodsValid && lod.firstIndex <= header.indexCount && lod.indexCount <= header.indexCount - lod.firstIndex;
+	}
+	m_materials.clear();
+	const char* names = reinterpret_cast<const char*>(data + header.materialOffset);
+	for (size_t begin = 0; begin < header.materialSize;) {
+		const void* end = std::memchr(names + begin, '\0', static_cast<size_t>(header.materialSize - begin));
+		if (!end) break;
+		m_materials.emplace_back(names + begin, static_cast<const char*>(end));
+		begin += m_materials.back().size() + 1;
+	}
+	for (const MeshShape& shape : m_shapes) {
+		lodsValid = lodsValid && shape.lodCount > 0 && shape.firstLod <= m_lods.size() && shape.lodCount <= m_lods.size() - shape.firstLod
+			&& (shape.material == kNoMaterial || shape.material < m_materials.size());
+	}
+	if (!lodsValid || m_materials.size() != header.materialCount) {
+		m_chunks.clear();
+		m_meshlets.clear();
+		m_shapes.clear();
+		m_lods.clear();
+		m_materials.clear();
+		return reject("corrupt");
+	}
+
+	m_vertexData = data + header.vertexOffset;
+	m_vertexCount = static_cast<size_t>(header.vertexCount);
+	m_vertexDecoding = VertexDecoding{};
+	m_vertexDecoding.octNormals = header.octNormals != 0;
+	m_vertexDecoding.positionOffset = glm::vec3(header.positionOffset[0], header.positionOffset[1], header.positionOffset[2]);
+	m_vertexDecoding.positionScale = glm::vec3(header.positionScale[0], header.positionScale[1], header.positionScale[2]);
+	m_vertexDecoding.maxPositionError = header.maxPositionError;
+	m_vertexDecoding.maxNormalError = header.maxNormalError;
+	m_vertexDecoding.maxColorError = header.maxColorError;
+	m_vertexDecoding.maxUVError = header.maxUVError;
+	m_vertexDecoding.radius = header.radius;
+	m_indexData = data + header.indexOffset;
+	m_indexCount = static_cast<size_t>(header.indexCount);
+	m_use16BitIndices = header.indexSize == sizeof(uint16_t);
+	return true;
+}
+
+bool MeshCache::writeCache(const void* vertexData, size_t vertexCount, const VertexDecoding& decoding, const IndexedMesh& indices) const {
+	MeshCacheHeader header{};
+	std::memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.formatVersion = kFormatVersion;
+	header.converterVersion = kMeshConverterVersion;
+	header.byteOrderMark = kByteOrderMark;
+	header.vertexStride = m_vertexStride;
+	header.vertexEncoding = m_encoding.key();
+	header.octNormals = decoding.octNormals ? 1 : 0;
+	for (int i = 0; i < 3; ++i) {
+		header.positionOffset[i] = decoding.positionOffset[i];
+		header.positionScale[i] = decoding.positionScale[i];
+	}
+	header.maxPositionError = decoding.maxPositionError;
+	header.maxNormalError = decoding.maxNormalError;
+	header.maxColorError = decoding.maxColorError;
+	header.maxUVError = decoding.maxUVError;
+	header.radius = decoding.radius;
+	header.sourceHash = m_sourceHash;
+	header.sourceSize = m_sourceSize;
+	header.vertexCount = vertexCount;
+	header.vertexOffset = sizeof(MeshCacheHeader);
+	header.indexCount = indices.indexCount();
+	header.indexSize = static_cast<uint32_t>(indices.indexSize());
+	header.indexOffset = alignUp(header.vertexOffset + header.vertexCount * header.vertexStride);
+	header.chunkCount = static_cast<uint32_t>(indices.chunks.size());
+	header.chunkOffset = alignUp(header.indexOffset + header.indexCount * header.indexSize);
+	header.meshletCount = indices.meshlets.size();
+	header.meshletOffset = alignUp(header.chunkOffset + header.chunkCount * sizeof(MeshChunk));
+	header.shapeCount = indices.shapes.size();
+	header.shapeOffset = alignUp(header.meshletOffset + header.meshletCount * sizeof(Meshlet));
+	header.lodCount = indices.lods.size();
+	header.lodOffset = alignUp(header.shapeOffset + header.shapeCount * sizeof(MeshShape));
+	std::string materialNames;
+	for (const std::string& name : indices.materials) {
+		materialNames.append(name.c_str(), name.size() + 1);
+	}
+	header.materialCount = indices.materials.size();
+	header.materialOffset = alignUp(header.lodOffset + header.lodCount * sizeof(MeshLod));
+	header.materialSize = materialNames.size();
+	const uint64_t fileSize = alignUp(header.materialOffset + header.materialSize);
+	header.payloadSize = fileSize - sizeof(MeshCacheHeader);
+
+	// Write to a temporary file first, so that a crash or a concurrent
+	// launch never sees a half written cache. Sections are written straight
+	// from where they are (the vertices may be a mapped GPU buffer) and
+	// hashed on the way, then the header is written over its placeholder.
+	fs::path tmpPath = m_path;
+	tmpPath += ".tmp";
+	bool written;
+	{
+		std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+		if (!file) return false;
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		IncrementalHash payloadHash;
+		uint64_t offset = sizeof(MeshCacheHeader);
+		auto writeSection = [&](uint64_t sectionOffset, const void* data, uint64_t size) {
+			static const char padding[kSectionAlignment] = {};
+			const size_t paddingSize = static_cast<size_t>(sectionOffset - offset);
+			file.write(padding, static_cast<std::streamsize>(paddingSize));
+			payloadHash.update(padding, paddingSize);
+			file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+			payloadHash.update(data, static_cast<size_t>(size));
+			offset = sectionOffset + size;
+		};
+		writeSection(header.vertexOffset, vertexData, header.vertexCount * header.vertexStride);
+		writeSection(header.indexOffset, indices.indexData(), header.indexCount * header.indexSize);
+		writeSection(header.chunkOffset, indices.chunks.data(), header.chunkCount * sizeof(MeshChunk));
+		writeSection(header.meshletOffset, indices.meshlets.data(), header.meshletCount * sizeof(Meshlet));
+		writeSection(header.shapeOffset, indices.shapes.data(), header.shapeCount * sizeof(MeshShape));
+		writeSection(header.lodOffset, indices.lods.data(), header.lodCount * sizeof(MeshLod));
+		writeSection(header.materialOffset, materialNames.data(), header.materialSize);
+		writeSection(fileSize, nullptr, 0);
+		header.payloadHash = payloadHash.digest();
+		file.seekp(0);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.close();
+		written = !file.fail();
+	}
+	std::error_code error;
+	if (written) {
+		fs::rename(tmpPath, m_path, error);
+	}
+	if (!written || error) {
+		fs::remove(tmpPath, error);
+		return false;
+	}
+	return true;
+}
+
+void MeshCache::useMesh(size_t vertexCount, const VertexDecoding& decoding, IndexedMesh&& mesh) {
+	m_mesh = std::move(mesh);
+	m_vertexData = nullptr;
+	m_vertexCount = vertexCount;
+	m_vertexDecoding = decoding;
+	m_indexData = m_mesh.indexData();
+	m_indexCount = m_mesh.indexCount();
+	m_use16BitIndices = m_mesh.use16BitIndices;
+	m_chunks = m_mesh.chunks;
+	m_meshlets = m_mesh.meshlets;
+	m_shapes = m_mesh.shapes;
+	m_lods = m_mesh.lods;
+	m_materials = m_mesh.materials;
+}
@@ -0,0 +1,119 @@
+/**
+ * Binary cache of converted meshes.
+ *
+ * The cache of `foo.obj` is written next to it as `foo.obj.meshcache` and
+ * holds the final vertex and index streams, vertices already in the
+ * encoding of the vertex buffer (see VertexEncoding.h), so that a warm
+ * start maps the file and uploads its bytes without touching individual
+ * vertices. A cache is only used when it was built from the same source
+ * bytes by the same converter, with the same vertex encoding; otherwise, or
+ * when it is truncated or corrupt, it is rebuilt.
+ */
+
+#pragma once
+
+#include "MappedFile.h"
+#include "Mesh.h"
+#include "VertexEncoding.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Bump this whenever the conversion from OBJ to IndexedMesh changes
+ * (axis swap, welding, index format selection, triangle order, meshlets, levels of detail, materials...)
+ * so that existing caches get rebuilt.
+ */
+constexpr uint32_t kMeshConverterVersion = 7;
+
+class MeshCache {
+public:
+	using BuildCallback = std::function<bool(IndexedMesh& mesh)>;
+
+	/**
+	 * Loads the cached mesh of `sourcePath`, with vertices in `encoding`.
+	 * When the cache is missing, stale or corrupt, calls `build` to convert
+	 * the source, encodes its vertices and writes a new cache (if the
+	 * directory is not writable, the mesh is just kept in memory). Returns
+	 * false if the source cannot be read or `build` fails.
+	 */
+	bool load(const std::filesystem::path& sourcePath, const VertexEncoding& encoding, const BuildCallback& build);
+
+	/**
+	 * Maps the cache of `sourcePath` if it is valid and its vertices are in
+	 * `encoding`. Otherwise returns false, and the caller converts the
+	 * source and calls `save`.
+	 */
+	bool open(const std::filesystem::path& sourcePath, const VertexEncoding& encoding);
+
+	/**
+	 * Writes the cache of the source last passed to `open`, from vertices in
+	 * the encoding passed to `open` that live outside of `indices` (e.g. in
+	 * a mapped GPU buffer), then maps it. If the cache cannot be written,
+	 * keeps `indices` in memory, and `vertexData()` is null.
+	 */
+	void save(const void* vertexData, size_t vertexCount, const VertexDecoding& decoding, IndexedMesh&& indices);
+
+	/**
+	 * Describes, without writing a cache, a mesh that was written straight
+	 * into GPU buffers as a single chunk, for sources that load about as
+	 * fast as their cache would. `vertexData()` and `indexData()` are null.
+	 */
+	void keep(const VertexEncoding& encoding, const VertexDecoding& decoding, size_t vertexCount, size_t indexCount, bool use16BitIndices);
+
+	/**
+	 * Whether the last `load` or `open` used an existing cache.
+	 */
+	bool wasCacheHit() const { return m_cacheHit; }
+
+	/**
+	 * Encoded vertices, ready to be copied into the vertex buffer
+	 */
+	const void* vertexData() const { return m_vertexData; }
+	size_t vertexCount() const { return m_vertexCount; }
+	size_t vertexDataSize() const { return m_vertexCount * m_vertexStride; }
+	const VertexDecoding& vertexDecoding() const { return m_vertexDecoding; }
+
+	const void* indexData() const { return m_indexData; }
+	size_t indexCount() const { return m_indexCount; }
+	bool use16BitIndices() const { return m_use16BitIndices; }
+	size_t indexDataSize() const { return m_indexCount * (m_use16BitIndices ? sizeof(uint16_t) : sizeof(uint32_t)); }
+
+	const std::vector<MeshChunk>& chunks() const { return m_chunks; }
+	const std::vector<Meshlet>& meshlets() const { return m_meshlets; }
+	const std::vector<MeshShape>& shapes() const { return m_shapes; }
+	const std::vector<MeshLod>& lods() const { return m_lods; }
+	const std::vector<std::string>& materials() const { return m_materials; }
+
+	static std::filesystem::path cachePath(const std::filesystem::path& sourcePath);
+
+private:
+	bool openCache();
+	bool writeCache(const void* vertexData, size_t vertexCount, const VertexDecoding& decoding, const IndexedMesh& indices) const;
+	void useMesh(size_t vertexCount, const VertexDecoding& decoding, IndexedMesh&& mesh);
+
+private:
+	std::filesystem::path m_path;
+	uint64_t m_sourceHash = 0;
+	uint64_t m_sourceSize = 0;
+	MappedFile m_file;
+	VertexEncoding m_encoding;
+	IndexedMesh m_mesh; // only used when the cache could not be written
+	std::vector<unsigned char> m_vertices; // same, for vertices encoded here
+	bool m_cacheHit = false;
+	const void* m_vertexData = nullptr;
+	size_t m_vertexCount = 0;
+	uint32_t m_vertexStride = sizeof(VertexAttributes);
+	VertexDecoding m_vertexDecoding;
+	const void* m_indexData = nullptr;
+	size_t m_indexCount = 0;
+	bool m_use16BitIndices = false;
+	std::vector<MeshChunk> m_chunks;
+	std::vector<Meshlet> m_meshlets;
+	std::vector<MeshShape> m_shapes;
+	std::vector<MeshLod> m_lods;
+	std::vector<std::string> m_materials;
+};
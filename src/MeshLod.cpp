@@ -0,0 +1,393 @@
+#include "MeshLod.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+enum class VertexKind : uint8_t {
+	Manifold, // can collapse onto any neighbour
+	Border, // can only collapse along the border
+	Locked, // on a seam or a non manifold edge, never moves
+};
+
+// Weight of the planes that keep borders in place, relative to triangles
+constexpr double kBorderWeight = 10.0;
+
+/**
+ * Sum of squared distances to weighted planes, as a symmetric 4x4 matrix.
+ */
+struct Quadric {
+	double a2 = 0, b2 = 0, c2 = 0, ab = 0, ac = 0, bc = 0, ad = 0, bd = 0, cd = 0, d2 = 0;
+	double weight = 0;
+
+	void addPlane(const glm::dvec3& n, double d, double w) {
+		a2 += w * n.x * n.x; b2 += w * n.y * n.y; c2 += w * n.z * n.z;
+		ab += w * n.x * n.y; ac += w * n.x * n.z; bc += w * n.y * n.z;
+		ad += w * n.x * d; bd += w * n.y * d; cd += w * n.z * d;
+		d2 += w * d * d;
+		weight += w;
+	}
+
+	void add(const Quadric& q) {
+		a2 += q.a2; b2 += q.b2; c2 += q.c2;
+		ab += q.ab; ac += q.ac; bc += q.bc;
+		ad += q.ad; bd += q.bd; cd += q.cd;
+		d2 += q.d2;
+		weight += q.weight;
+	}
+
+	double evaluate(const glm::dvec3& p) const {
+		const double value = a2 * p.x * p.x + b2 * p.y * p.y + c2 * p.z * p.z
+			+ 2 * (ab * p.x * p.y + ac * p.x * p.z + bc * p.y * p.z)
+			+ 2 * (ad * p.x + bd * p.y + cd * p.z)
+			+ d2;
+		return std::max(value, 0.0);
+	}
+};
+
+struct Collapse {
+	uint32_t from;
+	uint32_t to;
+	double cost; // mean squared distance
+};
+
+uint64_t edgeKey(uint32_t a, uint32_t b) {
+	return (static_cast<uint64_t>(a) << 32) | b;
+}
+
+} // namespace
+
+std::vector<uint32_t> simplifyMesh(
+	const uint32_t* indices,
+	size_t indexCount,
+	const std::vector<glm::vec3>& positions,
+	size_t targetIndexCount,
+	float maxError,
+	float* error
+) {
+	std::vector<uint32_t> result(indices, indices + indexCount / 3 * 3);
+	*error = 0.0f;
+	if (result.size() <= targetIndexCount) return result;
+	const size_t vertexCount = positions.size();
+
+	// 1. Vertices that share a position are on a seam: they are locked, and
+	// edges are compared by position through the first of them.
+	std::vector<bool> referenced(vertexCount, false);
+	for (uint32_t v : result) referenced[v] = true;
+	std::vector<uint32_t> order;
+	for (uint32_t v = 0; v < vertexCount; ++v) {
+		if (referenced[v]) order.push_back(v);
+	}
+	auto lessPosition = [&](uint32_t a, uint32_t b) {
+		const glm::vec3& pa = positions[a];
+		const glm::vec3& pb = positions[b];
+		if (pa.x != pb.x) return pa.x < pb.x;
+		if (pa.y != pb.y) return pa.y < pb.y;
+		if (pa.z != pb.z) return pa.z < pb.z;
+		return a < b;
+	};
+	std::sort(order.begin(), order.end(), lessPosition);
+	std::vector<uint32_t> positionId(vertexCount);
+	std::vector<VertexKind> kind(vertexCount, VertexKind::Manifold);
+	for (size_t i = 0; i < order.size();) {
+		size_t j = i + 1;
+		while (j < order.size() && positions[order[j]] == positions[order[i]]) ++j;
+		for (size_t k = i; k < j; ++k) {
+			positionId[order[k]] = order[i];
+			if (j - i > 1) kind[order[k]] = VertexKind::Locked;
+		}
+		i = j;
+	}
+
+	// 2. Border edges have no opposite edge, non manifold ones are shared by
+	// more than two triangles or twice in the same direction.
+	std::vector<uint64_t> edges;
+	edges.reserve(result.size());
+	for (size_t t = 0; t < result.size(); t += 3) {
+		for (int k = 0; k < 3; ++k) {
+			edges.push_back(edgeKey(positionId[result[t + k]], positionId[result[t + (k + 1) % 3]]));
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	auto edgeCount = [&](uint32_t a, uint32_t b) {
+		auto range = std::equal_range(edges.begin(), edges.end(), edgeKey(a, b));
+		return static_cast<size_t>(range.second - range.first);
+	};
+	auto isBorderEdge = [&](uint32_t a, uint32_t b) {
+		return edgeCount(positionId[a], positionId[b]) + edgeCount(positionId[b], positionId[a]) == 1;
+	};
+	for (size_t t = 0; t < result.size(); t += 3) {
+		for (int k = 0; k < 3; ++k) {
+			const uint32_t a = result[t + k];
+			const uint32_t b = result[t + (k + 1) % 3];
+			const size_t forward = edgeCount(positionId[a], positionId[b]);
+			const size_t backward = edgeCount(positionId[b], positionId[a]);
+			if (forward > 1 || backward > 1) {
+				kind[a] = kind[b] = VertexKind::Locked;
+			} else if (backward == 0) {
+				if (kind[a] == VertexKind::Manifold) kind[a] = VertexKind::Border;
+				if (kind[b] == VertexKind::Manifold) kind[b] = VertexKind::Border;
+			}
+		}
+	}
+
+	// 3. Quadrics of the planes of the triangles around each vertex, plus
+	// planes perpendicular to the border edges
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t t = 0; t < result.size(); t += 3) {
+		const glm::dvec3 p0 = positions[result[t]];
+		const glm::dvec3 p1 = positions[result[t + 1]];
+		const glm::dvec3 p2 = positions[result[t + 2]];
+		glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+		const double length = glm::length(n);
+		if (length == 0.0) continue;
+		n /= length;
+		const double area = 0.5 * length;
+		for (int k = 0; k < 3; ++k) {
+			quadrics[result[t + k]].addPlane(n, -glm::dot(n, p0), area);
+		}
+		for (int k = 0; k < 3; ++k) {
+			const uint32_t a = result[t + k];
+			const uint32_t b = result[t + (k + 1) % 3];
+			if (!isBorderEdge(a, b)) continue;
+			const glm::dvec3 pa = positions[a];
+			const glm::dvec3 edge = glm::dvec3(positions[b]) - pa;
+			const glm::dvec3 m = glm::cross(edge, n);
+			const double mLength = glm::length(m);
+			if (mLength == 0.0) continue;
+			const glm::dvec3 borderNormal = m / mLength;
+			const double w = kBorderWeight * glm::dot(edge, edge);
+			quadrics[a].addPlane(borderNormal, -glm::dot(borderNormal, pa), w);
+			quadrics[b].addPlane(borderNormal, -glm::dot(borderNormal, pa), w);
+		}
+	}
+
+	// 4. Collapse the cheapest edges, in passes that each touch a vertex at
+	// most once, until the target is reached or no collapse is cheap enough
+	const double maxCost = static_cast<double>(maxError) * maxError;
+	double worstCost = 0.0;
+	std::vector<size_t> adjacencyBegin(vertexCount + 1);
+	std::vector<uint32_t> adjacency;
+	std::vector<Collapse> best(vertexCount);
+	std::vector<Collapse> collapses;
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<bool> touched(vertexCount);
+	while (result.size() > targetIndexCount) {
+		// Vertex to triangle adjacency
+		std::fill(adjacencyBegin.begin(), adjacencyBegin.end(), 0);
+		for (uint32_t v : result) ++adjacencyBegin[v + 1];
+		for (size_t v = 0; v < vertexCount; ++v) adjacencyBegin[v + 1] += adjacencyBegin[v];
+		adjacency.resize(result.size());
+		{
+			std::vector<size_t> cursor(adjacencyBegin.begin(), adjacencyBegin.end() - 1);
+			for (size_t i = 0; i < result.size(); ++i) {
+				adjacency[cursor[result[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+
+		// Cheapest collapse of each vertex
+		std::fill(best.begin(), best.end(), Collapse{ 0, 0, std::numeric_limits<double>::infinity() });
+		for (size_t t = 0; t < result.size(); t += 3) {
+			for (int k = 0; k < 3; ++k) {
+				const uint32_t a = result[t + k];
+				const uint32_t b = result[t + (k + 1) % 3];
+				// An edge between manifold vertices has an opposite edge,
+				// from which it is only considered once
+				if (a > b && kind[a] == VertexKind::Manifold && kind[b] == VertexKind::Manifold) continue;
+				for (int direction = 0; direction < 2; ++direction) {
+					const uint32_t from = direction == 0 ? a : b;
+					const uint32_t to = direction == 0 ? b : a;
+					const bool allowed = kind[from] == VertexKind::Manifold
+						|| (kind[from] == VertexKind::Border && isBorderEdge(from, to));
+					if (!allowed) continue;
+					Quadric q = quadrics[from];
+					q.add(quadrics[to]);
+					const double cost = q.weight > 0.0 ? q.evaluate(positions[to]) / q.weight : 0.0;
+					if (cost < best[from].cost || (cost == best[from].cost && to < best[from].to)) {
+						best[from] = { from, to, cost };
+					}
+				}
+			}
+		}
+		collapses.clear();
+		for (const Collapse& collapse : best) {
+			if (collapse.cost <= maxCost) collapses.push_back(collapse);
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) {
+			if (x.cost != y.cost) return x.cost < y.cost;
+			if (x.from != y.from) return x.from < y.from;
+			return x.to < y.to;
+		});
+
+		// An interior collapse removes 2 triangles
+		const size_t goal = std::max<size_t>(1, (result.size() - targetIndexCount) / 6);
+		std::iota(remap.begin(), remap.end(), 0);
+		std::fill(touched.begin(), touched.end(), false);
+		size_t collapseCount = 0;
+		for (const Collapse& collapse : collapses) {
+			if (collapseCount >= goal) break;
+			if (touched[collapse.from] || touched[collapse.to]) continue;
+
+			// Reject collapses that flip a triangle
+			const glm::vec3 pTo = positions[collapse.to];
+			bool flips = false;
+			for (size_t i = adjacencyBegin[collapse.from]; i < adjacencyBegin[collapse.from + 1] && !flips; ++i) {
+				const uint32_t* tri = &result[3 * adjacency[i]];
+				if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to) continue;
+				glm::vec3 before[3], after[3];
+				for (int k = 0; k < 3; ++k) {
+					before[k] = positions[tri[k]];
+					after[k] = tri[k] == collapse.from ? pTo : before[k];
+				}
+				const glm::vec3 nBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+				const glm::vec3 nAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+				flips = glm::dot(nBefore, nAfter) <= 0.0f;
+			}
+			if (flips) continue;
+
+			remap[collapse.from] = collapse.to;
+			quadrics[collapse.to].add(quadrics[collapse.from]);
+			worstCost = std::max(worstCost, collapse.cost);
+			for (size_t i = adjacencyBegin[collapse.from]; i < adjacencyBegin[collapse.from + 1]; ++i) {
+				const uint32_t* tri = &result[3 * adjacency[i]];
+				touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+			}
+			++collapseCount;
+		}
+		if (collapseCount == 0) break;
+
+		// Drop the triangles that became degenerate
+		size_t kept = 0;
+		for (size_t t = 0; t < result.size(); t += 3) {
+			const uint32_t a = remap[result[t]], b = remap[result[t + 1]], c = remap[result[t + 2]];
+			if (a == b || b == c || c == a) continue;
+			result[kept++] = a;
+			result[kept++] = b;
+			result[kept++] = c;
+		}
+		result.resize(kept);
+	}
+
+	*error = static_cast<float>(std::sqrt(worstCost));
+	return result;
+}
+
+void buildLods(
+	std::vector<uint32_t>& indices,
+	const std::vector<glm::vec3>& positions,
+	const std::vector<size_t>& shapeOffsets,
+	const LodSettings& settings,
+	std::vector<MeshShape>& shapes,
+	std::vector<MeshLod>& lods,
+	unsigned threadCount
+) {
+	indices.resize(indices.size() / 3 * 3);
+	const std::vector<size_t> bounds = shapeBoundaries(indices.size(), shapeOffsets);
+	const size_t shapeCount = bounds.size() - 1;
+
+	struct ShapeLods {
+		MeshShape shape;
+		std::vector<MeshLod> lods; // first indices relative to `indices`
+		std::vector<uint32_t> indices; // all levels but the first one
+	};
+	std::vector<ShapeLods> results(shapeCount);
+
+	parallelFor(shapeCount, [&](size_t s) {
+		ShapeLods& result = results[s];
+		const uint32_t* shapeIndices = indices.data() + bounds[s];
+		const size_t shapeIndexCount = bounds[s + 1] - bounds[s];
+
+		// Work on local vertex ids, like the vertex cache optimization
+		std::vector<uint32_t> localToGlobal(shapeIndices, shapeIndices + shapeIndexCount);
+		std::sort(localToGlobal.begin(), localToGlobal.end());
+		localToGlobal.erase(std::unique(localToGlobal.begin(), localToGlobal.end()), localToGlobal.end());
+		std::vector<uint32_t> localIndices(shapeIndexCount);
+		for (size_t i = 0; i < shapeIndexCount; ++i) {
+			auto it = std::lower_bound(localToGlobal.begin(), localToGlobal.end(), shapeIndices[i]);
+			localIndices[i] = static_cast<uint32_t>(it - localToGlobal.begin());
+		}
+		std::vector<glm::vec3> localPositions(localToGlobal.size());
+		glm::vec3 lo = positions[localToGlobal[0]], hi = lo;
+		for (size_t v = 0; v < localToGlobal.size(); ++v) {
+			localPositions[v] = positions[localToGlobal[v]];
+			lo = glm::min(lo, localPositions[v]);
+			hi = glm::max(hi, localPositions[v]);
+		}
+
+		MeshShape& shape = result.shape;
+		shape.center = 0.5f * (lo + hi);
+		shape.radius = 0.0f;
+		for (const glm::vec3& p : localPositions) {
+			shape.radius = std::max(shape.radius, glm::length(p - shape.center));
+		}
+		result.lods.push_back({ static_cast<uint32_t>(bounds[s]), static_cast<uint32_t>(shapeIndexCount), 0.0f });
+
+		float error = 0.0f;
+		for (unsigned level = 0; level < settings.levelCount; ++level) {
+			const size_t target = static_cast<size_t>(localIndices.size() / 3 * settings.reduction) * 3;
+			float levelError;
+			std::vector<uint32_t> simplified = simplifyMesh(
+				localIndices.data(), localIndices.size(), localPositions,
+				target, settings.maxRelativeError * shape.radius, &levelError
+			);
+			// Stop when simplification gets stuck (seams, error bound)
+			if (simplified.empty() || 10 * simplified.size() > 9 * localIndices.size()) break;
+
+			// Errors of successive levels add up, since each one is
+			// simplified from the previous one
+			error += levelError;
+			result.lods.push_back({ static_cast<uint32_t>(result.indices.size()), static_cast<uint32_t>(simplified.size()), error });
+			for (uint32_t i : simplified) {
+				result.indices.push_back(localToGlobal[i]);
+			}
+			localIndices = std::move(simplified);
+		}
+	}, threadCount);
+
+	shapes.clear();
+	lods.clear();
+	for (ShapeLods& result : results) {
+		result.shape.firstLod = static_cast<uint32_t>(lods.size());
+		result.shape.lodCount = static_cast<uint32_t>(result.lods.size());
+		shapes.push_back(result.shape);
+		const uint32_t offset = static_cast<uint32_t>(indices.size());
+		lods.push_back(result.lods[0]);
+		for (size_t level = 1; level < result.lods.size(); ++level) {
+			MeshLod lod = result.lods[level];
+			lod.firstIndex += offset;
+			lods.push_back(lod);
+		}
+		indices.insert(indices.end(), result.indices.begin(), result.indices.end());
+	}
+}
+
+uint32_t selectLod(
+	const MeshShape& shape,
+	const std::vector<MeshLod>& lods,
+	const glm::vec3& cameraPosition,
+	float pixelsPerUnit,
+	float maxPixelError
+) {
+	const float distance = glm::length(shape.center - cameraPosition) - shape.radius;
+	return selectLodAtDistance(shape, lods, distance, pixelsPerUnit, maxPixelError);
+}
+
+uint32_t selectLodAtDistance(
+	const MeshShape& shape,
+	const std::vector<MeshLod>& lods,
+	float distance,
+	float pixelsPerUnit,
+	float maxPixelError
+) {
+	if (distance <= 0.0f) return 0;
+	for (uint32_t level = shape.lodCount; level-- > 1;) {
+		if (lods[shape.firstLod + level].error * pixelsPerUnit <= maxPixelError * distance) {
+			return level;
+		}
+	}
+	return 0;
+}
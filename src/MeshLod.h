@@ -0,0 +1,92 @@
+/**
+ * Levels of detail, generated by quadric error simplification ("Surface
+ * Simplification Using Quadric Error Metrics", Garland and Heckbert, 1997).
+ *
+ * Edges are collapsed onto one of their two vertices rather than onto a new
+ * position, so every level indexes the vertices of the full detail mesh:
+ * all levels share one vertex buffer and live in one index buffer, and
+ * switching levels only changes the range that is drawn.
+ *
+ * Vertices on a UV or normal seam (several vertices at the same position)
+ * never move, so that seams do not open. Vertices on the open border of a
+ * shape only slide along the border.
+ */
+
+#pragma once
+
+#include "Mesh.h"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct LodSettings {
+	// Maximum number of levels after the full detail one
+	unsigned levelCount = 4;
+	// Each level aims at this fraction of the triangles of the previous one
+	float reduction = 0.5f;
+	// Collapses that move the surface further than this fraction of the
+	// radius of the shape are rejected
+	float maxRelativeError = 0.05f;
+};
+
+/**
+ * Simplifies a triangle list towards `targetIndexCount` indices. Returns the
+ * new triangle list, which indexes the same vertices, and sets `error` to
+ * the largest distance the surface moved, in mesh units.
+ * @param maxError Collapses that would move the surface further are not done.
+ */
+std::vector<uint32_t> simplifyMesh(
+	const uint32_t* indices,
+	size_t indexCount,
+	const std::vector<glm::vec3>& positions,
+	size_t targetIndexCount,
+	float maxError,
+	float* error
+);
+
+/**
+ * Generates the levels of detail of each shape of `indices` (see
+ * shapeBoundaries in Mesh.h), appends their triangles to `indices`, and
+ * fills `shapes` and `lods`. Shapes are processed on worker threads, and the
+ * result does not depend on the number of threads.
+ * @param threadCount Number of worker threads, 0 to use all cores.
+ */
+void buildLods(
+	std::vector<uint32_t>& indices,
+	const std::vector<glm::vec3>& positions,
+	const std::vector<size_t>& shapeOffsets,
+	const LodSettings& settings,
+	std::vector<MeshShape>& shapes,
+	std::vector<MeshLod>& lods,
+	unsigned threadCount = 0
+);
+
+/**
+ * Coarsest level of `shape` whose error, projected on screen, stays below
+ * `maxPixelError`. Returns an index relative to `shape.firstLod`.
+ * @param cameraPosition In model space.
+ * @param pixelsPerUnit Size on screen of one unit at a distance of one
+ *        unit, i.e. projectionMatrix[1][1] * viewportHeight / 2.
+ */
+uint32_t selectLod(
+	const MeshShape& shape,
+	const std::vector<MeshLod>& lods,
+	const glm::vec3& cameraPosition,
+	float pixelsPerUnit,
+	float maxPixelError = 1.0f
+);
+
+/**
+ * Same as selectLod, for a shape at least `distance` away from the camera
+ * (e.g. that of a bounding sphere of several shapes), in model units.
+ */
+uint32_t selectLodAtDistance(
+	const MeshShape& shape,
+	const std::vector<MeshLod>& lods,
+	float distance,
+	float pixelsPerUnit,
+	float maxPixelError = 1.0f
+);
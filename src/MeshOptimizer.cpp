@@ -0,0 +1,263 @@
+#include "MeshOptimizer.h"
+#include "Mesh.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+constexpr uint32_t kNoVertex = std::numeric_limits<uint32_t>::max();
+
+/**
+ * Tipsify on a compact range of vertices, then overdraw sorting.
+ */
+void optimizeShape(uint32_t* indices, size_t indexCount, const std::vector<glm::vec3>& positions) {
+	// Work on local vertex ids, so that the temporary arrays are sized after
+	// the shape and not after the whole mesh.
+	std::vector<uint32_t> localToGlobal(indices, indices + indexCount);
+	std::sort(localToGlobal.begin(), localToGlobal.end());
+	localToGlobal.erase(std::unique(localToGlobal.begin(), localToGlobal.end()), localToGlobal.end());
+
+	std::vector<uint32_t> localIndices(indexCount);
+	for (size_t i = 0; i < indexCount; ++i) {
+		auto it = std::lower_bound(localToGlobal.begin(), localToGlobal.end(), indices[i]);
+		localIndices[i] = static_cast<uint32_t>(it - localToGlobal.begin());
+	}
+	std::vector<glm::vec3> localPositions(localToGlobal.size());
+	for (size_t v = 0; v < localToGlobal.size(); ++v) {
+		localPositions[v] = positions[localToGlobal[v]];
+	}
+
+	std::vector<size_t> clusters;
+	optimizeVertexCache(localIndices.data(), indexCount, localToGlobal.size(), clusters);
+	optimizeOverdraw(localIndices.data(), indexCount, localPositions.data(), clusters);
+
+	for (size_t i = 0; i < indexCount; ++i) {
+		indices[i] = localToGlobal[localIndices[i]];
+	}
+}
+
+} // namespace
+
+VertexCacheStats analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, unsigned cacheSize) {
+	VertexCacheStats stats;
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0) return stats;
+
+	// A vertex is in the FIFO while fewer than `cacheSize` other vertices
+	// were inserted after it.
+	const size_t never = std::numeric_limits<size_t>::max();
+	std::vector<size_t> insertedAt(vertexCount, never);
+	std::vector<bool> referenced(vertexCount, false);
+	size_t misses = 0;
+	size_t referencedCount = 0;
+	for (size_t i = 0; i < 3 * triangleCount; ++i) {
+		const uint32_t v = indices[i];
+		if (insertedAt[v] == never || misses - insertedAt[v] >= cacheSize) {
+			insertedAt[v] = misses++;
+		}
+		if (!referenced[v]) {
+			referenced[v] = true;
+			++referencedCount;
+		}
+	}
+
+	stats.acmr = static_cast<double>(misses) / triangleCount;
+	stats.atvr = static_cast<double>(misses) / referencedCount;
+	return stats;
+}
+
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<size_t>& clusters, unsigned cacheSize) {
+	clusters.clear();
+	const size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0) return;
+
+	// Vertex to triangle adjacency, and number of triangles left to emit
+	// around each vertex
+	std::vector<uint32_t> liveCount(vertexCount, 0);
+	for (size_t i = 0; i < 3 * triangleCount; ++i) {
+		++liveCount[indices[i]];
+	}
+	std::vector<size_t> adjacencyBegin(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; ++v) {
+		adjacencyBegin[v + 1] = adjacencyBegin[v] + liveCount[v];
+	}
+	std::vector<uint32_t> adjacency(3 * triangleCount);
+	{
+		std::vector<size_t> cursor(adjacencyBegin.begin(), adjacencyBegin.end() - 1);
+		for (size_t i = 0; i < 3 * triangleCount; ++i) {
+			adjacency[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+	}
+
+	std::vector<size_t> cacheTime(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> deadEnd; // recently used vertices, to restart from
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> output;
+	output.reserve(3 * triangleCount);
+
+	size_t timestamp = cacheSize + 1;
+	uint32_t scanCursor = 0;
+
+	// Next vertex that still has triangles to emit, when the fan around
+	// the current one leads nowhere
+	auto skipDeadEnd = [&]() {
+		while (!deadEnd.empty()) {
+			uint32_t v = deadEnd.back();
+			deadEnd.pop_back();
+			if (liveCount[v] > 0) return v;
+		}
+		while (scanCursor < vertexCount) {
+			if (liveCount[scanCursor] > 0) return scanCursor;
+			++scanCursor;
+		}
+		return kNoVertex;
+	};
+
+	clusters.push_back(0);
+	uint32_t fanning = indices[0];
+	while (fanning != kNoVertex) {
+		// Emit all remaining triangles around the fanning vertex
+		candidates.clear();
+		for (size_t a = adjacencyBegin[fanning]; a < adjacencyBegin[fanning + 1]; ++a) {
+			const uint32_t t = adjacency[a];
+			if (emitted[t]) continue;
+			for (int k = 0; k < 3; ++k) {
+				const uint32_t v = indices[3 * t + k];
+				output.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				--liveCount[v];
+				if (timestamp - cacheTime[v] > cacheSize) {
+					cacheTime[v] = timestamp++;
+				}
+			}
+			emitted[t] = true;
+		}
+
+		// Pick the candidate that will still be in the cache once its own
+		// fan is emitted, preferring the oldest one
+		uint32_t next = kNoVertex;
+		long long bestPriority = -1;
+		for (uint32_t v : candidates) {
+			if (liveCount[v] == 0) continue;
+			long long priority = 0;
+			if (timestamp - cacheTime[v] + 2 * static_cast<size_t>(liveCount[v]) <= cacheSize) {
+				priority = static_cast<long long>(timestamp - cacheTime[v]);
+			}
+			if (priority > bestPriority) {
+				bestPriority = priority;
+				next = v;
+			}
+		}
+		if (next == kNoVertex) {
+			next = skipDeadEnd();
+			if (next != kNoVertex && output.size() < 3 * triangleCount) {
+				clusters.push_back(output.size());
+			}
+		}
+		fanning = next;
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+}
+
+void optimizeOverdraw(uint32_t* indices, size_t indexCount, const glm::vec3* positions, const std::vector<size_t>& clusters) {
+	if (clusters.size() <= 1) return;
+	const size_t end = indexCount / 3 * 3;
+
+	struct Cluster {
+		size_t begin;
+		size_t end;
+		float key;
+	};
+	std::vector<Cluster> sorted(clusters.size());
+
+	// Area weighted centroids of the mesh and of each cluster
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	std::vector<glm::vec3> centroids(clusters.size());
+	std::vector<glm::vec3> normals(clusters.size());
+	for (size_t c = 0; c < clusters.size(); ++c) {
+		sorted[c].begin = clusters[c];
+		sorted[c].end = c + 1 < clusters.size() ? clusters[c + 1] : end;
+		glm::vec3 centroid(0.0f), normal(0.0f);
+		float area = 0.0f;
+		for (size_t i = sorted[c].begin; i < sorted[c].end; i += 3) {
+			const glm::vec3& a = positions[indices[i]];
+			const glm::vec3& b = positions[indices[i + 1]];
+			const glm::vec3& d = positions[indices[i + 2]];
+			const glm::vec3 n = glm::cross(b - a, d - a);
+			const float triangleArea = glm::length(n);
+			centroid += (a + b + d) * (triangleArea / 3.0f);
+			normal += n;
+			area += triangleArea;
+		}
+		meshCentroid += centroid;
+		meshArea += area;
+		centroids[c] = area > 0.0f ? centroid / area : positions[indices[sorted[c].begin]];
+		normals[c] = normal;
+	}
+	if (meshArea > 0.0f) meshCentroid /= meshArea;
+
+	for (size_t c = 0; c < clusters.size(); ++c) {
+		const float length = glm::length(normals[c]);
+		sorted[c].key = length > 0.0f ? glm::dot(centroids[c] - meshCentroid, normals[c] / length) : 0.0f;
+	}
+	std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b) {
+		return a.key > b.key;
+	});
+
+	std::vector<uint32_t> output;
+	output.reserve(end);
+	for (const Cluster& cluster : sorted) {
+		output.insert(output.end(), indices + cluster.begin, indices + cluster.end);
+	}
+	std::copy(output.begin(), output.end(), indices);
+}
+
+std::vector<uint32_t> optimizeVertexFetch(std::vector<uint32_t>& indices, size_t vertexCount) {
+	std::vector<uint32_t> oldToNew(vertexCount, kNoVertex);
+	std::vector<uint32_t> newToOld;
+	newToOld.reserve(vertexCount);
+	for (uint32_t& index : indices) {
+		if (oldToNew[index] == kNoVertex) {
+			oldToNew[index] = static_cast<uint32_t>(newToOld.size());
+			newToOld.push_back(index);
+		}
+		index = oldToNew[index];
+	}
+	for (uint32_t v = 0; v < vertexCount; ++v) {
+		if (oldToNew[v] == kNoVertex) {
+			newToOld.push_back(v);
+		}
+	}
+	return newToOld;
+}
+
+std::vector<uint32_t> optimizeMesh(
+	std::vector<uint32_t>& indices,
+	const std::vector<glm::vec3>& positions,
+	const std::vector<size_t>& shapeOffsets,
+	MeshOptimizationReport* report,
+	unsigned threadCount
+) {
+	if (report) {
+		report->before = analyzeVertexCache(indices, positions.size());
+	}
+
+	const std::vector<size_t> bounds = shapeBoundaries(indices.size(), shapeOffsets);
+
+	parallelFor(bounds.size() - 1, [&](size_t s) {
+		optimizeShape(indices.data() + bounds[s], bounds[s + 1] - bounds[s], positions);
+	}, threadCount);
+
+	std::vector<uint32_t> newToOld = optimizeVertexFetch(indices, positions.size());
+
+	if (report) {
+		report->after = analyzeVertexCache(indices, positions.size());
+	}
+	return newToOld;
+}
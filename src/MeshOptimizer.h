@@ -0,0 +1,84 @@
+/**
+ * Post-load optimization of indexed triangle lists for the GPU:
+ *  - vertex cache: triangles are reordered with Tipsify ("Fast Triangle
+ *    Reordering for Vertex Locality and Reduced Overdraw", Sander, Nehab
+ *    and Barczak, 2007) so that the post-transform cache hits more often;
+ *  - overdraw: the clusters Tipsify produces (runs between two cache
+ *    flushes) are sorted front to back from the outside of the mesh, so
+ *    that early depth testing rejects more fragments, whatever the view;
+ *  - vertex fetch: vertices are renumbered in order of first use, so that
+ *    the vertex buffer is read mostly sequentially.
+ *
+ * All passes are deterministic: the same input always gives the same
+ * output, whatever the number of threads.
+ */
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Size of the FIFO post-transform cache that is optimized for and
+ * simulated in the statistics.
+ */
+constexpr unsigned kVertexCacheSize = 16;
+
+struct VertexCacheStats {
+	// Average cache miss ratio: transformed vertices per triangle
+	// (0.5 at best on large regular meshes, 3 at worst)
+	double acmr = 0.0;
+	// Average transform to vertex ratio: transformed vertices per
+	// referenced vertex (1 at best)
+	double atvr = 0.0;
+};
+
+struct MeshOptimizationReport {
+	VertexCacheStats before;
+	VertexCacheStats after;
+};
+
+/**
+ * Simulates a FIFO post-transform cache of `cacheSize` entries on a
+ * triangle list.
+ */
+VertexCacheStats analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, unsigned cacheSize = kVertexCacheSize);
+
+/**
+ * Tipsify. Reorders the triangles of `indices` (into `vertexCount`
+ * vertices) in place, and fills `clusters` with the index offset of each
+ * run of triangles that starts after a cache flush.
+ */
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<size_t>& clusters, unsigned cacheSize = kVertexCacheSize);
+
+/**
+ * Sorts the clusters returned by `optimizeVertexCache` so that clusters
+ * on the outside of the mesh, facing away from its center, come first.
+ */
+void optimizeOverdraw(uint32_t* indices, size_t indexCount, const glm::vec3* positions, const std::vector<size_t>& clusters);
+
+/**
+ * Renumbers vertices in order of first use in `indices`, which is updated
+ * in place. Unused vertices go last. Returns, for each new vertex, the
+ * index of the old one.
+ */
+std::vector<uint32_t> optimizeVertexFetch(std::vector<uint32_t>& indices, size_t vertexCount);
+
+/**
+ * Runs the three passes. Triangles are only reordered within each shape,
+ * i.e. each index range [shapeOffsets[i], shapeOffsets[i + 1]) (the last
+ * one ends at indices.size()), and shapes are processed on worker threads.
+ * Returns the vertex order like `optimizeVertexFetch`.
+ * @param positions One per vertex, used for overdraw.
+ * @param threadCount Number of worker threads, 0 to use all cores.
+ */
+std::vector<uint32_t> optimizeMesh(
+	std::vector<uint32_t>& indices,
+	const std::vector<glm::vec3>& positions,
+	const std::vector<size_t>& shapeOffsets,
+	MeshOptimizationReport* report = nullptr,
+	unsigned threadCount = 0
+);
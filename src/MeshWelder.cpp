@@ -0,0 +1,215 @@
+#include "MeshWelder.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+constexpr uint32_t kEmptySlot = std::numeric_limits<uint32_t>::max();
+
+// Ranges smaller than this are not worth a thread
+constexpr size_t kMinVerticesPerThread = 16384;
+
+// Below this many indices per chunk, the extra draw calls of a split 16 bit
+// index buffer cost more than the memory they save.
+constexpr size_t kMinIndicesPerChunk = 3 * 16384;
+
+constexpr size_t kMaxVerticesPer16BitChunk = size_t(1) << 16;
+
+bool sameVertex(const VertexAttributes& a, const VertexAttributes& b) {
+	return std::memcmp(&a, &b, sizeof(VertexAttributes)) == 0;
+}
+
+} // namespace
+
+uint64_t hashVertex(const VertexAttributes& vertex) {
+	uint32_t words[sizeof(VertexAttributes) / sizeof(uint32_t)];
+	std::memcpy(words, &vertex, sizeof(words));
+	uint64_t h = 0x9E3779B97F4A7C15ull;
+	for (uint32_t w : words) {
+		h ^= w;
+		h *= 0xFF51AFD7ED558CCDull;
+		h ^= h >> 32;
+	}
+	return h;
+}
+
+IndexedMesh weldVertices(const std::vector<VertexAttributes>& expandedVertices, unsigned threadCount) {
+	const size_t n = expandedVertices.size();
+	assert(n < kEmptySlot);
+
+	// 1. Hash every vertex
+	std::vector<uint64_t> hashes(n);
+	parallelForRanges(n, kMinVerticesPerThread, [&](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			hashes[i] = hashVertex(expandedVertices[i]);
+		}
+	}, threadCount);
+
+	// 2. Bucket vertices by the high bits of their hash, so that each bucket
+	// can be deduplicated independently. A counting sort keeps vertices of a
+	// bucket in input order.
+	const size_t rangeCount = parallelRangeCount(n, kMinVerticesPerThread, threadCount);
+	int bucketBits = 0;
+	while ((size_t(1) << bucketBits) < 4 * rangeCount && bucketBits < 8) ++bucketBits;
+	const size_t bucketCount = size_t(1) << bucketBits;
+	auto bucketOf = [&](size_t i) {
+		return bucketBits == 0 ? size_t(0) : static_cast<size_t>(hashes[i] >> (64 - bucketBits));
+	};
+
+	std::vector<size_t> bucketOffsets(rangeCount * bucketCount, 0);
+	parallelForRanges(n, kMinVerticesPerThread, [&](size_t range, size_t begin, size_t end) {
+		size_t* counts = &bucketOffsets[range * bucketCount];
+		for (size_t i = begin; i < end; ++i) {
+			++counts[bucketOf(i)];
+		}
+	}, threadCount);
+	std::vector<size_t> bucketBegin(bucketCount + 1, 0);
+	size_t offset = 0;
+	for (size_t b = 0; b < bucketCount; ++b) {
+		bucketBegin[b] = offset;
+		for (size_t r = 0; r < rangeCount; ++r) {
+			size_t count = bucketOffsets[r * bucketCount + b];
+			bucketOffsets[r * bucketCount + b] = offset;
+			offset += count;
+		}
+	}
+	bucketBegin[bucketCount] = offset;
+
+	std::vector<uint32_t> sorted(n);
+	parallelForRanges(n, kMinVerticesPerThread, [&](size_t range, size_t begin, size_t end) {
+		size_t* cursors = &bucketOffsets[range * bucketCount];
+		for (size_t i = begin; i < end; ++i) {
+			sorted[cursors[bucketOf(i)]++] = static_cast<uint32_t>(i);
+		}
+	}, threadCount);
+
+	// 3. Within each bucket, map every vertex to the first identical one
+	// using an open addressing hash table.
+	std::vector<uint32_t> firstOccurrence(n);
+	parallelFor(bucketCount, [&](size_t b) {
+		const size_t begin = bucketBegin[b];
+		const size_t end = bucketBegin[b + 1];
+		size_t capacity = 16;
+		while (capacity < 2 * (end - begin)) capacity *= 2;
+		std::vector<uint32_t> table(capacity, kEmptySlot);
+		for (size_t k = begin; k < end; ++k) {
+			const uint32_t i = sorted[k];
+			size_t slot = static_cast<size_t>(hashes[i]) & (capacity - 1);
+			for (;;) {
+				const uint32_t j = table[slot];
+				if (j == kEmptySlot) {
+					table[slot] = i;
+					firstOccurrence[i] = i;
+					break;
+				}
+				if (hashes[j] == hashes[i] && sameVertex(expandedVertices[j], expandedVertices[i])) {
+					firstOccurrence[i] = j;
+					break;
+				}
+				slot = (slot + 1) & (capacity - 1);
+			}
+		}
+	}, threadCount);
+
+	// 4. Number unique vertices in order of first occurrence
+	std::vector<uint32_t> uniqueBefore(rangeCount + 1, 0);
+	parallelForRanges(n, kMinVerticesPerThread, [&](size_t range, size_t begin, size_t end) {
+		uint32_t count = 0;
+		for (size_t i = begin; i < end; ++i) {
+			count += firstOccurrence[i] == i;
+		}
+		uniqueBefore[range + 1] = count;
+	}, threadCount);
+	for (size_t r = 0; r < rangeCount; ++r) {
+		uniqueBefore[r + 1] += uniqueBefore[r];
+	}
+
+	IndexedMesh mesh;
+	mesh.vertices.resize(uniqueBefore[rangeCount]);
+	std::vector<uint32_t> remap(n);
+	parallelForRanges(n, kMinVerticesPerThread, [&](size_t range, size_t begin, size_t end) {
+		uint32_t next = uniqueBefore[range];
+		for (size_t i = begin; i < end; ++i) {
+			if (firstOccurrence[i] == i) {
+				mesh.vertices[next] = expandedVertices[i];
+				remap[i] = next++;
+			}
+		}
+	}, threadCount);
+
+	// First occurrences always come before, so their remap is known by now
+	std::vector<uint32_t> indices(n);
+	parallelForRanges(n, kMinVerticesPerThread, [&](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			indices[i] = remap[firstOccurrence[i]];
+		}
+	}, threadCount);
+
+	assignIndices(mesh, std::move(indices));
+	return mesh;
+}
+
+void assignIndices(IndexedMesh& mesh, std::vector<uint32_t>&& indices) {
+	assignIndices(mesh, std::move(indices), mesh.vertices.size());
+}
+
+void assignIndices(IndexedMesh& mesh, std::vector<uint32_t>&& indices, size_t vertexCount) {
+	mesh.indices16.clear();
+	mesh.indices32.clear();
+	mesh.chunks.clear();
+
+	const size_t indexCount = indices.size();
+	std::vector<MeshChunk> chunks;
+	bool fitsIn16Bit = true;
+	if (vertexCount <= kMaxVerticesPer16BitChunk) {
+		chunks.push_back({ 0, static_cast<uint32_t>(indexCount), 0 });
+	} else {
+		// Greedily grow a chunk triangle by triangle while the vertices it
+		// references span at most 65536 values.
+		uint32_t chunkBegin = 0, chunkMin = 0, chunkMax = 0;
+		for (size_t t = 0; t + 3 <= indexCount; t += 3) {
+			const uint32_t a = indices[t], b = indices[t + 1], c = indices[t + 2];
+			const uint32_t lo = std::min({ a, b, c });
+			const uint32_t hi = std::max({ a, b, c });
+			if (hi - lo >= kMaxVerticesPer16BitChunk) {
+				fitsIn16Bit = false;
+				break;
+			}
+			if (t == chunkBegin) {
+				chunkMin = lo;
+				chunkMax = hi;
+			} else if (std::max(hi, chunkMax) - std::min(lo, chunkMin) >= kMaxVerticesPer16BitChunk) {
+				chunks.push_back({ chunkBegin, static_cast<uint32_t>(t) - chunkBegin, static_cast<int32_t>(chunkMin) });
+				chunkBegin = static_cast<uint32_t>(t);
+				chunkMin = lo;
+				chunkMax = hi;
+			} else {
+				chunkMin = std::min(lo, chunkMin);
+				chunkMax = std::max(hi, chunkMax);
+			}
+		}
+		if (chunkBegin < indexCount) {
+			chunks.push_back({ chunkBegin, static_cast<uint32_t>(indexCount) - chunkBegin, static_cast<int32_t>(chunkMin) });
+		}
+		fitsIn16Bit = fitsIn16Bit && chunks.size() * kMinIndicesPerChunk <= indexCount;
+	}
+
+	mesh.use16BitIndices = fitsIn16Bit;
+	if (!fitsIn16Bit) {
+		mesh.chunks = { { 0, static_cast<uint32_t>(indexCount), 0 } };
+		mesh.indices32 = std::move(indices);
+		return;
+	}
+
+	mesh.chunks = std::move(chunks);
+	mesh.indices16.resize(indexCount);
+	for (const MeshChunk& chunk : mesh.chunks) {
+		for (uint32_t i = chunk.firstIndex; i < chunk.firstIndex + chunk.indexCount; ++i) {
+			mesh.indices16[i] = static_cast<uint16_t>(indices[i] - chunk.baseVertex);
+		}
+	}
+}
@@ -0,0 +1,42 @@
+/**
+ * Vertex welding: turns the fully expanded triangle list produced by the OBJ
+ * loader (one vertex per face corner) into unique vertices and an index
+ * buffer, so that each vertex is stored and shaded once.
+ */
+
+#pragma once
+
+#include "Mesh.h"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Merges bitwise identical vertices (position, normal, color and uv) of a
+ * triangle list. Vertices keep the order of their first occurrence, so the
+ * result does not depend on the number of threads.
+ * @param threadCount Number of worker threads, 0 to use all cores.
+ */
+IndexedMesh weldVertices(const std::vector<VertexAttributes>& expandedVertices, unsigned threadCount = 0);
+
+/**
+ * Sets the triangle list of `mesh` from 32 bit indices into `mesh.vertices`,
+ * picking the smallest index format that is worth it:
+ *  - 16 bit when the mesh has at most 65536 vertices;
+ *  - 16 bit split into chunks drawn with a base vertex when each chunk still
+ *    covers enough triangles to pay for the extra draw call;
+ *  - 32 bit otherwise.
+ */
+void assignIndices(IndexedMesh& mesh, std::vector<uint32_t>&& indices);
+
+/**
+ * Same as above, for indices into `vertexCount` vertices that are not
+ * stored in `mesh.vertices`.
+ */
+void assignIndices(IndexedMesh& mesh, std::vector<uint32_t>&& indices, size_t vertexCount);
+
+/**
+ * Hash of the raw bytes of a vertex, consistent with the equality used by
+ * the welder.
+ */
+uint64_t hashVertex(const VertexAttributes& vertex);
@@ -0,0 +1,232 @@
+#include "Meshlets.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+/**
+ * Ritter's bounding sphere: start from the two farthest apart of the
+ * extreme points along each axis, then grow to include every point.
+ */
+void boundingSphere(const std::vector<glm::vec3>& points, glm::vec3* center, float* radius) {
+	size_t minIndex[3] = { 0, 0, 0 };
+	size_t maxIndex[3] = { 0, 0, 0 };
+	for (size_t i = 1; i < points.size(); ++i) {
+		for (int axis = 0; axis < 3; ++axis) {
+			if (points[i][axis] < points[minIndex[axis]][axis]) minIndex[axis] = i;
+			if (points[i][axis] > points[maxIndex[axis]][axis]) maxIndex[axis] = i;
+		}
+	}
+	int widest = 0;
+	float widestDistance = -1.0f;
+	for (int axis = 0; axis < 3; ++axis) {
+		const glm::vec3 d = points[maxIndex[axis]] - points[minIndex[axis]];
+		if (glm::dot(d, d) > widestDistance) {
+			widestDistance = glm::dot(d, d);
+			widest = axis;
+		}
+	}
+
+	glm::vec3 c = 0.5f * (points[minIndex[widest]] + points[maxIndex[widest]]);
+	float r = 0.5f * std::sqrt(widestDistance);
+	for (const glm::vec3& p : points) {
+		const float d = glm::length(p - c);
+		if (d > r) {
+			const float grownRadius = 0.5f * (r + d);
+			c += (grownRadius - r) / d * (p - c);
+			r = grownRadius;
+		}
+	}
+	*center = c;
+	*radius = r;
+}
+
+Meshlet makeMeshlet(const uint32_t* indices, size_t firstIndex, size_t indexCount, const std::vector<glm::vec3>& positions, std::vector<glm::vec3>& scratch) {
+	Meshlet meshlet;
+	meshlet.firstIndex = static_cast<uint32_t>(firstIndex);
+	meshlet.indexCount = static_cast<uint32_t>(indexCount);
+
+	scratch.clear();
+	for (size_t i = firstIndex; i < firstIndex + indexCount; ++i) {
+		scratch.push_back(positions[indices[i]]);
+	}
+	boundingSphere(scratch, &meshlet.center, &meshlet.radius);
+
+	// The cone axis is the average triangle normal, and its cutoff is the
+	// sine of the largest angle between the axis and a triangle normal.
+	std::vector<glm::vec3> normals;
+	normals.reserve(indexCount / 3);
+	glm::vec3 axis(0.0f);
+	for (size_t i = 0; i < indexCount; i += 3) {
+		const glm::vec3 n = glm::cross(scratch[i + 1] - scratch[i], scratch[i + 2] - scratch[i]);
+		const float length = glm::length(n);
+		if (length > 0.0f) {
+			normals.push_back(n / length);
+			axis += n / length;
+		}
+	}
+	const float axisLength = glm::length(axis);
+	meshlet.coneAxis = axisLength > 0.0f ? axis / axisLength : glm::vec3(0.0f);
+	meshlet.coneCutoff = 1.0f; // never culled
+	if (axisLength > 0.0f) {
+		float minDot = 1.0f;
+		for (const glm::vec3& n : normals) {
+			minDot = std::min(minDot, glm::dot(n, meshlet.coneAxis));
+		}
+		if (minDot > 0.0f) {
+			meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+		}
+	}
+	return meshlet;
+}
+
+void buildShapeMeshlets(const uint32_t* indices, size_t begin, size_t end, const std::vector<glm::vec3>& positions, std::vector<Meshlet>& meshlets) {
+	std::vector<glm::vec3> scratch;
+	uint32_t vertices[kMaxMeshletVertices];
+	size_t vertexCount = 0;
+	size_t meshletBegin = begin;
+	for (size_t t = begin; t < end; t += 3) {
+		size_t newVertices = 0;
+		for (size_t k = 0; k < 3; ++k) {
+			const uint32_t v = indices[t + k];
+			bool found = std::find(vertices, vertices + vertexCount, v) != vertices + vertexCount;
+			// Repeated corners of a degenerate triangle are only counted once
+			for (size_t j = 0; j < k && !found; ++j) found = indices[t + j] == v;
+			newVertices += !found;
+		}
+		if (vertexCount + newVertices > kMaxMeshletVertices || t - meshletBegin == 3 * kMaxMeshletTriangles) {
+			meshlets.push_back(makeMeshlet(indices, meshletBegin, t - meshletBegin, positions, scratch));
+			meshletBegin = t;
+			vertexCount = 0;
+		}
+		for (size_t k = 0; k < 3; ++k) {
+			const uint32_t v = indices[t + k];
+			if (std::find(vertices, vertices + vertexCount, v) == vertices + vertexCount) {
+				vertices[vertexCount++] = v;
+			}
+		}
+	}
+	if (end > meshletBegin) {
+		meshlets.push_back(makeMeshlet(indices, meshletBegin, end - meshletBegin, positions, scratch));
+	}
+}
+
+} // namespace
+
+std::vector<Meshlet> buildMeshlets(
+	const std::vector<uint32_t>& indices,
+	const std::vector<glm::vec3>& positions,
+	const std::vector<size_t>& shapeOffsets,
+	unsigned threadCount
+) {
+	const std::vector<size_t> bounds = shapeBoundaries(indices.size(), shapeOffsets);
+
+	std::vector<std::vector<Meshlet>> shapeMeshlets(bounds.size() - 1);
+	parallelFor(shapeMeshlets.size(), [&](size_t s) {
+		buildShapeMeshlets(indices.data(), bounds[s], bounds[s + 1], positions, shapeMeshlets[s]);
+	}, threadCount);
+
+	std::vector<Meshlet> meshlets;
+	for (const std::vector<Meshlet>& shape : shapeMeshlets) {
+		meshlets.insert(meshlets.end(), shape.begin(), shape.end());
+	}
+	return meshlets;
+}
+
+Frustum extractFrustum(const glm::mat4& m) {
+	// Gribb and Hartmann: planes are sums and differences of matrix rows
+	auto row = [&](int i) { return glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]); };
+	Frustum frustum;
+	frustum.planes[0] = row(3) + row(0); // left
+	frustum.planes[1] = row(3) - row(0); // right
+	frustum.planes[2] = row(3) + row(1); // bottom
+	frustum.planes[3] = row(3) - row(1); // top
+	frustum.planes[4] = row(2); // near, for depth in [0, 1]
+	frustum.planes[5] = row(3) - row(2); // far
+	for (glm::vec4& plane : frustum.planes) {
+		const float length = glm::length(glm::vec3(plane));
+		if (length > 0.0f) plane /= length;
+	}
+	return frustum;
+}
+
+bool isSphereVisible(const Frustum& frustum, const glm::vec3& center, float radius) {
+	for (const glm::vec4& plane : frustum.planes) {
+		if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool isMeshletVisible(const Meshlet& meshlet, const Frustum& frustum, const glm::vec3& cameraPosition, bool backfaceCulling) {
+	if (!isSphereVisible(frustum, meshlet.center, meshlet.radius)) {
+		return false;
+	}
+	if (backfaceCulling) {
+		const glm::vec3 toCenter = meshlet.center - cameraPosition;
+		if (glm::dot(toCenter, meshlet.coneAxis) >= meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void cullMeshlets(
+	const std::vector<Meshlet>& meshlets,
+	uint32_t firstIndex,
+	uint32_t indexCount,
+	const Frustum& frustum,
+	const glm::vec3& cameraPosition,
+	bool backfaceCulling,
+	std::vector<IndexRange>& ranges
+) {
+	// Meshlets are sorted by first index
+	auto it = std::lower_bound(meshlets.begin(), meshlets.end(), firstIndex, [](const Meshlet& meshlet, uint32_t index) {
+		return meshlet.firstIndex < index;
+	});
+	for (; it != meshlets.end() && it->firstIndex + it->indexCount <= firstIndex + indexCount; ++it) {
+		if (isMeshletVisible(*it, frustum, cameraPosition, backfaceCulling)) {
+			appendIndexRange(ranges, it->firstIndex, it->indexCount);
+		}
+	}
+}
+
+void appendIndexRange(std::vector<IndexRange>& ranges, uint32_t firstIndex, uint32_t indexCount) {
+	if (!ranges.empty() && ranges.back().firstIndex + ranges.back().indexCount == firstIndex) {
+		ranges.back().indexCount += indexCount;
+	} else {
+		ranges.push_back({ firstIndex, indexCount });
+	}
+}
+
+void splitAtChunks(std::vector<IndexRange>& ranges, const std::vector<MeshChunk>& chunks, std::vector<MeshChunk>& draws) {
+	std::sort(ranges.begin(), ranges.end(), [](const IndexRange& a, const IndexRange& b) {
+		return a.firstIndex < b.firstIndex;
+	});
+	draws.clear();
+	size_t chunk = 0; // chunks are sorted by first index too
+	for (const IndexRange& range : ranges) {
+		uint32_t begin = range.firstIndex;
+		const uint32_t end = range.firstIndex + range.indexCount;
+		while (begin < end && chunk < chunks.size()) {
+			const MeshChunk& c = chunks[chunk];
+			const uint32_t chunkEnd = c.firstIndex + c.indexCount;
+			if (chunkEnd <= begin) {
+				++chunk;
+				continue;
+			}
+			if (c.firstIndex >= end) break;
+			const uint32_t rangeBegin = std::max(begin, c.firstIndex);
+			const uint32_t rangeEnd = std::min(end, chunkEnd);
+			if (!draws.empty() && draws.back().baseVertex == c.baseVertex && draws.back().firstIndex + draws.back().indexCount == rangeBegin) {
+				draws.back().indexCount += rangeEnd - rangeBegin;
+			} else {
+				draws.push_back({ rangeBegin, rangeEnd - rangeBegin, c.baseVertex });
+			}
+			begin = rangeEnd;
+		}
+	}
+}
@@ -0,0 +1,89 @@
+/**
+ * Meshlets: small clusters of triangles that are culled on the CPU before
+ * drawing, so that only the visible parts of a large mesh are submitted.
+ *
+ * Meshlets are built greedily along the triangle order, which the vertex
+ * cache optimization (MeshOptimizer.h) already made local, so the index
+ * buffer is left untouched and each meshlet is a contiguous range of it.
+ * Each one gets a bounding sphere, for frustum culling, and a normal cone,
+ * to reject clusters whose triangles all face away from the camera.
+ */
+
+#pragma once
+
+#include "Mesh.h"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+constexpr size_t kMaxMeshletVertices = 64;
+constexpr size_t kMaxMeshletTriangles = 124;
+
+/**
+ * Splits each shape, i.e. each index range [shapeOffsets[i],
+ * shapeOffsets[i + 1]) (the last one ends at indices.size()), into
+ * meshlets. Shapes are processed on worker threads, and the result does
+ * not depend on the number of threads.
+ * @param positions One per vertex.
+ * @param threadCount Number of worker threads, 0 to use all cores.
+ */
+std::vector<Meshlet> buildMeshlets(
+	const std::vector<uint32_t>& indices,
+	const std::vector<glm::vec3>& positions,
+	const std::vector<size_t>& shapeOffsets,
+	unsigned threadCount = 0
+);
+
+/**
+ * The 6 planes of a view frustum, pointing inwards, with normalized
+ * (a, b, c) so that a sphere can be tested with a single dot product.
+ */
+struct Frustum {
+	glm::vec4 planes[6];
+};
+
+/**
+ * Frustum of a model-view-projection matrix, in model space. Clip space
+ * depth goes from 0 to 1, as in WebGPU.
+ */
+Frustum extractFrustum(const glm::mat4& modelViewProjection);
+
+/**
+ * Whether a bounding sphere intersects the frustum.
+ */
+bool isSphereVisible(const Frustum& frustum, const glm::vec3& center, float radius);
+
+/**
+ * Whether a meshlet may be visible from `cameraPosition` (in model space).
+ * Only use `backfaceCulling` when the pipeline culls back faces.
+ */
+bool isMeshletVisible(const Meshlet& meshlet, const Frustum& frustum, const glm::vec3& cameraPosition, bool backfaceCulling);
+
+/**
+ * Appends to `ranges` the index ranges of the visible meshlets among those
+ * within [firstIndex, firstIndex + indexCount).
+ */
+void cullMeshlets(
+	const std::vector<Meshlet>& meshlets,
+	uint32_t firstIndex,
+	uint32_t indexCount,
+	const Frustum& frustum,
+	const glm::vec3& cameraPosition,
+	bool backfaceCulling,
+	std::vector<IndexRange>& ranges
+);
+
+/**
+ * Appends a range, merged with the last one when they are contiguous.
+ */
+void appendIndexRange(std::vector<IndexRange>& ranges, uint32_t firstIndex, uint32_t indexCount);
+
+/**
+ * Fills `draws` with `ranges`, ready for drawIndexed: ranges are sorted,
+ * merged when contiguous, and split where they cross a chunk boundary so
+ * that each one uses the base vertex of its chunk.
+ */
+void splitAtChunks(std::vector<IndexRange>& ranges, const std::vector<MeshChunk>& chunks, std::vector<MeshChunk>& draws);
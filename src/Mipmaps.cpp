@@ -0,0 +1,160 @@
+#include "Mipmaps.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIPMAPS_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MIPMAPS_NEON
+#endif
+
+namespace {
+
+// Resolution of the linear to sRGB table, fine enough that every 8 bit
+// code is reachable and rounding is exact but for a few codes near 0
+constexpr int kEncodeTableSize = 1 << 16;
+
+float srgbToLinear(float c) {
+	return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+float linearToSrgb(float c) {
+	return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+const std::array<float, 256>& decodeTable() {
+	static const std::array<float, 256> table = []() {
+		std::array<float, 256> t;
+		for (int i = 0; i < 256; ++i) t[i] = srgbToLinear(i / 255.0f);
+		return t;
+	}();
+	return table;
+}
+
+const std::vector<uint8_t>& encodeTable() {
+	static const std::vector<uint8_t> table = []() {
+		std::vector<uint8_t> t(kEncodeTableSize);
+		for (int i = 0; i < kEncodeTableSize; ++i) {
+			const float srgb = linearToSrgb(i / float(kEncodeTableSize - 1));
+			t[i] = static_cast<uint8_t>(std::lround(std::clamp(srgb, 0.0f, 1.0f) * 255.0f));
+		}
+		return t;
+	}();
+	return table;
+}
+
+// Image to linear RGBA floats
+std::vector<float> decode(const Image& image) {
+	const std::array<float, 256>& table = decodeTable();
+	std::vector<float> linear(image.pixels.size());
+	for (size_t i = 0; i < image.pixels.size(); i += 4) {
+		linear[i + 0] = table[image.pixels[i + 0]];
+		linear[i + 1] = table[image.pixels[i + 1]];
+		linear[i + 2] = table[image.pixels[i + 2]];
+		linear[i + 3] = image.pixels[i + 3] / 255.0f;
+	}
+	return linear;
+}
+
+// Linear RGBA floats to an sRGB image
+void encode(const float* linear, Image& image) {
+	const std::vector<uint8_t>& table = encodeTable();
+	const size_t pixelCount = size_t(image.width) * image.height;
+	uint8_t* out = image.pixels.data();
+	for (size_t p = 0; p < pixelCount; ++p, linear += 4, out += 4) {
+#if defined(MIPMAPS_SSE2)
+		const __m128 scale = _mm_setr_ps(kEncodeTableSize - 1, kEncodeTableSize - 1, kEncodeTableSize - 1, 255.0f);
+		__m128 v = _mm_mul_ps(_mm_loadu_ps(linear), scale);
+		v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), scale);
+		alignas(16) int32_t q[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(q), _mm_cvtps_epi32(v)); // rounds to nearest
+#elif defined(MIPMAPS_NEON)
+		const float32x4_t scale = { kEncodeTableSize - 1, kEncodeTableSize - 1, kEncodeTableSize - 1, 255.0f };
+		float32x4_t v = vmulq_f32(vld1q_f32(linear), scale);
+		v = vminq_f32(vmaxq_f32(v, vdupq_n_f32(0.0f)), scale);
+		int32_t q[4];
+		vst1q_s32(q, vcvtq_s32_f32(vaddq_f32(v, vdupq_n_f32(0.5f))));
+#else
+		int32_t q[4];
+		for (int c = 0; c < 4; ++c) {
+			const float scale = c < 3 ? float(kEncodeTableSize - 1) : 255.0f;
+			q[c] = static_cast<int32_t>(std::clamp(linear[c] * scale, 0.0f, scale) + 0.5f);
+		}
+#endif
+		out[0] = table[q[0]];
+		out[1] = table[q[1]];
+		out[2] = table[q[2]];
+		out[3] = static_cast<uint8_t>(q[3]);
+	}
+}
+
+/**
+ * One 2x2 box filter step. On an odd dimension the last row or column of
+ * `src` is dropped, except when it is the only one.
+ */
+void downsample(const float* src, uint32_t srcWidth, uint32_t srcHeight, float* dst, uint32_t dstWidth, uint32_t dstHeight) {
+	for (uint32_t y = 0; y < dstHeight; ++y) {
+		const float* row0 = src + size_t(4) * srcWidth * std::min(2 * y, srcHeight - 1);
+		const float* row1 = src + size_t(4) * srcWidth * std::min(2 * y + 1, srcHeight - 1);
+		float* out = dst + size_t(4) * dstWidth * y;
+		for (uint32_t x = 0; x < dstWidth; ++x, out += 4) {
+			const size_t x0 = size_t(4) * std::min(2 * x, srcWidth - 1);
+			const size_t x1 = size_t(4) * std::min(2 * x + 1, srcWidth - 1);
+#if defined(MIPMAPS_SSE2)
+			const __m128 sum = _mm_add_ps(
+				_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)),
+				_mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+			_mm_storeu_ps(out, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#elif defined(MIPMAPS_NEON)
+			const float32x4_t sum = vaddq_f32(
+				vaddq_f32(vld1q_f32(row0 + x0), vld1q_f32(row0 + x1)),
+				vaddq_f32(vld1q_f32(row1 + x0), vld1q_f32(row1 + x1)));
+			vst1q_f32(out, vmulq_n_f32(sum, 0.25f));
+#else
+			for (int c = 0; c < 4; ++c) {
+				out[c] = 0.25f * ((row0[x0 + c] + row0[x1 + c]) + (row1[x0 + c] + row1[x1 + c]));
+			}
+#endif
+		}
+	}
+}
+
+} // namespace
+
+uint32_t mipLevelCount(uint32_t width, uint32_t height) {
+	uint32_t levels = 1;
+	for (uint32_t size = std::max(width, height); size > 1; size >>= 1) {
+		++levels;
+	}
+	return levels;
+}
+
+std::vector<Image> generateMipmaps(Image&& image) {
+	std::vector<Image> levels;
+	const uint32_t levelCount = mipLevelCount(image.width, image.height);
+	levels.reserve(levelCount);
+	levels.push_back(std::move(image));
+	if (levels[0].pixels.empty()) {
+		return levels;
+	}
+
+	std::vector<float> current = decode(levels[0]);
+	std::vector<float> next;
+	for (uint32_t level = 1; level < levelCount; ++level) {
+		const Image& previous = levels.back();
+		Image mip;
+		mip.width = std::max(1u, previous.width / 2);
+		mip.height = std::max(1u, previous.height / 2);
+		mip.pixels.resize(size_t(4) * mip.width * mip.height);
+		next.resize(mip.pixels.size());
+		downsample(current.data(), previous.width, previous.height, next.data(), mip.width, mip.height);
+		encode(next.data(), mip);
+		levels.push_back(std::move(mip));
+		std::swap(current, next);
+	}
+	return levels;
+}
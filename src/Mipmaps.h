@@ -0,0 +1,26 @@
+/**
+ * Mip chain generation for sRGB encoded RGBA8 images.
+ *
+ * Color channels are averaged in linear space (averaging sRGB values
+ * directly darkens every level), alpha is averaged as is. Each level is a
+ * 2x2 box filter of the previous one, computed in float from the previous
+ * float level so that rounding does not accumulate down the chain.
+ */
+
+#pragma once
+
+#include "ImageDecoders.h"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Number of levels of a full mip chain, down to 1x1.
+ */
+uint32_t mipLevelCount(uint32_t width, uint32_t height);
+
+/**
+ * Returns the full mip chain of `image`, which becomes level 0. Level i is
+ * max(1, width >> i) by max(1, height >> i) pixels.
+ */
+std::vector<Image> generateMipmaps(Image&& image);
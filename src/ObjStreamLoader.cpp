@@ -0,0 +1,354 @@
+#include "ObjStreamLoader.h"
+#include "MeshWelder.h"
+#include "Meshlets.h"
+#include "Parallel.h"
+
+#include "tiny_obj_loader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+namespace {
+
+constexpr uint32_t kEmptySlot = std::numeric_limits<uint32_t>::max();
+
+// Vertices converted by each thread at least
+constexpr size_t kConversionGrain = 1 << 14;
+
+// Vertices converted at once before being encoded, small enough to stay in
+// the L1 cache
+constexpr size_t kEncodingBlock = 256;
+
+// Faces with up to this many corners are triangulated without allocating
+constexpr size_t kSmallFaceCorners = 16;
+
+} // namespace
+
+struct ObjStreamLoader::Callbacks {
+	static void vertex(void* user, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z,
+		tinyobj::real_t r, tinyobj::real_t g, tinyobj::real_t b, bool hasColor) {
+		ObjStreamLoader& loader = *static_cast<ObjStreamLoader*>(user);
+		loader.m_positions.insert(loader.m_positions.end(), { float(x), float(y), float(z) });
+		// Most files have no vertex colors, so colors are only stored from
+		// the first colored vertex on. r, g, b default to 1 like in LoadObj.
+		if (hasColor && loader.m_colors.empty()) {
+			loader.m_colors.assign(loader.m_positions.size() - 3, 1.0f);
+		}
+		if (!loader.m_colors.empty()) {
+			loader.m_colors.insert(loader.m_colors.end(), { float(r), float(g), float(b) });
+		}
+	}
+
+	static void normal(void* user, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z) {
+		ObjStreamLoader& loader = *static_cast<ObjStreamLoader*>(user);
+		loader.m_normals.insert(loader.m_normals.end(), { float(x), float(y), float(z) });
+	}
+
+	static void texcoord(void* user, tinyobj::real_t u, tinyobj::real_t v, tinyobj::real_t /* w */) {
+		ObjStreamLoader& loader = *static_cast<ObjStreamLoader*>(user);
+		loader.m_texcoords.insert(loader.m_texcoords.end(), { float(u), float(v) });
+	}
+
+	static void face(void* user, tinyobj::index_t* indices, int count) {
+		ObjStreamLoader& loader = *static_cast<ObjStreamLoader*>(user);
+		if (count < 3) {
+			++loader.m_degenerateFaceCount;
+			return;
+		}
+
+		// Resolve the 1-based and relative OBJ indices
+		Corner corners[kSmallFaceCorners];
+		std::vector<Corner> polygon; // only for larger faces
+		Corner* resolved = corners;
+		if (count > int(kSmallFaceCorners)) {
+			polygon.resize(count);
+			resolved = polygon.data();
+		}
+		for (int k = 0; k < count; ++k) {
+			Corner& corner = resolved[k];
+			if (!loader.resolve(indices[k].vertex_index, loader.m_positions.size() / 3, &corner.v)) {
+				++loader.m_invalidFaceCount;
+				return;
+			}
+			if (!loader.resolve(indices[k].texcoord_index, loader.m_texcoords.size() / 2, &corner.vt)) {
+				corner.vt = -1;
+			}
+			if (!loader.resolve(indices[k].normal_index, loader.m_normals.size() / 3, &corner.vn)) {
+				corner.vn = -1;
+			}
+		}
+
+		auto emit = [&](const Corner& a, const Corner& b, const Corner& c) {
+			loader.m_indices.push_back(loader.findOrAddVertex(a));
+			loader.m_indices.push_back(loader.findOrAddVertex(b));
+			loader.m_indices.push_back(loader.findOrAddVertex(c));
+		};
+
+		if (count == 3) {
+			emit(resolved[0], resolved[1], resolved[2]);
+			return;
+		}
+
+		// Larger faces are split like tinyobj::LoadObj does: quads along
+		// their shortest diagonal, convex polygons as a fan and the others by
+		// ear clipping
+		tinyobj::real_t smallPositions[3 * kSmallFaceCorners];
+		unsigned int smallTriangles[3 * (kSmallFaceCorners - 2)];
+		std::vector<tinyobj::real_t> largePositions;
+		std::vector<unsigned int> largeTriangles;
+		tinyobj::real_t* positions = smallPositions;
+		unsigned int* triangles = smallTriangles;
+		if (count > int(kSmallFaceCorners)) {
+			largePositions.resize(3 * size_t(count));
+			largeTriangles.resize(3 * size_t(count - 2));
+			positions = largePositions.data();
+			triangles = largeTriangles.data();
+		}
+		for (int k = 0; k < count; ++k) {
+			const float* p = &loader.m_positions[3 * size_t(resolved[k].v)];
+			positions[3 * k + 0] = p[0];
+			positions[3 * k + 1] = p[1];
+			positions[3 * k + 2] = p[2];
+		}
+		const size_t triangleCount = tinyobj::TriangulatePolygon(positions, size_t(count), triangles);
+		for (size_t t = 0; t < triangleCount; ++t) {
+			emit(resolved[triangles[3 * t + 0]], resolved[triangles[3 * t + 1]], resolved[triangles[3 * t + 2]]);
+		}
+	}
+
+	static void group(void* user, const char** /* names */, int /* count */) {
+		static_cast<ObjStreamLoader*>(user)->startShape();
+	}
+
+	static void object(void* user, const char* /* name */) {
+		static_cast<ObjStreamLoader*>(user)->startShape();
+	}
+
+	static void material(void* user, const char* name, int /* materialId */) {
+		static_cast<ObjStreamLoader*>(user)->useMaterial(name);
+	}
+};
+
+bool ObjStreamLoader::parse(const std::filesystem::path& path) {
+	*this = ObjStreamLoader{};
+
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+
+	tinyobj::callback_t callbacks;
+	callbacks.vertex_color_cb = Callbacks::vertex;
+	callbacks.normal_cb = Callbacks::normal;
+	callbacks.texcoord_cb = Callbacks::texcoord;
+	callbacks.index_cb = Callbacks::face;
+	callbacks.group_cb = Callbacks::group;
+	callbacks.object_cb = Callbacks::object;
+	callbacks.usemtl_cb = Callbacks::material;
+
+	std::string warn;
+	std::string err;
+	bool ret = tinyobj::LoadObjWithCallback(file, callbacks, this, nullptr, &warn, &err);
+
+	m_warnings = warn + err;
+	if (m_invalidFaceCount > 0) {
+		m_warnings += "Skipped " + std::to_string(m_invalidFaceCount) + " face(s) with an invalid vertex index\n";
+	}
+	if (m_degenerateFaceCount > 0) {
+		m_warnings += "Skipped " + std::to_string(m_degenerateFaceCount) + " face(s) with less than 3 vertices\n";
+	}
+
+	// Only the unique corners and the indices are needed from now on
+	std::vector<uint32_t>().swap(m_hashes);
+	std::vector<uint32_t>().swap(m_table);
+	return ret;
+}
+
+MeshOptimizationReport ObjStreamLoader::optimize(unsigned threadCount) {
+	MeshOptimizationReport report;
+	const std::vector<uint32_t> newToOld = optimizeMesh(m_indices, convertPositions(), m_shapeOffsets, &report, threadCount);
+
+	std::vector<Corner> corners(m_corners.size());
+	for (size_t i = 0; i < newToOld.size(); ++i) {
+		corners[i] = m_corners[newToOld[i]];
+	}
+	m_corners = std::move(corners);
+	return report;
+}
+
+void ObjStreamLoader::writeVertices(VertexAttributes* destination, unsigned threadCount) const {
+	const ObjVertexSources vertexSources = sources();
+	parallelForRanges(m_corners.size(), kConversionGrain, [&](size_t, size_t begin, size_t end) {
+		convertObjVertices(m_corners.data() + begin, end - begin, vertexSources, destination + begin);
+	}, threadCount);
+}
+
+VertexDecoding ObjStreamLoader::writeVertices(void* destination, const VertexEncoding& encoding, unsigned threadCount) const {
+	const ObjVertexSources vertexSources = sources();
+	const size_t count = m_corners.size();
+	const size_t rangeCount = parallelRangeCount(count, kConversionGrain, threadCount);
+	auto forEachBlock = [&](size_t begin, size_t end, auto&& fn) {
+		VertexAttributes block[kEncodingBlock];
+		for (size_t first = begin; first < end; first += kEncodingBlock) {
+			const size_t n = std::min(kEncodingBlock, end - first);
+			convertObjVertices(m_corners.data() + first, n, vertexSources, block);
+			fn(first, block, n);
+		}
+	};
+
+	// Unorm16 positions are relative to the bounding box, so the vertices
+	// are converted twice rather than kept
+	VertexBounds bounds;
+	if (encoding.position == PositionEncoding::Unorm16) {
+		std::vector<VertexBounds> rangeBounds(rangeCount);
+		parallelForRanges(count, kConversionGrain, [&](size_t range, size_t begin, size_t end) {
+			forEachBlock(begin, end, [&](size_t, const VertexAttributes* block, size_t n) {
+				rangeBounds[range].add(block, n);
+			});
+		}, threadCount);
+		for (const VertexBounds& b : rangeBounds) {
+			bounds.add(b);
+		}
+	}
+	VertexDecoding decoding = vertexDecoding(encoding, bounds);
+
+	const uint32_t stride = vertexLayout(encoding).stride;
+	unsigned char* output = static_cast<unsigned char*>(destination);
+	std::vector<VertexDecoding> measures(rangeCount);
+	parallelForRanges(count, kConversionGrain, [&](size_t range, size_t begin, size_t end) {
+		forEachBlock(begin, end, [&](size_t first, const VertexAttributes* block, size_t n) {
+			encodeVertexRange(block, n, encoding, decoding, output + first * stride, measures[range]);
+		});
+	}, threadCount);
+	for (const VertexDecoding& m : measures) {
+		mergeMeasures(decoding, m);
+	}
+	return decoding;
+}
+
+IndexedMesh ObjStreamLoader::takeIndices(const LodSettings& lodSettings, unsigned threadCount) {
+	IndexedMesh mesh;
+	const std::vector<glm::vec3> positions = convertPositions();
+	// Meshlets only cover the full detail triangles, so they are built
+	// before the other levels are appended.
+	mesh.meshlets = buildMeshlets(m_indices, positions, m_shapeOffsets, threadCount);
+	buildLods(m_indices, positions, m_shapeOffsets, lodSettings, mesh.shapes, mesh.lods, threadCount);
+	for (MeshShape& shape : mesh.shapes) {
+		// Material in use at the last shape offset up to the shape's first index
+		const size_t first = mesh.lods[shape.firstLod].firstIndex;
+		auto next = std::upper_bound(m_shapeOffsets.begin(), m_shapeOffsets.end(), first);
+		if (next != m_shapeOffsets.begin()) {
+			shape.material = m_shapeMaterials[next - m_shapeOffsets.begin() - 1];
+		}
+	}
+	mesh.materials = std::move(m_materials);
+	assignIndices(mesh, std::move(m_indices), m_corners.size());
+	m_indices = {};
+	return mesh;
+}
+
+bool ObjStreamLoader::resolve(int rawIndex, size_t count, int32_t* index) const {
+	// Same convention as tinyobj: 1-based, negative is relative to the end
+	// and 0 means missing.
+	long long i;
+	if (rawIndex > 0) {
+		i = static_cast<long long>(rawIndex) - 1;
+	} else if (rawIndex < 0) {
+		i = static_cast<long long>(count) + rawIndex;
+	} else {
+		return false;
+	}
+	if (i < 0 || i >= static_cast<long long>(count)) {
+		return false;
+	}
+	*index = static_cast<int32_t>(i);
+	return true;
+}
+
+ObjVertexSources ObjStreamLoader::sources() const {
+	ObjVertexSources vertexSources;
+	vertexSources.positions = m_positions.data();
+	vertexSources.colors = m_colors.empty() ? nullptr : m_colors.data();
+	vertexSources.normals = m_normals.empty() ? nullptr : m_normals.data();
+	vertexSources.texcoords = m_texcoords.empty() ? nullptr : m_texcoords.data();
+	return vertexSources;
+}
+
+VertexAttributes ObjStreamLoader::convert(const Corner& corner) const {
+	return convertObjVertex(corner, sources());
+}
+
+void ObjStreamLoader::startShape() {
+	if (m_shapeOffsets.empty() || m_shapeOffsets.back() != m_indices.size()) {
+		m_shapeOffsets.push_back(m_indices.size());
+		m_shapeMaterials.push_back(m_material);
+	} else {
+		m_shapeMaterials.back() = m_material;
+	}
+}
+
+void ObjStreamLoader::useMaterial(const char* rawName) {
+	// tinyobj passes the rest of the line, trailing blanks included
+	std::string name(rawName);
+	name.erase(name.find_last_not_of(" \t\r\n") + 1);
+	auto it = std::find(m_materials.begin(), m_materials.end(), name);
+	const uint32_t material = static_cast<uint32_t>(it - m_materials.begin());
+	if (it == m_materials.end()) {
+		m_materials.push_back(name);
+	}
+	if (material != m_material) {
+		// Shapes are drawn with a single material
+		m_material = material;
+		startShape();
+	}
+}
+
+std::vector<glm::vec3> ObjStreamLoader::convertPositions() const {
+	std::vector<glm::vec3> positions(m_corners.size());
+	for (size_t i = 0; i < m_corners.size(); ++i) {
+		positions[i] = convert(m_corners[i]).position;
+	}
+	return positions;
+}
+
+uint32_t ObjStreamLoader::findOrAddVertex(const Corner& corner) {
+	if (2 * (m_corners.size() + 1) > m_table.size()) {
+		growTable();
+	}
+
+	// Corners are compared by value, so that different index triples that
+	// give the same vertex are welded too.
+	const VertexAttributes vertex = convert(corner);
+	const uint32_t hash = static_cast<uint32_t>(hashVertex(vertex));
+	const size_t mask = m_table.size() - 1;
+	for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+		const uint32_t id = m_table[slot];
+		if (id == kEmptySlot) {
+			m_table[slot] = static_cast<uint32_t>(m_corners.size());
+			m_corners.push_back(corner);
+			m_hashes.push_back(hash);
+			return m_table[slot];
+		}
+		if (m_hashes[id] == hash) {
+			const VertexAttributes other = convert(m_corners[id]);
+			if (std::memcmp(&other, &vertex, sizeof(VertexAttributes)) == 0) {
+				return id;
+			}
+		}
+	}
+}
+
+void ObjStreamLoader::growTable() {
+	const size_t capacity = m_table.empty() ? 1024 : 2 * m_table.size();
+	m_table.assign(capacity, kEmptySlot);
+	const size_t mask = capacity - 1;
+	for (uint32_t id = 0; id < m_hashes.size(); ++id) {
+		size_t slot = m_hashes[id] & mask;
+		while (m_table[slot] != kEmptySlot) {
+			slot = (slot + 1) & mask;
+		}
+		m_table[slot] = id;
+	}
+}
@@ -0,0 +1,121 @@
+/**
+ * OBJ loader that converts vertices straight into their final destination,
+ * typically a vertex buffer mapped at creation.
+ *
+ * Loading is done in two phases:
+ *  1. `parse` streams the file through tinyobj::LoadObjWithCallback. It keeps
+ *     the raw v/vn/vt arrays needed to resolve face indices, and welds face
+ *     corners on the fly: each unique converted vertex is only remembered
+ *     as its (v, vt, vn) triple, and faces become an index list.
+ *  2. Once the caller knows `vertexCount()` and has allocated the
+ *     destination, `writeVertices` converts each unique vertex into it.
+ *
+ * No tinyobj::attrib_t, shape_t or expanded vertex array is ever built. The
+ * result is the same as expanding every face corner then calling
+ * weldVertices(): same vertices, in order of first occurrence.
+ */
+
+#pragma once
+
+#include "Mesh.h"
+#include "MeshLod.h"
+#include "MeshOptimizer.h"
+#include "VertexConversion.h"
+#include "VertexEncoding.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+class ObjStreamLoader {
+public:
+	/**
+	 * Phase 1. Returns false if the file cannot be read.
+	 * Polygons are triangulated like tinyobj::LoadObj does (see
+	 * tinyobj::TriangulatePolygon).
+	 */
+	bool parse(const std::filesystem::path& path);
+
+	/**
+	 * Number of unique vertices, to size the destination buffer.
+	 */
+	size_t vertexCount() const { return m_corners.size(); }
+
+	/**
+	 * Optional, between the two phases. Reorders triangles and vertices for
+	 * the post-transform cache, overdraw and vertex fetch (see
+	 * MeshOptimizer.h). Triangles stay within their OBJ group or object.
+	 * @param threadCount Number of worker threads, 0 to use all cores.
+	 */
+	MeshOptimizationReport optimize(unsigned threadCount = 0);
+
+	/**
+	 * Phase 2. Converts the vertices into `destination`, which must hold
+	 * `vertexCount()` vertices, with the SIMD kernels of VertexConversion.h.
+	 * Each thread writes a contiguous range sequentially, so `destination`
+	 * may be write-combined GPU memory.
+	 * @param threadCount Number of worker threads, 0 to use all cores.
+	 */
+	void writeVertices(VertexAttributes* destination, unsigned threadCount = 0) const;
+
+	/**
+	 * Phase 2, with the vertices encoded (see VertexEncoding.h) into
+	 * `destination`, which must hold `vertexCount()` of them. Vertices are
+	 * converted then encoded a small block at a time, so they are never
+	 * all held at full precision. Returns what the shader needs to decode
+	 * them.
+	 * @param threadCount Number of worker threads, 0 to use all cores.
+	 */
+	VertexDecoding writeVertices(void* destination, const VertexEncoding& encoding, unsigned threadCount = 0) const;
+
+	/**
+	 * Moves out the triangle list, as an IndexedMesh without vertices. Each
+	 * group or object becomes a shape (several if it switches materials),
+	 * with its meshlets (see Meshlets.h) and its levels of detail (see
+	 * MeshLod.h).
+	 * @param threadCount Number of worker threads, 0 to use all cores.
+	 */
+	IndexedMesh takeIndices(const LodSettings& lodSettings = LodSettings{}, unsigned threadCount = 0);
+
+	/**
+	 * Non fatal issues found while parsing.
+	 */
+	const std::string& warnings() const { return m_warnings; }
+
+private:
+	using Corner = ObjCorner;
+
+	// tinyobj callbacks, defined with the parser
+	struct Callbacks;
+
+	bool resolve(int rawIndex, size_t count, int32_t* index) const;
+	ObjVertexSources sources() const;
+	VertexAttributes convert(const Corner& corner) const;
+	std::vector<glm::vec3> convertPositions() const;
+	uint32_t findOrAddVertex(const Corner& corner);
+	void growTable();
+	void startShape();
+	void useMaterial(const char* rawName);
+
+private:
+	// Raw OBJ data needed to resolve face indices
+	std::vector<float> m_positions; // xyz
+	std::vector<float> m_colors; // rgb, empty if no vertex has a color
+	std::vector<float> m_normals; // xyz
+	std::vector<float> m_texcoords; // uv
+
+	// Welding state
+	std::vector<Corner> m_corners; // one per unique vertex
+	std::vector<uint32_t> m_hashes; // one per unique vertex
+	std::vector<uint32_t> m_table; // open addressing, unique vertex ids
+	std::vector<uint32_t> m_indices;
+	std::vector<size_t> m_shapeOffsets; // first index of each group or object
+	std::vector<uint32_t> m_shapeMaterials; // material from each shape offset on
+	std::vector<std::string> m_materials; // `usemtl` names
+	uint32_t m_material = kNoMaterial;
+
+	size_t m_invalidFaceCount = 0;
+	size_t m_degenerateFaceCount = 0;
+	std::string m_warnings;
+};
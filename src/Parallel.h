@@ -0,0 +1,148 @@
+/**
+ * Minimal helpers to spread CPU work over all cores.
+ *
+ * Work is split into contiguous ranges, one per thread, so that the result
+ * of a computation never depends on the number of threads as long as each
+ * range writes to its own outputs.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Number of worker threads to use when the caller passes 0.
+ */
+inline unsigned defaultThreadCount() {
+	unsigned count = std::thread::hardware_concurrency();
+	return count == 0 ? 1 : count;
+}
+
+/**
+ * Number of ranges `parallelForRanges` splits `count` items into, with at
+ * least `minGrain` items per range.
+ */
+inline size_t parallelRangeCount(size_t count, size_t minGrain, unsigned threadCount = 0) {
+	if (threadCount == 0) threadCount = defaultThreadCount();
+	size_t ranges = std::max<size_t>(1, count / std::max<size_t>(1, minGrain));
+	return std::min<size_t>(ranges, threadCount);
+}
+
+/**
+ * Calls `fn(rangeIndex, begin, end)` for `parallelRangeCount(...)` ranges
+ * covering [0, count), each on its own thread. The calling thread runs the
+ * first range.
+ */
+template <typename Fn>
+void parallelForRanges(size_t count, size_t minGrain, Fn&& fn, unsigned threadCount = 0) {
+	const size_t ranges = parallelRangeCount(count, minGrain, threadCount);
+	if (ranges <= 1) {
+		fn(size_t(0), size_t(0), count);
+		return;
+	}
+	auto rangeBegin = [&](size_t r) { return count * r / ranges; };
+	std::vector<std::thread> workers;
+	workers.reserve(ranges - 1);
+	for (size_t r = 1; r < ranges; ++r) {
+		workers.emplace_back([&, r]() { fn(r, rangeBegin(r), rangeBegin(r + 1)); });
+	}
+	fn(size_t(0), size_t(0), rangeBegin(1));
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+/**
+ * Calls `fn(i)` for every i in [0, count), spread over the worker threads.
+ */
+template <typename Fn>
+void parallelFor(size_t count, Fn&& fn, unsigned threadCount = 0) {
+	parallelForRanges(count, 1, [&](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			fn(i);
+		}
+	}, threadCount);
+}
+
+/**
+ * Fixed set of worker threads running submitted tasks in order, for work
+ * that runs in the background while the calling thread does something else
+ * (parallelFor blocks until its work is done). Tasks must not wait for
+ * other tasks of the same pool.
+ */
+class ThreadPool {
+public:
+	explicit ThreadPool(unsigned threadCount = 0) {
+		if (threadCount == 0) threadCount = defaultThreadCount();
+		m_workers.reserve(threadCount);
+		for (unsigned i = 0; i < threadCount; ++i) {
+			m_workers.emplace_back([this]() { run(); });
+		}
+	}
+
+	// Finishes the tasks already submitted
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_wakeUp.notify_all();
+		for (std::thread& worker : m_workers) {
+			worker.join();
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	size_t threadCount() const { return m_workers.size(); }
+
+	/**
+	 * Queues `fn()`, and returns a future of its result (or exception).
+	 */
+	template <typename Fn>
+	std::future<std::invoke_result_t<Fn>> submit(Fn&& fn) {
+		using Result = std::invoke_result_t<Fn>;
+		// std::function needs a copyable callable, and packaged_task is not
+		auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Fn>(fn));
+		std::future<Result> result = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_tasks.emplace_back([task]() { (*task)(); });
+		}
+		m_wakeUp.notify_one();
+		return result;
+	}
+
+private:
+	void run() {
+		for (;;) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wakeUp.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+				if (m_tasks.empty()) return;
+				task = std::move(m_tasks.front());
+				m_tasks.pop_front();
+			}
+			task();
+		}
+	}
+
+private:
+	std::vector<std::thread> m_workers;
+	std::deque<std::function<void()>> m_tasks;
+	std::mutex m_mutex;
+	std::condition_variable m_wakeUp;
+	bool m_stopping = false;
+};
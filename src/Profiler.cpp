@@ -0,0 +1,158 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+#ifdef PROFILER
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const Clock::time_point g_start = Clock::now();
+
+constexpr uint64_t kRingMask = kProfilerRingSize - 1;
+static_assert((kProfilerRingSize & kRingMask) == 0, "the ring size must be a power of 2");
+
+/**
+ * Zones of a thread. Only that thread writes them; `written` counts every
+ * zone ever recorded, and is published after the zone it counts.
+ */
+struct ThreadRing {
+	uint32_t id = 0; // 1-based
+	std::string name; // guarded by g_ringsMutex
+	bool inUse = false; // guarded by g_ringsMutex
+	std::atomic<uint64_t> written{ 0 };
+	std::unique_ptr<ProfileEvent[]> events{ new ProfileEvent[kProfilerRingSize] };
+};
+
+// Rings are never freed: the ring of a thread that exited is kept for the
+// trace, and reused by the next thread that records, so that short lived
+// workers do not each allocate one
+std::mutex g_ringsMutex;
+std::vector<std::unique_ptr<ThreadRing>> g_rings;
+
+struct RingOwner {
+	ThreadRing* ring = nullptr;
+
+	~RingOwner() {
+		if (!ring) return;
+		std::lock_guard<std::mutex> lock(g_ringsMutex);
+		ring->inUse = false;
+	}
+};
+
+ThreadRing& threadRing() {
+	thread_local RingOwner owner;
+	if (!owner.ring) {
+		std::lock_guard<std::mutex> lock(g_ringsMutex);
+		for (const std::unique_ptr<ThreadRing>& ring : g_rings) {
+			if (!ring->inUse) {
+				owner.ring = ring.get();
+				break;
+			}
+		}
+		if (!owner.ring) {
+			g_rings.push_back(std::make_unique<ThreadRing>());
+			owner.ring = g_rings.back().get();
+			owner.ring->id = static_cast<uint32_t>(g_rings.size());
+		}
+		owner.ring->inUse = true;
+	}
+	return *owner.ring;
+}
+
+void writeJsonString(std::ostream& out, const char* text) {
+	out << '"';
+	for (const char* c = text; *c; ++c) {
+		if (*c == '"' || *c == '\\') {
+			out << '\\' << *c;
+		} else if (static_cast<unsigned char>(*c) < 0x20) {
+			out << ' ';
+		} else {
+			out << *c;
+		}
+	}
+	out << '"';
+}
+
+} // namespace
+
+uint64_t profilerNow() {
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - g_start).count());
+}
+
+void recordProfileZone(const char* name, uint64_t begin, uint64_t end) {
+	ThreadRing& ring = threadRing();
+	const uint64_t index = ring.written.load(std::memory_order_relaxed);
+	ring.events[index & kRingMask] = { name, begin, end };
+	ring.written.store(index + 1, std::memory_order_release);
+}
+
+void setProfilerThreadName(const char* name) {
+	ThreadRing& ring = threadRing();
+	std::lock_guard<std::mutex> lock(g_ringsMutex);
+	ring.name = name;
+}
+
+bool writeChromeTrace(const fs::path& path) {
+	std::ofstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	const char* separator = "\n";
+	char numbers[96];
+	std::vector<ProfileEvent> events;
+
+	std::lock_guard<std::mutex> lock(g_ringsMutex);
+	for (const std::unique_ptr<ThreadRing>& ring : g_rings) {
+		if (!ring->name.empty()) {
+			file << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring->id << ",\"args\":{\"name\":";
+			writeJsonString(file, ring->name.c_str());
+			file << "}}";
+			separator = ",\n";
+		}
+
+		// Copy the zones still in the ring, then drop those the thread
+		// overwrote meanwhile
+		const uint64_t written = ring->written.load(std::memory_order_acquire);
+		const uint64_t first = written > kProfilerRingSize ? written - kProfilerRingSize : 0;
+		events.clear();
+		for (uint64_t i = first; i < written; ++i) {
+			events.push_back(ring->events[i & kRingMask]);
+		}
+		const uint64_t writtenAfter = ring->written.load(std::memory_order_acquire);
+		const uint64_t overwritten = writtenAfter > kProfilerRingSize ? writtenAfter - kProfilerRingSize : 0;
+		const size_t skipped = static_cast<size_t>(std::min<uint64_t>(overwritten > first ? overwritten - first : 0, events.size()));
+
+		for (size_t i = skipped; i < events.size(); ++i) {
+			const ProfileEvent& event = events[i];
+			file << separator << "{\"name\":";
+			writeJsonString(file, event.name);
+			std::snprintf(numbers, sizeof(numbers), ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				ring->id, event.begin / 1000.0, (event.end - event.begin) / 1000.0);
+			file << numbers;
+			separator = ",\n";
+		}
+	}
+	file << "\n]}\n";
+	return static_cast<bool>(file);
+}
+
+#else
+
+bool writeChromeTrace(const fs::path&) {
+	return false;
+}
+
+#endif
@@ -0,0 +1,81 @@
+/**
+ * Low overhead CPU profiler: scoped zones recorded per thread, exported as
+ * a Chrome trace (chrome://tracing or https://ui.perfetto.dev).
+ *
+ *     void update() {
+ *         PROFILE_ZONE("update");
+ *         ...
+ *     }
+ *
+ * Each thread records into its own ring buffer without locking, and once
+ * it is full the latest zones overwrite the oldest ones. Zones are only
+ * compiled in when PROFILER is defined (see CMakeLists.txt, every build type
+ * but Release and MinSizeRel); otherwise PROFILE_ZONE expands to nothing
+ * and there is no runtime check either.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+/**
+ * A zone, in nanoseconds since the profiler started.
+ */
+struct ProfileEvent {
+	const char* name; // must outlive the profiler, typically a literal
+	uint64_t begin;
+	uint64_t end;
+};
+
+// Zones kept per thread, a power of 2
+constexpr size_t kProfilerRingSize = size_t(1) << 16;
+
+#ifdef PROFILER
+
+constexpr bool kProfilerEnabled = true;
+
+uint64_t profilerNow();
+
+void recordProfileZone(const char* name, uint64_t begin, uint64_t end);
+
+/**
+ * Names the calling thread in the trace (threads are otherwise numbered in
+ * the order of their first zone).
+ */
+void setProfilerThreadName(const char* name);
+
+class ProfileZone {
+public:
+	explicit ProfileZone(const char* name) : m_name(name), m_begin(profilerNow()) {}
+	~ProfileZone() { recordProfileZone(m_name, m_begin, profilerNow()); }
+	ProfileZone(const ProfileZone&) = delete;
+	ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+	const char* m_name;
+	uint64_t m_begin;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+
+#else
+
+constexpr bool kProfilerEnabled = false;
+
+inline void setProfilerThreadName(const char*) {}
+
+#define PROFILE_ZONE(name) ((void)0)
+
+#endif
+
+/**
+ * Writes the zones of every thread so far, as Chrome trace events. Other
+ * threads may keep recording meanwhile; zones they overwrite while they are
+ * being copied are dropped. Returns false if the file cannot be written, or
+ * the profiler is compiled out.
+ */
+bool writeChromeTrace(const std::filesystem::path& path);
@@ -0,0 +1,684 @@
+#include "SceneBvh.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define CULLING_SSE
+#if defined(__GNUC__) || defined(__clang__)
+#define CULLING_AVX2
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define CULLING_AVX2
+#define TARGET_AVX2
+#endif
+#endif
+
+using Node = SceneBvh::Node;
+
+namespace {
+
+constexpr int kBins = 16;
+// Ranges from which bounds and bins are computed on all threads
+constexpr size_t kParallelBinning = 65536;
+constexpr uint32_t kAllPlanes = 0x3f;
+
+Aabb emptyBox() {
+	const float inf = std::numeric_limits<float>::infinity();
+	return { glm::vec3(inf), glm::vec3(-inf) };
+}
+
+void grow(Aabb& box, const Aabb& other) {
+	box.min = glm::min(box.min, other.min);
+	box.max = glm::max(box.max, other.max);
+}
+
+void grow(Aabb& box, const glm::vec3& point) {
+	box.min = glm::min(box.min, point);
+	box.max = glm::max(box.max, point);
+}
+
+// Half the surface area, which is all the heuristic needs
+float halfArea(const Aabb& box) {
+	const glm::vec3 d = box.max - box.min;
+	if (d.x < 0.0f || d.y < 0.0f || d.z < 0.0f) return 0.0f;
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+Aabb laneBox(const Node& node, uint32_t lane) {
+	return {
+		glm::vec3(node.minX[lane], node.minY[lane], node.minZ[lane]),
+		glm::vec3(node.maxX[lane], node.maxY[lane], node.maxZ[lane]),
+	};
+}
+
+void setLaneBox(Node& node, uint32_t lane, const Aabb& box) {
+	node.minX[lane] = box.min.x;
+	node.minY[lane] = box.min.y;
+	node.minZ[lane] = box.min.z;
+	node.maxX[lane] = box.max.x;
+	node.maxY[lane] = box.max.y;
+	node.maxZ[lane] = box.max.z;
+}
+
+Aabb nodeBox(const Node& node) {
+	Aabb box = emptyBox();
+	for (uint32_t lane = 0; lane < node.childCount; ++lane) {
+		grow(box, laneBox(node, lane));
+	}
+	return box;
+}
+
+// The plane tests of every kernel evaluate ((a x + b y) + c z) + d in this
+// order, without fused multiply-adds, so that they round the same.
+// Testing the vertex furthest along the normal is then monotonic: a box
+// inside another is never found visible when the outer one is not.
+bool isBoxVisible(const Frustum& frustum, const Aabb& box, uint32_t planes) {
+	for (uint32_t p = 0; p < 6; ++p) {
+		if (!(planes & (1u << p))) continue;
+		const glm::vec4& plane = frustum.planes[p];
+		const float x = plane.x >= 0.0f ? box.max.x : box.min.x;
+		const float y = plane.y >= 0.0f ? box.max.y : box.min.y;
+		const float z = plane.z >= 0.0f ? box.max.z : box.min.z;
+		if (plane.x * x + plane.y * y + plane.z * z + plane.w < 0.0f) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Lanes of a node against the planes of a query: those entirely outside of
+ * one plane, and for each plane those entirely inside of it.
+ */
+struct LaneMasks {
+	uint32_t outside = 0;
+	uint32_t inside[6] = {};
+};
+
+/**
+ * Coordinates of the vertices of the node's boxes nearest to and furthest
+ * along the normal of a plane.
+ */
+struct PlaneVertices {
+	const float* farX;
+	const float* farY;
+	const float* farZ;
+	const float* nearX;
+	const float* nearY;
+	const float* nearZ;
+};
+
+PlaneVertices planeVertices(const Node& node, const glm::vec4& plane) {
+	PlaneVertices vertices;
+	vertices.farX = plane.x >= 0.0f ? node.maxX : node.minX;
+	vertices.nearX = plane.x >= 0.0f ? node.minX : node.maxX;
+	vertices.farY = plane.y >= 0.0f ? node.maxY : node.minY;
+	vertices.nearY = plane.y >= 0.0f ? node.minY : node.maxY;
+	vertices.farZ = plane.z >= 0.0f ? node.maxZ : node.minZ;
+	vertices.nearZ = plane.z >= 0.0f ? node.minZ : node.maxZ;
+	return vertices;
+}
+
+LaneMasks testLanesScalar(const Node& node, const Frustum& frustum, uint32_t planes, uint32_t lanes) {
+	LaneMasks masks;
+	for (uint32_t p = 0; p < 6 && (masks.outside & lanes) != lanes; ++p) {
+		if (!(planes & (1u << p))) continue;
+		const glm::vec4& plane = frustum.planes[p];
+		const PlaneVertices v = planeVertices(node, plane);
+		for (uint32_t lane = 0; lane < SceneBvh::kWidth; ++lane) {
+			const float farDistance = plane.x * v.farX[lane] + plane.y * v.farY[lane] + plane.z * v.farZ[lane] + plane.w;
+			const float nearDistance = plane.x * v.nearX[lane] + plane.y * v.nearY[lane] + plane.z * v.nearZ[lane] + plane.w;
+			masks.outside |= farDistance < 0.0f ? 1u << lane : 0u;
+			masks.inside[p] |= nearDistance >= 0.0f ? 1u << lane : 0u;
+		}
+	}
+	return masks;
+}
+
+#ifdef CULLING_SSE
+
+// The 8 lanes as two halves of 4
+LaneMasks testLanesSse(const Node& node, const Frustum& frustum, uint32_t planes, uint32_t lanes) {
+	LaneMasks masks;
+	const __m128 zero = _mm_setzero_ps();
+	for (uint32_t p = 0; p < 6 && (masks.outside & lanes) != lanes; ++p) {
+		if (!(planes & (1u << p))) continue;
+		const glm::vec4& plane = frustum.planes[p];
+		const PlaneVertices v = planeVertices(node, plane);
+		const __m128 a = _mm_set1_ps(plane.x), b = _mm_set1_ps(plane.y), c = _mm_set1_ps(plane.z), d = _mm_set1_ps(plane.w);
+		for (uint32_t half = 0; half < SceneBvh::kWidth; half += 4) {
+			const __m128 farDistance = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(a, _mm_load_ps(v.farX + half)),
+				_mm_mul_ps(b, _mm_load_ps(v.farY + half))),
+				_mm_mul_ps(c, _mm_load_ps(v.farZ + half))),
+				d);
+			const __m128 nearDistance = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(a, _mm_load_ps(v.nearX + half)),
+				_mm_mul_ps(b, _mm_load_ps(v.nearY + half))),
+				_mm_mul_ps(c, _mm_load_ps(v.nearZ + half))),
+				d);
+			masks.outside |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmplt_ps(farDistance, zero))) << half;
+			masks.inside[p] |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpge_ps(nearDistance, zero))) << half;
+		}
+	}
+	return masks;
+}
+
+#endif // CULLING_SSE
+
+#ifdef CULLING_AVX2
+
+bool cpuHasAvx2() {
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_cpu_supports("avx2");
+#else
+	int info[4];
+	__cpuid(info, 1);
+	const bool osSavesYmm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+	__cpuidex(info, 7, 0);
+	return osSavesYmm && (info[1] & (1 << 5));
+#endif
+}
+
+TARGET_AVX2 LaneMasks testLanesAvx2(const Node& node, const Frustum& frustum, uint32_t planes, uint32_t lanes) {
+	LaneMasks masks;
+	const __m256 zero = _mm256_setzero_ps();
+	for (uint32_t p = 0; p < 6 && (masks.outside & lanes) != lanes; ++p) {
+		if (!(planes & (1u << p))) continue;
+		const glm::vec4& plane = frustum.planes[p];
+		const PlaneVertices v = planeVertices(node, plane);
+		const __m256 a = _mm256_set1_ps(plane.x), b = _mm256_set1_ps(plane.y), c = _mm256_set1_ps(plane.z), d = _mm256_set1_ps(plane.w);
+		const __m256 farDistance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+			_mm256_mul_ps(a, _mm256_load_ps(v.farX)),
+			_mm256_mul_ps(b, _mm256_load_ps(v.farY))),
+			_mm256_mul_ps(c, _mm256_load_ps(v.farZ))),
+			d);
+		const __m256 nearDistance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+			_mm256_mul_ps(a, _mm256_load_ps(v.nearX)),
+			_mm256_mul_ps(b, _mm256_load_ps(v.nearY))),
+			_mm256_mul_ps(c, _mm256_load_ps(v.nearZ))),
+			d);
+		masks.outside |= static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(farDistance, zero, _CMP_LT_OQ)));
+		masks.inside[p] |= static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(nearDistance, zero, _CMP_GE_OQ)));
+	}
+	return masks;
+}
+
+#endif // CULLING_AVX2
+
+LaneMasks testLanes(CullingKernel kernel, const Node& node, const Frustum& frustum, uint32_t planes, uint32_t lanes) {
+	switch (kernel) {
+#ifdef CULLING_SSE
+	case CullingKernel::SSE:
+		return testLanesSse(node, frustum, planes, lanes);
+#endif
+#ifdef CULLING_AVX2
+	case CullingKernel::AVX2:
+		return testLanesAvx2(node, frustum, planes, lanes);
+#endif
+	default:
+		return testLanesScalar(node, frustum, planes, lanes);
+	}
+}
+
+struct BinaryNode {
+	Aabb bounds;
+	uint32_t left = 0;
+	uint32_t right = 0;
+	uint32_t first = 0; // objects of the subtree, leaf or not
+	uint32_t count = 0;
+	bool leaf = false;
+};
+
+struct Bin {
+	Aabb bounds = emptyBox();
+	uint32_t count = 0;
+};
+
+using Bins = std::array<std::array<Bin, kBins>, 3>;
+
+/**
+ * Top-down construction of a binary tree over the objects, which `split`
+ * reorders in place.
+ */
+class Builder {
+public:
+	Builder(const std::vector<Aabb>& bounds, std::vector<uint32_t>& objects, unsigned threadCount)
+		: m_bounds(bounds)
+		, m_objects(objects)
+		, m_threadCount(threadCount)
+	{
+		m_centers.resize(bounds.size());
+		parallelForRanges(bounds.size(), kParallelBinning, [&](size_t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				m_centers[i] = 0.5f * (bounds[i].min + bounds[i].max);
+			}
+		}, threadCount);
+	}
+
+	/**
+	 * Bounds of the objects in [begin, end), and of their centers.
+	 */
+	void measure(uint32_t begin, uint32_t end, Aabb& bounds, Aabb& centers) const {
+		auto measureRange = [&](size_t rangeBegin, size_t rangeEnd, Aabb& rangeBounds, Aabb& rangeCenters) {
+			rangeBounds = rangeCenters = emptyBox();
+			for (size_t i = rangeBegin; i < rangeEnd; ++i) {
+				const uint32_t object = m_objects[i];
+				grow(rangeBounds, m_bounds[object]);
+				grow(rangeCenters, m_centers[object]);
+			}
+		};
+		const size_t ranges = end - begin >= kParallelBinning ? parallelRangeCount(end - begin, kParallelBinning / 4, m_threadCount) : 1;
+		if (ranges <= 1) {
+			measureRange(begin, end, bounds, centers);
+			return;
+		}
+		std::vector<std::pair<Aabb, Aabb>> partial(ranges);
+		parallelForRanges(end - begin, kParallelBinning / 4, [&](size_t range, size_t rangeBegin, size_t rangeEnd) {
+			measureRange(begin + rangeBegin, begin + rangeEnd, partial[range].first, partial[range].second);
+		}, m_threadCount);
+		bounds = centers = emptyBox();
+		for (const std::pair<Aabb, Aabb>& range : partial) {
+			grow(bounds, range.first);
+			grow(centers, range.second);
+		}
+	}
+
+	/**
+	 * Reorders [begin, end) into two children and returns where the second
+	 * one starts.
+	 */
+	uint32_t split(uint32_t begin, uint32_t end, const Aabb& centers) {
+		const glm::vec3 extent = centers.max - centers.min;
+		glm::vec3 scale;
+		for (int axis = 0; axis < 3; ++axis) {
+			scale[axis] = extent[axis] > 0.0f ? kBins / extent[axis] : 0.0f;
+		}
+		auto binOf = [&](const glm::vec3& center, int axis) {
+			const int bin = static_cast<int>((center[axis] - centers.min[axis]) * scale[axis]);
+			return std::min(bin, kBins - 1);
+		};
+
+		auto binRange = [&](size_t rangeBegin, size_t rangeEnd, Bins& rangeBins) {
+			for (size_t i = rangeBegin; i < rangeEnd; ++i) {
+				const uint32_t object = m_objects[i];
+				for (int axis = 0; axis < 3; ++axis) {
+					Bin& bin = rangeBins[axis][binOf(m_centers[object], axis)];
+					grow(bin.bounds, m_bounds[object]);
+					++bin.count;
+				}
+			}
+		};
+		Bins bins;
+		const size_t ranges = end - begin >= kParallelBinning ? parallelRangeCount(end - begin, kParallelBinning / 4, m_threadCount) : 1;
+		if (ranges <= 1) {
+			binRange(begin, end, bins);
+		} else {
+			std::vector<Bins> partial(ranges);
+			parallelForRanges(end - begin, kParallelBinning / 4, [&](size_t range, size_t rangeBegin, size_t rangeEnd) {
+				binRange(begin + rangeBegin, begin + rangeEnd, partial[range]);
+			}, m_threadCount);
+			for (const Bins& rangeBins : partial) {
+				for (int axis = 0; axis < 3; ++axis) {
+					for (int i = 0; i < kBins; ++i) {
+						grow(bins[axis][i].bounds, rangeBins[axis][i].bounds);
+						bins[axis][i].count += rangeBins[axis][i].count;
+					}
+				}
+			}
+		}
+
+		// Cost of each split between bins i - 1 and i, from sweeps in both
+		// directions
+		int bestAxis = -1, bestBin = 0;
+		float bestCost = std::numeric_limits<float>::infinity();
+		for (int axis = 0; axis < 3; ++axis) {
+			if (scale[axis] == 0.0f) continue;
+			std::array<float, kBins> rightCost{};
+			Aabb box = emptyBox();
+			uint32_t count = 0;
+			for (int i = kBins - 1; i > 0; --i) {
+				grow(box, bins[axis][i].bounds);
+				count += bins[axis][i].count;
+				rightCost[i] = count > 0 ? halfArea(box) * count : std::numeric_limits<float>::infinity();
+			}
+			box = emptyBox();
+			count = 0;
+			for (int i = 1; i < kBins; ++i) {
+				grow(box, bins[axis][i - 1].bounds);
+				count += bins[axis][i - 1].count;
+				if (count == 0) continue;
+				const float cost = halfArea(box) * count + rightCost[i];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = i;
+				}
+			}
+		}
+
+		uint32_t* first = m_objects.data() + begin;
+		uint32_t* last = m_objects.data() + end;
+		if (bestAxis >= 0) {
+			const uint32_t* middle = std::partition(first, last, [&](uint32_t object) {
+				return binOf(m_centers[object], bestAxis) < bestBin;
+			});
+			return static_cast<uint32_t>(middle - m_objects.data());
+		}
+		// Every center is in the same place: any half will do
+		return begin + (end - begin) / 2;
+	}
+
+	/**
+	 * Builds the tree of [begin, end) into `nodes`, whose first new node is
+	 * its root.
+	 */
+	void buildSubtree(uint32_t begin, uint32_t end, std::vector<BinaryNode>& nodes) {
+		struct Task {
+			uint32_t begin, end;
+			uint32_t parent;
+			bool right;
+		};
+		const uint32_t kNoParent = ~0u;
+		std::vector<Task> stack = { { begin, end, kNoParent, false } };
+		while (!stack.empty()) {
+			const Task task = stack.back();
+			stack.pop_back();
+			const uint32_t index = static_cast<uint32_t>(nodes.size());
+			if (task.parent != kNoParent) {
+				(task.right ? nodes[task.parent].right : nodes[task.parent].left) = index;
+			}
+			BinaryNode node;
+			Aabb centers;
+			measure(task.begin, task.end, node.bounds, centers);
+			node.first = task.begin;
+			node.count = task.end - task.begin;
+			node.leaf = node.count <= SceneBvh::kMaxLeafSize;
+			nodes.push_back(node);
+			if (node.leaf) continue;
+			const uint32_t middle = split(task.begin, task.end, centers);
+			stack.push_back({ middle, task.end, index, true });
+			stack.push_back({ task.begin, middle, index, false });
+		}
+	}
+
+	/**
+	 * Builds the whole tree: ranges larger than kSubtreeSize are split here,
+	 * then the others are built in parallel and appended.
+	 */
+	std::vector<BinaryNode> build() {
+		struct Subtree {
+			uint32_t begin, end;
+			uint32_t slot; // reserved for its root
+			std::vector<BinaryNode> nodes;
+		};
+		std::vector<BinaryNode> nodes;
+		std::vector<Subtree> subtrees;
+		struct Task {
+			uint32_t begin, end;
+			uint32_t parent;
+			bool right;
+		};
+		const uint32_t kNoParent = ~0u;
+		std::vector<Task> stack = { { 0, static_cast<uint32_t>(m_objects.size()), kNoParent, false } };
+		while (!stack.empty()) {
+			const Task task = stack.back();
+			stack.pop_back();
+			const uint32_t index = static_cast<uint32_t>(nodes.size());
+			if (task.parent != kNoParent) {
+				(task.right ? nodes[task.parent].right : nodes[task.parent].left) = index;
+			}
+			nodes.emplace_back();
+			if (task.end - task.begin <= SceneBvh::kSubtreeSize) {
+				subtrees.push_back({ task.begin, task.end, index, {} });
+				continue;
+			}
+			BinaryNode& node = nodes.back();
+			Aabb centers;
+			measure(task.begin, task.end, node.bounds, centers);
+			node.first = task.begin;
+			node.count = task.end - task.begin;
+			const uint32_t middle = split(task.begin, task.end, centers);
+			stack.push_back({ middle, task.end, index, true });
+			stack.push_back({ task.begin, middle, index, false });
+		}
+
+		parallelFor(subtrees.size(), [&](size_t i) {
+			Subtree& subtree = subtrees[i];
+			subtree.nodes.reserve(2 * (subtree.end - subtree.begin) / SceneBvh::kMaxLeafSize + 1);
+			buildSubtree(subtree.begin, subtree.end, subtree.nodes);
+		}, m_threadCount);
+
+		// The root of each subtree goes to its slot, the rest at the end
+		for (Subtree& subtree : subtrees) {
+			const uint32_t base = static_cast<uint32_t>(nodes.size()) - 1;
+			auto remap = [&](uint32_t local) { return local == 0 ? subtree.slot : base + local; };
+			for (BinaryNode& node : subtree.nodes) {
+				if (node.leaf) continue;
+				node.left = remap(node.left);
+				node.right = remap(node.right);
+			}
+			nodes[subtree.slot] = subtree.nodes[0];
+			nodes.insert(nodes.end(), subtree.nodes.begin() + 1, subtree.nodes.end());
+		}
+		return nodes;
+	}
+
+private:
+	const std::vector<Aabb>& m_bounds;
+	std::vector<uint32_t>& m_objects;
+	std::vector<glm::vec3> m_centers;
+	unsigned m_threadCount;
+};
+
+/**
+ * Turns the binary tree into nodes of up to kWidth children, by opening the
+ * largest children first, in depth first order.
+ */
+std::vector<Node> collapse(const std::vector<BinaryNode>& binary) {
+	std::vector<Node> nodes;
+	nodes.reserve(binary.size() / 4 + 1);
+	struct Task {
+		uint32_t binary;
+		uint32_t parent;
+		uint32_t lane;
+	};
+	const uint32_t kNoParent = ~0u;
+	std::vector<Task> stack = { { 0, kNoParent, 0 } };
+	std::vector<uint32_t> children;
+	while (!stack.empty()) {
+		const Task task = stack.back();
+		stack.pop_back();
+		const uint32_t index = static_cast<uint32_t>(nodes.size());
+		if (task.parent != kNoParent) {
+			nodes[task.parent].child[task.lane] = index;
+		}
+		nodes.emplace_back();
+
+		const BinaryNode& root = binary[task.binary];
+		children.clear();
+		if (root.leaf) {
+			children.push_back(task.binary);
+		} else {
+			children.push_back(root.left);
+			children.push_back(root.right);
+		}
+		while (children.size() < SceneBvh::kWidth) {
+			int largest = -1;
+			float largestArea = -1.0f;
+			for (size_t i = 0; i < children.size(); ++i) {
+				const BinaryNode& child = binary[children[i]];
+				if (!child.leaf && halfArea(child.bounds) > largestArea) {
+					largest = static_cast<int>(i);
+					largestArea = halfArea(child.bounds);
+				}
+			}
+			if (largest < 0) break;
+			const BinaryNode& opened = binary[children[largest]];
+			children[largest] = opened.right;
+			children.insert(children.begin() + largest, opened.left);
+		}
+
+		Node& node = nodes.back();
+		node.childCount = static_cast<uint32_t>(children.size());
+		for (uint32_t lane = 0; lane < node.childCount; ++lane) {
+			const BinaryNode& child = binary[children[lane]];
+			setLaneBox(node, lane, child.bounds);
+			node.first[lane] = child.first;
+			node.count[lane] = child.count;
+			node.child[lane] = SceneBvh::kLeaf;
+		}
+		for (uint32_t lane = node.childCount; lane-- > 0;) {
+			if (!binary[children[lane]].leaf) {
+				stack.push_back({ children[lane], index, lane });
+			}
+		}
+	}
+	return nodes;
+}
+
+} // namespace
+
+bool isBoxVisible(const Frustum& frustum, const Aabb& box) {
+	return isBoxVisible(frustum, box, kAllPlanes);
+}
+
+bool isSupported(CullingKernel kernel) {
+	switch (kernel) {
+	case CullingKernel::Scalar:
+		return true;
+#ifdef CULLING_SSE
+	case CullingKernel::SSE:
+		return true;
+#endif
+#ifdef CULLING_AVX2
+	case CullingKernel::AVX2: {
+		static const bool supported = cpuHasAvx2();
+		return supported;
+	}
+#endif
+	default:
+		return false;
+	}
+}
+
+CullingKernel bestCullingKernel() {
+	// Plain loads and arithmetic, so wider is faster
+	if (isSupported(CullingKernel::AVX2)) return CullingKernel::AVX2;
+	if (isSupported(CullingKernel::SSE)) return CullingKernel::SSE;
+	return CullingKernel::Scalar;
+}
+
+const char* cullingKernelName(CullingKernel kernel) {
+	switch (kernel) {
+	case CullingKernel::SSE: return "SSE";
+	case CullingKernel::AVX2: return "AVX2";
+	default: return "scalar";
+	}
+}
+
+void SceneBvh::build(const std::vector<Aabb>& bounds, unsigned threadCount) {
+	m_nodes.clear();
+	m_objects.resize(bounds.size());
+	for (uint32_t i = 0; i < m_objects.size(); ++i) {
+		m_objects[i] = i;
+	}
+	m_objectBounds.clear();
+	if (bounds.empty()) return;
+
+	Builder builder(bounds, m_objects, threadCount);
+	m_nodes = collapse(builder.build());
+	m_objectBounds.resize(bounds.size());
+	parallelForRanges(bounds.size(), kParallelBinning, [&](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			m_objectBounds[i] = bounds[m_objects[i]];
+		}
+	}, threadCount);
+}
+
+void SceneBvh::refit(const std::vector<Aabb>& bounds, unsigned threadCount) {
+	assert(bounds.size() == m_objects.size());
+	parallelForRanges(bounds.size(), kParallelBinning, [&](size_t, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			m_objectBounds[i] = bounds[m_objects[i]];
+		}
+	}, threadCount);
+	if (m_nodes.empty()) return;
+
+	// The subtree of each child of the root is a contiguous range of nodes,
+	// refit from the bottom up on its own thread, then the root
+	const Node& root = m_nodes[0];
+	std::vector<size_t> subtreeBegins;
+	for (uint32_t lane = 0; lane < root.childCount; ++lane) {
+		if (root.child[lane] != kLeaf) subtreeBegins.push_back(root.child[lane]);
+	}
+	subtreeBegins.push_back(m_nodes.size());
+	parallelFor(subtreeBegins.size() - 1, [&](size_t i) {
+		refitNodes(subtreeBegins[i], subtreeBegins[i + 1]);
+	}, threadCount);
+	refitNodes(0, 1);
+}
+
+void SceneBvh::refitNodes(size_t begin, size_t end) {
+	for (size_t i = end; i-- > begin;) {
+		Node& node = m_nodes[i];
+		for (uint32_t lane = 0; lane < node.childCount; ++lane) {
+			Aabb box = emptyBox();
+			if (node.child[lane] == kLeaf) {
+				for (uint32_t object = node.first[lane]; object < node.first[lane] + node.count[lane]; ++object) {
+					grow(box, m_objectBounds[object]);
+				}
+			} else {
+				box = nodeBox(m_nodes[node.child[lane]]);
+			}
+			setLaneBox(node, lane, box);
+		}
+	}
+}
+
+void SceneBvh::query(const Frustum& frustum, std::vector<uint32_t>& visible, CullingKernel kernel) const {
+	visible.clear();
+	if (m_nodes.empty()) return;
+	assert(isSupported(kernel));
+
+	struct Entry {
+		uint32_t node;
+		uint32_t planes; // those that the node is not entirely inside of
+	};
+	std::vector<Entry> stack;
+	stack.reserve(64);
+	stack.push_back({ 0, kAllPlanes });
+	while (!stack.empty()) {
+		const Entry entry = stack.back();
+		stack.pop_back();
+		const Node& node = m_nodes[entry.node];
+		const uint32_t lanes = (1u << node.childCount) - 1;
+		const LaneMasks masks = testLanes(kernel, node, frustum, entry.planes, lanes);
+		for (uint32_t lane = 0; lane < node.childCount; ++lane) {
+			if (masks.outside & (1u << lane)) continue;
+			uint32_t planes = entry.planes;
+			for (uint32_t p = 0; p < 6; ++p) {
+				if (masks.inside[p] & (1u << lane)) planes &= ~(1u << p);
+			}
+			const uint32_t first = node.first[lane];
+			const uint32_t last = first + node.count[lane];
+			if (planes == 0) {
+				visible.insert(visible.end(), m_objects.begin() + first, m_objects.begin() + last);
+			} else if (node.child[lane] == kLeaf) {
+				for (uint32_t object = first; object < last; ++object) {
+					if (isBoxVisible(frustum, m_objectBounds[object], planes)) {
+						visible.push_back(m_objects[object]);
+					}
+				}
+			} else {
+				stack.push_back({ node.child[lane], planes });
+			}
+		}
+	}
+}
@@ -0,0 +1,117 @@
+/**
+ * Bounding volume hierarchy of the objects of a scene, for frustum culling
+ * on the CPU.
+ *
+ * The tree is built top-down with a binned surface area heuristic (16 bins
+ * per axis, on the centers of the boxes). The top levels are split on the
+ * calling thread, with the binning of large ranges spread over the worker
+ * threads, then the subtrees below kSubtreeSize objects are built in
+ * parallel. Splits only depend on the boxes, so the tree is the same
+ * whatever the number of threads. The binary tree is then collapsed into
+ * nodes of 8 children whose bounds are stored as arrays per coordinate,
+ * so that a node's children are tested against a plane at once.
+ *
+ * Moving objects are handled by `refit`, which recomputes the bounds of the
+ * same tree bottom-up. It only degrades the tree when objects travel far
+ * from where it was built, then `build` again.
+ *
+ * Queries test boxes against each plane with the vertex furthest along the
+ * plane's normal, 4 children at a time (SSE) or 8 (AVX2). Planes that a
+ * child is entirely inside of are not tested again below it, and children
+ * inside every plane are output without visiting them. Every kernel gives
+ * the same objects as testing each object's box alone (see `isBoxVisible`).
+ */
+
+#pragma once
+
+#include "Meshlets.h"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct Aabb {
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+/**
+ * Whether a box intersects the frustum, or may: boxes near a corner of the
+ * frustum can be outside of it but on the inner side of every plane.
+ */
+bool isBoxVisible(const Frustum& frustum, const Aabb& box);
+
+enum class CullingKernel { Scalar, SSE, AVX2 };
+
+/**
+ * Whether `kernel` is built in and runs on this CPU.
+ */
+bool isSupported(CullingKernel kernel);
+
+/**
+ * The widest supported kernel.
+ */
+CullingKernel bestCullingKernel();
+
+const char* cullingKernelName(CullingKernel kernel);
+
+class SceneBvh {
+public:
+	static constexpr uint32_t kWidth = 8; // children per node
+	static constexpr uint32_t kMaxLeafSize = 4; // objects per leaf
+	static constexpr size_t kSubtreeSize = 16384; // objects per parallel build task
+
+	/**
+	 * Builds the tree of `bounds.size()` objects, identified by their index
+	 * in `bounds`. `threadCount` 0 uses all cores.
+	 */
+	void build(const std::vector<Aabb>& bounds, unsigned threadCount = 0);
+
+	/**
+	 * Updates the bounds of the objects the tree was built with, keeping its
+	 * structure.
+	 */
+	void refit(const std::vector<Aabb>& bounds, unsigned threadCount = 0);
+
+	/**
+	 * Replaces `visible` with the objects whose box intersects the frustum
+	 * (in the space of the boxes), in no particular order. `kernel` must be
+	 * supported.
+	 */
+	void query(const Frustum& frustum, std::vector<uint32_t>& visible, CullingKernel kernel = bestCullingKernel()) const;
+
+	size_t objectCount() const { return m_objects.size(); }
+	size_t nodeCount() const { return m_nodes.size(); }
+
+	/**
+	 * Objects in the order of the leaves, which only depends on the boxes
+	 * the tree was built with.
+	 */
+	const std::vector<uint32_t>& objectOrder() const { return m_objects; }
+
+public:
+	static constexpr uint32_t kLeaf = ~0u;
+
+	/**
+	 * Children are in the order of the objects, and nodes in depth first
+	 * order, so that a node's objects and subtree are both contiguous.
+	 */
+	struct alignas(32) Node {
+		float minX[kWidth], minY[kWidth], minZ[kWidth];
+		float maxX[kWidth], maxY[kWidth], maxZ[kWidth];
+		uint32_t child[kWidth]; // index in m_nodes, or kLeaf
+		uint32_t first[kWidth]; // the child's objects are m_objects[first, first + count)
+		uint32_t count[kWidth];
+		uint32_t childCount;
+	};
+
+private:
+	void refitNodes(size_t begin, size_t end);
+
+private:
+	std::vector<Node> m_nodes; // m_nodes[0] is the root
+	std::vector<uint32_t> m_objects; // object indices, in leaf order
+	std::vector<Aabb> m_objectBounds; // in leaf order
+};
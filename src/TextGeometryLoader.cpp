@@ -0,0 +1,321 @@
+#include "TextGeometryLoader.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Points parsed at once before being encoded, small enough to stay in the
+// L1 cache
+constexpr size_t kEncodingBlock = 256;
+
+// Powers of ten that doubles hold exactly
+constexpr double kExactPowersOfTen[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+bool isBlank(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+bool isDigit(char c) {
+	return static_cast<unsigned char>(c - '0') < 10;
+}
+
+const char* skipBlanks(const char* s, const char* end) {
+	while (s < end && isBlank(*s)) ++s;
+	return s;
+}
+
+// Whether a token ends at `s`
+bool atSeparator(const char* s, const char* end) {
+	return s == end || isBlank(*s) || *s == '#';
+}
+
+// Whether only blanks and a comment are left
+bool atLineEnd(const char* s, const char* end) {
+	s = skipBlanks(s, end);
+	return s == end || *s == '#';
+}
+
+/**
+ * Parses a decimal number at `s`, and moves `s` past it. Numbers with at
+ * most 19 significant digits and a small exponent, which is all of them in
+ * practice, are converted exactly with a single multiplication or division
+ * by a power of ten (Clinger's fast path); others go through strtod.
+ */
+bool parseFloat(const char*& s, const char* end, float* value) {
+	const char* start = s;
+	bool negative = false;
+	if (s < end && (*s == '-' || *s == '+')) {
+		negative = *s++ == '-';
+	}
+
+	uint64_t significand = 0;
+	int digits = 0; // significant ones
+	int exponent = 0;
+	bool truncated = false;
+	bool any = false;
+	for (; s < end && isDigit(*s); ++s, any = true) {
+		if (digits < 19) {
+			significand = 10 * significand + static_cast<uint64_t>(*s - '0');
+			digits += significand != 0;
+		} else {
+			++exponent;
+			truncated = true;
+		}
+	}
+	if (s < end && *s == '.') {
+		for (++s; s < end && isDigit(*s); ++s, any = true) {
+			if (digits < 19) {
+				significand = 10 * significand + static_cast<uint64_t>(*s - '0');
+				digits += significand != 0;
+				--exponent;
+			} else {
+				truncated = truncated || *s != '0';
+			}
+		}
+	}
+	if (!any) return false;
+	if (s < end && (*s == 'e' || *s == 'E')) {
+		++s;
+		bool negativeExponent = false;
+		if (s < end && (*s == '-' || *s == '+')) {
+			negativeExponent = *s++ == '-';
+		}
+		if (s == end || !isDigit(*s)) return false;
+		int written = 0;
+		for (; s < end && isDigit(*s); ++s) {
+			written = std::min(10 * written + (*s - '0'), 100000);
+		}
+		exponent += negativeExponent ? -written : written;
+	}
+	if (!atSeparator(s, end)) return false;
+
+	if (!truncated && significand <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22) {
+		double number = static_cast<double>(significand);
+		number = exponent < 0 ? number / kExactPowersOfTen[-exponent] : number * kExactPowersOfTen[exponent];
+		*value = static_cast<float>(negative ? -number : number);
+		return true;
+	}
+
+	// The mapping is not null terminated
+	char token[128];
+	const size_t length = static_cast<size_t>(s - start);
+	if (length >= sizeof(token)) return false;
+	std::memcpy(token, start, length);
+	token[length] = '\0';
+	*value = static_cast<float>(std::strtod(token, nullptr));
+	return true;
+}
+
+bool parseIndex(const char*& s, const char* end, uint32_t* value) {
+	uint64_t index = 0;
+	const char* start = s;
+	for (; s < end && isDigit(*s); ++s) {
+		index = 10 * index + static_cast<uint64_t>(*s - '0');
+		if (index > std::numeric_limits<uint32_t>::max()) return false;
+	}
+	*value = static_cast<uint32_t>(index);
+	return s != start && atSeparator(s, end);
+}
+
+/**
+ * Calls `row(begin, end, line)` for each line of [begin, end) that is
+ * neither blank nor a comment, until it returns false.
+ */
+template <typename Row>
+bool forEachRow(const char* s, const char* end, size_t line, Row&& row) {
+	while (s < end) {
+		const char* lineEnd = static_cast<const char*>(std::memchr(s, '\n', static_cast<size_t>(end - s)));
+		if (!lineEnd) lineEnd = end;
+		const char* first = skipBlanks(s, lineEnd);
+		if (first < lineEnd && *first != '#' && !row(first, lineEnd, line)) {
+			return false;
+		}
+		s = lineEnd + (lineEnd < end ? 1 : 0);
+		++line;
+	}
+	return true;
+}
+
+} // namespace
+
+bool TextGeometryLoader::open(const fs::path& path) {
+	m_points = {};
+	m_indices = {};
+	m_columns = 0;
+	m_error.clear();
+	if (!m_file.open(path)) {
+		return fail(0, "cannot read the file");
+	}
+	const char* data = reinterpret_cast<const char*>(m_file.data());
+	const char* end = data + m_file.size();
+
+	// Sections run from the line after their header to the next header
+	Section* current = nullptr;
+	forEachRow(data, end, 1, [&](const char* s, const char* lineEnd, size_t line) {
+		if (*s == '[') {
+			if (current) current->end = s;
+			const size_t length = static_cast<size_t>(lineEnd - s);
+			auto is = [&](const char* header) {
+				const size_t n = std::strlen(header);
+				return length >= n && std::memcmp(s, header, n) == 0 && atLineEnd(s + n, lineEnd);
+			};
+			current = is("[points]") ? &m_points : is("[indices]") ? &m_indices : nullptr; // others are skipped
+			if (current) {
+				// A later section of the same kind replaces the earlier one
+				*current = {};
+				if (current == &m_points) m_columns = 0;
+				current->begin = lineEnd + (lineEnd < end ? 1 : 0);
+				current->firstLine = line;
+			}
+			return true;
+		}
+		if (current == &m_points && m_points.rows == 0) {
+			for (const char* t = s; !atLineEnd(t, lineEnd); ++m_columns) {
+				t = skipBlanks(t, lineEnd);
+				while (!atSeparator(t, lineEnd)) ++t;
+			}
+		}
+		if (current) ++current->rows;
+		return true;
+	});
+	if (current) current->end = end;
+
+	if (!m_points.begin) {
+		return fail(0, "no [points] section");
+	}
+	if (m_columns == 5) {
+		m_layout = PointLayout::XYRGB;
+	} else if (m_columns == 9) {
+		m_layout = PointLayout::XYZNormalRGB;
+	} else if (m_points.rows > 0) {
+		return fail(0, "points must have 5 (x y r g b) or 9 (x y z nx ny nz r g b) columns");
+	}
+	return true;
+}
+
+bool TextGeometryLoader::writeVertices(VertexAttributes* destination) {
+	return parsePoints([&](const VertexAttributes& vertex) {
+		*destination++ = vertex;
+	});
+}
+
+bool TextGeometryLoader::writeVertices(void* destination, const VertexEncoding& encoding, VertexDecoding* decoding) {
+	// Points are parsed into a small block, which is encoded once full
+	VertexAttributes block[kEncodingBlock];
+	size_t blockSize = 0;
+
+	// Unorm16 positions are relative to the bounding box, so the points are
+	// parsed twice rather than kept
+	VertexBounds bounds;
+	if (encoding.position == PositionEncoding::Unorm16) {
+		const bool ok = parsePoints([&](const VertexAttributes& vertex) {
+			block[blockSize++] = vertex;
+			if (blockSize == kEncodingBlock) {
+				bounds.add(block, blockSize);
+				blockSize = 0;
+			}
+		});
+		if (!ok) return false;
+		bounds.add(block, blockSize);
+		blockSize = 0;
+	}
+	*decoding = vertexDecoding(encoding, bounds);
+
+	const uint32_t stride = vertexLayout(encoding).stride;
+	unsigned char* output = static_cast<unsigned char*>(destination);
+	VertexDecoding measures;
+	auto flush = [&]() {
+		encodeVertexRange(block, blockSize, encoding, *decoding, output, measures);
+		output += blockSize * stride;
+		blockSize = 0;
+	};
+	const bool ok = parsePoints([&](const VertexAttributes& vertex) {
+		block[blockSize++] = vertex;
+		if (blockSize == kEncodingBlock) flush();
+	});
+	if (!ok) return false;
+	flush();
+	mergeMeasures(*decoding, measures);
+	return true;
+}
+
+template <typename Visitor>
+bool TextGeometryLoader::parsePoints(Visitor&& visit) {
+	const int columns = m_columns;
+	const bool flat = m_layout == PointLayout::XYRGB;
+	return forEachRow(m_points.begin, m_points.end, m_points.firstLine + 1, [&](const char* s, const char* end, size_t line) {
+		float v[9];
+		for (int c = 0; c < columns; ++c) {
+			s = skipBlanks(s, end);
+			if (!parseFloat(s, end, &v[c])) {
+				return fail(line, "invalid number");
+			}
+		}
+		if (!atLineEnd(s, end)) {
+			return fail(line, "too many columns");
+		}
+		VertexAttributes vertex;
+		if (flat) {
+			vertex.position = { v[0], v[1], 0.0f };
+			vertex.normal = { 0.0f, 0.0f, 1.0f };
+			vertex.color = { v[2], v[3], v[4] };
+		} else {
+			vertex.position = { v[0], v[1], v[2] };
+			vertex.normal = { v[3], v[4], v[5] };
+			vertex.color = { v[6], v[7], v[8] };
+		}
+		vertex.uv = { 0.0f, 1.0f };
+		visit(vertex);
+		return true;
+	});
+}
+
+bool TextGeometryLoader::writeIndices(uint16_t* destination) {
+	if (!use16BitIndices()) {
+		return fail(0, "too many vertices for 16 bit indices");
+	}
+	return parseIndices(destination);
+}
+
+bool TextGeometryLoader::writeIndices(uint32_t* destination) {
+	return parseIndices(destination);
+}
+
+template <typename Index>
+bool TextGeometryLoader::parseIndices(Index* destination) {
+	const uint32_t vertexCount = static_cast<uint32_t>(m_points.rows);
+	return forEachRow(m_indices.begin, m_indices.end, m_indices.firstLine + 1, [&](const char* s, const char* end, size_t line) {
+		for (int k = 0; k < 3; ++k) {
+			uint32_t index;
+			s = skipBlanks(s, end);
+			if (!parseIndex(s, end, &index)) {
+				return fail(line, "invalid index");
+			}
+			if (index >= vertexCount) {
+				return fail(line, "index out of range");
+			}
+			*destination++ = static_cast<Index>(index);
+		}
+		if (!atLineEnd(s, end)) {
+			return fail(line, "more than 3 indices");
+		}
+		return true;
+	});
+}
+
+bool TextGeometryLoader::handles(const fs::path& path) {
+	return path.extension() == ".txt";
+}
+
+bool TextGeometryLoader::fail(size_t line, const char* message) {
+	m_error = line > 0 ? "line " + std::to_string(line) + ": " + message : message;
+	return false;
+}
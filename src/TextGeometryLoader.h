@@ -0,0 +1,119 @@
+/**
+ * Loader of the text geometry format of resources/pyramid.txt and
+ * resources/webgpu.txt:
+ *
+ *     [points]
+ *     # one vertex per line
+ *     x y z nx ny nz r g b
+ *     ...
+ *     [indices]
+ *     # one triangle per line
+ *     a b c
+ *     ...
+ *
+ * with `#` comments and blank lines anywhere. The columns of the points
+ * are detected from the first one: 5 for flat shapes (x y r g b) or 9 for
+ * x y z nx ny nz r g b. Positions are already Z up, so unlike OBJ they are
+ * not swapped. Flat shapes lie at z = 0 and face +z. There are no texture
+ * coordinates, uvs are (0, 1) like for OBJ corners without one.
+ *
+ * Like ObjStreamLoader, loading is done in two phases, so that the caller
+ * can allocate the destination buffers (typically GPU buffers mapped at
+ * creation) in between:
+ *  1. `open` maps the file and counts its vertices and triangles;
+ *  2. `writeVertices` and `writeIndices` parse the numbers straight into
+ *     the destinations, sequentially.
+ */
+
+#pragma once
+
+#include "MappedFile.h"
+#include "Mesh.h"
+#include "VertexEncoding.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+enum class PointLayout {
+	XYRGB, // 5 columns
+	XYZNormalRGB, // 9 columns
+};
+
+class TextGeometryLoader {
+public:
+	/**
+	 * Phase 1. Returns false if the file cannot be read, has no [points]
+	 * section or has points of an unknown layout (see `error`).
+	 */
+	bool open(const std::filesystem::path& path);
+
+	PointLayout layout() const { return m_layout; }
+	size_t vertexCount() const { return m_points.rows; }
+	size_t indexCount() const { return 3 * m_indices.rows; }
+
+	/**
+	 * Whether every index fits in 16 bits, for the index buffer format.
+	 */
+	bool use16BitIndices() const { return vertexCount() <= 65536; }
+
+	/**
+	 * Phase 2. Converts the points into `destination`, which must hold
+	 * `vertexCount()` vertices. Returns false if a point does not have the
+	 * columns of the first one, or a number cannot be parsed.
+	 */
+	bool writeVertices(VertexAttributes* destination);
+
+	/**
+	 * Phase 2, with the vertices encoded (see VertexEncoding.h) into
+	 * `destination`, which must hold `vertexCount()` of them, and what the
+	 * shader needs to decode them in `decoding`. Points are parsed and
+	 * encoded a small block at a time (twice with unorm16 positions, which
+	 * need the bounding box first), so they are never all held at full
+	 * precision.
+	 */
+	bool writeVertices(void* destination, const VertexEncoding& encoding, VertexDecoding* decoding);
+
+	/**
+	 * Phase 2. Writes the indices into `destination`, which must hold
+	 * `indexCount()` of them. Returns false if a triangle does not have 3
+	 * indices, or one is not below `vertexCount()`. The 16 bit version
+	 * requires `use16BitIndices()`.
+	 */
+	bool writeIndices(uint16_t* destination);
+	bool writeIndices(uint32_t* destination);
+
+	/**
+	 * What went wrong, with a line number, after a call returned false.
+	 */
+	const std::string& error() const { return m_error; }
+
+	/**
+	 * Whether `path` is in this format rather than OBJ, from its extension.
+	 */
+	static bool handles(const std::filesystem::path& path);
+
+private:
+	struct Section {
+		const char* begin = nullptr;
+		const char* end = nullptr;
+		size_t firstLine = 0; // of the header, 1-based
+		size_t rows = 0;
+	};
+
+	// Calls `visit(const VertexAttributes&)` for each point, in order
+	template <typename Visitor>
+	bool parsePoints(Visitor&& visit);
+	template <typename Index>
+	bool parseIndices(Index* destination);
+	bool fail(size_t line, const char* message);
+
+private:
+	MappedFile m_file;
+	Section m_points;
+	Section m_indices;
+	PointLayout m_layout = PointLayout::XYZNormalRGB;
+	int m_columns = 0;
+	std::string m_error;
+};
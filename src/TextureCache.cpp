@@ -0,0 +1,203 @@
+#include "TextureCache.h"
+#include "Hash.h"
+#include "MappedFile.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <system_error>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char kMagic[8] = { 'W', 'G', 'P', 'U', 'T', 'E', 'X', 'C' };
+
+// Bump when the layout of the file itself changes
+constexpr uint32_t kFormatVersion = 1;
+
+// Written in native byte order, so a file from a host with the other
+// endianness fails this check and gets rebuilt.
+constexpr uint32_t kByteOrderMark = 0x01020304;
+
+constexpr size_t kSectionAlignment = 16;
+
+// More than enough for the largest 2D texture WebGPU allows
+constexpr uint32_t kMaxLevelCount = 32;
+
+/**
+ * File layout: this header, then the size in bytes of each level as a
+ * uint64_t, then the levels, largest first, each aligned to 16 bytes.
+ */
+struct TextureCacheHeader {
+	char magic[8];
+	uint32_t formatVersion;
+	uint32_t encoderVersion;
+	uint32_t byteOrderMark;
+	uint32_t blockFormat;
+	uint32_t preset;
+	uint32_t width;
+	uint32_t height;
+	uint32_t levelCount;
+	uint64_t sourceHash;
+	uint64_t sourceSize;
+	double psnr; // of level 0
+	uint64_t payloadSize; // everything after the header
+	uint64_t payloadHash;
+};
+
+static_assert(sizeof(TextureCacheHeader) % kSectionAlignment == 0);
+
+uint64_t alignUp(uint64_t value) {
+	return (value + kSectionAlignment - 1) & ~uint64_t(kSectionAlignment - 1);
+}
+
+} // namespace
+
+fs::path TextureCache::cachePath(const fs::path& sourcePath) {
+	fs::path path = sourcePath;
+	path += ".texcache";
+	return path;
+}
+
+bool TextureCache::open(const fs::path& sourcePath, CompressionPreset preset) {
+	m_texture = EncodedTexture{};
+	m_psnr = 0.0;
+	m_path.clear();
+	m_preset = preset;
+
+	MappedFile source;
+	if (!source.open(sourcePath)) {
+		return false; // the decoder reports it
+	}
+	m_sourceSize = source.size();
+	m_sourceHash = hashBytes(source.data(), source.size());
+	source.close();
+
+	m_path = cachePath(sourcePath);
+	return readCache();
+}
+
+bool TextureCache::readCache() {
+	MappedFile file;
+	if (!file.open(m_path)) {
+		return false; // no cache yet
+	}
+
+	auto reject = [&](const char* reason) {
+		std::cout << "Rebuilding texture cache " << m_path << " (" << reason << ")" << std::endl;
+		m_texture = EncodedTexture{};
+		return false;
+	};
+
+	const unsigned char* data = file.data();
+	const uint64_t fileSize = file.size();
+	if (fileSize < sizeof(TextureCacheHeader)) {
+		return reject("truncated");
+	}
+	TextureCacheHeader header;
+	std::memcpy(&header, data, sizeof(header));
+	if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+		return reject("not a texture cache");
+	}
+	if (header.formatVersion != kFormatVersion || header.byteOrderMark != kByteOrderMark) {
+		return reject("unsupported format");
+	}
+	if (header.encoderVersion != kTextureEncoderVersion) {
+		return reject("older encoder");
+	}
+	if (header.sourceHash != m_sourceHash || header.sourceSize != m_sourceSize) {
+		return reject("source changed");
+	}
+	if (header.preset != static_cast<uint32_t>(m_preset)) {
+		return reject("other preset");
+	}
+	if (header.payloadSize != fileSize - sizeof(TextureCacheHeader)) {
+		return reject("truncated");
+	}
+	if (hashBytes(data + sizeof(TextureCacheHeader), header.payloadSize) != header.payloadHash) {
+		return reject("corrupt");
+	}
+	if (header.blockFormat > static_cast<uint32_t>(BlockFormat::BC7) || header.width == 0 || header.height == 0
+		|| header.levelCount == 0 || header.levelCount > kMaxLevelCount
+		|| header.levelCount * sizeof(uint64_t) > header.payloadSize) {
+		return reject("corrupt");
+	}
+
+	m_texture.format = static_cast<BlockFormat>(header.blockFormat);
+	m_texture.width = header.width;
+	m_texture.height = header.height;
+	uint64_t offset = alignUp(sizeof(TextureCacheHeader) + header.levelCount * sizeof(uint64_t));
+	for (uint32_t level = 0; level < header.levelCount; ++level) {
+		uint64_t size;
+		std::memcpy(&size, data + sizeof(TextureCacheHeader) + level * sizeof(uint64_t), sizeof(size));
+		if (size != uint64_t(m_texture.bytesPerRow(level)) * m_texture.rowCount(level)
+			|| offset > fileSize || size > fileSize - offset) {
+			return reject("corrupt");
+		}
+		m_texture.levels.emplace_back(data + offset, data + offset + size);
+		offset = alignUp(offset + size);
+	}
+	m_psnr = header.psnr;
+	return true;
+}
+
+bool TextureCache::save(const EncodedTexture& texture, double psnr) const {
+	if (m_path.empty() || texture.levels.empty() || texture.levels.size() > kMaxLevelCount) {
+		return false;
+	}
+	TextureCacheHeader header{};
+	std::memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.formatVersion = kFormatVersion;
+	header.encoderVersion = kTextureEncoderVersion;
+	header.byteOrderMark = kByteOrderMark;
+	header.blockFormat = static_cast<uint32_t>(texture.format);
+	header.preset = static_cast<uint32_t>(m_preset);
+	header.width = texture.width;
+	header.height = texture.height;
+	header.levelCount = static_cast<uint32_t>(texture.levels.size());
+	header.sourceHash = m_sourceHash;
+	header.sourceSize = m_sourceSize;
+	header.psnr = psnr;
+
+	std::vector<uint64_t> levelOffsets;
+	uint64_t offset = alignUp(sizeof(TextureCacheHeader) + header.levelCount * sizeof(uint64_t));
+	for (const std::vector<uint8_t>& level : texture.levels) {
+		levelOffsets.push_back(offset);
+		offset = alignUp(offset + level.size());
+	}
+	header.payloadSize = offset - sizeof(TextureCacheHeader);
+
+	std::vector<unsigned char> payload(header.payloadSize, 0);
+	auto section = [&](uint64_t at) { return payload.data() + (at - sizeof(TextureCacheHeader)); };
+	for (uint32_t level = 0; level < header.levelCount; ++level) {
+		const uint64_t size = texture.levels[level].size();
+		std::memcpy(payload.data() + level * sizeof(uint64_t), &size, sizeof(size));
+		std::memcpy(section(levelOffsets[level]), texture.levels[level].data(), size);
+	}
+	header.payloadHash = hashBytes(payload.data(), payload.size());
+
+	// Write to a temporary file first, so that a crash or a concurrent
+	// launch never sees a half written cache.
+	fs::path tmpPath = m_path;
+	tmpPath += ".tmp";
+	bool written;
+	{
+		std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+		if (!file) return false;
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+		file.close();
+		written = !file.fail();
+	}
+	std::error_code error;
+	if (written) {
+		fs::rename(tmpPath, m_path, error);
+	}
+	if (!written || error) {
+		fs::remove(tmpPath, error);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,55 @@
+/**
+ * Binary cache of encoded textures.
+ *
+ * Block compression is much slower than decoding an image, so the encoded
+ * mip chain of `foo.png` is written next to it as `foo.png.texcache`, along
+ * with the PSNR measured when it was encoded. Like the mesh cache (see
+ * MeshCache.h), it is only used when it was built from the same source
+ * bytes, with the same preset, by the same encoder; otherwise, or when it
+ * is truncated or corrupt, it is rebuilt.
+ */
+
+#pragma once
+
+#include "BlockCompression.h"
+
+#include <cstdint>
+#include <filesystem>
+
+/**
+ * Bump this whenever the output of the encoder or of the mipmap generator
+ * changes, so that existing caches get rebuilt.
+ */
+constexpr uint32_t kTextureEncoderVersion = 1;
+
+class TextureCache {
+public:
+	/**
+	 * Reads the cache of `sourcePath` encoded with `preset` into `texture`
+	 * if it is valid. Otherwise returns false, and the caller encodes the
+	 * source and calls `save`.
+	 */
+	bool open(const std::filesystem::path& sourcePath, CompressionPreset preset);
+
+	/**
+	 * Writes the cache of the source last passed to `open`. Returns false if
+	 * it could not be written, which only costs encoding it again next time.
+	 */
+	bool save(const EncodedTexture& texture, double psnr) const;
+
+	EncodedTexture& texture() { return m_texture; }
+	double psnr() const { return m_psnr; }
+
+	static std::filesystem::path cachePath(const std::filesystem::path& sourcePath);
+
+private:
+	bool readCache();
+
+private:
+	std::filesystem::path m_path;
+	CompressionPreset m_preset = CompressionPreset::Normal;
+	uint64_t m_sourceHash = 0;
+	uint64_t m_sourceSize = 0;
+	EncodedTexture m_texture;
+	double m_psnr = 0.0;
+};
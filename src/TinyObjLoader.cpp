@@ -0,0 +1,4 @@
+// The tinyobj implementation lives alone, so that programs that define it
+// themselves (bench_triangulation) can still link ObjStreamLoader.cpp
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
@@ -0,0 +1,46 @@
+#include "UniformArena.h"
+
+#include <cassert>
+#include <cstring>
+
+using namespace wgpu;
+
+bool UniformArena::init(Device device, uint64_t capacity, uint32_t alignment) {
+	release();
+	m_alignment = alignment;
+	m_capacity = blockSize(capacity, alignment);
+
+	BufferDescriptor bufferDesc;
+	bufferDesc.label = "Uniform arena";
+	bufferDesc.size = m_capacity;
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
+	bufferDesc.mappedAtCreation = false;
+	m_buffer = device.createBuffer(bufferDesc);
+	m_staging.reserve(m_capacity);
+	return m_buffer != nullptr;
+}
+
+void UniformArena::release() {
+	if (m_buffer) {
+		m_buffer.destroy();
+		m_buffer.release();
+		m_buffer = nullptr;
+	}
+	m_staging = {};
+	m_capacity = 0;
+}
+
+uint32_t UniformArena::push(const void* data, size_t size) {
+	const size_t offset = m_staging.size();
+	const uint64_t end = offset + blockSize(size, m_alignment);
+	assert(end <= m_capacity);
+	// Padding is zeroed too, so that the upload is deterministic
+	m_staging.resize(end, 0);
+	std::memcpy(m_staging.data() + offset, data, size);
+	return static_cast<uint32_t>(offset);
+}
+
+void UniformArena::upload(Queue queue) const {
+	if (m_staging.empty()) return;
+	queue.writeBuffer(m_buffer, 0, m_staging.data(), m_staging.size());
+}
@@ -0,0 +1,65 @@
+/**
+ * Uniforms of a frame, suballocated from one large uniform buffer and
+ * uploaded with a single queue.writeBuffer.
+ *
+ * Each block (the per-frame uniforms, then one per object when copies are
+ * not instanced) starts at a multiple of minUniformBufferOffsetAlignment,
+ * so that draws select theirs with a dynamic offset in setBindGroup instead
+ * of a bind group or a write of their own. Blocks are packed in CPU memory
+ * during the frame, then the whole range is written at once. writeBuffer is
+ * ordered with the submissions on the queue, so frames can reuse the same
+ * range of the buffer without waiting for the GPU to be done with the
+ * previous one.
+ */
+
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class UniformArena {
+public:
+	/**
+	 * Bytes taken by a block of `size` bytes aligned to `alignment` (a power
+	 * of 2), padding included.
+	 */
+	static uint64_t blockSize(size_t size, uint32_t alignment) { return (size + alignment - 1) & ~uint64_t(alignment - 1); }
+
+	/**
+	 * Creates a buffer of `capacity` bytes, for blocks aligned to
+	 * `alignment`.
+	 */
+	bool init(wgpu::Device device, uint64_t capacity, uint32_t alignment);
+	void release();
+
+	wgpu::Buffer buffer() const { return m_buffer; }
+	uint32_t alignment() const { return m_alignment; }
+
+	/**
+	 * Drops the blocks of the previous frame.
+	 */
+	void reset() { m_staging.clear(); }
+
+	/**
+	 * Copies `size` bytes into the next block and returns its offset in the
+	 * buffer. The blocks of a frame must fit in the capacity.
+	 */
+	uint32_t push(const void* data, size_t size);
+
+	template <typename T>
+	uint32_t push(const T& value) { return push(&value, sizeof(T)); }
+
+	/**
+	 * Writes the blocks pushed since `reset` into the buffer.
+	 */
+	void upload(wgpu::Queue queue) const;
+
+private:
+	wgpu::Buffer m_buffer = nullptr;
+	uint64_t m_capacity = 0;
+	uint32_t m_alignment = 256;
+	std::vector<uint8_t> m_staging;
+};
@@ -0,0 +1,321 @@
+#include "VertexConversion.h"
+
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define CONVERSION_SSE2
+#if defined(__GNUC__) || defined(__clang__)
+#define CONVERSION_AVX2
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define CONVERSION_AVX2
+#define TARGET_AVX2
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CONVERSION_NEON
+#endif
+
+namespace {
+
+// Read in place of missing attributes. The missing normal has a -0 z so
+// that its converted y, -z, is +0 like in convertObjVertex.
+const float kMissingNormal[3] = { 0.0f, 0.0f, -0.0f };
+const float kMissingUV[2] = { 0.0f, 0.0f };
+const float kWhite[3] = { 1.0f, 1.0f, 1.0f };
+// Lanes of missing attributes are masked out of the AVX2 gathers
+const float kZeros[3] = { 0.0f, 0.0f, 0.0f };
+
+constexpr size_t kFloatsPerVertex = sizeof(VertexAttributes) / sizeof(float);
+
+void convertScalar(const ObjCorner* corners, size_t count, const ObjVertexSources& sources, VertexAttributes* destination) {
+	for (size_t i = 0; i < count; ++i) {
+		destination[i] = convertObjVertex(corners[i], sources);
+	}
+}
+
+#ifdef CONVERSION_SSE2
+
+// One vertex at a time: four loads, shuffles into the interleaved layout,
+// and three stores, the last of which spills one float into the next
+// vertex. There is no gather instruction in SSE2.
+void convertSse2(const ObjCorner* corners, size_t count, const ObjVertexSources& sources, VertexAttributes* destination) {
+	const float* colors = sources.colors ? sources.colors : kWhite;
+	const int colorStride = sources.colors ? 3 : 0;
+	const __m128 negateY = _mm_setr_ps(0.0f, -0.0f, 0.0f, 0.0f);
+	const __m128 negateX = _mm_setr_ps(-0.0f, 0.0f, 0.0f, 0.0f);
+	// u + -0 is u, even for -0, and 1 + -v is 1 - v
+	const __m128 flipV = _mm_setr_ps(-0.0f, 1.0f, 0.0f, 0.0f);
+	// Floats are only 4 byte aligned, memcpy makes the 8 byte load legal
+	auto load2 = [](const float* x) {
+		double xy;
+		std::memcpy(&xy, x, sizeof(xy));
+		return _mm_castpd_ps(_mm_set_sd(xy));
+	};
+	auto load3 = [&](const float* x) {
+		return _mm_movelh_ps(load2(x), _mm_load_ss(x + 2));
+	};
+
+	float* out = reinterpret_cast<float*>(destination);
+	size_t i = 0;
+	for (; i + 1 < count; ++i, out += kFloatsPerVertex) {
+		const ObjCorner& k = corners[i];
+		const __m128 p = load3(sources.positions + 3 * k.v); // x y z 0
+		const __m128 n = load3(k.vn >= 0 ? sources.normals + 3 * k.vn : kMissingNormal);
+		const __m128 c = load3(colors + colorStride * k.v);
+		const __m128 t = load2(k.vt >= 0 ? sources.texcoords + 2 * k.vt : kMissingUV);
+
+		// px -pz py nx | -nz ny r g | b u 1-v
+		const __m128 pyNx = _mm_shuffle_ps(p, n, _MM_SHUFFLE(0, 0, 1, 1));
+		const __m128 first = _mm_xor_ps(_mm_shuffle_ps(p, pyNx, _MM_SHUFFLE(2, 0, 2, 0)), negateY);
+		const __m128 second = _mm_xor_ps(_mm_shuffle_ps(n, c, _MM_SHUFFLE(1, 0, 1, 2)), negateX);
+		const __m128 uv = _mm_add_ps(_mm_xor_ps(t, negateY), flipV);
+		const __m128 bUV = _mm_shuffle_ps(c, uv, _MM_SHUFFLE(1, 0, 2, 2));
+		const __m128 third = _mm_shuffle_ps(bUV, bUV, _MM_SHUFFLE(3, 3, 2, 0));
+		_mm_storeu_ps(out + 0, first);
+		_mm_storeu_ps(out + 4, second);
+		_mm_storeu_ps(out + 8, third);
+	}
+	convertScalar(corners + i, count - i, sources, destination + i);
+}
+
+#endif // CONVERSION_SSE2
+
+#ifdef CONVERSION_AVX2
+
+bool cpuHasAvx2() {
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_cpu_supports("avx2");
+#else
+	int info[4];
+	__cpuid(info, 1);
+	const bool osSavesYmm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+	__cpuidex(info, 7, 0);
+	return osSavesYmm && (info[1] & (1 << 5));
+#endif
+}
+
+TARGET_AVX2 void transpose8(__m256 rows[8]) {
+	const __m256 t0 = _mm256_unpacklo_ps(rows[0], rows[1]), t1 = _mm256_unpackhi_ps(rows[0], rows[1]);
+	const __m256 t2 = _mm256_unpacklo_ps(rows[2], rows[3]), t3 = _mm256_unpackhi_ps(rows[2], rows[3]);
+	const __m256 t4 = _mm256_unpacklo_ps(rows[4], rows[5]), t5 = _mm256_unpackhi_ps(rows[4], rows[5]);
+	const __m256 t6 = _mm256_unpacklo_ps(rows[6], rows[7]), t7 = _mm256_unpackhi_ps(rows[6], rows[7]);
+	const __m256 s0 = _mm256_shuffle_ps(t0, t2, 0x44), s1 = _mm256_shuffle_ps(t0, t2, 0xee);
+	const __m256 s2 = _mm256_shuffle_ps(t1, t3, 0x44), s3 = _mm256_shuffle_ps(t1, t3, 0xee);
+	const __m256 s4 = _mm256_shuffle_ps(t4, t6, 0x44), s5 = _mm256_shuffle_ps(t4, t6, 0xee);
+	const __m256 s6 = _mm256_shuffle_ps(t5, t7, 0x44), s7 = _mm256_shuffle_ps(t5, t7, 0xee);
+	rows[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+	rows[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+	rows[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+	rows[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+	rows[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+	rows[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+	rows[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+	rows[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+TARGET_AVX2 void convertAvx2(const ObjCorner* corners, size_t count, const ObjVertexSources& sources, VertexAttributes* destination) {
+	const float* p = sources.positions;
+	const float* c = sources.colors;
+	const float* n = sources.normals ? sources.normals : kZeros;
+	const float* t = sources.texcoords ? sources.texcoords : kZeros;
+	const __m256 sign = _mm256_set1_ps(-0.0f);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256i missing = _mm256_set1_epi32(-1);
+	// Field offsets in the 12 byte corners
+	const __m256i field = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+	alignas(32) float stage[8 * kFloatsPerVertex + 4];
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const int* k = reinterpret_cast<const int*>(corners + i);
+		static_assert(sizeof(ObjCorner) == 3 * sizeof(int), "corners are gathered as ints");
+		const __m256i v = _mm256_i32gather_epi32(k, field, 4);
+		const __m256i vt = _mm256_i32gather_epi32(k + 1, field, 4);
+		const __m256i vn = _mm256_i32gather_epi32(k + 2, field, 4);
+		const __m256i v3 = _mm256_add_epi32(v, _mm256_add_epi32(v, v));
+		const __m256i vn3 = _mm256_add_epi32(vn, _mm256_add_epi32(vn, vn));
+		const __m256i vt2 = _mm256_add_epi32(vt, vt);
+		// Lanes of missing attributes are not loaded at all
+		const __m256 normalMask = _mm256_castsi256_ps(_mm256_cmpgt_epi32(vn, missing));
+		const __m256 uvMask = _mm256_castsi256_ps(_mm256_cmpgt_epi32(vt, missing));
+
+		__m256 rows[8];
+		rows[0] = _mm256_i32gather_ps(p + 0, v3, 4);
+		rows[1] = _mm256_xor_ps(_mm256_i32gather_ps(p + 2, v3, 4), sign);
+		rows[2] = _mm256_i32gather_ps(p + 1, v3, 4);
+		// Masked after the negation, so that missing normals are +0
+		rows[3] = _mm256_mask_i32gather_ps(zero, n + 0, vn3, normalMask, 4);
+		rows[4] = _mm256_and_ps(_mm256_xor_ps(_mm256_mask_i32gather_ps(zero, n + 2, vn3, normalMask, 4), sign), normalMask);
+		rows[5] = _mm256_mask_i32gather_ps(zero, n + 1, vn3, normalMask, 4);
+		rows[6] = c ? _mm256_i32gather_ps(c + 0, v3, 4) : one;
+		rows[7] = c ? _mm256_i32gather_ps(c + 1, v3, 4) : one;
+		const __m256 b = c ? _mm256_i32gather_ps(c + 2, v3, 4) : one;
+		const __m256 u = _mm256_mask_i32gather_ps(zero, t + 0, vt2, uvMask, 4);
+		const __m256 w = _mm256_sub_ps(one, _mm256_mask_i32gather_ps(zero, t + 1, vt2, uvMask, 4));
+		transpose8(rows);
+
+		// The last 3 floats of each vertex, 4 vertices per half
+		__m128 lo0 = _mm256_castps256_ps128(b), lo1 = _mm256_castps256_ps128(u), lo2 = _mm256_castps256_ps128(w), lo3 = _mm_setzero_ps();
+		__m128 hi0 = _mm256_extractf128_ps(b, 1), hi1 = _mm256_extractf128_ps(u, 1), hi2 = _mm256_extractf128_ps(w, 1), hi3 = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(lo0, lo1, lo2, lo3);
+		_MM_TRANSPOSE4_PS(hi0, hi1, hi2, hi3);
+		const __m128 tails[8] = { lo0, lo1, lo2, lo3, hi0, hi1, hi2, hi3 };
+		const bool direct = i + 8 < count;
+		float* out = direct ? reinterpret_cast<float*>(destination + i) : stage;
+		for (int j = 0; j < 8; ++j) {
+			_mm256_storeu_ps(out + j * kFloatsPerVertex, rows[j]);
+			_mm_storeu_ps(out + j * kFloatsPerVertex + 8, tails[j]);
+		}
+		if (!direct) std::memcpy(destination + i, stage, 8 * sizeof(VertexAttributes));
+	}
+	convertSse2(corners + i, count - i, sources, destination + i);
+}
+
+#endif // CONVERSION_AVX2
+
+#ifdef CONVERSION_NEON
+
+// Same as the SSE2 kernel, with lane loads in place of the shuffles
+void convertNeon(const ObjCorner* corners, size_t count, const ObjVertexSources& sources, VertexAttributes* destination) {
+	const float* colors = sources.colors ? sources.colors : kWhite;
+	const int colorStride = sources.colors ? 3 : 0;
+	const uint32_t negateYBits[4] = { 0, 0x80000000u, 0, 0 };
+	const uint32_t negateXBits[4] = { 0x80000000u, 0, 0, 0 };
+	const uint32x4_t negateY = vld1q_u32(negateYBits);
+	const uint32x4_t negateX = vld1q_u32(negateXBits);
+	auto negate = [](float32x4_t x, uint32x4_t sign) {
+		return vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(x), sign));
+	};
+
+	float* out = reinterpret_cast<float*>(destination);
+	size_t i = 0;
+	for (; i + 1 < count; ++i, out += kFloatsPerVertex) {
+		const ObjCorner& k = corners[i];
+		const float* p = sources.positions + 3 * k.v;
+		const float* n = k.vn >= 0 ? sources.normals + 3 * k.vn : kMissingNormal;
+		const float* c = colors + colorStride * k.v;
+		const float* t = k.vt >= 0 ? sources.texcoords + 2 * k.vt : kMissingUV;
+
+		// px -pz py nx | -nz ny r g | b u 1-v
+		float32x4_t first = vcombine_f32(vld1_f32(p), vld1_f32(p + 1));
+		first = vld1q_lane_f32(p + 2, first, 1);
+		first = vld1q_lane_f32(n, first, 3);
+		float32x4_t second = vcombine_f32(vld1_f32(n), vld1_f32(c));
+		second = vld1q_lane_f32(n + 2, second, 0);
+		second = vld1q_lane_f32(n + 1, second, 1);
+		float32x4_t third = vcombine_f32(vld1_f32(c + 1), vld1_f32(t));
+		third = vld1q_lane_f32(c + 2, third, 0);
+		third = vld1q_lane_f32(t, third, 1);
+		third = vsetq_lane_f32(1 - t[1], third, 2);
+		vst1q_f32(out + 0, negate(first, negateY));
+		vst1q_f32(out + 4, negate(second, negateX));
+		vst1q_f32(out + 8, third);
+	}
+	convertScalar(corners + i, count - i, sources, destination + i);
+}
+
+#endif // CONVERSION_NEON
+
+} // namespace
+
+bool isSupported(ConversionKernel kernel) {
+	switch (kernel) {
+	case ConversionKernel::Scalar:
+		return true;
+#ifdef CONVERSION_SSE2
+	case ConversionKernel::SSE2:
+		return true;
+#endif
+#ifdef CONVERSION_AVX2
+	case ConversionKernel::AVX2: {
+		static const bool supported = cpuHasAvx2();
+		return supported;
+	}
+#endif
+#ifdef CONVERSION_NEON
+	case ConversionKernel::NEON:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+ConversionKernel bestConversionKernel() {
+	static const ConversionKernel best = []() {
+		// Gathers are fast on some CPUs and microcoded on others, so the
+		// kernels are timed on a small synthetic mesh rather than ranked.
+		// They all give the same bytes, only the speed depends on the pick.
+		constexpr int kVertices = 4096;
+		constexpr int kCorners = 4 * kVertices;
+		std::vector<float> attributes(3 * kVertices);
+		for (int i = 0; i < 3 * kVertices; ++i) attributes[i] = static_cast<float>(i % 97) / 97.0f;
+		ObjVertexSources sources;
+		sources.positions = sources.normals = sources.texcoords = attributes.data();
+		std::vector<ObjCorner> corners(kCorners);
+		uint32_t random = 1;
+		for (ObjCorner& corner : corners) {
+			random = random * 1664525u + 1013904223u;
+			corner.v = static_cast<int32_t>((random >> 8) % kVertices);
+			corner.vt = (random & 15) == 0 ? -1 : corner.v;
+			corner.vn = (random & 15) == 1 ? -1 : corner.v;
+		}
+		std::vector<VertexAttributes> vertices(kCorners);
+
+		ConversionKernel fastest = ConversionKernel::Scalar;
+		double fastestTime = std::numeric_limits<double>::infinity();
+		for (ConversionKernel kernel : { ConversionKernel::Scalar, ConversionKernel::SSE2, ConversionKernel::AVX2, ConversionKernel::NEON }) {
+			if (!isSupported(kernel)) continue;
+			for (int run = 0; run < 3; ++run) {
+				const auto start = std::chrono::steady_clock::now();
+				convertObjVertices(corners.data(), corners.size(), sources, vertices.data(), kernel);
+				const double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				if (time < fastestTime) {
+					fastestTime = time;
+					fastest = kernel;
+				}
+			}
+		}
+		return fastest;
+	}();
+	return best;
+}
+
+const char* conversionKernelName(ConversionKernel kernel) {
+	switch (kernel) {
+	case ConversionKernel::SSE2: return "SSE2";
+	case ConversionKernel::AVX2: return "AVX2";
+	case ConversionKernel::NEON: return "NEON";
+	default: return "scalar";
+	}
+}
+
+void convertObjVertices(const ObjCorner* corners, size_t count, const ObjVertexSources& sources, VertexAttributes* destination, ConversionKernel kernel) {
+	switch (kernel) {
+#ifdef CONVERSION_SSE2
+	case ConversionKernel::SSE2:
+		convertSse2(corners, count, sources, destination);
+		return;
+#endif
+#ifdef CONVERSION_AVX2
+	case ConversionKernel::AVX2:
+		convertAvx2(corners, count, sources, destination);
+		return;
+#endif
+#ifdef CONVERSION_NEON
+	case ConversionKernel::NEON:
+		convertNeon(corners, count, sources, destination);
+		return;
+#endif
+	default:
+		convertScalar(corners, count, sources, destination);
+		return;
+	}
+}
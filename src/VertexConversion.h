@@ -0,0 +1,89 @@
+/**
+ * Conversion of OBJ vertices, given as (v, vt, vn) indices into the raw
+ * OBJ arrays, into VertexAttributes: Y up to Z up axis swap, flipped V, and
+ * defaults for the attributes a corner does not have.
+ *
+ * Batches are converted by SIMD kernels:
+ *  - SSE2 and NEON load each vertex's attributes as vectors and shuffle
+ *    them into the interleaved layout, with constant stand-ins for missing
+ *    attributes instead of branches;
+ *  - AVX2 gathers 8 vertices at a time component by component, masking out
+ *    missing attributes, then transposes them.
+ * The kernel is picked at runtime among the ones this CPU supports. Every
+ * kernel writes the same bytes as `convertObjVertex`, so that welded
+ * vertices and caches do not depend on the CPU.
+ */
+
+#pragma once
+
+#include "Mesh.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * 0-based indices of a face corner, -1 for a missing texture coordinate or
+ * normal.
+ */
+struct ObjCorner {
+	int32_t v;
+	int32_t vt;
+	int32_t vn;
+};
+
+struct ObjVertexSources {
+	const float* positions = nullptr; // xyz, indexed by v
+	const float* colors = nullptr; // rgb, indexed by v, nullptr if none
+	const float* normals = nullptr; // xyz, nullptr if none
+	const float* texcoords = nullptr; // uv, nullptr if none
+};
+
+inline VertexAttributes convertObjVertex(const ObjCorner& corner, const ObjVertexSources& sources) {
+	VertexAttributes vertex;
+
+	const float* p = &sources.positions[3 * corner.v];
+	vertex.position = { p[0], -p[2], p[1] };
+
+	if (corner.vn >= 0) {
+		const float* n = &sources.normals[3 * corner.vn];
+		vertex.normal = { n[0], -n[2], n[1] };
+	} else {
+		vertex.normal = { 0.0f, 0.0f, 0.0f };
+	}
+
+	if (sources.colors) {
+		const float* c = &sources.colors[3 * corner.v];
+		vertex.color = { c[0], c[1], c[2] };
+	} else {
+		vertex.color = { 1.0f, 1.0f, 1.0f };
+	}
+
+	if (corner.vt >= 0) {
+		const float* t = &sources.texcoords[2 * corner.vt];
+		vertex.uv = { t[0], 1 - t[1] };
+	} else {
+		vertex.uv = { 0.0f, 1.0f };
+	}
+
+	return vertex;
+}
+
+enum class ConversionKernel { Scalar, SSE2, AVX2, NEON };
+
+/**
+ * Whether `kernel` is built in and runs on this CPU.
+ */
+bool isSupported(ConversionKernel kernel);
+
+/**
+ * The fastest supported kernel, timed on the first call.
+ */
+ConversionKernel bestConversionKernel();
+
+const char* conversionKernelName(ConversionKernel kernel);
+
+/**
+ * Converts `count` corners into `destination`, sequentially. `kernel` must
+ * be supported.
+ */
+void convertObjVertices(const ObjCorner* corners, size_t count, const ObjVertexSources& sources, VertexAttributes* destination, ConversionKernel kernel = bestConversionKernel());
@@ -0,0 +1,203 @@
+#include "VertexEncoding.h"
+#include "Parallel.h"
+
+#include <glm/gtc/packing.hpp>
+#include <glm/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace {
+
+// Ranges smaller than this are not worth a thread
+constexpr size_t kMinVerticesPerThread = 16384;
+
+constexpr float kDegreesPerRadian = 57.2957795131f;
+
+glm::vec2 signNotZero(glm::vec2 v) {
+	return { v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f };
+}
+
+/**
+ * Octahedral mapping of a unit vector to [-1, 1]^2 ("A Survey of Efficient
+ * Representations for Independent Unit Vectors", Cigolle et al., 2014)
+ */
+glm::vec2 octEncode(glm::vec3 n) {
+	n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	glm::vec2 p(n.x, n.y);
+	if (n.z < 0.0f) {
+		p = (1.0f - glm::abs(glm::vec2(p.y, p.x))) * signNotZero(p);
+	}
+	return p;
+}
+
+// Same as octDecode in shader.wgsl
+glm::vec3 octDecode(glm::vec2 p) {
+	glm::vec3 n(p.x, p.y, 1.0f - std::abs(p.x) - std::abs(p.y));
+	if (n.z < 0.0f) {
+		glm::vec2 xy = (1.0f - glm::abs(glm::vec2(n.y, n.x))) * signNotZero(glm::vec2(n.x, n.y));
+		n.x = xy.x;
+		n.y = xy.y;
+	}
+	return glm::normalize(n);
+}
+
+/**
+ * Rounding each coordinate to the nearest snorm16 is not always the closest
+ * direction once decoded, so the 4 neighbours are tried.
+ */
+uint32_t encodeNormal(const glm::vec3& normal, float* angle) {
+	const glm::vec3 n = glm::normalize(normal);
+	const glm::vec2 p = octEncode(n) * 32767.0f;
+	uint32_t best = 0;
+	float bestAngle = std::numeric_limits<float>::max();
+	for (int i = 0; i < 4; ++i) {
+		glm::vec2 q((i & 1) ? std::ceil(p.x) : std::floor(p.x), (i & 2) ? std::ceil(p.y) : std::floor(p.y));
+		const uint32_t packed = glm::packSnorm2x16(q / 32767.0f);
+		const glm::vec3 decoded = octDecode(glm::unpackSnorm2x16(packed));
+		// More accurate than acos for small angles
+		const float a = std::atan2(glm::length(glm::cross(decoded, n)), glm::dot(decoded, n));
+		if (a < bestAngle) {
+			bestAngle = a;
+			best = packed;
+		}
+	}
+	*angle = bestAngle * kDegreesPerRadian;
+	return best;
+}
+
+} // namespace
+
+VertexLayout vertexLayout(const VertexEncoding& encoding) {
+	VertexLayout layout;
+	uint32_t offset = 0;
+	layout.positionOffset = offset;
+	offset += encoding.position == PositionEncoding::Unorm16 ? 4 * sizeof(uint16_t) : sizeof(glm::vec3);
+	layout.normalOffset = offset;
+	offset += encoding.normal == NormalEncoding::OctSnorm16 ? 2 * sizeof(int16_t) : sizeof(glm::vec3);
+	layout.colorOffset = offset;
+	offset += encoding.color == ColorEncoding::Unorm8 ? 4 * sizeof(uint8_t) : sizeof(glm::vec3);
+	layout.uvOffset = offset;
+	offset += encoding.uv == UVEncoding::Float16 ? 2 * sizeof(uint16_t) : sizeof(glm::vec2);
+	layout.stride = offset;
+	return layout;
+}
+
+void VertexBounds::add(const VertexAttributes* vertices, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		min = glm::min(min, vertices[i].position);
+		max = glm::max(max, vertices[i].position);
+	}
+}
+
+void VertexBounds::add(const VertexBounds& other) {
+	min = glm::min(min, other.min);
+	max = glm::max(max, other.max);
+}
+
+VertexDecoding vertexDecoding(const VertexEncoding& encoding, const VertexBounds& bounds) {
+	VertexDecoding decoding;
+	decoding.octNormals = encoding.normal == NormalEncoding::OctSnorm16;
+	if (encoding.position == PositionEncoding::Unorm16 && bounds.min.x <= bounds.max.x) {
+		decoding.positionOffset = bounds.min;
+		decoding.positionScale = bounds.max - bounds.min;
+	}
+	return decoding;
+}
+
+void encodeVertexRange(const VertexAttributes* vertices, size_t count, const VertexEncoding& encoding, const VertexDecoding& decoding, void* destination, VertexDecoding& measures) {
+	const VertexLayout layout = vertexLayout(encoding);
+	unsigned char* output = static_cast<unsigned char*>(destination);
+	unsigned char encoded[sizeof(VertexAttributes)];
+	for (size_t i = 0; i < count; ++i) {
+		const VertexAttributes& vertex = vertices[i];
+		measures.radius = std::max(measures.radius, glm::length(vertex.position));
+
+		if (encoding.position == PositionEncoding::Unorm16) {
+			const glm::vec3 extent = decoding.positionScale;
+			glm::vec3 t = vertex.position - decoding.positionOffset;
+			t.x = extent.x > 0.0f ? t.x / extent.x : 0.0f;
+			t.y = extent.y > 0.0f ? t.y / extent.y : 0.0f;
+			t.z = extent.z > 0.0f ? t.z / extent.z : 0.0f;
+			const uint64_t packed = glm::packUnorm4x16(glm::vec4(t, 0.0f));
+			std::memcpy(encoded + layout.positionOffset, &packed, sizeof(packed));
+			const glm::vec3 decoded = decoding.positionOffset + extent * glm::vec3(glm::unpackUnorm4x16(packed));
+			measures.maxPositionError = std::max(measures.maxPositionError, glm::length(decoded - vertex.position));
+		} else {
+			std::memcpy(encoded + layout.positionOffset, &vertex.position, sizeof(glm::vec3));
+		}
+
+		if (encoding.normal == NormalEncoding::OctSnorm16) {
+			uint32_t packed = 0;
+			if (glm::dot(vertex.normal, vertex.normal) > 0.0f) {
+				float angle;
+				packed = encodeNormal(vertex.normal, &angle);
+				measures.maxNormalError = std::max(measures.maxNormalError, angle);
+			}
+			std::memcpy(encoded + layout.normalOffset, &packed, sizeof(packed));
+		} else {
+			std::memcpy(encoded + layout.normalOffset, &vertex.normal, sizeof(glm::vec3));
+		}
+
+		if (encoding.color == ColorEncoding::Unorm8) {
+			const uint32_t packed = glm::packUnorm4x8(glm::vec4(vertex.color, 1.0f));
+			std::memcpy(encoded + layout.colorOffset, &packed, sizeof(packed));
+			const glm::vec3 decoded(glm::unpackUnorm4x8(packed));
+			const glm::vec3 delta = glm::abs(decoded - vertex.color);
+			measures.maxColorError = std::max({ measures.maxColorError, delta.x, delta.y, delta.z });
+		} else {
+			std::memcpy(encoded + layout.colorOffset, &vertex.color, sizeof(glm::vec3));
+		}
+
+		if (encoding.uv == UVEncoding::Float16) {
+			const uint32_t packed = glm::packHalf2x16(vertex.uv);
+			std::memcpy(encoded + layout.uvOffset, &packed, sizeof(packed));
+			const glm::vec2 delta = glm::abs(glm::unpackHalf2x16(packed) - vertex.uv);
+			measures.maxUVError = std::max({ measures.maxUVError, delta.x, delta.y });
+		} else {
+			std::memcpy(encoded + layout.uvOffset, &vertex.uv, sizeof(glm::vec2));
+		}
+
+		std::memcpy(output + i * layout.stride, encoded, layout.stride);
+	}
+}
+
+void mergeMeasures(VertexDecoding& decoding, const VertexDecoding& measures) {
+	decoding.maxPositionError = std::max(decoding.maxPositionError, measures.maxPositionError);
+	decoding.maxNormalError = std::max(decoding.maxNormalError, measures.maxNormalError);
+	decoding.maxColorError = std::max(decoding.maxColorError, measures.maxColorError);
+	decoding.maxUVError = std::max(decoding.maxUVError, measures.maxUVError);
+	decoding.radius = std::max(decoding.radius, measures.radius);
+}
+
+VertexDecoding encodeVertices(const VertexAttributes* vertices, size_t count, const VertexEncoding& encoding, void* destination, unsigned threadCount) {
+	const VertexLayout layout = vertexLayout(encoding);
+	const size_t rangeCount = parallelRangeCount(count, kMinVerticesPerThread, threadCount);
+
+	// 1. Bounding box, for positions relative to it
+	VertexBounds bounds;
+	if (encoding.position == PositionEncoding::Unorm16) {
+		std::vector<VertexBounds> rangeBounds(rangeCount);
+		parallelForRanges(count, kMinVerticesPerThread, [&](size_t range, size_t begin, size_t end) {
+			rangeBounds[range].add(vertices + begin, end - begin);
+		}, threadCount);
+		for (const VertexBounds& b : rangeBounds) {
+			bounds.add(b);
+		}
+	}
+	VertexDecoding decoding = vertexDecoding(encoding, bounds);
+
+	// 2. Encode, and measure the error against what the shader decodes
+	std::vector<VertexDecoding> measures(rangeCount);
+	unsigned char* output = static_cast<unsigned char*>(destination);
+	parallelForRanges(count, kMinVerticesPerThread, [&](size_t range, size_t begin, size_t end) {
+		encodeVertexRange(vertices + begin, end - begin, encoding, decoding, output + begin * layout.stride, measures[range]);
+	}, threadCount);
+	for (const VertexDecoding& m : measures) {
+		mergeMeasures(decoding, m);
+	}
+	return decoding;
+}
@@ -0,0 +1,130 @@
+/**
+ * Compact encodings of VertexAttributes for the vertex buffer.
+ *
+ * Meshes are cached already encoded, so that a warm start copies the cache
+ * into the vertex buffer as is (the cache records its encoding, and is
+ * rebuilt when it changes). Each attribute has its own encoding:
+ *  - position: float32x3, or unorm16x4 relative to the bounding box of the
+ *    mesh (the shader applies `positionOffset + positionScale * p`);
+ *  - normal: float32x3, or snorm16x2 octahedral encoding (the shader
+ *    decodes it when `octNormals` is set);
+ *  - color: float32x3, or unorm8x4;
+ *  - uv: float32x2, or float16x2.
+ * Colors and UVs need no decoding, the vertex fetch converts them to floats.
+ * With all compact encodings, a vertex takes 20 bytes instead of 44.
+ */
+
+#pragma once
+
+#include "Mesh.h"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+enum class PositionEncoding { Float32, Unorm16 };
+enum class NormalEncoding { Float32, OctSnorm16 };
+enum class ColorEncoding { Float32, Unorm8 };
+enum class UVEncoding { Float32, Float16 };
+
+struct VertexEncoding {
+	PositionEncoding position = PositionEncoding::Float32;
+	NormalEncoding normal = NormalEncoding::Float32;
+	ColorEncoding color = ColorEncoding::Float32;
+	UVEncoding uv = UVEncoding::Float32;
+
+	/**
+	 * Same layout as VertexAttributes
+	 */
+	static VertexEncoding full() { return {}; }
+
+	/**
+	 * Smallest layout, 20 bytes per vertex
+	 */
+	static VertexEncoding compact() {
+		return { PositionEncoding::Unorm16, NormalEncoding::OctSnorm16, ColorEncoding::Unorm8, UVEncoding::Float16 };
+	}
+
+	/**
+	 * Identifies the encoding, e.g. in a cache
+	 */
+	uint32_t key() const {
+		return uint32_t(position) | uint32_t(normal) << 8 | uint32_t(color) << 16 | uint32_t(uv) << 24;
+	}
+};
+
+/**
+ * Byte offsets of the attributes in an encoded vertex. Attributes come in
+ * the same order as in VertexAttributes and are all 4 byte aligned.
+ */
+struct VertexLayout {
+	uint32_t positionOffset;
+	uint32_t normalOffset;
+	uint32_t colorOffset;
+	uint32_t uvOffset;
+	uint32_t stride;
+};
+
+VertexLayout vertexLayout(const VertexEncoding& encoding);
+
+/**
+ * What the shader needs to decode an encoded mesh, and the largest error
+ * measured between decoded and original vertices.
+ */
+struct VertexDecoding {
+	glm::vec3 positionOffset = glm::vec3(0.0f);
+	glm::vec3 positionScale = glm::vec3(1.0f);
+	bool octNormals = false;
+
+	float maxPositionError = 0.0f; // distance, in mesh units
+	float maxNormalError = 0.0f; // angle, in degrees (zero normals are skipped)
+	float maxColorError = 0.0f; // per channel
+	float maxUVError = 0.0f; // per coordinate
+
+	float radius = 0.0f; // largest distance of an original position to the origin
+};
+
+/**
+ * Encodes `count` vertices into `destination`, which must hold
+ * `count * vertexLayout(encoding).stride` bytes. Writes are sequential, so
+ * `destination` may be a mapped GPU buffer.
+ * @param threadCount Number of worker threads, 0 to use all cores.
+ */
+VertexDecoding encodeVertices(const VertexAttributes* vertices, size_t count, const VertexEncoding& encoding, void* destination, unsigned threadCount = 0);
+
+/**
+ * Bounding box of original positions, which unorm16 positions are relative
+ * to.
+ */
+struct VertexBounds {
+	glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+
+	void add(const VertexAttributes* vertices, size_t count);
+	void add(const VertexBounds& other);
+};
+
+/*
+ * The steps of encodeVertices, for vertices that are produced a range at a
+ * time and never all held in memory (see ObjStreamLoader::writeVertices):
+ *  1. with unorm16 positions, gather the VertexBounds of every range;
+ *  2. get the decoding of the whole mesh from them with `vertexDecoding`;
+ *  3. encode each range with `encodeVertexRange`, which measures its errors
+ *     in a VertexDecoding of its own, then `mergeMeasures` them.
+ */
+
+VertexDecoding vertexDecoding(const VertexEncoding& encoding, const VertexBounds& bounds);
+
+/**
+ * Encodes `count` vertices into `destination`, which must hold
+ * `count * vertexLayout(encoding).stride` bytes, written sequentially.
+ * Raises the errors and radius of `measures` to cover these vertices.
+ */
+void encodeVertexRange(const VertexAttributes* vertices, size_t count, const VertexEncoding& encoding, const VertexDecoding& decoding, void* destination, VertexDecoding& measures);
+
+/**
+ * Raises the errors and radius of `decoding` to cover those of `measures`.
+ */
+void mergeMeasures(VertexDecoding& decoding, const VertexDecoding& measures);
@@ -25,7 +25,9 @@
  */
 
 #include "glm/ext/matrix_transform.hpp"
+#ifndef HEADLESS_ONLY
 #include <glfw3webgpu.h>
+#endif
 #include <GLFW/glfw3.h>
 
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -36,16 +38,38 @@
 #define WEBGPU_CPP_IMPLEMENTATION
 #include <webgpu/webgpu.hpp>
 
-#define TINYOBJLOADER_IMPLEMENTATION // add this to exactly 1 of your C++ files
-#include "tiny_obj_loader.h"
+#include "AssetLoader.h"
+#include "BlockCompression.h"
+#include "FileWatcher.h"
+#include "GpuCulling.h"
+#include "GpuTimer.h"
+#include "MaterialTextures.h"
+#include "Mesh.h"
+#include "MeshCache.h"
+#include "MeshLod.h"
+#include "Meshlets.h"
+#include "Mipmaps.h"
+#include "ObjStreamLoader.h"
+#include "Profiler.h"
+#include "SceneBvh.h"
+#include "UniformArena.h"
+#include "VertexEncoding.h"
 
 #include <iostream>
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
 #include <filesystem>
 #include <fstream>
+#include <future>
+#include <numeric>
 #include <sstream>
 #include <string>
 #include <array>
+#include <cstring>
 
 using namespace wgpu;
 namespace fs = std::filesystem;
@@ -57,94 +81,240 @@ using glm::vec2;
 constexpr float PI = 3.14159265358979323846f;
 
 /**
- * The same structure as in the shader, replicated in C++
+ * The same structures as in the shader, replicated in C++: the uniforms
+ * that every draw of a frame shares, then the attributes of each copy of
+ * the mesh, fetched once per instance from a second vertex buffer. Without
+ * instancing, the same attributes are the ObjectUniforms of the shader,
+ * which each draw selects with a dynamic offset (see UniformArena.h).
  */
-struct MyUniforms {
+struct FrameUniforms {
 	// We add transform matrices
     mat4x4 projectionMatrix;
     mat4x4 viewMatrix;
-    mat4x4 modelMatrix;
-    std::array<float, 4> color;
     float time;
-    float _pad[3];
+    uint32_t octNormals;
+    float _pad[2];
+    // Decoding of quantized positions
+    vec4 positionOffset;
+    vec4 positionScale;
+};
+
+struct InstanceAttributes {
+    mat4x4 modelMatrix; // one vec4 attribute per column
+    std::array<float, 4> color;
 };
 
 // Have the compiler check byte alignment
-static_assert(sizeof(MyUniforms) % 16 == 0);
+static_assert(sizeof(FrameUniforms) % 16 == 0);
+static_assert(sizeof(InstanceAttributes) == 20 * sizeof(float));
+static_assert(sizeof(InstanceAttributes) % 16 == 0);
 
 /**
- * A structure that describes the data layout in the vertex buffer
- * We do not instantiate it but use it in `sizeof` and `offsetof`
+ * Where the copies of the mesh are culled against the view frustum
  */
-struct VertexAttributes {
-	vec3 position;
-	vec3 normal;
-	vec3 color;
-	vec2 uv; // <--- Add a texture coordinate attribute
+enum class ObjectCulling { None, Cpu, Gpu };
+
+/**
+ * Vertex and index buffers of the mesh
+ */
+struct GpuMesh {
+	Buffer vertexBuffer = nullptr;
+	uint64_t vertexBufferSize = 0;
+	Buffer indexBuffer = nullptr;
+	uint64_t indexBufferSize = 0;
+	IndexFormat indexFormat = IndexFormat::Uint16;
+	VertexDecoding vertexDecoding;
 };
 
-ShaderModule loadShaderModule(const fs::path& path, Device device);
-// New loading procedure
-bool loadGeometryFromObj(const fs::path& path, std::vector<VertexAttributes>& vertexData);
+ShaderModule createShaderModule(const std::string& source, Device device);
+GpuMesh uploadMesh(MeshAsset& asset, const VertexEncoding& vertexEncoding, Device device);
+Texture createMipmappedTexture(const EncodedTexture& encoded, uint32_t maxDimension, Device device, Queue queue, uint32_t* mipLevelCount, TextureFormat* format);
+bool captureFrame(Texture texture, uint32_t width, uint32_t height, Device device, Queue queue, const fs::path& path);
+float meshRadius(const MeshCache& mesh);
+void placeObjects(std::vector<InstanceAttributes>& objects, float meshRadius);
+
+int main (int argc, char** argv) {
+	using Clock = std::chrono::steady_clock;
+	const Clock::time_point processStart = Clock::now();
+	auto millisecondsSinceStart = [&](Clock::time_point time) {
+		return std::chrono::duration<double, std::milli>(time - processStart).count();
+	};
+
+	// With --headless, frames are rendered into an offscreen texture, without
+	// a window, so that the app runs on hosts that have no display
+	bool headless = false;
+	uint32_t frameCount = 0; // 0 to run until the window is closed
+	fs::path capturePath; // where the last offscreen frame is saved
+	fs::path tracePath; // where the profiler's zones are saved at exit
+	uint32_t objectCount = 1; // copies of the mesh
+	bool instancing = true; // otherwise a draw per copy, for comparison
+	ObjectCulling objectCulling = ObjectCulling::Gpu; // on the CPU without instancing
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if (arg == "--headless") {
+			headless = true;
+		} else if (arg == "--frames" && i + 1 < argc) {
+			frameCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		} else if (arg == "--capture" && i + 1 < argc) {
+			capturePath = argv[++i];
+		} else if (arg == "--trace" && i + 1 < argc) {
+			tracePath = argv[++i];
+		} else if (arg == "--objects" && i + 1 < argc) {
+			objectCount = std::max<uint32_t>(1, static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10)));
+		} else if (arg == "--no-instancing") {
+			instancing = false;
+		} else if (arg == "--culling" && i + 1 < argc && std::strcmp(argv[i + 1], "gpu") == 0) {
+			objectCulling = ObjectCulling::Gpu;
+			++i;
+		} else if (arg == "--culling" && i + 1 < argc && std::strcmp(argv[i + 1], "cpu") == 0) {
+			objectCulling = ObjectCulling::Cpu;
+			++i;
+		} else if (arg == "--culling" && i + 1 < argc && std::strcmp(argv[i + 1], "none") == 0) {
+			objectCulling = ObjectCulling::None;
+			++i;
+		} else {
+			std::cerr << "Usage: " << argv[0] << " [--headless [--capture frame.ppm]] [--frames count] [--trace trace.json] [--objects count [--no-instancing] [--culling gpu|cpu|none]]" << std::endl;
+			return 1;
+		}
+	}
+	if (!capturePath.empty() && !headless) {
+		std::cerr << "--capture requires --headless" << std::endl;
+		return 1;
+	}
+	if (headless && frameCount == 0) {
+		frameCount = 100;
+	}
+	if (!tracePath.empty() && !kProfilerEnabled) {
+		std::cerr << "--trace requires the profiler, which is compiled out of release builds" << std::endl;
+		return 1;
+	}
+	setProfilerThreadName("render");
+
+	// Assets are read and parsed on worker threads from now on, while the
+	// adapter and device are acquired. Textures are decoded and mipmapped
+	// right away, but only block compressed once the adapter says whether it
+	// supports it.
+	const fs::path shaderPath = RESOURCE_DIR "/shader.wgsl";
+	const fs::path meshPath = RESOURCE_DIR "/plane.obj";
+	TextureLoadSettings textureSettings;
+	textureSettings.preset = CompressionPreset::Normal; // Fast for BC1/BC3, Normal or High for BC7
+	// Layout of the vertex buffer, in which the mesh cache also holds the
+	// vertices (VertexEncoding::full() keeps the 44 byte VertexAttributes,
+	// the compact encoding takes 20 bytes per vertex)
+	const VertexEncoding vertexEncoding = VertexEncoding::compact();
+	const VertexLayout encodedLayout = vertexLayout(vertexEncoding);
+	AssetLoader assets;
+	std::promise<bool> textureCompressionSupport;
+	const std::shared_future<bool> blockCompression = textureCompressionSupport.get_future().share();
+	assets.loadShader(shaderPath);
+	assets.loadMesh(meshPath, vertexEncoding);
+	assets.loadMaterialTextures(meshPath, textureSettings, blockCompression);
 
-int main (int, char**) {
 	Instance instance = createInstance(InstanceDescriptor{});
 	if (!instance) {
 		std::cerr << "Could not initialize WebGPU!" << std::endl;
 		return 1;
 	}
 
-	if (!glfwInit()) {
-		std::cerr << "Could not initialize GLFW!" << std::endl;
+	GLFWwindow* window = nullptr;
+	Surface surface = nullptr;
+	if (!headless) {
+#ifdef HEADLESS_ONLY
+		std::cerr << "This build has no display support (HEADLESS_ONLY), run with --headless" << std::endl;
 		return 1;
-	}
+#else
+		if (!glfwInit()) {
+			std::cerr << "Could not initialize GLFW!" << std::endl;
+			return 1;
+		}
 
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-	GLFWwindow* window = glfwCreateWindow(640, 480, "Learn WebGPU", NULL, NULL);
-	if (!window) {
-		std::cerr << "Could not open window!" << std::endl;
-		return 1;
+		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+		glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+		window = glfwCreateWindow(640, 480, "Learn WebGPU", NULL, NULL);
+		if (!window) {
+			std::cerr << "Could not open window!" << std::endl;
+			return 1;
+		}
+		surface = glfwGetWGPUSurface(instance, window);
+#endif
 	}
 
 	std::cout << "Requesting adapter..." << std::endl;
-	Surface surface = glfwGetWGPUSurface(instance, window);
 	RequestAdapterOptions adapterOpts{};
 	adapterOpts.compatibleSurface = surface;
+	// Offscreen, ask for the software adapter that display-less hosts have
+	// (e.g. SwiftShader or llvmpipe), but take any if there is none
+	adapterOpts.forceFallbackAdapter = headless;
 	Adapter adapter = instance.requestAdapter(adapterOpts);
+	if (!adapter && headless) {
+		adapterOpts.forceFallbackAdapter = false;
+		adapter = instance.requestAdapter(adapterOpts);
+	}
+	if (!adapter) {
+		std::cerr << "Could not get an adapter!" << std::endl;
+		return 1;
+	}
 	std::cout << "Got adapter: " << adapter << std::endl;
 
+	const bool textureCompressionBC = adapter.hasFeature(FeatureName::TextureCompressionBC);
+	textureCompressionSupport.set_value(textureCompressionBC);
+	std::cout << "Texture compression: " << (textureCompressionBC ? "BC" : "none (RGBA8)") << std::endl;
+	const bool timestampQuery = adapter.hasFeature(FeatureName::TimestampQuery);
+
 	SupportedLimits supportedLimits;
 	adapter.getLimits(&supportedLimits);
 
 	std::cout << "Requesting device..." << std::endl;
 	RequiredLimits requiredLimits = Default;
-	requiredLimits.limits.maxVertexAttributes = 4;
-	//                                          ^ This was a 4
-	requiredLimits.limits.maxVertexBuffers = 1;
-	requiredLimits.limits.maxBufferSize = 10000 * sizeof(VertexAttributes);
-	requiredLimits.limits.maxVertexBufferArrayStride = sizeof(VertexAttributes);
+	requiredLimits.limits.maxVertexAttributes = 9;
+	//                                          ^ This was a 4, plus the model matrix and color of instances
+	requiredLimits.limits.maxVertexBuffers = 2;
+	requiredLimits.limits.maxBufferSize = supportedLimits.limits.maxBufferSize;
+	requiredLimits.limits.maxVertexBufferArrayStride = std::max<uint32_t>(encodedLayout.stride, sizeof(InstanceAttributes));
 	requiredLimits.limits.minStorageBufferOffsetAlignment = supportedLimits.limits.minStorageBufferOffsetAlignment;
 	requiredLimits.limits.minUniformBufferOffsetAlignment = supportedLimits.limits.minUniformBufferOffsetAlignment;
-	requiredLimits.limits.maxInterStageShaderComponents = 8;
-	//                                                    ^ This was a 6
+	requiredLimits.limits.maxInterStageShaderComponents = 12;
+	//                                                    ^ This was a 6, then 8, plus the color of the instance
 	requiredLimits.limits.maxBindGroups = 1;
-	requiredLimits.limits.maxUniformBuffersPerShaderStage = 1;
+	requiredLimits.limits.maxUniformBuffersPerShaderStage = 2;
+	requiredLimits.limits.maxDynamicUniformBuffersPerPipelineLayout = 1;
 	requiredLimits.limits.maxUniformBufferBindingSize = 16 * 4 * sizeof(float);
 	requiredLimits.limits.maxTextureDimension1D = 480;
-	requiredLimits.limits.maxTextureDimension2D = 640;
+	// Material textures may be larger than the window, their largest mip
+	// levels are dropped if the adapter does not support them
+	requiredLimits.limits.maxTextureDimension2D = std::max(640u, supportedLimits.limits.maxTextureDimension2D);
 	requiredLimits.limits.maxTextureArrayLayers = 1;
 	requiredLimits.limits.maxSampledTexturesPerShaderStage = 1;
   requiredLimits.limits.maxSamplersPerShaderStage = 1;
+	// Culling of instances in a compute pass (see GpuCulling.h)
+	requiredLimits.limits.maxStorageBuffersPerShaderStage = 5;
+	requiredLimits.limits.maxStorageBufferBindingSize = supportedLimits.limits.maxStorageBufferBindingSize;
+	requiredLimits.limits.maxComputeWorkgroupSizeX = GpuCulling::kWorkgroupSize;
+	requiredLimits.limits.maxComputeWorkgroupSizeY = 1;
+	requiredLimits.limits.maxComputeWorkgroupSizeZ = 1;
+	requiredLimits.limits.maxComputeInvocationsPerWorkgroup = GpuCulling::kWorkgroupSize;
+	requiredLimits.limits.maxComputeWorkgroupsPerDimension = 65535;
 
 	DeviceDescriptor deviceDesc;
 	deviceDesc.label = "My Device";
-	deviceDesc.requiredFeaturesCount = 0;
+	std::vector<FeatureName> requiredFeatures;
+	if (textureCompressionBC) requiredFeatures.push_back(FeatureName::TextureCompressionBC);
+	if (timestampQuery) requiredFeatures.push_back(FeatureName::TimestampQuery);
+	deviceDesc.requiredFeaturesCount = requiredFeatures.size();
+	deviceDesc.requiredFeatures = requiredFeatures.empty() ? nullptr : (const WGPUFeatureName*)requiredFeatures.data();
 	deviceDesc.requiredLimits = &requiredLimits;
 	deviceDesc.defaultQueue.label = "The default queue";
 	Device device = adapter.requestDevice(deviceDesc);
 	std::cout << "Got device: " << device << std::endl;
 
+	// GPU time of each pass, read back a few frames late
+	GpuTimer gpuTimer;
+	if (timestampQuery && gpuTimer.init(device, { "render pass" })) {
+		std::cout << "GPU timestamps: enabled" << std::endl;
+	} else {
+		std::cout << "GPU timestamps: not supported" << std::endl;
+	}
+
 	// Add an error callback for more debug info
 	auto h = device.setUncapturedErrorCallback([](ErrorType type, char const* message) {
 		std::cout << "Device error: type " << type;
@@ -154,24 +324,141 @@ int main (int, char**) {
 
 	Queue queue = device.getQueue();
 
-	std::cout << "Creating swapchain..." << std::endl;
+	SwapChain swapChain = nullptr;
+	// Headless, the color target of every frame, which can be copied out
+	Texture offscreenTexture = nullptr;
+	TextureView offscreenView = nullptr;
+	// Offscreen, the same encoding as the window gets, so that headless runs
+	// and captures render the same image: the preferred format of the
+	// surface is sRGB with wgpu-native (which shader.wgsl expects), while
+	// Dawn's swap chain here is BGRA8Unorm.
 #ifdef WEBGPU_BACKEND_WGPU
-	TextureFormat swapChainFormat = surface.getPreferredFormat(adapter);
+	TextureFormat swapChainFormat = headless ? TextureFormat::RGBA8UnormSrgb : surface.getPreferredFormat(adapter);
 #else
-	TextureFormat swapChainFormat = TextureFormat::BGRA8Unorm;
+	TextureFormat swapChainFormat = headless ? TextureFormat::RGBA8Unorm : TextureFormat::BGRA8Unorm;
 #endif
-	SwapChainDescriptor swapChainDesc;
-	swapChainDesc.width = 640;
-	swapChainDesc.height = 480;
-	swapChainDesc.usage = TextureUsage::RenderAttachment;
-	swapChainDesc.format = swapChainFormat;
-	swapChainDesc.presentMode = PresentMode::Fifo;
-	SwapChain swapChain = device.createSwapChain(surface, swapChainDesc);
-	std::cout << "Swapchain: " << swapChain << std::endl;
-
-	std::cout << "Creating shader module..." << std::endl;
-	ShaderModule shaderModule = loadShaderModule(RESOURCE_DIR "/shader.wgsl", device);
-	std::cout << "Shader module: " << shaderModule << std::endl;
+	if (headless) {
+		std::cout << "Creating offscreen target..." << std::endl;
+		TextureDescriptor offscreenDesc;
+		offscreenDesc.dimension = TextureDimension::_2D;
+		offscreenDesc.format = swapChainFormat;
+		offscreenDesc.mipLevelCount = 1;
+		offscreenDesc.sampleCount = 1;
+		offscreenDesc.size = {640, 480, 1};
+		offscreenDesc.usage = TextureUsage::RenderAttachment | TextureUsage::CopySrc;
+		offscreenDesc.viewFormatCount = 0;
+		offscreenDesc.viewFormats = nullptr;
+		offscreenTexture = device.createTexture(offscreenDesc);
+		TextureViewDescriptor offscreenViewDesc;
+		offscreenViewDesc.aspect = TextureAspect::All;
+		offscreenViewDesc.baseArrayLayer = 0;
+		offscreenViewDesc.arrayLayerCount = 1;
+		offscreenViewDesc.baseMipLevel = 0;
+		offscreenViewDesc.mipLevelCount = 1;
+		offscreenViewDesc.dimension = TextureViewDimension::_2D;
+		offscreenViewDesc.format = swapChainFormat;
+		offscreenView = offscreenTexture.createView(offscreenViewDesc);
+		std::cout << "Offscreen target: " << offscreenTexture << std::endl;
+	} else {
+		std::cout << "Creating swapchain..." << std::endl;
+		SwapChainDescriptor swapChainDesc;
+		swapChainDesc.width = 640;
+		swapChainDesc.height = 480;
+		swapChainDesc.usage = TextureUsage::RenderAttachment;
+		swapChainDesc.format = swapChainFormat;
+		swapChainDesc.presentMode = PresentMode::Fifo;
+		swapChain = device.createSwapChain(surface, swapChainDesc);
+		std::cout << "Swapchain: " << swapChain << std::endl;
+	}
+
+	// Create image data of the default texture, used by shapes without a
+	// material or whose texture could not be loaded
+	Image checkerboard;
+	checkerboard.width = 256;
+	checkerboard.height = 256;
+	checkerboard.pixels.resize(4 * checkerboard.width * checkerboard.height);
+	for (uint32_t i = 0; i < checkerboard.width; ++i) {
+		for (uint32_t j = 0; j < checkerboard.height; ++j) {
+			uint8_t *p = &checkerboard.pixels[4 * (j * checkerboard.width + i)];
+			p[0] = (i / 16) % 2 == (j / 16) % 2 ? 255 : 0; // r
+			p[1] = ((i - j) / 16) % 2 == 0 ? 255 : 0; // g
+			p[2] = ((i + j) / 16) % 2 == 0 ? 255 : 0; // b
+			p[3] = 255; // a
+		}
+	}
+	const uint32_t maxTextureDimension = requiredLimits.limits.maxTextureDimension2D;
+	std::vector<Texture> textures;
+	std::vector<uint32_t> textureMipLevelCounts(1);
+	std::vector<TextureFormat> textureFormats(1);
+	const EncodedTexture defaultTexture = encodeTexture(generateMipmaps(std::move(checkerboard)), BlockFormat::RGBA8, CompressionPreset::Fast);
+	textures.push_back(createMipmappedTexture(defaultTexture, maxTextureDimension, device, queue, &textureMipLevelCounts[0], &textureFormats[0]));
+	std::cout << "Texture: " << textures[0] << std::endl;
+
+	// Index in `textures` of each material texture, the default one until it
+	// is loaded or if it could not be
+	std::vector<size_t> materialTextureSlots;
+	auto addMaterialTexture = [&](const TextureAsset& loaded, std::vector<size_t>& slots, double readyTime) {
+		const MaterialTexture& texture = loaded.texture;
+		if (texture.encoded.levels.empty()) {
+			std::cout << "Could not load texture " << texture.source.string() << ": " << loaded.error << std::endl;
+			return;
+		}
+		slots[loaded.index] = textures.size();
+		textureMipLevelCounts.push_back(0);
+		textureFormats.push_back(TextureFormat::RGBA8Unorm);
+		textures.push_back(createMipmappedTexture(texture.encoded, maxTextureDimension, device, queue, &textureMipLevelCounts.back(), &textureFormats.back()));
+		if (!texture.source.empty()) {
+			std::cout << "Texture " << texture.source.filename().string() << ": " << texture.encoded.width << "x"
+				<< texture.encoded.height << " " << blockFormatName(texture.encoded.format);
+			if (texture.encoded.format != BlockFormat::RGBA8) {
+				std::cout << ", PSNR " << texture.psnr << " dB";
+			}
+			std::cout << (texture.fromCache ? " (from cache)" : "") << " (ready at " << readyTime << " ms)" << std::endl;
+		}
+	};
+
+	// Upload the assets as they finish loading, whatever their order
+	ShaderModule shaderModule = nullptr;
+	std::unique_ptr<MeshCache> meshCache;
+	GpuMesh gpuMesh;
+	MaterialTextures materialTextures;
+	LoadedAsset asset;
+	while (assets.next(asset)) {
+		const double readyTime = millisecondsSinceStart(assets.lastFinishTime());
+		if (ShaderAsset* shader = std::get_if<ShaderAsset>(&asset)) {
+			if (shader->source.empty()) {
+				std::cerr << "Could not read shader " << shader->path << std::endl;
+				return 1;
+			}
+			shaderModule = createShaderModule(shader->source, device);
+			std::cout << "Shader module: " << shaderModule << " (ready at " << readyTime << " ms)" << std::endl;
+		} else if (MeshAsset* loadedMesh = std::get_if<MeshAsset>(&asset)) {
+			if (!loadedMesh->ok) {
+				std::cerr << "Could not load geometry!" << std::endl;
+				return 1;
+			}
+			gpuMesh = uploadMesh(*loadedMesh, vertexEncoding, device);
+			if (!gpuMesh.vertexBuffer) {
+				std::cerr << "Could not load geometry!" << std::endl;
+				return 1;
+			}
+			meshCache = std::move(loadedMesh->cache);
+			std::cout << "Mesh: " << meshCache->vertexCount() << " vertices, " << meshCache->indexCount() << " indices, "
+				<< meshCache->meshlets().size() << " meshlets, " << meshCache->lods().size() << " levels of detail for "
+				<< meshCache->shapes().size() << " shapes" << (meshCache->wasCacheHit() ? " (from cache)" : "")
+				<< " (ready at " << readyTime << " ms)" << std::endl;
+		} else if (MaterialsAsset* materials = std::get_if<MaterialsAsset>(&asset)) {
+			if (!materials->warnings.empty()) {
+				std::cout << materials->warnings << std::endl;
+			}
+			materialTextures = std::move(materials->materials);
+			materialTextureSlots.assign(materials->textureCount, 0);
+		} else if (TextureAsset* loadedTexture = std::get_if<TextureAsset>(&asset)) {
+			addMaterialTexture(*loadedTexture, materialTextureSlots, readyTime);
+		}
+	}
+	std::cout << "Material textures: " << textures.size() - 1 << " for " << materialTextures.names.size()
+		<< " materials, all assets uploaded at " << millisecondsSinceStart(Clock::now()) << " ms" << std::endl;
 
 	std::cout << "Creating render pipeline..." << std::endl;
 	RenderPipelineDescriptor pipelineDesc;
@@ -182,35 +469,49 @@ int main (int, char**) {
 
 	// Position attribute
 	vertexAttribs[0].shaderLocation = 0;
-	vertexAttribs[0].format = VertexFormat::Float32x3;
-	vertexAttribs[0].offset = 0;
+	vertexAttribs[0].format = vertexEncoding.position == PositionEncoding::Unorm16 ? VertexFormat::Unorm16x4 : VertexFormat::Float32x3;
+	vertexAttribs[0].offset = encodedLayout.positionOffset;
 
 	// Normal attribute
 	vertexAttribs[1].shaderLocation = 1;
-	vertexAttribs[1].format = VertexFormat::Float32x3;
-	vertexAttribs[1].offset = offsetof(VertexAttributes, normal);
+	vertexAttribs[1].format = vertexEncoding.normal == NormalEncoding::OctSnorm16 ? VertexFormat::Snorm16x2 : VertexFormat::Float32x3;
+	vertexAttribs[1].offset = encodedLayout.normalOffset;
 
 	// Color attribute
 	vertexAttribs[2].shaderLocation = 2;
-	vertexAttribs[2].format = VertexFormat::Float32x3;
-	vertexAttribs[2].offset = offsetof(VertexAttributes, color);
+	vertexAttribs[2].format = vertexEncoding.color == ColorEncoding::Unorm8 ? VertexFormat::Unorm8x4 : VertexFormat::Float32x3;
+	vertexAttribs[2].offset = encodedLayout.colorOffset;
 
 	// UV attribute
 	vertexAttribs[3].shaderLocation = 3;
-	vertexAttribs[3].format = VertexFormat::Float32x2;
-	vertexAttribs[3].offset = offsetof(VertexAttributes, uv);
+	vertexAttribs[3].format = vertexEncoding.uv == UVEncoding::Float16 ? VertexFormat::Float16x2 : VertexFormat::Float32x2;
+	vertexAttribs[3].offset = encodedLayout.uvOffset;
+
+	// Instance attributes: the columns of the model matrix, then the color
+	std::vector<VertexAttribute> instanceAttribs(5);
+	for (uint32_t i = 0; i < instanceAttribs.size(); ++i) {
+		instanceAttribs[i].shaderLocation = 4 + i;
+		instanceAttribs[i].format = VertexFormat::Float32x4;
+		instanceAttribs[i].offset = i * 4 * sizeof(float);
+	}
+
+	std::vector<VertexBufferLayout> vertexBufferLayouts(2);
+	vertexBufferLayouts[0].attributeCount = (uint32_t)vertexAttribs.size();
+	vertexBufferLayouts[0].attributes = vertexAttribs.data();
+	vertexBufferLayouts[0].arrayStride = encodedLayout.stride;
+	vertexBufferLayouts[0].stepMode = VertexStepMode::Vertex;
 
-	VertexBufferLayout vertexBufferLayout;
-	vertexBufferLayout.attributeCount = (uint32_t)vertexAttribs.size();
-	vertexBufferLayout.attributes = vertexAttribs.data();
-	vertexBufferLayout.arrayStride = sizeof(VertexAttributes);
-	vertexBufferLayout.stepMode = VertexStepMode::Vertex;
+	vertexBufferLayouts[1].attributeCount = (uint32_t)instanceAttribs.size();
+	vertexBufferLayouts[1].attributes = instanceAttribs.data();
+	vertexBufferLayouts[1].arrayStride = sizeof(InstanceAttributes);
+	vertexBufferLayouts[1].stepMode = VertexStepMode::Instance;
 
-	pipelineDesc.vertex.bufferCount = 1;
-	pipelineDesc.vertex.buffers = &vertexBufferLayout;
+	// Without instancing, the attributes of each copy are uniforms instead
+	pipelineDesc.vertex.bufferCount = instancing ? (uint32_t)vertexBufferLayouts.size() : 1;
+	pipelineDesc.vertex.buffers = vertexBufferLayouts.data();
 
 	pipelineDesc.vertex.module = shaderModule;
-	pipelineDesc.vertex.entryPoint = "vs_main";
+	pipelineDesc.vertex.entryPoint = instancing ? "vs_main" : "vs_object";
 	pipelineDesc.vertex.constantCount = 0;
 	pipelineDesc.vertex.constants = nullptr;
 
@@ -259,14 +560,14 @@ int main (int, char**) {
 	// Create binding layouts
 
 	// Since we now have 2 bindings, we use a vector to store them
-	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(3, Default);
+	std::vector<BindGroupLayoutEntry> bindingLayoutEntries(instancing ? 3 : 4, Default);
 
 	// The uniform buffer binding that we already had
 	BindGroupLayoutEntry& bindingLayout = bindingLayoutEntries[0];
 	bindingLayout.binding = 0;
 	bindingLayout.visibility = ShaderStage::Vertex | ShaderStage::Fragment;
 	bindingLayout.buffer.type = BufferBindingType::Uniform;
-	bindingLayout.buffer.minBindingSize = sizeof(MyUniforms);
+	bindingLayout.buffer.minBindingSize = sizeof(FrameUniforms);
 
 	// The texture binding
 	BindGroupLayoutEntry& textureBindingLayout = bindingLayoutEntries[1];
@@ -281,6 +582,17 @@ int main (int, char**) {
   samplerBindingLayout.visibility = ShaderStage::Fragment;
   samplerBindingLayout.sampler.type = SamplerBindingType::Filtering;
 
+	// Without instancing, the uniforms of the object being drawn, in the same
+	// buffer, at the offset given to setBindGroup
+	if (!instancing) {
+		BindGroupLayoutEntry& objectBindingLayout = bindingLayoutEntries[3];
+		objectBindingLayout.binding = 3;
+		objectBindingLayout.visibility = ShaderStage::Vertex;
+		objectBindingLayout.buffer.type = BufferBindingType::Uniform;
+		objectBindingLayout.buffer.hasDynamicOffset = true;
+		objectBindingLayout.buffer.minBindingSize = sizeof(InstanceAttributes);
+	}
+
 	// Create a bind group layout
 	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
 	bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayoutEntries.size();
@@ -322,30 +634,6 @@ int main (int, char**) {
 	TextureView depthTextureView = depthTexture.createView(depthTextureViewDesc);
 	std::cout << "Depth texture view: " << depthTextureView << std::endl;
 
-	// Create the color texture
-	TextureDescriptor textureDesc;
-	textureDesc.dimension = TextureDimension::_2D;
-	textureDesc.size = { 256, 256, 1 };
-	textureDesc.mipLevelCount = 1;
-	textureDesc.sampleCount = 1;
-	textureDesc.format = TextureFormat::RGBA8Unorm;
-	textureDesc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
-	textureDesc.viewFormatCount = 0;
-	textureDesc.viewFormats = nullptr;
-	Texture texture = device.createTexture(textureDesc);
-	std::cout << "Texture: " << texture << std::endl;
-
-	TextureViewDescriptor textureViewDesc;
-	textureViewDesc.aspect = TextureAspect::All;
-	textureViewDesc.baseArrayLayer = 0;
-	textureViewDesc.arrayLayerCount = 1;
-	textureViewDesc.baseMipLevel = 0;
-	textureViewDesc.mipLevelCount = 1;
-	textureViewDesc.dimension = TextureViewDimension::_2D;
-	textureViewDesc.format = textureDesc.format;
-	TextureView textureView = texture.createView(textureViewDesc);
-	std::cout << "Texture view: " << textureView << std::endl;
-
   // Createe a sampler
   SamplerDescriptor samplerDesc;
   samplerDesc.addressModeU = AddressMode::Repeat;
@@ -355,165 +643,681 @@ int main (int, char**) {
   samplerDesc.minFilter = FilterMode::Linear;
   samplerDesc.mipmapFilter =MipmapFilterMode::Linear;
   samplerDesc.lodMinClamp = 0.0f;
-  samplerDesc.lodMaxClamp = 1.0f;
+  samplerDesc.lodMaxClamp = 32.0f; // all mip levels
   samplerDesc.compare = CompareFunction::Undefined;
   samplerDesc.maxAnisotropy = 1;
   Sampler sampler = device.createSampler(samplerDesc);
 
-	// Create image data
-	std::vector<uint8_t> pixels(4 * textureDesc.size.width * textureDesc.size.height);
-	for (uint32_t i = 0; i < textureDesc.size.width; ++i) {
-		for (uint32_t j = 0; j < textureDesc.size.height; ++j) {
-			uint8_t *p = &pixels[4 * (j * textureDesc.size.width + i)];
-			p[0] = (i / 16) % 2 == (j / 16) % 2 ? 255 : 0; // r
-			p[1] = ((i - j) / 16) % 2 == 0 ? 255 : 0; // g
-			p[2] = ((i + j) / 16) % 2 == 0 ? 255 : 0; // b
-			p[3] = 255; // a
-		}
-	}
 
-	// Upload texture data
-	ImageCopyTexture destination;
-	destination.texture = texture;
-	destination.mipLevel = 0;
-	destination.origin = { 0, 0, 0 };
-	destination.aspect = TextureAspect::All;
-	TextureDataLayout source;
-	source.offset = 0;
-	source.bytesPerRow = 4 * textureDesc.size.width;
-	source.rowsPerImage = textureDesc.size.height;
-	queue.writeTexture(destination, pixels.data(), pixels.size(), source, textureDesc.size);
-
-	std::vector<float> pointData;
-	std::vector<uint16_t> indexData;
-
-	// Load mesh data from OBJ file
-	std::vector<VertexAttributes> vertexData;
-	bool success = loadGeometryFromObj(RESOURCE_DIR "/plane.obj", vertexData);
-	if (!success) {
-		std::cerr << "Could not load geometry!" << std::endl;
-		return 1;
+	// Copies of the mesh, on a grid about as large as the mesh itself. They
+	// do not move, so the instance buffer is only written when they are
+	// placed. Without instancing, their uniforms follow those of the frame.
+	const uint32_t uniformAlignment = supportedLimits.limits.minUniformBufferOffsetAlignment;
+	const uint64_t frameBlockSize = UniformArena::blockSize(sizeof(FrameUniforms), uniformAlignment);
+	const uint64_t objectBlockSize = UniformArena::blockSize(sizeof(InstanceAttributes), uniformAlignment);
+	const uint64_t maxObjectCount = instancing
+		? requiredLimits.limits.maxBufferSize / sizeof(InstanceAttributes)
+		: (requiredLimits.limits.maxBufferSize - frameBlockSize) / objectBlockSize;
+	if (objectCount > maxObjectCount) {
+		std::cout << "Drawing " << maxObjectCount << " objects, the most that the " << (instancing ? "instance" : "uniform") << " buffer can hold" << std::endl;
+		objectCount = static_cast<uint32_t>(maxObjectCount);
 	}
 
-	// Create vertex buffer
-	BufferDescriptor bufferDesc;
-	bufferDesc.size = vertexData.size() * sizeof(VertexAttributes);
-	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Vertex;
-	bufferDesc.mappedAtCreation = false;
-	Buffer vertexBuffer = device.createBuffer(bufferDesc);
-	queue.writeBuffer(vertexBuffer, 0, vertexData.data(), bufferDesc.size);
-
-	int indexCount = static_cast<int>(vertexData.size());
-	
-	// Create uniform buffer
-	bufferDesc.size = sizeof(MyUniforms);
-	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Uniform;
-	bufferDesc.mappedAtCreation = false;
-	Buffer uniformBuffer = device.createBuffer(bufferDesc);
+	// Create the uniform buffer, uploaded at once every frame
+	UniformArena uniformArena;
+	uniformArena.init(device, frameBlockSize + (instancing ? 0 : objectCount * objectBlockSize), uniformAlignment);
 
-	// Upload the initial value of the uniforms
-	MyUniforms uniforms;
-	uniforms.modelMatrix = mat4x4(1.0);
+	// Initial value of the uniforms
+	FrameUniforms uniforms;
 	// NB: The last argument of lookAt indicates our Up direction convention:
 	uniforms.viewMatrix = glm::lookAt(vec3(-2.0f, -3.0f, 2.0f), vec3(0.0f), vec3(0, 0, 1));
 	uniforms.projectionMatrix = glm::perspective(45 * PI / 180, 640.0f / 480.0f, 0.01f, 100.0f);
 	uniforms.time = 1.0f;
-	uniforms.color = { 0.0f, 1.0f, 0.4f, 1.0f };
-	queue.writeBuffer(uniformBuffer, 0, &uniforms, sizeof(MyUniforms));
+	uniforms.octNormals = gpuMesh.vertexDecoding.octNormals ? 1 : 0;
+	uniforms.positionOffset = vec4(gpuMesh.vertexDecoding.positionOffset, 0.0f);
+	uniforms.positionScale = vec4(gpuMesh.vertexDecoding.positionScale, 0.0f);
+
+	std::vector<InstanceAttributes> objects(objectCount);
+	std::vector<uint32_t> objectOffsets(instancing ? 0 : objectCount); // in the uniform buffer
+	BufferDescriptor instanceBufferDesc;
+	instanceBufferDesc.label = "Instance buffer";
+	instanceBufferDesc.size = objectCount * sizeof(InstanceAttributes);
+	instanceBufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Vertex;
+	instanceBufferDesc.mappedAtCreation = false;
+	Buffer instanceBuffer = instancing ? device.createBuffer(instanceBufferDesc) : nullptr;
+
+	// When several copies are instanced, a compute pass culls their bounding
+	// spheres every frame, sorts them by distance and writes the arguments
+	// of indirect draws, so the CPU does not depend on the number of copies.
+	// Otherwise a tree of their bounding boxes is queried on the CPU, and the
+	// visible copies are sorted by distance, then either drawn one by one or
+	// gathered into a second instance buffer. Each distance bucket is drawn
+	// at its own level of detail.
+	if (objectCount == 1) {
+		objectCulling = ObjectCulling::None;
+	} else if (objectCulling == ObjectCulling::Gpu && !instancing) {
+		objectCulling = ObjectCulling::Cpu;
+	}
+	GpuCulling gpuCulling;
+	if (objectCulling == ObjectCulling::Gpu) {
+		if (gpuCulling.init(device, sizeof(InstanceAttributes), objectCount)) {
+			std::cout << "Culling: on the GPU" << std::endl;
+		} else {
+			std::cout << "Culling: not available on the GPU, culling on the CPU" << std::endl;
+			objectCulling = ObjectCulling::Cpu;
+		}
+	}
+	if (objectCulling == ObjectCulling::Cpu) {
+		std::cout << "Culling: on the CPU, " << cullingKernelName(bestCullingKernel()) << " kernel" << std::endl;
+	}
+	Buffer visibleInstanceBuffer = nullptr;
+	if (instancing && objectCount > 1 && !gpuCulling.enabled()) {
+		instanceBufferDesc.label = "Visible instance buffer";
+		visibleInstanceBuffer = device.createBuffer(instanceBufferDesc);
+		instanceBufferDesc.label = "Instance buffer";
+	}
+	float objectRadius = 1.0f; // of the mesh, in model units
+	std::vector<vec4> objectSpheres(objectCount);
+	std::vector<GpuCulling::DrawIndexedArgs> indirectDraws;
+	std::vector<Aabb> objectBounds(objectCount);
+	SceneBvh objectBvh;
+	std::vector<uint32_t> visibleObjects;
+	std::vector<uint8_t> visibleBuckets;
+	// The visible copies sorted by distance bucket, those of bucket b from
+	// bucketObjects[firstBucketObject[b]] on
+	std::vector<uint32_t> bucketObjects;
+	std::array<uint32_t, GpuCulling::kDistanceBuckets + 1> firstBucketObject{};
+	std::vector<InstanceAttributes> visibleObjectAttributes;
+
+	auto uploadObjects = [&]() {
+		objectRadius = meshRadius(*meshCache);
+		placeObjects(objects, objectRadius);
+		if (instanceBuffer) {
+			queue.writeBuffer(instanceBuffer, 0, objects.data(), instanceBufferDesc.size);
+		}
+		for (size_t i = 0; i < objects.size(); ++i) {
+			const mat4x4& model = objects[i].modelMatrix;
+			const float scale = std::max({ glm::length(vec3(model[0])), glm::length(vec3(model[1])), glm::length(vec3(model[2])) });
+			objectSpheres[i] = vec4(vec3(model[3]), objectRadius * scale);
+		}
+		if (objectCulling == ObjectCulling::None) return;
+		if (objectCulling == ObjectCulling::Gpu) {
+			gpuCulling.setInstances(queue, objects.data(), objectSpheres.data(), objectCount);
+			return;
+		}
+		PROFILE_ZONE("build object tree");
+		for (size_t i = 0; i < objects.size(); ++i) {
+			const vec3 center = vec3(objectSpheres[i]);
+			objectBounds[i] = { center - objectSpheres[i].w, center + objectSpheres[i].w };
+		}
+		// The grid scales with the mesh, so a reloaded mesh keeps the shape of
+		// the tree and only its bounds change
+		if (objectBvh.objectCount() == objectBounds.size()) {
+			objectBvh.refit(objectBounds);
+		} else {
+			objectBvh.build(objectBounds);
+		}
+	};
+	uploadObjects();
 
-	// Create a binding
-	std::vector<BindGroupEntry> bindings(3);
+	// Create a binding per texture
+	std::vector<BindGroupEntry> bindings(instancing ? 3 : 4);
 
 	bindings[0].binding = 0;
-	bindings[0].buffer = uniformBuffer;
+	bindings[0].buffer = uniformArena.buffer();
 	bindings[0].offset = 0;
-	bindings[0].size = sizeof(MyUniforms);
+	bindings[0].size = sizeof(FrameUniforms);
 
 	bindings[1].binding = 1;
-	bindings[1].textureView = textureView;
 
   bindings[2].binding = 2;
   bindings[2].sampler = sampler;
 
+	if (!instancing) {
+		bindings[3].binding = 3;
+		bindings[3].buffer = uniformArena.buffer();
+		bindings[3].offset = 0;
+		bindings[3].size = sizeof(InstanceAttributes);
+	}
+
 	BindGroupDescriptor bindGroupDesc;
 	bindGroupDesc.layout = bindGroupLayout;
 	bindGroupDesc.entryCount = (uint32_t)bindings.size();
 	bindGroupDesc.entries = bindings.data();
-	BindGroup bindGroup = device.createBindGroup(bindGroupDesc);
 
-	while (!glfwWindowShouldClose(window)) {
-		glfwPollEvents();
+	// Index ranges that survive culling, rebuilt every frame: the level of
+	// detail of each visible shape, or its visible meshlets at full detail,
+	// grouped by distance bucket of the copies, then by bind group. Normal
+	// cones are only used when the pipeline culls back faces.
+	std::vector<std::vector<IndexRange>> ranges;
+	std::array<std::vector<std::vector<MeshChunk>>, GpuCulling::kDistanceBuckets> visibleRanges;
+	const bool backfaceCulling = pipelineDesc.primitive.cullMode == CullMode::Back;
+
+	std::vector<TextureView> textureViews;
+	std::vector<BindGroup> bindGroups;
+	auto createBindGroups = [&]() {
+		for (BindGroup bindGroup : bindGroups) {
+			bindGroup.release();
+		}
+		for (TextureView textureView : textureViews) {
+			textureView.release();
+		}
+		textureViews.clear();
+		bindGroups.clear();
+		for (size_t i = 0; i < textures.size(); ++i) {
+			TextureViewDescriptor textureViewDesc;
+			textureViewDesc.aspect = TextureAspect::All;
+			textureViewDesc.baseArrayLayer = 0;
+			textureViewDesc.arrayLayerCount = 1;
+			textureViewDesc.baseMipLevel = 0;
+			textureViewDesc.mipLevelCount = textureMipLevelCounts[i];
+			textureViewDesc.dimension = TextureViewDimension::_2D;
+			textureViewDesc.format = textureFormats[i];
+			textureViews.push_back(textures[i].createView(textureViewDesc));
+			bindings[1].textureView = textureViews.back();
+			bindGroups.push_back(device.createBindGroup(bindGroupDesc));
+		}
+		ranges.resize(bindGroups.size());
+		for (std::vector<std::vector<MeshChunk>>& bucketRanges : visibleRanges) {
+			bucketRanges.resize(bindGroups.size());
+		}
+	};
+	createBindGroups();
+
+	// Bind group of each material of the mesh, then the default one for
+	// shapes without a material
+	std::vector<size_t> materialBindGroups;
+	auto assignMaterialBindGroups = [&]() {
+		materialBindGroups.clear();
+		for (const std::string& name : meshCache->materials()) {
+			const int material = materialTextures.find(name);
+			const uint32_t texture = material >= 0 ? materialTextures.textureOfMaterial[material] : kNoTexture;
+			materialBindGroups.push_back(texture == kNoTexture ? 0 : materialTextureSlots[texture]);
+		}
+		materialBindGroups.push_back(0);
+	};
+	assignMaterialBindGroups();
+
+#ifdef HOT_RELOAD
+	// Resources are read from the source tree (see DEV_MODE in
+	// CMakeLists.txt), so edits are reloaded on the asset loader's threads
+	// and swapped in between two frames. A file that fails to load or a
+	// shader that fails to compile leaves the previous version in place.
+	FileWatcher watcher;
+	auto watchMaterialLibraries = [&]() {
+		for (const fs::path& library : materialTextures.libraries) {
+			watcher.watch(library);
+		}
+	};
+	if (watcher.watch(shaderPath) && watcher.watch(meshPath)) {
+		watchMaterialLibraries();
+		std::cout << "Watching resources for changes" << std::endl;
+	} else {
+		std::cout << "Cannot watch resources, hot reload is disabled" << std::endl;
+	}
+
+	// A new pipeline is only swapped in, at the start of a frame, once both
+	// the pipeline and the validation errors of its shader are known, which
+	// some backends only report on a later tick. Only the source is read on
+	// the loader threads: the error scope stack belongs to the whole device,
+	// so the module and pipeline are created on the render thread between
+	// frames, where nothing else can push errors to it. Dawn then compiles
+	// the pipeline on its own threads.
+	struct PipelineReload {
+		ShaderModule shaderModule = nullptr;
+		RenderPipeline pipeline = nullptr;
+		bool created = false; // the pipeline, valid or not
+		bool checked = false; // the error scope
+		std::string error; // empty if it compiled
+		std::unique_ptr<ErrorCallback> errorCallback;
+#ifdef WEBGPU_BACKEND_DAWN
+		std::unique_ptr<CreateRenderPipelineAsyncCallback> pipelineCallback;
+#endif
+	};
+	std::deque<std::unique_ptr<PipelineReload>> pipelineReloads;
+	auto buildPipeline = [&](PipelineReload& reload, const std::string& source) {
+		PROFILE_ZONE("build pipeline");
+		device.pushErrorScope(ErrorFilter::Validation);
+		reload.shaderModule = createShaderModule(source, device);
+		pipelineDesc.vertex.module = reload.shaderModule;
+		fragmentState.module = reload.shaderModule;
+		PipelineReload* pending = &reload;
+#ifdef WEBGPU_BACKEND_DAWN
+		reload.pipelineCallback = device.createRenderPipelineAsync(pipelineDesc, [pending](CreatePipelineAsyncStatus status, RenderPipeline pipeline, char const* message) {
+			if (status == CreatePipelineAsyncStatus::Success) {
+				pending->pipeline = pipeline;
+			} else if (pending->error.empty()) {
+				pending->error = message ? message : "unknown error";
+			}
+			pending->created = true;
+		});
+#else
+		reload.pipeline = device.createRenderPipeline(pipelineDesc);
+		reload.created = true;
+#endif
+		reload.errorCallback = device.popErrorScope([pending](ErrorType type, char const* message) {
+			if (type != ErrorType::NoError) {
+				pending->error = message ? message : "unknown error";
+			}
+			pending->checked = true;
+		});
+	};
+
+	// Textures of the latest reload of the material table, appended after
+	// the current ones until they are all uploaded
+	uint32_t materialRequest = 0;
+	MaterialTextures reloadedMaterials;
+	std::vector<size_t> reloadedTextureSlots;
+	size_t reloadedTexturesLeft = 0;
+	size_t firstReloadedTexture = 0;
+	auto dropTextures = [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; ++i) {
+			textures[i].destroy();
+			textures[i].release();
+		}
+		textures.erase(textures.begin() + first, textures.begin() + last);
+		textureMipLevelCounts.erase(textureMipLevelCounts.begin() + first, textureMipLevelCounts.begin() + last);
+		textureFormats.erase(textureFormats.begin() + first, textureFormats.begin() + last);
+	};
+	auto swapMaterials = [&]() {
+		// Keep the default texture
+		dropTextures(1, firstReloadedTexture);
+		for (size_t& slot : reloadedTextureSlots) {
+			if (slot != 0) slot -= firstReloadedTexture - 1;
+		}
+		materialTextures = std::move(reloadedMaterials);
+		materialTextureSlots = std::move(reloadedTextureSlots);
+		createBindGroups();
+		assignMaterialBindGroups();
+		watchMaterialLibraries();
+		std::cout << "Reloaded materials: " << textures.size() - 1 << " textures for " << materialTextures.names.size() << " materials" << std::endl;
+	};
+#endif
+
+	bool firstFrame = true;
+	uint32_t frame = 0;
+	Clock::time_point secondFrameStart; // the first one includes pipeline warm up
+	auto keepRendering = [&]() {
+		if (frameCount > 0 && frame >= frameCount) return false;
+		return headless || !glfwWindowShouldClose(window);
+	};
+	for (; keepRendering(); ++frame) {
+		PROFILE_ZONE("frame");
+		if (frame == 1) {
+			secondFrameStart = Clock::now();
+		}
+		if (!headless) {
+			PROFILE_ZONE("glfwPollEvents");
+			glfwPollEvents();
+		}
+
+#ifdef HOT_RELOAD
+		// Start reloading the files that changed since the last frame
+		bool reloadShader = false, reloadMesh = false, reloadMaterials = false;
+		for (const fs::path& changed : watcher.changes()) {
+			std::cout << "Reloading " << changed.filename().string() << "..." << std::endl;
+			reloadShader = reloadShader || changed == shaderPath;
+			reloadMesh = reloadMesh || changed == meshPath;
+			// The OBJ may reference other material libraries
+			reloadMaterials = reloadMaterials || changed != shaderPath;
+		}
+		if (reloadShader) {
+			assets.loadShader(shaderPath);
+		}
+		if (reloadMesh) {
+			assets.loadMesh(meshPath, vertexEncoding);
+		}
+		if (reloadMaterials) {
+			materialRequest = assets.loadMaterialTextures(meshPath, textureSettings, blockCompression);
+		}
+
+		// Swap in what finished reloading
+		while (assets.poll(asset)) {
+			if (ShaderAsset* shader = std::get_if<ShaderAsset>(&asset)) {
+				if (shader->source.empty()) {
+					std::cerr << "Could not read shader " << shader->path << ", keeping the previous one" << std::endl;
+					continue;
+				}
+				auto reload = std::make_unique<PipelineReload>();
+				buildPipeline(*reload, shader->source);
+				pipelineReloads.push_back(std::move(reload));
+			} else if (MeshAsset* loadedMesh = std::get_if<MeshAsset>(&asset)) {
+				if (!loadedMesh->ok) {
+					std::cerr << "Could not reload geometry, keeping the previous one" << std::endl;
+					continue;
+				}
+				GpuMesh uploaded = uploadMesh(*loadedMesh, vertexEncoding, device);
+				if (!uploaded.vertexBuffer) {
+					std::cerr << "Could not reload geometry, keeping the previous one" << std::endl;
+					continue;
+				}
+				GpuMesh previous = gpuMesh;
+				gpuMesh = uploaded;
+				previous.vertexBuffer.destroy();
+				previous.vertexBuffer.release();
+				previous.indexBuffer.destroy();
+				previous.indexBuffer.release();
+				meshCache = std::move(loadedMesh->cache);
+				uniforms.octNormals = gpuMesh.vertexDecoding.octNormals ? 1 : 0;
+				uniforms.positionOffset = vec4(gpuMesh.vertexDecoding.positionOffset, 0.0f);
+				uniforms.positionScale = vec4(gpuMesh.vertexDecoding.positionScale, 0.0f);
+				uploadObjects();
+				assignMaterialBindGroups();
+				for (std::vector<std::vector<MeshChunk>>& bucketRanges : visibleRanges) {
+					for (std::vector<MeshChunk>& groupRanges : bucketRanges) {
+						groupRanges.clear();
+					}
+				}
+				std::cout << "Reloaded mesh: " << meshCache->vertexCount() << " vertices, " << meshCache->indexCount() << " indices" << std::endl;
+			} else if (MaterialsAsset* materials = std::get_if<MaterialsAsset>(&asset)) {
+				// Superseded by a later reload
+				if (materials->request != materialRequest) continue;
+				if (!materials->warnings.empty()) {
+					std::cout << materials->warnings << std::endl;
+				}
+				if (reloadedTexturesLeft > 0) {
+					dropTextures(firstReloadedTexture, textures.size());
+				}
+				reloadedMaterials = std::move(materials->materials);
+				reloadedTextureSlots.assign(materials->textureCount, 0);
+				reloadedTexturesLeft = materials->textureCount;
+				firstReloadedTexture = textures.size();
+				if (reloadedTexturesLeft == 0) {
+					swapMaterials();
+				}
+			} else if (TextureAsset* loadedTexture = std::get_if<TextureAsset>(&asset)) {
+				if (loadedTexture->request != materialRequest) continue;
+				addMaterialTexture(*loadedTexture, reloadedTextureSlots, millisecondsSinceStart(assets.lastFinishTime()));
+				if (--reloadedTexturesLeft == 0) {
+					swapMaterials();
+				}
+			}
+		}
+		while (!pipelineReloads.empty() && pipelineReloads.front()->created && pipelineReloads.front()->checked) {
+			PipelineReload& reload = *pipelineReloads.front();
+			if (reload.error.empty()) {
+				pipeline.release();
+				shaderModule.release();
+				pipeline = reload.pipeline;
+				shaderModule = reload.shaderModule;
+				std::cout << "Reloaded shader" << std::endl;
+			} else {
+				std::cerr << "Shader error, keeping the previous pipeline:" << std::endl << reload.error << std::endl;
+				if (reload.pipeline) reload.pipeline.release();
+				if (reload.shaderModule) reload.shaderModule.release();
+			}
+			pipelineReloads.pop_front();
+		}
+#endif
 
 		// Update uniform buffer
-		uniforms.time = static_cast<float>(glfwGetTime());
-		queue.writeBuffer(uniformBuffer, offsetof(MyUniforms, time), &uniforms.time, sizeof(MyUniforms::time));
+		{
+			PROFILE_ZONE("write uniforms");
+			// Offscreen, time advances at 60 frames per second, so that a
+			// given frame always renders the same
+			uniforms.time = headless ? frame / 60.0f : static_cast<float>(glfwGetTime());
+
+			float viewZ = glm::mix(0.0f, 0.25f, cos(2 * PI * uniforms.time / 4)*0.5+0.5);
+			uniforms.viewMatrix = glm::lookAt(vec3(-0.5f, -1.5f,  viewZ + 0.5f),vec3(0.0f),vec3(0,0,1));
+
+			// A single write for the whole frame
+			uniformArena.reset();
+			uniformArena.push(uniforms);
+			for (size_t i = 0; i < objectOffsets.size(); ++i) {
+				objectOffsets[i] = uniformArena.push(objects[i]);
+			}
+			uniformArena.upload(queue);
+		}
 
-    float viewZ = glm::mix(0.0f, 0.25f, cos(2 * PI * uniforms.time / 4)*0.5+0.5);
-    uniforms.viewMatrix = glm::lookAt(vec3(-0.5f, -1.5f,  viewZ + 0.5f),vec3(0.0f),vec3(0,0,1)); 
-    queue.writeBuffer(uniformBuffer, offsetof(MyUniforms, viewMatrix), &uniforms.viewMatrix, sizeof(MyUniforms::viewMatrix));
+		// Find the visible copies and sort them by distance bucket (a single
+		// copy is always drawn), then gather their attributes when they are
+		// instanced
+		const vec3 eye = vec3(glm::inverse(uniforms.viewMatrix) * vec4(0.0f, 0.0f, 0.0f, 1.0f));
+		if (objectCount == 1) {
+			bucketObjects.assign(1, 0);
+			firstBucketObject.fill(1);
+			firstBucketObject[0] = 0;
+		} else if (!gpuCulling.enabled()) {
+			PROFILE_ZONE("cull objects");
+			if (objectCulling == ObjectCulling::Cpu) {
+				objectBvh.query(extractFrustum(uniforms.projectionMatrix * uniforms.viewMatrix), visibleObjects);
+			} else {
+				visibleObjects.resize(objectCount);
+				std::iota(visibleObjects.begin(), visibleObjects.end(), 0);
+			}
+			std::array<uint32_t, GpuCulling::kDistanceBuckets> bucketCounts{};
+			visibleBuckets.resize(visibleObjects.size());
+			for (size_t i = 0; i < visibleObjects.size(); ++i) {
+				visibleBuckets[i] = static_cast<uint8_t>(GpuCulling::distanceBucket(objectSpheres[visibleObjects[i]], eye));
+				++bucketCounts[visibleBuckets[i]];
+			}
+			firstBucketObject[0] = 0;
+			for (uint32_t bucket = 0; bucket < GpuCulling::kDistanceBuckets; ++bucket) {
+				firstBucketObject[bucket + 1] = firstBucketObject[bucket] + bucketCounts[bucket];
+			}
+			std::array<uint32_t, GpuCulling::kDistanceBuckets + 1> next = firstBucketObject;
+			bucketObjects.resize(visibleObjects.size());
+			for (size_t i = 0; i < visibleObjects.size(); ++i) {
+				bucketObjects[next[visibleBuckets[i]]++] = visibleObjects[i];
+			}
+			if (instancing && !bucketObjects.empty()) {
+				visibleObjectAttributes.resize(bucketObjects.size());
+				for (size_t i = 0; i < bucketObjects.size(); ++i) {
+					visibleObjectAttributes[i] = objects[bucketObjects[i]];
+				}
+				queue.writeBuffer(visibleInstanceBuffer, 0, visibleObjectAttributes.data(), visibleObjectAttributes.size() * sizeof(InstanceAttributes));
+			}
+		}
+
+		// Select levels of detail and cull in model space
+		{
+			PROFILE_ZONE("select levels of detail and cull");
+			const MeshCache& mesh = *meshCache;
+			// The copies are scaled uniformly, so the ratio of their error to
+			// their distance is the same in model and world units
+			const float pixelsPerUnit = uniforms.projectionMatrix[1][1] * 480 / 2.0f;
+			for (uint32_t bucket = 0; bucket < GpuCulling::kDistanceBuckets; ++bucket) {
+				std::vector<std::vector<MeshChunk>>& bucketRanges = visibleRanges[bucket];
+				// The GPU sorts the copies, so every bucket may have some
+				const bool hasObjects = gpuCulling.enabled() || firstBucketObject[bucket + 1] > firstBucketObject[bucket];
+				if (!hasObjects) {
+					for (std::vector<MeshChunk>& groupRanges : bucketRanges) {
+						groupRanges.clear();
+					}
+					continue;
+				}
+				if (mesh.shapes().empty()) {
+					bucketRanges[0] = mesh.chunks();
+					continue;
+				}
+				for (std::vector<IndexRange>& groupRanges : ranges) {
+					groupRanges.clear();
+				}
+				if (objectCount == 1) {
+					// A single copy: its shapes are culled and simplified one
+					// by one, and its meshlets culled at full detail
+					const mat4x4 modelView = uniforms.viewMatrix * objects[0].modelMatrix;
+					const Frustum frustum = extractFrustum(uniforms.projectionMatrix * modelView);
+					const vec3 cameraPosition = vec3(glm::inverse(modelView) * vec4(0.0f, 0.0f, 0.0f, 1.0f));
+					for (const MeshShape& shape : mesh.shapes()) {
+						if (!isSphereVisible(frustum, shape.center, shape.radius)) continue;
+						const uint32_t level = selectLod(shape, mesh.lods(), cameraPosition, pixelsPerUnit);
+						const MeshLod& lod = mesh.lods()[shape.firstLod + level];
+						const size_t material = std::min<size_t>(shape.material, mesh.materials().size());
+						std::vector<IndexRange>& groupRanges = ranges[materialBindGroups[material]];
+						if (level == 0 && !mesh.meshlets().empty()) {
+							cullMeshlets(mesh.meshlets(), lod.firstIndex, lod.indexCount, frustum, cameraPosition, backfaceCulling, groupRanges);
+						} else {
+							appendIndexRange(groupRanges, lod.firstIndex, lod.indexCount);
+						}
+					}
+				} else {
+					// The copies of a bucket share their ranges, simplified for
+					// the nearest one that it may hold. No shape of a copy is
+					// closer to the camera than its bounding sphere.
+					const float distance = GpuCulling::bucketDistance(bucket) * objectRadius;
+					for (const MeshShape& shape : mesh.shapes()) {
+						const uint32_t level = selectLodAtDistance(shape, mesh.lods(), distance, pixelsPerUnit);
+						const MeshLod& lod = mesh.lods()[shape.firstLod + level];
+						const size_t material = std::min<size_t>(shape.material, mesh.materials().size());
+						appendIndexRange(ranges[materialBindGroups[material]], lod.firstIndex, lod.indexCount);
+					}
+				}
+				for (size_t group = 0; group < ranges.size(); ++group) {
+					splitAtChunks(ranges[group], mesh.chunks(), bucketRanges[group]);
+				}
+			}
+		}
 		
-		TextureView nextTexture = swapChain.getCurrentTextureView();
+		TextureView nextTexture = nullptr;
+		{
+			PROFILE_ZONE("getCurrentTextureView");
+			nextTexture = headless ? offscreenView : swapChain.getCurrentTextureView();
+		}
 		if (!nextTexture) {
 			std::cerr << "Cannot acquire next swap chain texture" << std::endl;
 			return 1;
 		}
 
-		CommandEncoderDescriptor commandEncoderDesc;
-		commandEncoderDesc.label = "Command Encoder";
-		CommandEncoder encoder = device.createCommandEncoder(commandEncoderDesc);
+		CommandBuffer command = nullptr;
+		{
+			PROFILE_ZONE("encode");
+			CommandEncoderDescriptor commandEncoderDesc;
+			commandEncoderDesc.label = "Command Encoder";
+			CommandEncoder encoder = device.createCommandEncoder(commandEncoderDesc);
 		
-		RenderPassDescriptor renderPassDesc{};
-
-		RenderPassColorAttachment renderPassColorAttachment{};
-		renderPassColorAttachment.view = nextTexture;
-		renderPassColorAttachment.resolveTarget = nullptr;
-		renderPassColorAttachment.loadOp = LoadOp::Clear;
-		renderPassColorAttachment.storeOp = StoreOp::Store;
-		renderPassColorAttachment.clearValue = Color{ 0.05, 0.05, 0.05, 1.0 };
-		renderPassDesc.colorAttachmentCount = 1;
-		renderPassDesc.colorAttachments = &renderPassColorAttachment;
-
-		RenderPassDepthStencilAttachment depthStencilAttachment;
-		depthStencilAttachment.view = depthTextureView;
-		depthStencilAttachment.depthClearValue = 1.0f;
-		depthStencilAttachment.depthLoadOp = LoadOp::Clear;
-		depthStencilAttachment.depthStoreOp = StoreOp::Store;
-		depthStencilAttachment.depthReadOnly = false;
-		depthStencilAttachment.stencilClearValue = 0;
+			RenderPassDescriptor renderPassDesc{};
+
+			RenderPassColorAttachment renderPassColorAttachment{};
+			renderPassColorAttachment.view = nextTexture;
+			renderPassColorAttachment.resolveTarget = nullptr;
+			renderPassColorAttachment.loadOp = LoadOp::Clear;
+			renderPassColorAttachment.storeOp = StoreOp::Store;
+			renderPassColorAttachment.clearValue = Color{ 0.05, 0.05, 0.05, 1.0 };
+			renderPassDesc.colorAttachmentCount = 1;
+			renderPassDesc.colorAttachments = &renderPassColorAttachment;
+
+			RenderPassDepthStencilAttachment depthStencilAttachment;
+			depthStencilAttachment.view = depthTextureView;
+			depthStencilAttachment.depthClearValue = 1.0f;
+			depthStencilAttachment.depthLoadOp = LoadOp::Clear;
+			depthStencilAttachment.depthStoreOp = StoreOp::Store;
+			depthStencilAttachment.depthReadOnly = false;
+			depthStencilAttachment.stencilClearValue = 0;
 #ifdef WEBGPU_BACKEND_WGPU
-		depthStencilAttachment.stencilLoadOp = LoadOp::Clear;
-		depthStencilAttachment.stencilStoreOp = StoreOp::Store;
+			depthStencilAttachment.stencilLoadOp = LoadOp::Clear;
+			depthStencilAttachment.stencilStoreOp = StoreOp::Store;
 #else
-		depthStencilAttachment.stencilLoadOp = LoadOp::Undefined;
-		depthStencilAttachment.stencilStoreOp = StoreOp::Undefined;
+			depthStencilAttachment.stencilLoadOp = LoadOp::Undefined;
+			depthStencilAttachment.stencilStoreOp = StoreOp::Undefined;
 #endif
-		depthStencilAttachment.stencilReadOnly = true;
-
-		renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
-
-		renderPassDesc.timestampWriteCount = 0;
-		renderPassDesc.timestampWrites = nullptr;
-		RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
-
-		renderPass.setPipeline(pipeline);
-
-		renderPass.setVertexBuffer(0, vertexBuffer, 0, vertexData.size() * sizeof(VertexAttributes));
-
-		// Set binding group
-		renderPass.setBindGroup(0, bindGroup, 0, nullptr);
-
-		renderPass.draw(indexCount, 1, 0, 0);
-
-		renderPass.end();
+			depthStencilAttachment.stencilReadOnly = true;
+
+			renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
+
+			// The copies are culled before the render pass draws the visible
+			// ones, with one indirect draw per range of each bucket
+			if (gpuCulling.enabled()) {
+				indirectDraws.clear();
+				for (size_t group = 0; group < bindGroups.size(); ++group) {
+					for (uint32_t bucket = 0; bucket < GpuCulling::kDistanceBuckets; ++bucket) {
+						for (const MeshChunk& range : visibleRanges[bucket][group]) {
+							indirectDraws.push_back({ range.indexCount, 0, range.firstIndex, range.baseVertex, bucket });
+						}
+					}
+				}
+				gpuCulling.cull(queue, encoder, extractFrustum(uniforms.projectionMatrix * uniforms.viewMatrix), eye, indirectDraws);
+			}
+
+			gpuTimer.beginFrame();
+			renderPassDesc.timestampWriteCount = gpuTimer.timestampWriteCount();
+			renderPassDesc.timestampWrites = gpuTimer.renderPassTimestampWrites(0);
+			RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
+
+			renderPass.setPipeline(pipeline);
+
+			renderPass.setVertexBuffer(0, gpuMesh.vertexBuffer, 0, gpuMesh.vertexBufferSize);
+			if (gpuCulling.enabled()) {
+				renderPass.setVertexBuffer(1, gpuCulling.visibleInstances(), 0, gpuCulling.visibleInstancesSize());
+			} else if (visibleInstanceBuffer) {
+				renderPass.setVertexBuffer(1, visibleInstanceBuffer, 0, instanceBufferDesc.size);
+			} else if (instanceBuffer) {
+				renderPass.setVertexBuffer(1, instanceBuffer, 0, instanceBufferDesc.size);
+			}
+			renderPass.setIndexBuffer(gpuMesh.indexBuffer, gpuMesh.indexFormat, 0, gpuMesh.indexBufferSize);
+
+			// Set binding group, once per texture that has something to draw,
+			// then draw every copy of a bucket with each of its ranges at
+			// once. The visible instances are sorted by bucket. Without
+			// instancing, the bind group is set again for each copy, whose
+			// uniforms the dynamic offset selects.
+			size_t indirectDraw = 0;
+			for (size_t group = 0; group < bindGroups.size(); ++group) {
+				const bool hasRanges = std::any_of(visibleRanges.begin(), visibleRanges.end(), [&](const std::vector<std::vector<MeshChunk>>& bucketRanges) {
+					return !bucketRanges[group].empty();
+				});
+				if (!hasRanges) continue;
+				if (instancing) {
+					renderPass.setBindGroup(0, bindGroups[group], 0, nullptr);
+				}
+				for (uint32_t bucket = 0; bucket < GpuCulling::kDistanceBuckets; ++bucket) {
+					const uint32_t firstObject = firstBucketObject[bucket];
+					const uint32_t bucketObjectCount = firstBucketObject[bucket + 1] - firstObject;
+					if (!instancing) {
+						for (uint32_t i = firstObject; i < firstObject + bucketObjectCount; ++i) {
+							renderPass.setBindGroup(0, bindGroups[group], 1, &objectOffsets[bucketObjects[i]]);
+							for (const MeshChunk& range : visibleRanges[bucket][group]) {
+								renderPass.drawIndexed(range.indexCount, 1, range.firstIndex, range.baseVertex, 0);
+							}
+						}
+						continue;
+					}
+					for (const MeshChunk& range : visibleRanges[bucket][group]) {
+						if (gpuCulling.enabled()) {
+							renderPass.drawIndexedIndirect(gpuCulling.drawArgs(), GpuCulling::drawArgsOffset(indirectDraw++));
+						} else {
+							renderPass.drawIndexed(range.indexCount, bucketObjectCount, range.firstIndex, range.baseVertex, firstObject);
+						}
+					}
+				}
+			}
+
+			renderPass.end();
+			gpuTimer.resolve(encoder);
 		
-		nextTexture.release();
+			if (!headless) {
+				nextTexture.release();
+			}
 
-		CommandBufferDescriptor cmdBufferDescriptor{};
-		cmdBufferDescriptor.label = "Command buffer";
-		CommandBuffer command = encoder.finish(cmdBufferDescriptor);
-		queue.submit(command);
+			CommandBufferDescriptor cmdBufferDescriptor{};
+			cmdBufferDescriptor.label = "Command buffer";
+			command = encoder.finish(cmdBufferDescriptor);
+		}
+		{
+			PROFILE_ZONE("queue.submit");
+			queue.submit(command);
+		}
+		gpuTimer.afterSubmit();
 
-		swapChain.present();
+		if (!headless) {
+			PROFILE_ZONE("present");
+			swapChain.present();
+		}
+#ifdef WEBGPU_BACKEND_WGPU
+		// Let the device reclaim finished frames (nothing presents them
+		// offscreen) and call the callbacks of timestamp readbacks
+		wgpuDevicePoll(device, false, nullptr);
+#endif
+		if (frame % 300 == 299) {
+			const std::string gpuTimes = gpuTimer.report();
+			if (!gpuTimes.empty()) {
+				std::cout << "GPU time: " << gpuTimes << std::endl;
+			}
+		}
+		if (firstFrame) {
+			std::cout << "Time to first frame: " << millisecondsSinceStart(Clock::now()) << " ms" << std::endl;
+			firstFrame = false;
+		}
 
 #ifdef WEBGPU_BACKEND_DAWN
 		// Check for pending error callbacks
@@ -521,42 +1325,81 @@ int main (int, char**) {
 #endif
 	}
 
-	vertexBuffer.destroy();
-	vertexBuffer.release();
+	if (frame > 1) {
+		const double cpuTime = std::chrono::duration<double, std::milli>(Clock::now() - secondFrameStart).count();
+		std::cout << frame << " frames, " << cpuTime / (frame - 1) << " ms of CPU time per frame after the first" << std::endl;
+	}
+	gpuTimer.release();
+	uniformArena.release();
+	if (instanceBuffer) {
+		instanceBuffer.destroy();
+		instanceBuffer.release();
+	}
+	if (visibleInstanceBuffer) {
+		visibleInstanceBuffer.destroy();
+		visibleInstanceBuffer.release();
+	}
+	gpuCulling.release();
+	if (!capturePath.empty()) {
+		if (!captureFrame(offscreenTexture, 640, 480, device, queue, capturePath)) {
+			std::cerr << "Could not capture the last frame into " << capturePath << std::endl;
+			return 1;
+		}
+		std::cout << "Captured the last frame into " << capturePath.string() << std::endl;
+	}
+	if (!tracePath.empty()) {
+		if (!writeChromeTrace(tracePath)) {
+			std::cerr << "Could not write the trace into " << tracePath << std::endl;
+			return 1;
+		}
+		std::cout << "Wrote the trace of the last frames into " << tracePath.string() << std::endl;
+	}
+
+	gpuMesh.vertexBuffer.destroy();
+	gpuMesh.vertexBuffer.release();
+
+	gpuMesh.indexBuffer.destroy();
+	gpuMesh.indexBuffer.release();
 
-	texture.destroy();
-	texture.release();
+	for (BindGroup bindGroup : bindGroups) {
+		bindGroup.release();
+	}
+	for (TextureView textureView : textureViews) {
+		textureView.release();
+	}
+	for (Texture texture : textures) {
+		texture.destroy();
+		texture.release();
+	}
 
 	depthTextureView.release();
 	depthTexture.destroy();
 	depthTexture.release();
 
-	swapChain.release();
+	if (headless) {
+		offscreenView.release();
+		offscreenTexture.destroy();
+		offscreenTexture.release();
+	} else {
+		swapChain.release();
+	}
 	device.release();
 	adapter.release();
 	instance.release();
 
-	glfwDestroyWindow(window);
-	glfwTerminate();
+	if (window) {
+		glfwDestroyWindow(window);
+		glfwTerminate();
+	}
 
 	return 0;
 }
 
-ShaderModule loadShaderModule(const fs::path& path, Device device) {
-	std::ifstream file(path);
-	if (!file.is_open()) {
-		return nullptr;
-	}
-	file.seekg(0, std::ios::end);
-	size_t size = file.tellg();
-	std::string shaderSource(size, ' ');
-	file.seekg(0);
-	file.read(shaderSource.data(), size);
-
+ShaderModule createShaderModule(const std::string& source, Device device) {
 	ShaderModuleWGSLDescriptor shaderCodeDesc;
 	shaderCodeDesc.chain.next = nullptr;
 	shaderCodeDesc.chain.sType = SType::ShaderModuleWGSLDescriptor;
-	shaderCodeDesc.code = shaderSource.c_str();
+	shaderCodeDesc.code = source.c_str();
 	ShaderModuleDescriptor shaderDesc;
 	shaderDesc.nextInChain = &shaderCodeDesc.chain;
 #ifdef WEBGPU_BACKEND_WGPU
@@ -567,65 +1410,245 @@ ShaderModule loadShaderModule(const fs::path& path, Device device) {
 	return device.createShaderModule(shaderDesc);
 }
 
-bool loadGeometryFromObj(const fs::path& path, std::vector<VertexAttributes>& vertexData) {
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-
-	std::string warn;
-	std::string err;
-
-	// Call the core loading procedure of TinyOBJLoader
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path.string().c_str());
-
-	// Check errors
-	if (!warn.empty()) {
-		std::cout << warn << std::endl;
+GpuMesh uploadMesh(MeshAsset& asset, const VertexEncoding& vertexEncoding, Device device) {
+	GpuMesh gpu;
+	MeshCache& mesh = *asset.cache;
+	if (asset.loader) {
+		if (!asset.loader->warnings().empty()) {
+			std::cout << asset.loader->warnings() << std::endl;
+		}
+		std::cout << "Vertex cache: ACMR " << asset.report.before.acmr << " -> " << asset.report.after.acmr
+			<< ", ATVR " << asset.report.before.atvr << " -> " << asset.report.after.atvr << std::endl;
 	}
-
-	if (!err.empty()) {
-		std::cerr << err << std::endl;
+	size_t vertexCount = mesh.vertexCount();
+	if (asset.textLoader) {
+		vertexCount = asset.textLoader->vertexCount();
+	} else if (asset.loader) {
+		vertexCount = asset.loader->vertexCount();
 	}
+	const VertexLayout encodedLayout = vertexLayout(vertexEncoding);
 
-	if (!ret) {
-		return false;
+	// Create vertex buffer
+	// (mapped at creation, so that vertices are written in place)
+	BufferDescriptor bufferDesc;
+	bufferDesc.size = vertexCount * encodedLayout.stride;
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Vertex;
+	bufferDesc.mappedAtCreation = true;
+	gpu.vertexBuffer = device.createBuffer(bufferDesc);
+	void* mappedVertices = gpu.vertexBuffer.getMappedRange(0, bufferDesc.size);
+	// The cache holds vertices already encoded. Otherwise they are encoded
+	// a block at a time straight into the buffer, then cached from there.
+	bool ok = true;
+	if (asset.fromCache) {
+		std::memcpy(mappedVertices, mesh.vertexData(), bufferDesc.size);
+		gpu.vertexDecoding = mesh.vertexDecoding();
+	} else if (asset.textLoader) {
+		TextGeometryLoader& text = *asset.textLoader;
+		ok = text.writeVertices(mappedVertices, vertexEncoding, &gpu.vertexDecoding);
+		mesh.keep(vertexEncoding, gpu.vertexDecoding, vertexCount, text.indexCount(), text.use16BitIndices());
+	} else {
+		gpu.vertexDecoding = asset.loader->writeVertices(mappedVertices, vertexEncoding);
+		mesh.save(mappedVertices, vertexCount, gpu.vertexDecoding, std::move(asset.indices));
+		asset.loader.reset(); // free the parsing scratch
 	}
+	gpu.vertexBuffer.unmap();
+	if (encodedLayout.stride != sizeof(VertexAttributes)) {
+		std::cout << "Vertex encoding: " << encodedLayout.stride << " bytes per vertex, max error: position "
+			<< gpu.vertexDecoding.maxPositionError << ", normal " << gpu.vertexDecoding.maxNormalError << " deg, color "
+			<< gpu.vertexDecoding.maxColorError << ", uv " << gpu.vertexDecoding.maxUVError << std::endl;
+	}
+	gpu.vertexBufferSize = bufferDesc.size;
+
+	// Create index buffer
+	// (we map it at creation because writeBuffer needs a size that is a
+	// multiple of 4 bytes, which an odd number of 16 bit indices is not)
+	bufferDesc.size = (mesh.indexDataSize() + 3) & ~size_t(3);
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Index;
+	bufferDesc.mappedAtCreation = true;
+	gpu.indexBuffer = device.createBuffer(bufferDesc);
+	void* mappedIndices = gpu.indexBuffer.getMappedRange(0, bufferDesc.size);
+	if (asset.textLoader) {
+		TextGeometryLoader& text = *asset.textLoader;
+		ok = ok && (text.use16BitIndices()
+			? text.writeIndices(static_cast<uint16_t*>(mappedIndices))
+			: text.writeIndices(static_cast<uint32_t*>(mappedIndices)));
+		if (!ok) {
+			std::cerr << "Could not load " << asset.path << ": " << text.error() << std::endl;
+		}
+		asset.textLoader.reset(); // unmap the file
+	} else {
+		std::memcpy(mappedIndices, mesh.indexData(), mesh.indexDataSize());
+	}
+	gpu.indexBuffer.unmap();
+	gpu.indexBufferSize = bufferDesc.size;
+	gpu.indexFormat = mesh.use16BitIndices() ? IndexFormat::Uint16 : IndexFormat::Uint32;
+
+	// Only text geometry is parsed here, and may turn out to be invalid
+	if (!ok) {
+		gpu.vertexBuffer.destroy();
+		gpu.vertexBuffer.release();
+		gpu.indexBuffer.destroy();
+		gpu.indexBuffer.release();
+		return GpuMesh{};
+	}
+	return gpu;
+}
 
-	// Filling in vertexData:
-	vertexData.clear();
-	for (const auto& shape : shapes) {
-		size_t offset = vertexData.size();
-		vertexData.resize(offset + shape.mesh.indices.size());
-
-		for (size_t i = 0; i < shape.mesh.indices.size(); ++i) {
-			const tinyobj::index_t& idx = shape.mesh.indices[i];
+Texture createMipmappedTexture(const EncodedTexture& encoded, uint32_t maxDimension, Device device, Queue queue, uint32_t* mipLevelCount, TextureFormat* format) {
+	// Skip the levels the device cannot hold
+	size_t firstLevel = 0;
+	while (firstLevel + 1 < encoded.levels.size() && std::max(encoded.levelWidth(firstLevel), encoded.levelHeight(firstLevel)) > maxDimension) {
+		++firstLevel;
+	}
 
-			vertexData[offset + i].position = {
-				attrib.vertices[3 * idx.vertex_index + 0],
-				-attrib.vertices[3 * idx.vertex_index + 2],
-				attrib.vertices[3 * idx.vertex_index + 1]
-			};
+	switch (encoded.format) {
+	case BlockFormat::BC1: *format = TextureFormat::BC1RGBAUnorm; break;
+	case BlockFormat::BC3: *format = TextureFormat::BC3RGBAUnorm; break;
+	case BlockFormat::BC7: *format = TextureFormat::BC7RGBAUnorm; break;
+	default: *format = TextureFormat::RGBA8Unorm; break;
+	}
+	const bool compressed = encoded.format != BlockFormat::RGBA8;
 
-			vertexData[offset + i].normal = {
-				attrib.normals[3 * idx.normal_index + 0],
-				-attrib.normals[3 * idx.normal_index + 2],
-				attrib.normals[3 * idx.normal_index + 1]
-			};
+	TextureDescriptor textureDesc;
+	textureDesc.dimension = TextureDimension::_2D;
+	textureDesc.size = { encoded.levelWidth(firstLevel), encoded.levelHeight(firstLevel), 1 };
+	textureDesc.mipLevelCount = static_cast<uint32_t>(encoded.levels.size() - firstLevel);
+	*mipLevelCount = textureDesc.mipLevelCount;
+	textureDesc.sampleCount = 1;
+	textureDesc.format = *format;
+	textureDesc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
+	textureDesc.viewFormatCount = 0;
+	textureDesc.viewFormats = nullptr;
+	Texture texture = device.createTexture(textureDesc);
 
-			vertexData[offset + i].color = {
-				attrib.colors[3 * idx.vertex_index + 0],
-				attrib.colors[3 * idx.vertex_index + 1],
-				attrib.colors[3 * idx.vertex_index + 2]
-			};
+	// Upload texture data, every mip level
+	ImageCopyTexture destination;
+	destination.texture = texture;
+	destination.origin = { 0, 0, 0 };
+	destination.aspect = TextureAspect::All;
+	TextureDataLayout source;
+	source.offset = 0;
+	for (size_t level = firstLevel; level < encoded.levels.size(); ++level) {
+		const std::vector<uint8_t>& data = encoded.levels[level];
+		destination.mipLevel = static_cast<uint32_t>(level - firstLevel);
+		source.bytesPerRow = encoded.bytesPerRow(level);
+		source.rowsPerImage = encoded.rowCount(level);
+		// Compressed levels smaller than a block are copied as a whole block
+		Extent3D size = { encoded.levelWidth(level), encoded.levelHeight(level), 1 };
+		if (compressed) {
+			size.width = (size.width + 3) & ~3u;
+			size.height = (size.height + 3) & ~3u;
+		}
+		queue.writeTexture(destination, data.data(), data.size(), source, size);
+	}
+	return texture;
+}
 
-			vertexData[offset + i].uv = {
-				attrib.texcoords[2 * idx.texcoord_index + 0],
-				1 - attrib.texcoords[2 * idx.texcoord_index + 1]
-			};
+float meshRadius(const MeshCache& mesh) {
+	// Measured on the vertices when they were encoded, otherwise from the
+	// bounding spheres of the shapes
+	float radius = mesh.vertexDecoding().radius;
+	if (radius == 0.0f) {
+		for (const MeshShape& shape : mesh.shapes()) {
+			radius = std::max(radius, glm::length(shape.center) + shape.radius);
 		}
 	}
+	return radius > 0.0f ? radius : 1.0f;
+}
 
-	return true;
+void placeObjects(std::vector<InstanceAttributes>& objects, float meshRadius) {
+	// A single object is drawn as modeled. Copies are scaled down on a
+	// square grid centered on the origin, each with its own tint.
+	if (objects.size() == 1) {
+		objects[0].modelMatrix = mat4x4(1.0f);
+		objects[0].color = { 1.0f, 1.0f, 1.0f, 1.0f };
+		return;
+	}
+	const uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(objects.size()))));
+	const float cell = 2.0f * meshRadius / side;
+	const float scale = 0.8f / side;
+	for (size_t i = 0; i < objects.size(); ++i) {
+		const vec3 position(
+			(static_cast<float>(i % side) - 0.5f * (side - 1)) * cell,
+			(static_cast<float>(i / side) - 0.5f * (side - 1)) * cell,
+			0.0f
+		);
+		objects[i].modelMatrix = glm::scale(glm::translate(mat4x4(1.0f), position), vec3(scale));
+		const float hue = 2 * PI * static_cast<float>(i) / objects.size();
+		objects[i].color = {
+			0.6f + 0.4f * std::cos(hue),
+			0.6f + 0.4f * std::cos(hue - 2 * PI / 3),
+			0.6f + 0.4f * std::cos(hue + 2 * PI / 3),
+			1.0f
+		};
+	}
 }
 
+bool captureFrame(Texture texture, uint32_t width, uint32_t height, Device device, Queue queue, const fs::path& path) {
+	// Copy the RGBA8 texture into a buffer that the CPU can map (rows of
+	// such copies are aligned to 256 bytes)
+	const uint32_t bytesPerRow = (4 * width + 255) & ~255u;
+	BufferDescriptor bufferDesc;
+	bufferDesc.size = uint64_t(bytesPerRow) * height;
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::MapRead;
+	bufferDesc.mappedAtCreation = false;
+	Buffer readback = device.createBuffer(bufferDesc);
+
+	CommandEncoderDescriptor encoderDesc;
+	encoderDesc.label = "Capture encoder";
+	CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+	ImageCopyTexture source;
+	source.texture = texture;
+	source.mipLevel = 0;
+	source.origin = { 0, 0, 0 };
+	source.aspect = TextureAspect::All;
+	ImageCopyBuffer destination;
+	destination.buffer = readback;
+	destination.layout.offset = 0;
+	destination.layout.bytesPerRow = bytesPerRow;
+	destination.layout.rowsPerImage = height;
+	encoder.copyTextureToBuffer(source, destination, { width, height, 1 });
+	CommandBufferDescriptor cmdBufferDescriptor{};
+	cmdBufferDescriptor.label = "Capture command buffer";
+	CommandBuffer command = encoder.finish(cmdBufferDescriptor);
+	encoder.release();
+	queue.submit(command);
+	command.release();
+
+	// Wait for the copy, and so for every frame before it
+	bool done = false;
+	bool mapped = false;
+	auto callback = readback.mapAsync(MapMode::Read, 0, bufferDesc.size, [&](BufferMapAsyncStatus status) {
+		done = true;
+		mapped = status == BufferMapAsyncStatus::Success;
+	});
+	while (!done) {
+#ifdef WEBGPU_BACKEND_WGPU
+		wgpuDevicePoll(device, true, nullptr);
+#else
+		device.tick();
+#endif
+	}
 
+	bool ok = mapped;
+	if (mapped) {
+		const uint8_t* pixels = static_cast<const uint8_t*>(readback.getConstMappedRange(0, bufferDesc.size));
+		std::ofstream file(path, std::ios::binary);
+		file << "P6\n" << width << " " << height << "\n255\n";
+		std::vector<char> row(3 * width);
+		for (uint32_t y = 0; y < height; ++y) {
+			const uint8_t* rgba = pixels + size_t(y) * bytesPerRow;
+			for (uint32_t x = 0; x < width; ++x) {
+				row[3 * x + 0] = static_cast<char>(rgba[4 * x + 0]);
+				row[3 * x + 1] = static_cast<char>(rgba[4 * x + 1]);
+				row[3 * x + 2] = static_cast<char>(rgba[4 * x + 2]);
+			}
+			file.write(row.data(), row.size());
+		}
+		ok = static_cast<bool>(file);
+		readback.unmap();
+	}
+	readback.destroy();
+	readback.release();
+	return ok;
+}
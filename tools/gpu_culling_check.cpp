@@ -0,0 +1,321 @@
+/**
+ * Checks the frustum culling of GpuCulling against the CPU reference
+ * (isSphereVisible), on the software adapter when there is one, so that it
+ * runs on hosts without a GPU.
+ *
+ * Random bounding spheres are culled against several cameras. For each, the
+ * visible instances and the indirect draw arguments are read back, then
+ * compared with the spheres that the CPU finds visible, and with the
+ * distance bucket that the CPU finds for them. Spheres that touch a plane
+ * or the edge of a bucket within rounding may go either way, they are only
+ * counted.
+ *
+ * Usage: gpu_culling_check [--instances <n>] [--seed <n>]
+ * Returns 0 when every camera matches.
+ */
+
+#include "GpuCulling.h"
+#include "Meshlets.h"
+
+#include <webgpu/webgpu.hpp>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace wgpu;
+
+namespace {
+
+// The instance payload: its index, and its complement to catch torn copies
+struct CheckInstance {
+	uint32_t index;
+	uint32_t check;
+	uint32_t _pad[2];
+};
+
+static_assert(sizeof(CheckInstance) == 16);
+
+void wait(Device device, const bool& done) {
+	while (!done) {
+#ifdef WEBGPU_BACKEND_WGPU
+		wgpuDevicePoll(device, true, nullptr);
+#else
+		device.tick();
+#endif
+	}
+}
+
+/**
+ * Copies `size` bytes of `source` into `destination`, through a mappable
+ * buffer. The copy is submitted after every command before it.
+ */
+bool readBuffer(Device device, Queue queue, Buffer source, uint64_t size, void* destination) {
+	BufferDescriptor bufferDesc;
+	bufferDesc.label = "Readback buffer";
+	bufferDesc.size = size;
+	bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::MapRead;
+	bufferDesc.mappedAtCreation = false;
+	Buffer readback = device.createBuffer(bufferDesc);
+
+	CommandEncoderDescriptor encoderDesc;
+	encoderDesc.label = "Readback encoder";
+	CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+	encoder.copyBufferToBuffer(source, 0, readback, 0, size);
+	CommandBufferDescriptor cmdBufferDescriptor{};
+	cmdBufferDescriptor.label = "Readback command buffer";
+	CommandBuffer command = encoder.finish(cmdBufferDescriptor);
+	encoder.release();
+	queue.submit(command);
+	command.release();
+
+	bool done = false;
+	bool mapped = false;
+	auto callback = readback.mapAsync(MapMode::Read, 0, size, [&](BufferMapAsyncStatus status) {
+		done = true;
+		mapped = status == BufferMapAsyncStatus::Success;
+	});
+	wait(device, done);
+	if (mapped) {
+		const uint8_t* data = static_cast<const uint8_t*>(readback.getConstMappedRange(0, size));
+		std::copy(data, data + size, static_cast<uint8_t*>(destination));
+		readback.unmap();
+	}
+	readback.destroy();
+	readback.release();
+	return mapped;
+}
+
+/**
+ * Smallest distance of the sphere's boundary to a plane it is not inside
+ * of, i.e. how far it is from changing visibility.
+ */
+float boundaryDistance(const Frustum& frustum, const glm::vec4& sphere) {
+	float distance = INFINITY;
+	for (const glm::vec4& plane : frustum.planes) {
+		distance = std::min(distance, std::abs(glm::dot(glm::vec3(plane), glm::vec3(sphere)) + plane.w + sphere.w));
+	}
+	return distance;
+}
+
+/**
+ * Whether the gap between the camera and the sphere is within rounding of
+ * a power of 2 radii, where it changes distance bucket.
+ */
+bool onBucketEdge(const glm::vec4& sphere, const glm::vec3& eye) {
+	const float gap = (glm::length(glm::vec3(sphere) - eye) - sphere.w) / sphere.w;
+	return gap > 0.0f && std::abs(gap - std::exp2(std::round(std::log2(gap)))) <= 1e-4f * gap;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	uint32_t instanceCount = 100000;
+	uint32_t seed = 1;
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if (arg == "--instances" && i + 1 < argc) {
+			instanceCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		} else if (arg == "--seed" && i + 1 < argc) {
+			seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		} else {
+			std::cerr << "Usage: " << argv[0] << " [--instances n] [--seed n]" << std::endl;
+			return 1;
+		}
+	}
+	instanceCount = std::clamp<uint32_t>(instanceCount, 1, GpuCulling::kMaxInstances);
+
+	Instance instance = createInstance(InstanceDescriptor{});
+	if (!instance) {
+		std::cerr << "Could not initialize WebGPU!" << std::endl;
+		return 1;
+	}
+	RequestAdapterOptions adapterOpts{};
+	adapterOpts.compatibleSurface = nullptr;
+	adapterOpts.forceFallbackAdapter = true;
+	Adapter adapter = instance.requestAdapter(adapterOpts);
+	if (!adapter) {
+		adapterOpts.forceFallbackAdapter = false;
+		adapter = instance.requestAdapter(adapterOpts);
+	}
+	if (!adapter) {
+		std::cerr << "Could not get an adapter!" << std::endl;
+		return 1;
+	}
+	std::cout << "Adapter: " << (adapterOpts.forceFallbackAdapter ? "fallback" : "default") << std::endl;
+
+	// The default limits are enough
+	DeviceDescriptor deviceDesc;
+	deviceDesc.label = "Culling check device";
+	deviceDesc.requiredFeaturesCount = 0;
+	deviceDesc.requiredLimits = nullptr;
+	deviceDesc.defaultQueue.label = "The default queue";
+	Device device = adapter.requestDevice(deviceDesc);
+	if (!device) {
+		std::cerr << "Could not get a device!" << std::endl;
+		return 1;
+	}
+	uint32_t deviceErrors = 0;
+	auto h = device.setUncapturedErrorCallback([&](ErrorType type, char const* message) {
+		std::cerr << "Device error: type " << type;
+		if (message) std::cerr << " (message: " << message << ")";
+		std::cerr << std::endl;
+		++deviceErrors;
+	});
+	Queue queue = device.getQueue();
+
+	GpuCulling culling;
+	if (!culling.init(device, sizeof(CheckInstance), instanceCount)) {
+		std::cerr << "Could not create the culling pipelines" << std::endl;
+		return 1;
+	}
+
+	// Spheres of all sizes in a box around the origin, some much larger
+	// than the near plane is close
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::vector<glm::vec4> spheres(instanceCount);
+	std::vector<CheckInstance> instances(instanceCount);
+	for (uint32_t i = 0; i < instanceCount; ++i) {
+		spheres[i] = glm::vec4(position(random), position(random), position(random), 0.05f + 4.0f * unit(random) * unit(random));
+		instances[i] = { i, ~i, { 0, 0 } };
+	}
+	culling.setInstances(queue, instances.data(), spheres.data(), instanceCount);
+
+	// Draws of every bucket, whose other arguments must come through
+	// untouched
+	std::vector<GpuCulling::DrawIndexedArgs> draws;
+	for (uint32_t bucket = 0; bucket < GpuCulling::kDistanceBuckets; ++bucket) {
+		draws.push_back({ 36, 0, 0, 0, bucket });
+		draws.push_back({ 300, 0, 36, 24, bucket });
+		draws.push_back({ 6, 0, 336, -4, bucket });
+	}
+
+	struct Camera {
+		glm::vec3 eye;
+		glm::vec3 target;
+		float fovy;
+		float far;
+	};
+	const Camera cameras[] = {
+		{ glm::vec3(0.0f, -80.0f, 0.0f), glm::vec3(0.0f), 45.0f, 200.0f },
+		{ glm::vec3(0.0f), glm::vec3(1.0f, 0.3f, 0.2f), 60.0f, 40.0f },
+		{ glm::vec3(-30.0f, -30.0f, 40.0f), glm::vec3(10.0f, 5.0f, -3.0f), 30.0f, 100.0f },
+		{ glm::vec3(500.0f, 0.0f, 0.0f), glm::vec3(600.0f, 0.0f, 0.0f), 45.0f, 100.0f }, // looking away
+	};
+
+	bool ok = true;
+	std::vector<CheckInstance> visible(instanceCount);
+	std::vector<GpuCulling::DrawIndexedArgs> args(draws.size());
+	for (const Camera& camera : cameras) {
+		const glm::mat4 view = glm::lookAt(camera.eye, camera.target, glm::vec3(0, 0, 1));
+		const glm::mat4 projection = glm::perspective(glm::radians(camera.fovy), 4.0f / 3.0f, 0.1f, camera.far);
+		const Frustum frustum = extractFrustum(projection * view);
+
+		using Clock = std::chrono::steady_clock;
+		const Clock::time_point start = Clock::now();
+		CommandEncoderDescriptor encoderDesc;
+		encoderDesc.label = "Culling encoder";
+		CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+		culling.cull(queue, encoder, frustum, camera.eye, draws);
+		CommandBufferDescriptor cmdBufferDescriptor{};
+		cmdBufferDescriptor.label = "Culling command buffer";
+		CommandBuffer command = encoder.finish(cmdBufferDescriptor);
+		encoder.release();
+		queue.submit(command);
+		command.release();
+
+		if (!readBuffer(device, queue, culling.drawArgs(), args.size() * sizeof(GpuCulling::DrawIndexedArgs), args.data())
+			|| !readBuffer(device, queue, culling.visibleInstances(), uint64_t(instanceCount) * sizeof(CheckInstance), visible.data())) {
+			std::cerr << "Could not read back the culling results" << std::endl;
+			return 1;
+		}
+		const double milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+		// Every draw keeps its arguments and gets the instances of its
+		// bucket, which follow those of the previous buckets
+		std::vector<uint32_t> bucketCounts(GpuCulling::kDistanceBuckets);
+		std::vector<uint32_t> firstInstances(GpuCulling::kDistanceBuckets + 1, 0);
+		for (uint32_t bucket = 0; bucket < GpuCulling::kDistanceBuckets; ++bucket) {
+			bucketCounts[bucket] = args[3 * bucket].instanceCount;
+			firstInstances[bucket + 1] = firstInstances[bucket] + bucketCounts[bucket];
+		}
+		const uint32_t visibleCount = firstInstances.back();
+		bool argsOk = visibleCount <= instanceCount;
+		for (size_t i = 0; i < draws.size(); ++i) {
+			const uint32_t bucket = draws[i].firstInstance;
+			argsOk = argsOk
+				&& args[i].indexCount == draws[i].indexCount
+				&& args[i].instanceCount == bucketCounts[bucket]
+				&& args[i].firstIndex == draws[i].firstIndex
+				&& args[i].baseVertex == draws[i].baseVertex
+				&& args[i].firstInstance == firstInstances[bucket];
+		}
+
+		// Each visible instance exactly once, in the bucket of its distance
+		// but for spheres on the edge of one
+		std::vector<uint8_t> seen(instanceCount, 0);
+		uint32_t corrupt = 0, duplicates = 0, misplaced = 0, missed = 0, extra = 0, ambiguous = 0, expected = 0;
+		for (uint32_t bucket = 0; argsOk && bucket < GpuCulling::kDistanceBuckets; ++bucket) {
+			for (uint32_t i = firstInstances[bucket]; i < firstInstances[bucket + 1]; ++i) {
+				const CheckInstance& copy = visible[i];
+				if (copy.index >= instanceCount || copy.check != ~copy.index) {
+					++corrupt;
+				} else if (seen[copy.index]++) {
+					++duplicates;
+				} else if (GpuCulling::distanceBucket(spheres[copy.index], camera.eye) != bucket) {
+					if (onBucketEdge(spheres[copy.index], camera.eye)) {
+						++ambiguous;
+					} else {
+						++misplaced;
+					}
+				}
+			}
+		}
+		for (uint32_t i = 0; argsOk && i < instanceCount; ++i) {
+			const glm::vec4& sphere = spheres[i];
+			const bool reference = isSphereVisible(frustum, glm::vec3(sphere), sphere.w);
+			expected += reference ? 1 : 0;
+			if (reference == (seen[i] != 0)) continue;
+			if (boundaryDistance(frustum, sphere) <= 1e-4f * (glm::length(glm::vec3(sphere)) + sphere.w + 1.0f)) {
+				++ambiguous;
+			} else if (reference) {
+				++missed;
+			} else {
+				++extra;
+			}
+		}
+
+		const bool cameraOk = argsOk && corrupt == 0 && duplicates == 0 && misplaced == 0 && missed == 0 && extra == 0;
+		ok = ok && cameraOk;
+		std::cout << (cameraOk ? "ok   " : "FAIL ") << visibleCount << " / " << instanceCount << " visible (CPU " << expected << ")";
+		if (!argsOk) std::cout << ", wrong draw arguments";
+		if (corrupt) std::cout << ", " << corrupt << " corrupt";
+		if (duplicates) std::cout << ", " << duplicates << " duplicates";
+		if (misplaced) std::cout << ", " << misplaced << " in the wrong bucket";
+		if (missed) std::cout << ", " << missed << " missed";
+		if (extra) std::cout << ", " << extra << " extra";
+		if (ambiguous) std::cout << ", " << ambiguous << " on a plane or bucket edge";
+		std::cout << ", " << milliseconds << " ms with readback" << std::endl;
+	}
+
+	culling.release();
+	queue.release();
+	device.release();
+	adapter.release();
+	instance.release();
+
+	ok = ok && deviceErrors == 0;
+	std::cout << (ok ? "GPU culling matches the CPU reference" : "GPU culling differs from the CPU reference") << std::endl;
+	return ok ? 0 : 1;
+}
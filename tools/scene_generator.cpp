@@ -0,0 +1,570 @@
+/**
+ * Generates a deterministic OBJ/MTL scene from a seed, to stress test the
+ * loaders and the renderer at production scale (millions of triangles)
+ * when resources/ only has small samples.
+ *
+ * The scene is a bumpy terrain of square cells with normals and uvs, cut
+ * into tiles that are each one group. Every cell is a quad, a pair of
+ * triangles or, for the requested ratio, a convex polygon of 5 to 8
+ * corners (the cell with its edges pushed out). The triangle count, after
+ * triangulation, is exact.
+ *
+ * The same options and seed give the same bytes on every platform: all
+ * the geometry is computed in fixed point, and random values come from a
+ * hash of the seed and the cell rather than from a sequence, so nothing
+ * depends on the standard library's distributions or on libm.
+ *
+ * Usage: scene_generator [options] <output.obj>
+ *   --seed <n>              seed of the scene (default 1)
+ *   --triangles <n>         triangles after triangulation, with an optional
+ *                           k, M or G suffix (default 1M)
+ *   --ngon-ratio <r>        fraction of cells that are polygons of 5 to 8
+ *                           corners, in [0, 1] (default 0.1)
+ *   --groups <n>            number of groups (default 16)
+ *   --materials <n>         number of materials, 0 for no MTL (default 8)
+ *   --vertex-colors         write an RGB color after each position
+ *   --negative-indices <r>  fraction of faces whose corners are relative
+ *                           (negative) indices, in [0, 1] (default 0)
+ *
+ * The MTL is written next to the OBJ, with the same name.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Fixed point positions, uvs and normals, printed with 6 decimals
+constexpr int64_t kOne = 1000000;
+// The terrain fits in [-1, 1] on x and z
+constexpr int64_t kExtent = 2 * kOne;
+constexpr int64_t kHeightAmplitude = 80000;
+constexpr int64_t kDetailAmplitude = 6000;
+constexpr int64_t kDetailPeriod = 8; // cells
+
+struct Settings {
+	uint64_t seed = 1;
+	uint64_t triangles = 1000000;
+	double ngonRatio = 0.1;
+	uint64_t groups = 16;
+	uint64_t materials = 8;
+	bool vertexColors = false;
+	double negativeIndices = 0.0;
+	fs::path output;
+};
+
+uint64_t splitmix(uint64_t x) {
+	x += 0x9e3779b97f4a7c15ull;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+/**
+ * Random value of a tuple, the same wherever and in whatever order it is
+ * asked for.
+ */
+uint64_t hash(uint64_t seed, uint64_t a, uint64_t b = 0, uint64_t c = 0, uint64_t d = 0) {
+	uint64_t h = splitmix(seed);
+	h = splitmix(h ^ a);
+	h = splitmix(h ^ b);
+	h = splitmix(h ^ c);
+	return splitmix(h ^ d);
+}
+
+/**
+ * Whether a random value falls in a fraction `ratio` of the range.
+ */
+bool below(uint64_t random, double ratio) {
+	if (ratio <= 0.0) return false;
+	if (ratio >= 1.0) return true;
+	return (random >> 32) < static_cast<uint64_t>(ratio * 4294967296.0);
+}
+
+int64_t isqrt(int64_t n) {
+	int64_t r = static_cast<int64_t>(std::sqrt(static_cast<double>(n)));
+	while (r > 0 && r * r > n) --r;
+	while ((r + 1) * (r + 1) <= n) ++r;
+	return r;
+}
+
+/**
+ * Buffered writer of OBJ text, with the number formatting done by hand
+ * for speed and so that the output does not depend on the locale.
+ */
+class Writer {
+public:
+	explicit Writer(FILE* file) : m_file(file) { m_buffer.resize(1 << 20); }
+	~Writer() { flush(); }
+
+	void put(char c) {
+		if (m_size == m_buffer.size()) flush();
+		m_buffer[m_size++] = c;
+	}
+
+	void put(const char* text) {
+		while (*text) put(*text++);
+	}
+
+	void putInt(int64_t value) {
+		char digits[24];
+		int count = 0;
+		uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+		do {
+			digits[count++] = static_cast<char>('0' + magnitude % 10);
+			magnitude /= 10;
+		} while (magnitude != 0);
+		if (value < 0) put('-');
+		while (count > 0) put(digits[--count]);
+	}
+
+	/**
+	 * Writes value / 10^decimals.
+	 */
+	void putFixed(int64_t value, int decimals) {
+		int64_t scale = 1;
+		for (int i = 0; i < decimals; ++i) scale *= 10;
+		if (value < 0) {
+			put('-');
+			value = -value;
+		}
+		putInt(value / scale);
+		put('.');
+		int64_t fraction = value % scale;
+		for (int64_t digit = scale / 10; digit > 0; digit /= 10) {
+			put(static_cast<char>('0' + fraction / digit));
+			fraction %= digit;
+		}
+	}
+
+	void flush() {
+		if (m_size > 0) {
+			m_ok = std::fwrite(m_buffer.data(), 1, m_size, m_file) == m_size && m_ok;
+			m_bytes += m_size;
+			m_size = 0;
+		}
+	}
+
+	bool ok() const { return m_ok; }
+	uint64_t bytes() const { return m_bytes + m_size; }
+
+private:
+	FILE* m_file;
+	std::vector<char> m_buffer;
+	size_t m_size = 0;
+	uint64_t m_bytes = 0;
+	bool m_ok = true;
+};
+
+struct Point {
+	int64_t x, y, z;
+};
+
+class SceneGenerator {
+public:
+	explicit SceneGenerator(const Settings& settings, Writer& writer)
+		: m_settings(settings)
+		, m_out(writer)
+	{
+		// Expected triangles per cell, to size the tiles: quads and pairs
+		// of triangles give 2, polygons of 5 to 8 corners 4.5 on average
+		const double perCell = 2.0 + 2.5 * std::min(1.0, std::max(0.0, settings.ngonRatio));
+		const uint64_t largestGroup = (settings.triangles + settings.groups - 1) / settings.groups;
+		m_side = std::max<int64_t>(1, static_cast<int64_t>(std::ceil(std::sqrt(largestGroup / perCell))));
+		m_tilesPerRow = std::max<int64_t>(1, static_cast<int64_t>(std::ceil(std::sqrt(static_cast<double>(settings.groups)))));
+		const int64_t cells = m_tilesPerRow * (m_side + 1);
+		m_cell = std::max<int64_t>(1, kExtent / cells);
+		m_origin = -(cells * m_cell) / 2;
+		m_period = std::min<int64_t>(4096, std::max<int64_t>(kDetailPeriod, cells / 6));
+	}
+
+	void run(const std::string& mtlName) {
+		if (m_settings.materials > 0) {
+			m_out.put("mtllib ");
+			m_out.put(mtlName.c_str());
+			m_out.put('\n');
+		}
+		for (uint64_t g = 0; g < m_settings.groups; ++g) {
+			const uint64_t budget = m_settings.triangles / m_settings.groups + (g < m_settings.triangles % m_settings.groups ? 1 : 0);
+			if (budget > 0) {
+				writeGroup(g, budget);
+			}
+		}
+	}
+
+	uint64_t vertexCount() const { return m_vertexCount; }
+	uint64_t faceCount() const { return m_faceCount; }
+	uint64_t polygonCount() const { return m_polygonCount; }
+	uint64_t triangleCount() const { return m_triangleCount; }
+	uint64_t negativeFaceCount() const { return m_negativeFaceCount; }
+
+private:
+	// Terrain height at a grid point, in global cell coordinates: a coarse
+	// and a fine octave of value noise
+	int64_t height(int64_t gx, int64_t gz) const {
+		return noise(gx, gz, m_period, kHeightAmplitude, 1) + noise(gx, gz, kDetailPeriod, kDetailAmplitude, 2);
+	}
+
+	int64_t noise(int64_t gx, int64_t gz, int64_t period, int64_t amplitude, uint64_t octave) const {
+		// Floor division, the normals look one point past the grid
+		auto floorDiv = [&](int64_t v) { return (v >= 0 ? v : v - period + 1) / period; };
+		const int64_t lx = floorDiv(gx), lz = floorDiv(gz);
+		const int64_t tx = gx - lx * period, tz = gz - lz * period;
+		auto lattice = [&](int64_t x, int64_t z) {
+			return static_cast<int64_t>(hash(m_settings.seed, octave, x, z) % (2 * amplitude + 1)) - amplitude;
+		};
+		// Smoothstep, scaled by period^3
+		auto smooth = [&](int64_t t) { return t * t * (3 * period - 2 * t); };
+		const int64_t cube = period * period * period;
+		const int64_t sx = smooth(tx), sz = smooth(tz);
+		const int64_t h00 = lattice(lx, lz), h10 = lattice(lx + 1, lz);
+		const int64_t h01 = lattice(lx, lz + 1), h11 = lattice(lx + 1, lz + 1);
+		const int64_t h0 = h00 + (h10 - h00) * sx / cube;
+		const int64_t h1 = h01 + (h11 - h01) * sx / cube;
+		return h0 + (h1 - h0) * sz / cube;
+	}
+
+	Point position(int64_t gx, int64_t gz) const {
+		return { m_origin + gx * m_cell, height(gx, gz), m_origin + gz * m_cell };
+	}
+
+	Point normal(int64_t gx, int64_t gz) const {
+		const int64_t x = height(gx - 1, gz) - height(gx + 1, gz);
+		const int64_t y = 2 * m_cell;
+		const int64_t z = height(gx, gz - 1) - height(gx, gz + 1);
+		const int64_t length = std::max<int64_t>(1, isqrt(x * x + y * y + z * z));
+		return { x * kOne / length, y * kOne / length, z * kOne / length };
+	}
+
+	void writeVertex(const Point& p, const Point& n, int64_t tileX, int64_t tileZ, uint64_t colorKey) {
+		m_out.put("v ");
+		m_out.putFixed(p.x, 6);
+		m_out.put(' ');
+		m_out.putFixed(p.y, 6);
+		m_out.put(' ');
+		m_out.putFixed(p.z, 6);
+		if (m_settings.vertexColors) {
+			const uint64_t random = hash(m_settings.seed, 3, colorKey);
+			for (int c = 0; c < 3; ++c) {
+				m_out.put(' ');
+				m_out.putFixed(static_cast<int64_t>((random >> (16 * c)) % 1001), 3);
+			}
+		}
+		// Each tile is textured once
+		const int64_t tileSize = m_side * m_cell;
+		m_out.put("\nvt ");
+		m_out.putFixed((p.x - (m_origin + tileX * m_cell)) * kOne / tileSize, 6);
+		m_out.put(' ');
+		m_out.putFixed((p.z - (m_origin + tileZ * m_cell)) * kOne / tileSize, 6);
+		m_out.put("\nvn ");
+		m_out.putFixed(n.x, 6);
+		m_out.put(' ');
+		m_out.putFixed(n.y, 6);
+		m_out.put(' ');
+		m_out.putFixed(n.z, 6);
+		m_out.put('\n');
+		++m_vertexCount;
+	}
+
+	// One row of grid points of a tile, returns the index of its first one
+	uint64_t writeRow(int64_t tileX, int64_t tileZ, int64_t j) {
+		const uint64_t first = m_vertexCount + 1;
+		const int64_t gz = tileZ + j;
+		for (int64_t i = 0; i <= m_side; ++i) {
+			const int64_t gx = tileX + i;
+			const uint64_t key = static_cast<uint64_t>(gz) * 0x100000000ull + static_cast<uint64_t>(gx);
+			writeVertex(position(gx, gz), normal(gx, gz), tileX, tileZ, key);
+		}
+		return first;
+	}
+
+	// `corners` are absolute indices, starting at 1. Positions, uvs and
+	// normals are written together, so one index serves all three.
+	void writeFace(const uint64_t* corners, int count, bool negative) {
+		m_out.put('f');
+		for (int k = 0; k < count; ++k) {
+			const int64_t index = negative ? static_cast<int64_t>(corners[k]) - static_cast<int64_t>(m_vertexCount) - 1 : static_cast<int64_t>(corners[k]);
+			m_out.put(' ');
+			m_out.putInt(index);
+			m_out.put('/');
+			m_out.putInt(index);
+			m_out.put('/');
+			m_out.putInt(index);
+		}
+		m_out.put('\n');
+		++m_faceCount;
+		m_triangleCount += count - 2;
+		if (negative) ++m_negativeFaceCount;
+		if (count > 4) ++m_polygonCount;
+	}
+
+	void writeGroup(uint64_t g, uint64_t budget) {
+		const int64_t tileX = static_cast<int64_t>(g % m_tilesPerRow) * (m_side + 1);
+		const int64_t tileZ = static_cast<int64_t>(g / m_tilesPerRow) * (m_side + 1);
+		m_out.put("g group");
+		m_out.putInt(static_cast<int64_t>(g));
+		m_out.put('\n');
+
+		// When there are more materials than groups, each group goes through
+		// several of them, in bands of rows
+		const uint64_t materials = m_settings.materials;
+		const uint64_t bands = materials > m_settings.groups ? (materials + m_settings.groups - 1) / m_settings.groups : 1;
+		uint64_t currentMaterial = UINT64_MAX;
+
+		uint64_t remaining = budget;
+		uint64_t lower = writeRow(tileX, tileZ, 0);
+		for (int64_t j = 0; remaining > 0; ++j) {
+			const uint64_t upper = writeRow(tileX, tileZ, j + 1);
+			if (materials > 0) {
+				const uint64_t band = std::min<uint64_t>(bands - 1, static_cast<uint64_t>(j) * bands / static_cast<uint64_t>(m_side));
+				const uint64_t material = (g + band * m_settings.groups) % materials;
+				if (material != currentMaterial) {
+					m_out.put("usemtl material");
+					m_out.putInt(static_cast<int64_t>(material));
+					m_out.put('\n');
+					currentMaterial = material;
+				}
+			}
+			for (int64_t i = 0; i < m_side && remaining > 0; ++i) {
+				remaining -= writeCell(g, tileX, tileZ, i, j, lower + i, upper + i, remaining);
+			}
+			lower = upper;
+		}
+	}
+
+	// Cell (i, j) of the tile, whose lower corners are `a` and `a + 1`, and
+	// upper ones `d` and `d + 1`. Returns its number of triangles.
+	uint64_t writeCell(uint64_t g, int64_t tileX, int64_t tileZ, int64_t i, int64_t j, uint64_t a, uint64_t d, uint64_t remaining) {
+		const uint64_t random = hash(m_settings.seed, 4, g, static_cast<uint64_t>(j), static_cast<uint64_t>(i));
+		const bool negative = below(hash(m_settings.seed, 5, g, static_cast<uint64_t>(j), static_cast<uint64_t>(i)), m_settings.negativeIndices);
+		const uint64_t b = a + 1, c = d + 1;
+		// Counterclockwise seen from above (+y)
+		uint64_t corners[8] = { a, d, c, b };
+
+		if (remaining == 1) {
+			// The last triangle of the group
+			writeFace(corners, 3, negative);
+			return 1;
+		}
+		int count = 4;
+		if (below(random, m_settings.ngonRatio)) {
+			count = std::min(5 + static_cast<int>((random >> 8) % 4), static_cast<int>(std::min<uint64_t>(remaining, 6)) + 2);
+		} else if (random & 1) {
+			const uint64_t first[3] = { a, d, c }, second[3] = { a, c, b };
+			writeFace(first, 3, negative);
+			writeFace(second, 3, negative);
+			return 2;
+		}
+		if (count == 4) {
+			writeFace(corners, 4, negative);
+			return 2;
+		}
+
+		// Push the middle of `count - 4` edges out, starting from a random
+		// one, which keeps the polygon convex
+		const int64_t gx = tileX + i, gz = tileZ + j;
+		const Point grid[4] = { position(gx, gz), position(gx, gz + 1), position(gx + 1, gz + 1), position(gx + 1, gz) };
+		const int64_t outX[4] = { -1, 0, 1, 0 }, outZ[4] = { 0, 1, 0, -1 };
+		const Point n = normal(gx, gz);
+		const int start = static_cast<int>((random >> 16) % 4);
+		bool pushed[4] = {};
+		for (int k = 0; k < count - 4; ++k) {
+			const int edge = (start + k) % 4;
+			pushed[edge] = true;
+			const Point& p = grid[edge];
+			const Point& q = grid[(edge + 1) % 4];
+			const Point middle = {
+				(p.x + q.x) / 2 + outX[edge] * m_cell / 4,
+				(p.y + q.y) / 2,
+				(p.z + q.z) / 2 + outZ[edge] * m_cell / 4
+			};
+			writeVertex(middle, n, tileX, tileZ, random ^ static_cast<uint64_t>(edge));
+		}
+		// The new vertices are the last ones written, in edge order from `start`
+		uint64_t extra[4] = {};
+		for (int k = 0; k < count - 4; ++k) {
+			extra[(start + k) % 4] = m_vertexCount - static_cast<uint64_t>(count - 4) + 1 + k;
+		}
+		const uint64_t grids[4] = { a, d, c, b };
+		int k = 0;
+		for (int edge = 0; edge < 4; ++edge) {
+			corners[k++] = grids[edge];
+			if (pushed[edge]) corners[k++] = extra[edge];
+		}
+		writeFace(corners, count, negative);
+		return count - 2;
+	}
+
+private:
+	const Settings& m_settings;
+	Writer& m_out;
+	int64_t m_side = 1; // cells on each side of a tile
+	int64_t m_tilesPerRow = 1;
+	int64_t m_cell = 1; // size of a cell
+	int64_t m_origin = 0; // of the grid, on x and z
+	int64_t m_period = kDetailPeriod; // of the coarse noise, in cells
+	uint64_t m_vertexCount = 0;
+	uint64_t m_faceCount = 0;
+	uint64_t m_polygonCount = 0;
+	uint64_t m_triangleCount = 0;
+	uint64_t m_negativeFaceCount = 0;
+};
+
+bool writeMaterials(const fs::path& path, const Settings& settings) {
+	FILE* file = std::fopen(path.string().c_str(), "wb");
+	if (!file) return false;
+	{
+		Writer out(file);
+		out.put("# Generated by scene_generator\n");
+		for (uint64_t m = 0; m < settings.materials; ++m) {
+			const uint64_t random = hash(settings.seed, 6, m);
+			out.put("\nnewmtl material");
+			out.putInt(static_cast<int64_t>(m));
+			out.put("\nKa 0.000 0.000 0.000\nKd");
+			for (int c = 0; c < 3; ++c) {
+				out.put(' ');
+				out.putFixed(200 + static_cast<int64_t>((random >> (16 * c)) % 801), 3);
+			}
+			out.put("\nKs 0.500 0.500 0.500\nNs ");
+			out.putInt(8 + static_cast<int64_t>((random >> 48) % 120));
+			out.put("\nillum 2\n");
+		}
+		out.flush();
+		if (!out.ok()) {
+			std::fclose(file);
+			return false;
+		}
+	}
+	return std::fclose(file) == 0;
+}
+
+bool parseCount(const char* text, uint64_t& value) {
+	char* end = nullptr;
+	value = std::strtoull(text, &end, 10);
+	if (end == text) return false;
+	if (*end == 'k' || *end == 'K') value *= 1000, ++end;
+	else if (*end == 'M') value *= 1000000, ++end;
+	else if (*end == 'G') value *= 1000000000, ++end;
+	return *end == '\0';
+}
+
+bool parseRatio(const char* text, double& value) {
+	char* end = nullptr;
+	value = std::strtod(text, &end);
+	return end != text && *end == '\0' && value >= 0.0 && value <= 1.0;
+}
+
+void printUsage() {
+	std::fprintf(stderr,
+		"Usage: scene_generator [options] <output.obj>\n"
+		"  --seed <n>              seed of the scene (default 1)\n"
+		"  --triangles <n>         triangles, with an optional k, M or G suffix (default 1M)\n"
+		"  --ngon-ratio <r>        fraction of cells that are 5 to 8 sided polygons (default 0.1)\n"
+		"  --groups <n>            number of groups (default 16)\n"
+		"  --materials <n>         number of materials, 0 for no MTL (default 8)\n"
+		"  --vertex-colors         write a color after each position\n"
+		"  --negative-indices <r>  fraction of faces with relative indices (default 0)\n");
+}
+
+bool parseArguments(int argc, char** argv, Settings& settings) {
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		bool ok = true;
+		if (arg == "--vertex-colors") {
+			settings.vertexColors = true;
+			continue;
+		} else if (arg.compare(0, 2, "--") != 0) {
+			if (!settings.output.empty()) return false;
+			settings.output = arg;
+			continue;
+		} else if (!value) {
+			return false;
+		} else if (arg == "--seed") {
+			ok = parseCount(value, settings.seed);
+		} else if (arg == "--triangles") {
+			ok = parseCount(value, settings.triangles);
+		} else if (arg == "--ngon-ratio") {
+			ok = parseRatio(value, settings.ngonRatio);
+		} else if (arg == "--groups") {
+			ok = parseCount(value, settings.groups) && settings.groups > 0;
+		} else if (arg == "--materials") {
+			ok = parseCount(value, settings.materials);
+		} else if (arg == "--negative-indices") {
+			ok = parseRatio(value, settings.negativeIndices);
+		} else {
+			ok = false;
+		}
+		if (!ok) {
+			std::fprintf(stderr, "Invalid option %s %s\n", argv[i], value);
+			return false;
+		}
+		++i;
+	}
+	return !settings.output.empty();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	Settings settings;
+	if (!parseArguments(argc, argv, settings)) {
+		printUsage();
+		return 1;
+	}
+
+	const auto start = Clock::now();
+	fs::path mtlPath = settings.output;
+	mtlPath.replace_extension(".mtl");
+	if (settings.materials > 0 && !writeMaterials(mtlPath, settings)) {
+		std::fprintf(stderr, "Could not write %s\n", mtlPath.string().c_str());
+		return 1;
+	}
+
+	FILE* file = std::fopen(settings.output.string().c_str(), "wb");
+	if (!file) {
+		std::fprintf(stderr, "Could not write %s\n", settings.output.string().c_str());
+		return 1;
+	}
+	bool ok = true;
+	{
+		Writer out(file);
+		// Enough to generate the same file again
+		char header[256];
+		std::snprintf(header, sizeof(header),
+			"# Generated by scene_generator --seed %llu --triangles %llu --ngon-ratio %g --groups %llu --materials %llu%s --negative-indices %g\n",
+			static_cast<unsigned long long>(settings.seed), static_cast<unsigned long long>(settings.triangles), settings.ngonRatio,
+			static_cast<unsigned long long>(settings.groups), static_cast<unsigned long long>(settings.materials),
+			settings.vertexColors ? " --vertex-colors" : "", settings.negativeIndices);
+		out.put(header);
+		SceneGenerator scene(settings, out);
+		scene.run(mtlPath.filename().string());
+		out.flush();
+		ok = out.ok();
+
+		const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		const double megabytes = out.bytes() / 1e6;
+		std::printf("%s: %llu triangles (%llu faces, %llu polygons, %llu with negative indices), %llu vertices, %.1f MB in %.2f s (%.1f MB/s)\n",
+			settings.output.string().c_str(),
+			static_cast<unsigned long long>(scene.triangleCount()), static_cast<unsigned long long>(scene.faceCount()),
+			static_cast<unsigned long long>(scene.polygonCount()), static_cast<unsigned long long>(scene.negativeFaceCount()),
+			static_cast<unsigned long long>(scene.vertexCount()), megabytes, seconds, megabytes / seconds);
+	}
+	if (std::fclose(file) != 0 || !ok) {
+		std::fprintf(stderr, "Could not write %s\n", settings.output.string().c_str());
+		return 1;
+	}
+	return 0;
+}